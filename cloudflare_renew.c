@@ -1,20 +1,42 @@
 #define _POSIX_C_SOURCE 200809L
+#include "lib/cloudflare_utils.h"
+#include "lib/convergence.h"
+#include "lib/gateway.h"
 #include "lib/getip.h"
+#include "lib/ifwatch.h"
 #include "lib/publicip.h"
+#include "lib/schedule.h"
 #include "lib/setip.h"
+#include "lib/socket_http.h"
 
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#endif
+
 #define CONFIG_FILE "cloudflare.conf"
 #define TOKEN_FILE "cloudflare.token"
 #define LAST_IP_FILE "last.ip"
 #define LOG_FILE "cloudflare.log"
 
+// A run gives up on the API after this long, well before the next cron run
+#define RUN_DEADLINE_MS 120000
+
+// In --watch mode, address changes arrive in bursts (the old address removed,
+// the new one added, IPv4 and IPv6 apart): renew once they stop for this long
+#define WATCH_SETTLE_MS 2000
+
 // Function to write log messages with timestamp
 static void write_log(const char *message)
 {
@@ -24,11 +46,13 @@ static void write_log(const char *message)
         return;
     }
 
+    // Formatted as ctime() does, into our own buffer rather than its static one
     time_t now = time(NULL);
-    char *timestamp = ctime(&now);
-    // Note: ctime is used here for simplicity in single-threaded context
-    // Remove newline from ctime
-    timestamp[strlen(timestamp) - 1] = '\0';
+    struct tm local;
+    char timestamp[64] = "";
+    if (localtime_r(&now, &local)) {
+        strftime(timestamp, sizeof(timestamp), "%a %b %e %H:%M:%S %Y", &local);
+    }
 
     fprintf(log, "[%s] %s\n", timestamp, message);
     fclose(log);
@@ -123,17 +147,195 @@ static char **get_all_domains(int *count)
     return domains;
 }
 
-int main(void)
+// Log the phase timings of each API request, to find where a slow run spends its time
+static void log_timing(const char *method, const char *url, const struct http_response *response, void *user_data)
+{
+    (void) user_data;
+    char timing[256];
+    char message[1800];
+    http_timing_format(&response->timing, timing, sizeof(timing));
+    snprintf(message, sizeof(message), "HTTP %s %s -> %d: %s", method, url, response->status_code, timing);
+    write_log(message);
+}
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Desired and observed state of every record, kept across renewals so failed
+// records are retried on their own
+static struct convergence records;
+
+// Bring the records that are due to the desired IP, then record it in last.ip
+// once every record holds it. Returns the number of records still pending.
+static int converge(void)
 {
     char log_msg[512];
+    const char *public_ip = records.desired;
+    long long now = now_ms();
+    int domain_count = 0;
+    for (int i = 0; i < records.count; i++) {
+        domain_count += convergence_is_due(&records, i, now);
+    }
+    int pending = convergence_pending(&records);
+    if (domain_count == 0 && pending > 0) {
+        return pending;
+    }
 
-    write_log("=== Starting cloudflare_renew ===");
+    size_t size = (size_t) (domain_count > 0 ? domain_count : 1);
+    char **domains = calloc(size, sizeof(char *));
+    int *indexes = calloc(size, sizeof(int));
+    char **cf_ips = calloc(size, sizeof(char *));
+    char **stale = calloc(size, sizeof(char *)); // Due domains holding another IP
+    int *stale_index = calloc(size, sizeof(int));
+    int *results = calloc(size, sizeof(int));
+    char **verify_ips = calloc(size, sizeof(char *));
+    if (!domains || !indexes || !cf_ips || !stale || !stale_index || !results || !verify_ips) {
+        free((void *) domains);
+        free(indexes);
+        free((void *) cf_ips);
+        free((void *) stale);
+        free(stale_index);
+        free(results);
+        free((void *) verify_ips);
+        return pending;
+    }
+    domain_count = 0;
+    for (int i = 0; i < records.count; i++) {
+        if (convergence_is_due(&records, i, now)) {
+            indexes[domain_count] = i;
+            domains[domain_count++] = records.records[i].domain;
+        }
+    }
+
+    // Step 4: Read the current Cloudflare IP of every due domain in one pipelined batch
+    get_cloudflare_ips(CONFIG_FILE, TOKEN_FILE, domains, domain_count, cf_ips);
+
+    int stale_count = 0;
+    for (int i = 0; i < domain_count; i++) {
+        snprintf(log_msg, sizeof(log_msg), "Processing domain: %s", domains[i]);
+        write_log(log_msg);
+
+        // Current Cloudflare IP for this domain, taken from the batch
+        if (!cf_ips[i]) {
+            snprintf(log_msg, sizeof(log_msg), "ERROR: Failed to get Cloudflare IP for %s", domains[i]);
+            write_log(log_msg);
+            convergence_report(&records, indexes[i], NULL, now_ms());
+            continue;
+        }
+
+        snprintf(log_msg, sizeof(log_msg), "Current Cloudflare IP for %s: %s", domains[i], cf_ips[i]);
+        write_log(log_msg);
+
+        // Check if update is needed
+        if (strcmp(cf_ips[i], public_ip) != 0) {
+            snprintf(log_msg, sizeof(log_msg), "Updating %s from %s to %s", domains[i], cf_ips[i], public_ip);
+            write_log(log_msg);
+            stale_index[stale_count] = i;
+            stale[stale_count++] = domains[i];
+        } else {
+            snprintf(log_msg, sizeof(log_msg), "No update needed for %s (already correct)", domains[i]);
+            write_log(log_msg);
+            convergence_report(&records, indexes[i], cf_ips[i], now_ms());
+        }
+    }
+
+    // Step 5: Update the stale domains concurrently, within the configured
+    // limits, then verify the updated ones with one more batch
+    set_cloudflare_ips(CONFIG_FILE, TOKEN_FILE, public_ip, stale, stale_count, results);
+    int verify_count = 0;
+    for (int k = 0; k < stale_count; k++) {
+        if (results[k] == 0) {
+            stale[verify_count++] = stale[k];
+        }
+    }
+    get_cloudflare_ips(CONFIG_FILE, TOKEN_FILE, stale, verify_count, verify_ips);
+
+    int updated_count = 0;
+    for (int k = 0, verified = 0; k < stale_count; k++) {
+        int i = stale_index[k];
+        const char *observed = cf_ips[i];
+        if (results[k] == 0) {
+            snprintf(log_msg, sizeof(log_msg), "Successfully updated %s", domains[i]);
+            write_log(log_msg);
+
+            observed = verify_ips[verified++];
+            if (observed && strcmp(observed, public_ip) == 0) {
+                snprintf(log_msg, sizeof(log_msg), "Verification successful for %s", domains[i]);
+                write_log(log_msg);
+                updated_count++;
+            } else {
+                snprintf(log_msg, sizeof(log_msg), "Verification failed for %s", domains[i]);
+                write_log(log_msg);
+            }
+        } else {
+            snprintf(log_msg, sizeof(log_msg), "Failed to update %s", domains[i]);
+            write_log(log_msg);
+        }
+        convergence_report(&records, indexes[i], observed, now_ms());
+    }
+
+    snprintf(log_msg, sizeof(log_msg), "Processing complete: %d domains updated", updated_count);
+    write_log(log_msg);
+    for (int i = 0; i < domain_count; i++) {
+        free(cf_ips[i]);
+        free(verify_ips[i]);
+    }
+    free((void *) domains);
+    free(indexes);
+    free((void *) cf_ips);
+    free((void *) stale);
+    free(stale_index);
+    free(results);
+    free((void *) verify_ips);
+
+    pending = convergence_pending(&records);
+    if (pending > 0) {
+        snprintf(log_msg,
+                 sizeof(log_msg),
+                 "%d of %d domains not at %s yet, retrying in %lld s",
+                 pending,
+                 records.count,
+                 public_ip,
+                 (convergence_next_ms(&records, now_ms()) + 500) / 1000);
+        write_log(log_msg);
+        return pending;
+    }
+
+    // Step 6: Update last.ip file, now that every record holds the IP
+    char *last_ip = read_ip_from_file(LAST_IP_FILE);
+    if (!last_ip || strcmp(last_ip, public_ip) != 0) {
+        if (write_ip_to_file(LAST_IP_FILE, public_ip) == 0) {
+            write_log("Updated last.ip file with new IP");
+        } else {
+            write_log("ERROR: Failed to update last.ip file");
+        }
+    }
+    free(last_ip);
+    return 0;
+}
+
+// Bring the records up to date with the public IP. With a schedule (the
+// daemon), a change is only written once it has settled. Returns 0, or 1 on
+// failure.
+static int renew(struct schedule *schedule)
+{
+    char log_msg[512];
+
+    // The deadline counts from here, so each renewal of a watch gets its own
+    http_set_deadline(RUN_DEADLINE_MS);
 
     // Step 1: Get current public IP
     write_log("Getting current public IP...");
     char *public_ip = get_public_ip();
     if (!public_ip) {
         write_log("ERROR: Failed to get public IP");
+        if (schedule) {
+            schedule_failed(schedule);
+        }
         return 1;
     }
 
@@ -159,6 +361,19 @@ int main(void)
         }
     }
 
+    // Addresses often flap right after a change: write once the new one holds
+    if (schedule && schedule_observe(schedule, public_ip, last_ip, time(NULL)) == SCHEDULE_WAIT) {
+        snprintf(log_msg,
+                 sizeof(log_msg),
+                 "Waiting for %s to hold for %d s before updating",
+                 public_ip,
+                 schedule->policy.settle_s);
+        write_log(log_msg);
+        free(public_ip);
+        free(last_ip);
+        return 0;
+    }
+
     if (ip_changed) {
         // Step 3: Get all domains from config
         int domain_count = 0;
@@ -174,76 +389,325 @@ int main(void)
         snprintf(log_msg, sizeof(log_msg), "Found %d domains to check/update", domain_count);
         write_log(log_msg);
 
-        // Step 4: Process each domain
-        int updated_count = 0;
+        // Records already converging on this IP keep their state and retry time
+        int targeted = convergence_set_target(&records, public_ip, domains, domain_count, now_ms());
         for (int i = 0; i < domain_count; i++) {
-            snprintf(log_msg, sizeof(log_msg), "Processing domain: %s", domains[i]);
-            write_log(log_msg);
+            free(domains[i]);
+        }
+        free((void *) domains);
+        if (targeted != 0) {
+            write_log("ERROR: Out of memory");
+            free(public_ip);
+            free(last_ip);
+            return 1;
+        }
 
-            // Get current Cloudflare IP for this domain
-            char *cf_ip = get_cloudflare_ip(CONFIG_FILE, TOKEN_FILE, domains[i]);
-            if (!cf_ip) {
-                snprintf(log_msg, sizeof(log_msg), "ERROR: Failed to get Cloudflare IP for %s", domains[i]);
-                write_log(log_msg);
-                continue;
-            }
+        // Steps 4 to 6: update the records that are due, last.ip once all hold the IP
+        converge();
+    }
 
-            snprintf(log_msg, sizeof(log_msg), "Current Cloudflare IP for %s: %s", domains[i], cf_ip);
-            write_log(log_msg);
+    free(public_ip);
+    free(last_ip);
+    return 0;
+}
 
-            // Check if update is needed
-            if (strcmp(cf_ip, public_ip) != 0) {
-                snprintf(log_msg, sizeof(log_msg), "Updating %s from %s to %s", domains[i], cf_ip, public_ip);
-                write_log(log_msg);
+#ifdef __linux__
 
-                // Update the IP
-                if (set_cloudflare_ip(CONFIG_FILE, TOKEN_FILE, public_ip, domains[i]) == 0) {
-                    snprintf(log_msg, sizeof(log_msg), "Successfully updated %s", domains[i]);
-                    write_log(log_msg);
-
-                    // Verify the update
-                    char *verify_ip = get_cloudflare_ip(CONFIG_FILE, TOKEN_FILE, domains[i]);
-                    if (verify_ip && strcmp(verify_ip, public_ip) == 0) {
-                        snprintf(log_msg, sizeof(log_msg), "Verification successful for %s", domains[i]);
-                        write_log(log_msg);
-                        updated_count++;
-                    } else {
-                        snprintf(log_msg, sizeof(log_msg), "Verification failed for %s", domains[i]);
-                        write_log(log_msg);
-                    }
-                    free(verify_ip);
-                } else {
-                    snprintf(log_msg, sizeof(log_msg), "Failed to update %s", domains[i]);
-                    write_log(log_msg);
-                }
+// Arm a one-shot timer to fire in delay_ms, or disarm it when negative
+static void arm_timer(int timer, long long delay_ms)
+{
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (delay_ms >= 0) {
+        delay_ms = delay_ms > 0 ? delay_ms : 1; // Zero would disarm it
+        spec.it_value.tv_sec = (time_t) (delay_ms / 1000);
+        spec.it_value.tv_nsec = (long) (delay_ms % 1000) * 1000000;
+    }
+    timerfd_settime(timer, 0, &spec, NULL);
+}
+
+// Arm the timer for the next check the schedule asks for
+static void schedule_check(int timer, const struct schedule *schedule)
+{
+    long long delay_ms = schedule_next_ms(schedule, time(NULL));
+    char log_msg[128];
+    snprintf(log_msg, sizeof(log_msg), "Next check in %lld s", (delay_ms + 500) / 1000);
+    write_log(log_msg);
+    arm_timer(timer, delay_ms);
+}
+
+// Stay running, renewing at start, then on every timer tick (with a schedule),
+// on SIGUSR1, and once address changes of ifname (when given) settle. Records
+// that failed are retried on their own timer as they come due. Between
+// checks the configuration and the DNS and TLS session caches stay loaded;
+// pooled connections do not outlive the pool's idle timeout, so a tick
+// usually reconnects, resuming its TLS session. SIGTERM and SIGINT stop it
+// after the renewal in progress. Returns 0, or 1 if it could not start or
+// lost the address notifications it alone depends on.
+static int serve(struct schedule *schedule, const char *ifname)
+{
+    char log_msg[512];
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    int timer = schedule ? timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC) : -1;
+    int retry_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    struct ifwatch watch;
+    watch.fd = -1;
+    if (ifname && ifwatch_open(&watch, ifname) != 0) {
+        snprintf(log_msg, sizeof(log_msg), "ERROR: Cannot watch the addresses of %s", ifname);
+        write_log(log_msg);
+    }
+    if (signal_fd < 0 || retry_timer < 0 || (schedule && timer < 0) || (!schedule && watch.fd < 0)) {
+        write_log("ERROR: Cannot start the event loop");
+        if (signal_fd >= 0) {
+            close(signal_fd);
+        }
+        if (timer >= 0) {
+            close(timer);
+        }
+        if (retry_timer >= 0) {
+            close(retry_timer);
+        }
+        sigprocmask(SIG_UNBLOCK, &signals, NULL);
+        return 1;
+    }
+
+    if (schedule) {
+        const struct schedule_policy *policy = &schedule->policy;
+        snprintf(log_msg,
+                 sizeof(log_msg),
+                 "Daemon started: checking every %d to %d s, changes written once they hold for %d s",
+                 policy->min_interval_s,
+                 policy->max_interval_s,
+                 policy->settle_s);
+        write_log(log_msg);
+    }
+    if (watch.fd >= 0) {
+        snprintf(log_msg, sizeof(log_msg), "Watching the addresses of %s", ifname);
+        write_log(log_msg);
+    }
+    renew(schedule);
+    if (timer >= 0) {
+        schedule_check(timer, schedule);
+    }
+    arm_timer(retry_timer, convergence_next_ms(&records, now_ms()));
+
+    int result = 0;
+    bool running = true;
+    long long settle_at = -1; // When a burst of address changes is over
+    while (running) {
+        struct pollfd pfds[4] = {
+            {signal_fd, POLLIN, 0}, {timer, POLLIN, 0}, {watch.fd, POLLIN, 0}, {retry_timer, POLLIN, 0}};
+        long long wait_ms = settle_at < 0 ? -1 : settle_at - now_ms();
+        if (poll(pfds, 4, settle_at < 0 ? -1 : (int) (wait_ms > 0 ? wait_ms : 0)) < 0 && errno != EINTR) {
+            break;
+        }
+
+        bool check = false;
+        struct signalfd_siginfo info;
+        if ((pfds[0].revents & POLLIN) && read(signal_fd, &info, sizeof(info)) == (ssize_t) sizeof(info)) {
+            if (info.ssi_signo == SIGUSR1) {
+                write_log("SIGUSR1 received, checking now");
+                check = true;
             } else {
-                snprintf(log_msg, sizeof(log_msg), "No update needed for %s (already correct)", domains[i]);
-                write_log(log_msg);
+                running = false;
             }
+        }
+        uint64_t ticks = 0;
+        if ((pfds[1].revents & POLLIN) && read(timer, &ticks, sizeof(ticks)) == (ssize_t) sizeof(ticks)) {
+            check = true;
+        }
+        if (pfds[2].revents & POLLIN) {
+            int changed = ifwatch_wait(&watch, 0);
+            if (changed > 0) {
+                settle_at = now_ms() + WATCH_SETTLE_MS;
+            } else if (changed < 0) {
+                write_log("ERROR: Lost the address change notifications");
+                ifwatch_close(&watch);
+                if (!schedule) {
+                    result = 1;
+                    running = false;
+                }
+            }
+        }
+        if (settle_at >= 0 && now_ms() >= settle_at) {
+            settle_at = -1;
+            snprintf(log_msg, sizeof(log_msg), "Addresses of %s changed", ifname);
+            write_log(log_msg);
+            check = true;
+        }
 
-            free(cf_ip);
+        bool retry = false;
+        if ((pfds[3].revents & POLLIN) && read(retry_timer, &ticks, sizeof(ticks)) == (ssize_t) sizeof(ticks)) {
+            retry = true;
         }
 
-        snprintf(log_msg, sizeof(log_msg), "Processing complete: %d domains updated", updated_count);
-        write_log(log_msg);
+        if (running && check) {
+            renew(schedule);
+            if (timer >= 0) {
+                schedule_check(timer, schedule);
+            }
+        } else if (running && retry) {
+            // Only the failed records, against the IP they were aimed at; a
+            // change of it is left to the next check
+            http_set_deadline(RUN_DEADLINE_MS);
+            converge();
+        }
+        arm_timer(retry_timer, convergence_next_ms(&records, now_ms()));
+    }
 
-        // Cleanup domains array
-        for (int i = 0; i < domain_count; i++) {
-            free(domains[i]);
+    write_log("Shutting down");
+    ifwatch_close(&watch);
+    close(signal_fd);
+    if (timer >= 0) {
+        close(timer);
+    }
+    close(retry_timer);
+    sigprocmask(SIG_UNBLOCK, &signals, NULL);
+    return result;
+}
+
+#else
+
+static int serve(struct schedule *schedule, const char *ifname)
+{
+    (void) schedule;
+    (void) ifname;
+    fprintf(stderr, "Error: --daemon and --watch need timerfd, signalfd and rtnetlink (Linux)\n");
+    return 1;
+}
+
+#endif // __linux__
+
+int main(int argc, char *argv[])
+{
+    char log_msg[512];
+    bool daemon_mode = argc == 2 && strcmp(argv[1], "--daemon") == 0;
+    bool watch_mode = argc == 2 && strcmp(argv[1], "--watch") == 0;
+    if (argc > 2 || (argc == 2 && !daemon_mode && !watch_mode)) {
+        fprintf(stderr, "Usage: %s [--daemon | --watch]\n", argv[0]);
+        fprintf(stderr,
+                "  --daemon  Stay running, checking less often while the IP is stable, or at once on SIGUSR1\n");
+        fprintf(stderr, "  --watch   Stay running and check when WAN_INTERFACE changes address\n");
+        return 1;
+    }
+
+    write_log("=== Starting cloudflare_renew ===");
+
+    // Resume TLS sessions and reuse DNS answers saved by previous runs
+    http_set_session_cache_file(HTTP_SESSION_CACHE_FILE);
+    http_set_dns_cache_file(HTTP_DNS_CACHE_FILE);
+
+    // Let the API calls share one multiplexed connection when the server speaks HTTP/2
+    http_set_http2(true);
+
+    // Record listings are JSON, which compresses well
+    http_set_compression(true);
+
+    // Save round trips on new connections; lookups are GETs, safe to send as early data
+    http_set_fast_open(true);
+    http_set_early_data(true);
+
+    http_set_timing_callback(log_timing, NULL);
+
+    // Ride out transient API and network failures instead of leaving records
+    // stale until the next run, backing off so a struggling API is not flooded
+    struct http_retry_policy retry = {
+        .max_attempts = 4,
+        .attempt_timeout_ms = 10000,
+        .backoff_ms = 500,
+        .backoff_max_ms = 8000,
+        .retry_after_max_ms = 30000,
+    };
+    http_set_retry_policy(&retry);
+
+    // Sources of the public IP named in the config, best scored first
+    publicip_set_config_file(CONFIG_FILE);
+    publicip_set_score_file(PUBLICIP_SCORE_FILE);
+    gateway_set_cache_file(GATEWAY_CACHE_FILE);
+
+    int result = 0;
+    if (daemon_mode || watch_mode) {
+        // The daemon also follows WAN_INTERFACE when one is named; --watch depends on it
+        struct publicip_config config;
+        if (publicip_config_load(&config, CONFIG_FILE) != 0) {
+            http_cleanup();
+            return 1;
+        }
+        if (watch_mode && config.interface[0] == '\0') {
+            fprintf(stderr, "Error: --watch needs WAN_INTERFACE in %s\n", CONFIG_FILE);
+            publicip_config_free(&config);
+            http_cleanup();
+            return 1;
+        }
+        struct schedule_policy policy;
+        schedule_policy_load(&policy, CONFIG_FILE);
+        struct schedule schedule;
+        schedule_init(&schedule, &policy);
+        result = serve(daemon_mode ? &schedule : NULL, config.interface[0] ? config.interface : NULL);
+        publicip_config_free(&config);
+    } else {
+        long long run_end = now_ms() + RUN_DEADLINE_MS;
+        if (renew(NULL) != 0) {
+            http_cleanup();
+            return 1;
         }
-        free((void *) domains);
 
-        // Step 5: Update last.ip file
-        if (write_ip_to_file(LAST_IP_FILE, public_ip) == 0) {
-            write_log("Updated last.ip file with new IP");
-        } else {
-            write_log("ERROR: Failed to update last.ip file");
+        // Retry records that failed while the run has time left, instead of
+        // leaving them stale until the IP changes again
+        long long delay_ms = convergence_next_ms(&records, now_ms());
+        while (delay_ms >= 0 && now_ms() + delay_ms < run_end) {
+            struct timespec wait = {(time_t) (delay_ms / 1000), (long) (delay_ms % 1000) * 1000000};
+            nanosleep(&wait, NULL);
+            converge();
+            delay_ms = convergence_next_ms(&records, now_ms());
+        }
+        if (convergence_pending(&records) > 0) {
+            write_log("ERROR: Some domains did not take the new IP, last.ip kept so the next run retries them");
+            result = 1;
         }
     }
 
-    free(public_ip);
-    free(last_ip);
+    // Report connection reuse so we can confirm one TLS session serves the run
+    struct http_stats stats;
+    http_get_stats(&stats);
+    snprintf(log_msg,
+             sizeof(log_msg),
+             "HTTP stats: %lu requests, %lu DNS lookups (%lu cached, %lu stale), %lu connections opened, %lu reused, "
+             "%lu TLS handshakes (%lu resumed, %lu full), %lu Fast Open (%lu fallbacks), "
+             "%lu early data (%lu rejected), %lu stale retries, %lu retried, %lu pipelined (%lu resent), "
+             "%lu HTTP/2 streams on %lu connections, %lu body bytes received compressed (%lu decoded)",
+             stats.requests,
+             stats.dns_lookups,
+             stats.dns_cache_hits,
+             stats.dns_stale_answers,
+             stats.connections_opened,
+             stats.connections_reused,
+             stats.tls_handshakes,
+             stats.tls_resumed,
+             stats.tls_full_handshakes,
+             stats.fast_open_connects,
+             stats.fast_open_fallbacks,
+             stats.early_data_accepted + stats.early_data_rejected,
+             stats.early_data_rejected,
+             stats.stale_retries,
+             stats.retries,
+             stats.requests_pipelined,
+             stats.pipeline_fallbacks,
+             stats.http2_streams,
+             stats.http2_connections,
+             stats.bytes_compressed,
+             stats.bytes_decompressed);
+    write_log(log_msg);
+    convergence_free(&records);
+    cloudflare_config_cleanup();
+    http_cleanup();
 
     write_log("=== cloudflare_renew completed ===");
-    return 0;
+    return result;
 }
@@ -1,9 +1,21 @@
 #define _POSIX_C_SOURCE 200809L
 #include "cloudflare_utils.h"
 
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Configuration shared by getip and setip, and the state of the files it came from
+static cloudflare_config_t *shared_config = NULL;
+static char *shared_config_file = NULL;
+static char *shared_token_file = NULL;
+static struct stat shared_config_stat;
+static struct stat shared_token_stat;
 
 // Helper function to trim whitespace
 char *trim_whitespace(char *str)
@@ -28,6 +40,30 @@ char *trim_whitespace(char *str)
     return str;
 }
 
+// Random fraction from 0 up to 1, for spreading timers. The generator is
+// seeded from /dev/urandom on first use; it is not meant for secrets.
+double random_fraction(void)
+{
+    static uint64_t state = 0;
+    if (state == 0) {
+        int fd = open("/dev/urandom", O_RDONLY);
+        if (fd >= 0) {
+            if (read(fd, &state, sizeof(state)) != (ssize_t) sizeof(state)) {
+                state = 0;
+            }
+            close(fd);
+        }
+        if (state == 0) {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            state = (uint64_t) ts.tv_nsec ^ ((uint64_t) getpid() << 32);
+        }
+        state |= 1;
+    }
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (double) (state >> 11) / 9007199254740992.0; // The top 53 bits over 2^53
+}
+
 // Helper function to read a single value from file (like the old read_value_from_file)
 static char *read_token_from_file(const char *filename)
 {
@@ -113,6 +149,23 @@ static int parse_array_index(const char *key, char *base_key, size_t base_key_si
     return (int) result;
 }
 
+// Parse a concurrency limit, falling back to the default if it is not a
+// number from 1 to CLOUDFLARE_CONCURRENCY_MAX
+static int parse_limit(const char *key, const char *value, int fallback)
+{
+    char *end = NULL;
+    long limit = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || limit < 1 || limit > CLOUDFLARE_CONCURRENCY_MAX) {
+        fprintf(stderr,
+                "Warning: Ignoring %s '%s', expected a number from 1 to %d\n",
+                key,
+                value,
+                CLOUDFLARE_CONCURRENCY_MAX);
+        return fallback;
+    }
+    return (int) limit;
+}
+
 // Load configuration from two separate files
 cloudflare_config_t *load_cloudflare_config(const char *config_file, const char *token_file)
 {
@@ -134,6 +187,8 @@ cloudflare_config_t *load_cloudflare_config(const char *config_file, const char
     config->entries = NULL;
     config->entry_count = 0;
     config->cloudflare_token = NULL;
+    config->update_concurrency = CLOUDFLARE_UPDATE_CONCURRENCY;
+    config->zone_concurrency = CLOUDFLARE_ZONE_CONCURRENCY;
 
     // First pass: count maximum index to allocate array
     int max_index = -1;
@@ -151,9 +206,11 @@ cloudflare_config_t *load_cloudflare_config(const char *config_file, const char
         *equals = '\0';
         const char *key = trim_whitespace(trimmed);
 
+        // Other arrays (IP_SOURCE) share the file but are not records
         char base_key[64];
         int index = parse_array_index(key, base_key, sizeof(base_key));
-        if (index >= 0 && index > max_index) {
+        if (index > max_index && (strcmp(base_key, "ZONE_ID") == 0 || strcmp(base_key, "DNS_RECORD_ID") == 0 ||
+                                  strcmp(base_key, "DOMAIN_NAME") == 0)) {
             max_index = index;
         }
     }
@@ -206,6 +263,10 @@ cloudflare_config_t *load_cloudflare_config(const char *config_file, const char
             } else if (strcmp(base_key, "DOMAIN_NAME") == 0) {
                 config->entries[index].domain_name = strdup(value);
             }
+        } else if (strcmp(key, "UPDATE_CONCURRENCY") == 0) {
+            config->update_concurrency = parse_limit(key, value, CLOUDFLARE_UPDATE_CONCURRENCY);
+        } else if (strcmp(key, "UPDATE_ZONE_CONCURRENCY") == 0) {
+            config->zone_concurrency = parse_limit(key, value, CLOUDFLARE_ZONE_CONCURRENCY);
         }
     }
 
@@ -240,6 +301,10 @@ void free_cloudflare_config(cloudflare_config_t *config)
                 free(config->entries[i].zone_id);
                 free(config->entries[i].dns_record_id);
                 free(config->entries[i].domain_name);
+                http_template_free(config->entries[i].query);
+                http_template_free(config->entries[i].update);
+                free(config->entries[i].update_body[0]);
+                free(config->entries[i].update_body[1]);
             }
             free(config->entries);
         }
@@ -248,6 +313,75 @@ void free_cloudflare_config(cloudflare_config_t *config)
     }
 }
 
+// Modification time of a file in nanoseconds, so edits within a second show
+static long long modified_ns(const struct stat *st)
+{
+#ifdef __APPLE__
+    return st->st_mtimespec.tv_sec * 1000000000LL + st->st_mtimespec.tv_nsec;
+#else
+    return st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+#endif
+}
+
+// Check whether a file is missing or differs from when it was last seen
+static bool file_changed(const char *path, const struct stat *seen)
+{
+    struct stat now;
+    if (stat(path, &now) != 0) {
+        return true;
+    }
+    return now.st_ino != seen->st_ino || now.st_size != seen->st_size || modified_ns(&now) != modified_ns(seen);
+}
+
+// Get the shared configuration, loading it again when a file changed
+cloudflare_config_t *cloudflare_config_get(const char *config_file, const char *token_file)
+{
+    if (shared_config && strcmp(shared_config_file, config_file) == 0 && strcmp(shared_token_file, token_file) == 0 &&
+        !file_changed(config_file, &shared_config_stat) && !file_changed(token_file, &shared_token_stat)) {
+        return shared_config;
+    }
+    cloudflare_config_cleanup();
+
+    // Stat before reading, so an edit made while loading is seen next time
+    struct stat config_stat;
+    struct stat token_stat;
+    if (stat(config_file, &config_stat) != 0 || stat(token_file, &token_stat) != 0) {
+        return load_cloudflare_config(config_file, token_file); // Fails, reporting the missing file
+    }
+    cloudflare_config_t *config = load_cloudflare_config(config_file, token_file);
+    shared_config_file = strdup(config_file);
+    shared_token_file = strdup(token_file);
+    if (!config || !shared_config_file || !shared_token_file) {
+        free_cloudflare_config(config);
+        cloudflare_config_cleanup();
+        return NULL;
+    }
+    shared_config = config;
+    shared_config_stat = config_stat;
+    shared_token_stat = token_stat;
+    return config;
+}
+
+// Free the shared configuration
+void cloudflare_config_cleanup(void)
+{
+    free_cloudflare_config(shared_config);
+    free(shared_config_file);
+    free(shared_token_file);
+    shared_config = NULL;
+    shared_config_file = NULL;
+    shared_token_file = NULL;
+}
+
+// Authorization and Content-Type headers for API requests
+struct http_header *cloudflare_api_headers(const cloudflare_config_t *config)
+{
+    char auth_header[512];
+    snprintf(auth_header, sizeof(auth_header), "Bearer %s", config->cloudflare_token);
+    struct http_header *headers = http_header_add(NULL, "Authorization", auth_header);
+    return http_header_add(headers, "Content-Type", "application/json");
+}
+
 // Find entry by domain name
 cloudflare_entry_t *find_entry_by_domain(cloudflare_config_t *config, const char *domain_name)
 {
@@ -274,6 +408,15 @@ cloudflare_entry_t *get_entry_by_index(cloudflare_config_t *config, int index)
     return &config->entries[index];
 }
 
+// Base of the API URLs, changed by tests to point at a local server
+static const char *api_url = CLOUDFLARE_API_URL;
+
+// Set the base of the API URLs, NULL for CLOUDFLARE_API_URL
+void cloudflare_set_api_url(const char *url)
+{
+    api_url = url ? url : CLOUDFLARE_API_URL;
+}
+
 // Build Cloudflare DNS URL
 void build_cloudflare_dns_url(char *url_buffer,
                               size_t buffer_size,
@@ -284,22 +427,18 @@ void build_cloudflare_dns_url(char *url_buffer,
 {
     if (dns_record_id != NULL) {
         // For specific record operations (PUT/DELETE) - setip
-        snprintf(url_buffer,
-                 buffer_size,
-                 "https://api.cloudflare.com/client/v4/zones/%s/dns_records/%s",
-                 zone_id,
-                 dns_record_id);
+        snprintf(url_buffer, buffer_size, "%s/zones/%s/dns_records/%s", api_url, zone_id, dns_record_id);
     } else if (domain_name != NULL && record_type != NULL) {
         // For querying records (GET) - getip
         snprintf(url_buffer,
                  buffer_size,
-                 "https://api.cloudflare.com/client/v4/zones/%s/dns_records?name=%s&type=%s",
+                 "%s/zones/%s/dns_records?name=%s&type=%s",
+                 api_url,
                  zone_id,
                  domain_name,
                  record_type);
     } else {
         // Just the base URL for listing all records
-        const char *base_url = "https://api.cloudflare.com/client/v4/zones/%s/dns_records";
-        snprintf(url_buffer, buffer_size, base_url, zone_id);
+        snprintf(url_buffer, buffer_size, "%s/zones/%s/dns_records", api_url, zone_id);
     }
 }
@@ -1,13 +1,29 @@
 #ifndef CLOUDFLARE_UTILS_H
 #define CLOUDFLARE_UTILS_H
 
+#include "socket_http.h"
+
 #include <stddef.h>
 
+// Default limits on concurrent record updates, overall and within one zone,
+// and the largest value either may be configured to
+#define CLOUDFLARE_UPDATE_CONCURRENCY 8
+#define CLOUDFLARE_ZONE_CONCURRENCY 4
+#define CLOUDFLARE_CONCURRENCY_MAX 64
+
+// Base of the API URLs
+#define CLOUDFLARE_API_URL "https://api.cloudflare.com/client/v4"
+
 // Configuration entry structure
 typedef struct {
     char *zone_id;
     char *dns_record_id;
     char *domain_name;
+
+    // Requests for the record, compiled on first use and kept with the configuration
+    http_template_t *query;  // GET of the A record (getip)
+    http_template_t *update; // PUT of the record (setip), with the body below
+    char *update_body[2];    // The update body before and after the IP
 } cloudflare_entry_t;
 
 // Configuration structure with arrays
@@ -15,13 +31,32 @@ typedef struct {
     cloudflare_entry_t *entries;
     int entry_count;
     char *cloudflare_token;
+    int update_concurrency; // UPDATE_CONCURRENCY: record updates in flight at once
+    int zone_concurrency;   // UPDATE_ZONE_CONCURRENCY: of those, in one zone
 } cloudflare_config_t;
 
 // Function declarations
+char *trim_whitespace(char *str);
+double random_fraction(void);
 cloudflare_config_t *load_cloudflare_config(const char *config_file, const char *token_file);
 void free_cloudflare_config(cloudflare_config_t *config);
+
+// Get the configuration shared by getip and setip, so the requests compiled
+// for its records are reused. It is loaded on first use and again whenever
+// either file changes. Do not free it; cloudflare_config_cleanup() does.
+cloudflare_config_t *cloudflare_config_get(const char *config_file, const char *token_file);
+
+// Free the shared configuration
+void cloudflare_config_cleanup(void);
+
+// Authorization and Content-Type headers for API requests (caller frees)
+struct http_header *cloudflare_api_headers(const cloudflare_config_t *config);
 cloudflare_entry_t *find_entry_by_domain(cloudflare_config_t *config, const char *domain_name);
 cloudflare_entry_t *get_entry_by_index(cloudflare_config_t *config, int index);
+
+// Point the API URLs at another server (tests), NULL to restore
+// CLOUDFLARE_API_URL. Affects requests compiled afterwards.
+void cloudflare_set_api_url(const char *url);
 void build_cloudflare_dns_url(char *url_buffer,
                               size_t buffer_size,
                               const char *zone_id,
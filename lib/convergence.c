@@ -0,0 +1,108 @@
+#define _POSIX_C_SOURCE 200809L
+#include "convergence.h"
+
+#include "cloudflare_utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int convergence_set_target(struct convergence *convergence, const char *ip, char **domains, int count, long long now_ms)
+{
+    struct record_state *records = calloc(count > 0 ? (size_t) count : 1, sizeof(*records));
+    if (!records) {
+        return -1;
+    }
+    bool same_target = strcmp(convergence->desired, ip) == 0;
+    for (int i = 0; i < count; i++) {
+        records[i].domain = strdup(domains[i]);
+        if (!records[i].domain) {
+            for (int j = 0; j < i; j++) {
+                free(records[j].domain);
+            }
+            free(records);
+            return -1;
+        }
+        records[i].retry_at_ms = now_ms;
+        for (int j = 0; same_target && j < convergence->count; j++) {
+            struct record_state *old = &convergence->records[j];
+            if (strcmp(old->domain, domains[i]) == 0) {
+                char *domain = records[i].domain;
+                records[i] = *old;
+                records[i].domain = domain;
+                break;
+            }
+        }
+    }
+
+    convergence_free(convergence);
+    snprintf(convergence->desired, sizeof(convergence->desired), "%s", ip);
+    convergence->records = records;
+    convergence->count = count;
+    return 0;
+}
+
+bool convergence_is_due(const struct convergence *convergence, int index, long long now_ms)
+{
+    const struct record_state *record = &convergence->records[index];
+    return !record->converged && record->retry_at_ms <= now_ms;
+}
+
+void convergence_report(struct convergence *convergence, int index, const char *observed, long long now_ms)
+{
+    struct record_state *record = &convergence->records[index];
+    snprintf(record->observed, sizeof(record->observed), "%s", observed ? observed : "");
+    record->converged = observed && strcmp(observed, convergence->desired) == 0;
+    if (record->converged) {
+        record->failures = 0;
+        return;
+    }
+
+    record->failures++;
+    long long backoff = CONVERGENCE_RETRY_MS;
+    for (int i = 1; i < record->failures && backoff < CONVERGENCE_RETRY_MAX_MS; i++) {
+        backoff *= 2;
+    }
+    if (backoff > CONVERGENCE_RETRY_MAX_MS) {
+        backoff = CONVERGENCE_RETRY_MAX_MS;
+    }
+    // Spread the retries, so records failing together do not retry in lockstep
+    record->retry_at_ms = now_ms + backoff / 2 + (long long) ((backoff - backoff / 2) * random_fraction());
+}
+
+int convergence_pending(const struct convergence *convergence)
+{
+    int pending = 0;
+    for (int i = 0; i < convergence->count; i++) {
+        if (!convergence->records[i].converged) {
+            pending++;
+        }
+    }
+    return pending;
+}
+
+long long convergence_next_ms(const struct convergence *convergence, long long now_ms)
+{
+    long long next_ms = -1;
+    for (int i = 0; i < convergence->count; i++) {
+        const struct record_state *record = &convergence->records[i];
+        if (record->converged) {
+            continue;
+        }
+        long long delay_ms = record->retry_at_ms > now_ms ? record->retry_at_ms - now_ms : 0;
+        if (next_ms < 0 || delay_ms < next_ms) {
+            next_ms = delay_ms;
+        }
+    }
+    return next_ms;
+}
+
+void convergence_free(struct convergence *convergence)
+{
+    for (int i = 0; i < convergence->count; i++) {
+        free(convergence->records[i].domain);
+    }
+    free(convergence->records);
+    convergence->records = NULL;
+    convergence->count = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef CONVERGENCE_H
+#define CONVERGENCE_H
+
+#include <stdbool.h>
+
+// A record that failed to update is retried after this long (ms), doubling
+// with each failure up to the maximum, less a random part of up to half
+#define CONVERGENCE_RETRY_MS 2000
+#define CONVERGENCE_RETRY_MAX_MS 300000
+
+// Desired and observed state of one DNS record
+struct record_state {
+    char *domain;
+    char observed[64];     // IP last read from Cloudflare, empty if unknown
+    bool converged;        // Observed to hold the desired IP
+    int failures;          // Consecutive failed attempts
+    long long retry_at_ms; // When the next attempt is due (monotonic ms)
+};
+
+// The records and the IP they should all hold
+struct convergence {
+    char desired[64];
+    struct record_state *records;
+    int count;
+};
+
+// Aim the records of these domains at ip (convergence starts zeroed). The
+// records of domains kept with the same desired IP keep their state; the
+// others are due at once. Returns 0, or -1 if out of memory (the previous
+// state is kept).
+int convergence_set_target(struct convergence *convergence,
+                           const char *ip,
+                           char **domains,
+                           int count,
+                           long long now_ms);
+
+// Whether record index is pending and due for an attempt by now_ms
+bool convergence_is_due(const struct convergence *convergence, int index, long long now_ms);
+
+// Report the IP an attempt found record index holding afterwards (NULL if it
+// could not be read). A record holding the desired IP has converged; any
+// other outcome schedules a retry with backoff.
+void convergence_report(struct convergence *convergence, int index, const char *observed, long long now_ms);
+
+// Records that have not converged yet
+int convergence_pending(const struct convergence *convergence);
+
+// Delay until the next record is due in ms (0 if one is due now), -1 if all converged
+long long convergence_next_ms(const struct convergence *convergence, long long now_ms);
+
+void convergence_free(struct convergence *convergence);
+
+#endif // CONVERGENCE_H
@@ -0,0 +1,578 @@
+#define _POSIX_C_SOURCE 200809L
+#include "dns.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RESOLV_CONF "/etc/resolv.conf"
+#define HOSTS_FILE "/etc/hosts"
+
+// TTL reported for numeric hosts and /etc/hosts entries
+#define DNS_LOCAL_TTL 86400
+
+// Milliseconds on the monotonic clock
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void put16(unsigned char *p, uint16_t value)
+{
+    p[0] = (unsigned char) (value >> 8);
+    p[1] = (unsigned char) (value & 0xff);
+}
+
+static uint16_t get16(const unsigned char *p)
+{
+    return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+// Encode a standard recursive query for name/type into buf
+int dns_build_query(unsigned char *buf, size_t size, uint16_t id, const char *name, uint16_t type)
+{
+    return dns_build_query_class(buf, size, id, name, type, DNS_CLASS_IN);
+}
+
+// Encode a recursive query for name/type in the given class
+int dns_build_query_class(unsigned char *buf,
+                          size_t size,
+                          uint16_t id,
+                          const char *name,
+                          uint16_t type,
+                          uint16_t qclass)
+{
+    size_t name_len = strlen(name);
+    if (name_len > 0 && name[name_len - 1] == '.') {
+        name_len--;
+    }
+    // Header + encoded name (length bytes + labels + root) + type + class
+    if (name_len > 253 || size < 12 + name_len + 2 + 4) {
+        return -1;
+    }
+
+    memset(buf, 0, 12);
+    put16(buf, id);
+    buf[2] = 0x01; // RD
+    put16(buf + 4, 1);
+
+    size_t pos = 12;
+    const char *label = name;
+    const char *end = name + name_len;
+    while (label < end) {
+        const char *dot = memchr(label, '.', (size_t) (end - label));
+        size_t label_len = dot ? (size_t) (dot - label) : (size_t) (end - label);
+        if (label_len == 0 || label_len > 63) {
+            return -1;
+        }
+        buf[pos++] = (unsigned char) label_len;
+        memcpy(buf + pos, label, label_len);
+        pos += label_len;
+        label += label_len + (dot ? 1 : 0);
+    }
+    buf[pos++] = 0;
+
+    put16(buf + pos, type);
+    put16(buf + pos + 2, qclass);
+    return (int) (pos + 4);
+}
+
+// Skip over a possibly compressed name, returns the offset after it or -1
+static int skip_name(const unsigned char *buf, size_t len, size_t pos)
+{
+    while (pos < len) {
+        unsigned char label_len = buf[pos];
+        if (label_len == 0) {
+            return (int) (pos + 1);
+        }
+        if ((label_len & 0xc0) == 0xc0) {
+            return pos + 2 <= len ? (int) (pos + 2) : -1;
+        }
+        if (label_len & 0xc0) {
+            return -1;
+        }
+        pos += 1 + (size_t) label_len;
+    }
+    return -1;
+}
+
+// Decode a response packet
+int dns_parse_response(const unsigned char *buf, size_t len, struct dns_message *message)
+{
+    memset(message, 0, sizeof(*message));
+    if (len < 12) {
+        return -1;
+    }
+
+    message->id = get16(buf);
+    if (!(buf[2] & 0x80)) {
+        return -1; // Not a response
+    }
+    message->truncated = (buf[2] & 0x02) != 0;
+    message->rcode = buf[3] & 0x0f;
+
+    uint16_t qdcount = get16(buf + 4);
+    uint16_t ancount = get16(buf + 6);
+
+    int pos = 12;
+    for (uint16_t i = 0; i < qdcount; i++) {
+        pos = skip_name(buf, len, (size_t) pos);
+        if (pos < 0 || (size_t) pos + 4 > len) {
+            return -1;
+        }
+        pos += 4;
+    }
+
+    for (uint16_t i = 0; i < ancount; i++) {
+        pos = skip_name(buf, len, (size_t) pos);
+        if (pos < 0 || (size_t) pos + 10 > len) {
+            return -1;
+        }
+        uint16_t type = get16(buf + pos);
+        uint16_t rclass = get16(buf + pos + 2);
+        uint32_t ttl = get32(buf + pos + 4);
+        uint16_t rdlength = get16(buf + pos + 8);
+        pos += 10;
+        if ((size_t) pos + rdlength > len) {
+            return -1;
+        }
+
+        if ((rclass == DNS_CLASS_IN || rclass == DNS_CLASS_CH) && rdlength <= sizeof(message->answers[0].rdata) &&
+            message->answer_count < DNS_MAX_ANSWERS) {
+            struct dns_answer *answer = &message->answers[message->answer_count++];
+            answer->type = type;
+            answer->rclass = rclass;
+            // Treat TTLs with the top bit set as zero (RFC 2181)
+            answer->ttl = (ttl & 0x80000000u) ? 0 : ttl;
+            answer->rdlength = rdlength;
+            memcpy(answer->rdata, buf + pos, rdlength);
+        }
+        pos += rdlength;
+    }
+
+    return 0;
+}
+
+// Generate a random query ID
+uint16_t dns_random_id(void)
+{
+    uint16_t id = 0;
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        ssize_t n = read(fd, &id, sizeof(id));
+        close(fd);
+        if (n == (ssize_t) sizeof(id)) {
+            return id;
+        }
+    }
+    return (uint16_t) (now_ms() ^ getpid());
+}
+
+// Add an address to a result unless it is already present
+static void add_address(struct dns_result *result, int family, const void *addr, uint32_t ttl)
+{
+    size_t addr_len = family == AF_INET ? 4 : 16;
+    for (int i = 0; i < result->count; i++) {
+        if (result->addresses[i].family == family && memcmp(result->addresses[i].addr, addr, addr_len) == 0) {
+            return;
+        }
+    }
+    if (result->count >= DNS_MAX_ADDRESSES) {
+        return;
+    }
+
+    struct dns_address *entry = &result->addresses[result->count++];
+    memset(entry, 0, sizeof(*entry));
+    entry->family = family;
+    memcpy(entry->addr, addr, addr_len);
+    entry->ttl = ttl;
+}
+
+// Append the A/AAAA answers of a message to a result
+void dns_collect_addresses(const struct dns_message *message, struct dns_result *result)
+{
+    for (int i = 0; i < message->answer_count; i++) {
+        const struct dns_answer *answer = &message->answers[i];
+        if (answer->rclass != DNS_CLASS_IN) {
+            continue;
+        }
+        if (answer->type == DNS_TYPE_A && answer->rdlength == 4) {
+            add_address(result, AF_INET, answer->rdata, answer->ttl);
+        } else if (answer->type == DNS_TYPE_AAAA && answer->rdlength == 16) {
+            add_address(result, AF_INET6, answer->rdata, answer->ttl);
+        }
+    }
+}
+
+// Answer numeric hosts without any lookup
+static bool resolve_numeric(const char *host, struct dns_result *result)
+{
+    unsigned char addr[16];
+    if (inet_pton(AF_INET, host, addr) == 1) {
+        add_address(result, AF_INET, addr, DNS_LOCAL_TTL);
+        return true;
+    }
+    if (inet_pton(AF_INET6, host, addr) == 1) {
+        add_address(result, AF_INET6, addr, DNS_LOCAL_TTL);
+        return true;
+    }
+    return false;
+}
+
+// Look host up in /etc/hosts
+static bool resolve_hosts_file(const char *host, struct dns_result *result)
+{
+    FILE *file = fopen(HOSTS_FILE, "r");
+    if (!file) {
+        return false;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        char *saveptr = NULL;
+        const char *address = strtok_r(line, " \t\r\n", &saveptr);
+        if (!address) {
+            continue;
+        }
+        const char *name;
+        while ((name = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL) {
+            if (strcasecmp(name, host) == 0) {
+                unsigned char addr[16];
+                if (inet_pton(AF_INET, address, addr) == 1) {
+                    add_address(result, AF_INET, addr, DNS_LOCAL_TTL);
+                } else if (inet_pton(AF_INET6, address, addr) == 1) {
+                    add_address(result, AF_INET6, addr, DNS_LOCAL_TTL);
+                }
+                break;
+            }
+        }
+    }
+
+    fclose(file);
+    return result->count > 0;
+}
+
+// Read nameserver addresses from /etc/resolv.conf
+static int load_nameservers(struct sockaddr_storage *servers, socklen_t *lengths, int max)
+{
+    FILE *file = fopen(RESOLV_CONF, "r");
+    if (!file) {
+        return 0;
+    }
+
+    int count = 0;
+    char line[256];
+    while (count < max && fgets(line, sizeof(line), file)) {
+        char *saveptr = NULL;
+        const char *keyword = strtok_r(line, " \t\r\n", &saveptr);
+        const char *address = strtok_r(NULL, " \t\r\n", &saveptr);
+        if (!keyword || !address || strcmp(keyword, "nameserver") != 0) {
+            continue;
+        }
+
+        memset(&servers[count], 0, sizeof(servers[count]));
+        struct sockaddr_in *sin = (struct sockaddr_in *) &servers[count];
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &servers[count];
+        if (inet_pton(AF_INET, address, &sin->sin_addr) == 1) {
+            sin->sin_family = AF_INET;
+            sin->sin_port = htons(53);
+            lengths[count++] = sizeof(*sin);
+        } else if (inet_pton(AF_INET6, address, &sin6->sin6_addr) == 1) {
+            sin6->sin6_family = AF_INET6;
+            sin6->sin6_port = htons(53);
+            lengths[count++] = sizeof(*sin6);
+        }
+    }
+
+    fclose(file);
+    return count;
+}
+
+// Open the UDP socket used for one address family
+static int open_query_socket(int family)
+{
+    int fd = socket(family, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Socket slot for a nameserver's family
+static int family_slot(const struct sockaddr_storage *server)
+{
+    return server->ss_family == AF_INET6 ? 1 : 0;
+}
+
+// Send the A and AAAA queries to the current nameserver.
+// Returns 0 if at least one query went out.
+static int send_queries(struct dns_query *query)
+{
+    static const uint16_t types[2] = {DNS_TYPE_A, DNS_TYPE_AAAA};
+    const struct sockaddr_storage *server = &query->servers[query->server_index];
+    int fd = query->sockfd[family_slot(server)];
+    bool sent_any = false;
+
+    for (int i = 0; i < 2; i++) {
+        unsigned char packet[DNS_MAX_PACKET];
+        query->ids[i] = dns_random_id();
+        query->answered[i] = false;
+        int packet_len = dns_build_query(packet, sizeof(packet), query->ids[i], query->host, types[i]);
+        if (fd < 0 || packet_len < 0 ||
+            sendto(fd,
+                   packet,
+                   (size_t) packet_len,
+                   0,
+                   (const struct sockaddr *) server,
+                   query->server_lengths[query->server_index]) != packet_len) {
+            query->answered[i] = true; // Nothing to wait for
+        } else {
+            sent_any = true;
+        }
+    }
+
+    long long attempt_deadline = now_ms() + DNS_ATTEMPT_TIMEOUT_MS;
+    query->attempt_deadline = attempt_deadline < query->deadline ? attempt_deadline : query->deadline;
+    return sent_any ? 0 : -1;
+}
+
+// Move on to the next nameserver, or finish when none are left
+static int next_server(struct dns_query *query)
+{
+    while (++query->server_index < query->server_count && now_ms() < query->deadline) {
+        if (send_queries(query) == 0) {
+            return 0;
+        }
+    }
+    query->done = true;
+    return 1;
+}
+
+// Check that a datagram came from the nameserver being queried
+static bool from_current_server(const struct dns_query *query, const struct sockaddr_storage *from)
+{
+    const struct sockaddr_storage *server = &query->servers[query->server_index];
+    if (from->ss_family != server->ss_family) {
+        return false;
+    }
+    if (from->ss_family == AF_INET) {
+        const struct sockaddr_in *a = (const struct sockaddr_in *) from;
+        const struct sockaddr_in *b = (const struct sockaddr_in *) server;
+        return a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr;
+    }
+    const struct sockaddr_in6 *a = (const struct sockaddr_in6 *) from;
+    const struct sockaddr_in6 *b = (const struct sockaddr_in6 *) server;
+    return a->sin6_port == b->sin6_port && memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0;
+}
+
+// Start a lookup
+int dns_query_start(struct dns_query *query, const char *host, int timeout_ms)
+{
+    memset(query, 0, sizeof(*query));
+    query->sockfd[0] = -1;
+    query->sockfd[1] = -1;
+    strncpy(query->host, host, sizeof(query->host) - 1);
+    query->deadline = now_ms() + timeout_ms;
+
+    if (dns_resolve_local(host, &query->result) == 0) {
+        query->done = true;
+        return 1;
+    }
+
+    query->server_count = load_nameservers(query->servers, query->server_lengths, DNS_MAX_NAMESERVERS);
+    for (int i = 0; i < query->server_count; i++) {
+        int slot = family_slot(&query->servers[i]);
+        if (query->sockfd[slot] < 0) {
+            query->sockfd[slot] = open_query_socket(slot ? AF_INET6 : AF_INET);
+        }
+    }
+
+    query->server_index = 0;
+    if (query->server_count == 0 || (send_queries(query) != 0 && next_server(query) != 0)) {
+        query->done = true;
+        return 1;
+    }
+    return 0;
+}
+
+// Process datagrams waiting on the query sockets
+int dns_query_read(struct dns_query *query)
+{
+    for (int slot = 0; slot < 2 && !query->done; slot++) {
+        if (query->sockfd[slot] < 0) {
+            continue;
+        }
+
+        unsigned char packet[DNS_MAX_PACKET];
+        struct sockaddr_storage from;
+        socklen_t from_len = sizeof(from);
+        ssize_t received;
+        while ((received = recvfrom(query->sockfd[slot],
+                                    packet,
+                                    sizeof(packet),
+                                    0,
+                                    (struct sockaddr *) &from,
+                                    &from_len)) > 0) {
+            from_len = sizeof(from);
+            struct dns_message message;
+            if (!from_current_server(query, &from) || dns_parse_response(packet, (size_t) received, &message) != 0) {
+                continue;
+            }
+            for (int i = 0; i < 2; i++) {
+                if (!query->answered[i] && message.id == query->ids[i]) {
+                    query->answered[i] = true;
+                    // A truncated reply still carries usable addresses for our purposes
+                    if (message.rcode == DNS_RCODE_NOERROR || message.rcode == DNS_RCODE_NXDOMAIN) {
+                        query->any_answer = true;
+                        dns_collect_addresses(&message, &query->result);
+                    }
+                }
+            }
+        }
+    }
+
+    if (query->done) {
+        return 1;
+    }
+    if (query->answered[0] && query->answered[1]) {
+        // Both families answered; a refusal from this server means try the next one
+        if (query->any_answer) {
+            query->done = true;
+            return 1;
+        }
+        return next_server(query);
+    }
+
+    // Once one family answered, give the other a short grace period only
+    long long grace = now_ms() + DNS_ATTEMPT_TIMEOUT_MS / 4;
+    if (query->result.count > 0 && query->attempt_deadline > grace) {
+        query->attempt_deadline = grace;
+    }
+    return 0;
+}
+
+// Advance timers
+int dns_query_check_timeout(struct dns_query *query)
+{
+    if (query->done) {
+        return 1;
+    }
+    long long now = now_ms();
+    if (now < query->attempt_deadline) {
+        return 0;
+    }
+    if (query->any_answer || now >= query->deadline) {
+        query->done = true;
+        return 1;
+    }
+    return next_server(query);
+}
+
+// Time of the next timer on the monotonic clock, in milliseconds
+long long dns_query_deadline(const struct dns_query *query)
+{
+    return query->attempt_deadline;
+}
+
+// Close the query sockets
+void dns_query_cleanup(struct dns_query *query)
+{
+    for (int slot = 0; slot < 2; slot++) {
+        if (query->sockfd[slot] >= 0) {
+            close(query->sockfd[slot]);
+            query->sockfd[slot] = -1;
+        }
+    }
+}
+
+// Answer numeric hosts and /etc/hosts entries locally
+int dns_resolve_local(const char *host, struct dns_result *result)
+{
+    memset(result, 0, sizeof(*result));
+    return (resolve_numeric(host, result) || resolve_hosts_file(host, result)) ? 0 : -1;
+}
+
+// Socket address of a result, IPv4 first
+socklen_t dns_result_sockaddr(const struct dns_result *result, uint16_t port, struct sockaddr_storage *addr)
+{
+    const struct dns_address *address = &result->addresses[0];
+    for (int i = 0; i < result->count; i++) {
+        if (result->addresses[i].family == AF_INET) {
+            address = &result->addresses[i];
+            break;
+        }
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    if (address->family == AF_INET) {
+        struct sockaddr_in *sin = (struct sockaddr_in *) addr;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        memcpy(&sin->sin_addr, address->addr, 4);
+        return sizeof(*sin);
+    }
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) addr;
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_port = htons(port);
+    memcpy(&sin6->sin6_addr, address->addr, 16);
+    return sizeof(*sin6);
+}
+
+// Resolve host to IPv4 and IPv6 addresses
+int dns_resolve(const char *host, int timeout_ms, struct dns_result *result)
+{
+    struct dns_query query;
+    int done = dns_query_start(&query, host, timeout_ms);
+
+    while (!done) {
+        struct pollfd pfds[2];
+        nfds_t nfds = 0;
+        for (int slot = 0; slot < 2; slot++) {
+            if (query.sockfd[slot] >= 0) {
+                pfds[nfds].fd = query.sockfd[slot];
+                pfds[nfds].events = POLLIN;
+                pfds[nfds].revents = 0;
+                nfds++;
+            }
+        }
+
+        long long wait_ms = dns_query_deadline(&query) - now_ms();
+        int ready = poll(pfds, nfds, wait_ms > 0 ? (int) wait_ms : 0);
+        if (ready > 0) {
+            done = dns_query_read(&query);
+        }
+        if (!done) {
+            done = dns_query_check_timeout(&query);
+        }
+    }
+
+    *result = query.result;
+    dns_query_cleanup(&query);
+    return result->count > 0 ? 0 : -1;
+}
@@ -0,0 +1,133 @@
+#ifndef DNS_H
+#define DNS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Record types and classes used by the resolver
+#define DNS_TYPE_A 1
+#define DNS_TYPE_TXT 16
+#define DNS_TYPE_AAAA 28
+#define DNS_CLASS_IN 1
+#define DNS_CLASS_CH 3
+
+// Response codes
+#define DNS_RCODE_NOERROR 0
+#define DNS_RCODE_NXDOMAIN 3
+
+// Limits
+#define DNS_MAX_PACKET 512
+#define DNS_MAX_ANSWERS 16
+#define DNS_MAX_ADDRESSES 16
+#define DNS_MAX_NAMESERVERS 3
+
+// Resolver timing
+#define DNS_ATTEMPT_TIMEOUT_MS 1000
+
+// Answer record from a response, rdata is copied out of the packet
+struct dns_answer {
+    uint16_t type;
+    uint16_t rclass; // DNS_CLASS_IN or DNS_CLASS_CH, others are dropped
+    uint32_t ttl;
+    uint16_t rdlength;
+    unsigned char rdata[256];
+};
+
+// Parsed response
+struct dns_message {
+    uint16_t id;
+    int rcode;
+    int truncated;
+    struct dns_answer answers[DNS_MAX_ANSWERS];
+    int answer_count;
+};
+
+// Resolved address with its remaining TTL
+struct dns_address {
+    int family; // AF_INET or AF_INET6
+    unsigned char addr[16];
+    uint32_t ttl;
+};
+
+// Result of resolving a host name
+struct dns_result {
+    struct dns_address addresses[DNS_MAX_ADDRESSES];
+    int count;
+};
+
+// Non-blocking A/AAAA lookup against the nameservers in /etc/resolv.conf.
+// Drive it by waiting for sockfd[] to become readable (calling
+// dns_query_read) and for dns_query_deadline() (calling
+// dns_query_check_timeout) until either returns 1.
+struct dns_query {
+    char host[256];
+    struct sockaddr_storage servers[DNS_MAX_NAMESERVERS];
+    socklen_t server_lengths[DNS_MAX_NAMESERVERS];
+    int server_count;
+    int server_index;
+    int sockfd[2]; // IPv4 and IPv6 UDP sockets, -1 if unused
+    uint16_t ids[2];
+    bool answered[2];
+    bool any_answer;
+    bool done;
+    long long attempt_deadline;
+    long long deadline;
+    struct dns_result result;
+};
+
+// Encode a standard recursive query for name/type into buf.
+// Returns the packet length or -1 if the name does not fit.
+int dns_build_query(unsigned char *buf, size_t size, uint16_t id, const char *name, uint16_t type);
+
+// Same in another class, such as DNS_CLASS_CH for server identity queries
+int dns_build_query_class(unsigned char *buf,
+                          size_t size,
+                          uint16_t id,
+                          const char *name,
+                          uint16_t type,
+                          uint16_t qclass);
+
+// Decode a response packet. Returns 0 on success, -1 if malformed.
+int dns_parse_response(const unsigned char *buf, size_t len, struct dns_message *message);
+
+// Generate a random query ID
+uint16_t dns_random_id(void);
+
+// Append the A/AAAA answers of a message to a result
+void dns_collect_addresses(const struct dns_message *message, struct dns_result *result);
+
+// Answer numeric hosts and /etc/hosts entries without any network traffic.
+// Returns 0 if the host was found locally, -1 otherwise.
+int dns_resolve_local(const char *host, struct dns_result *result);
+
+// Fill addr with the first IPv4 address of a result and port, or its first
+// address if it has no IPv4 one: the public address seen by a server reached
+// over IPv4 is the one A records want. Returns the length of the address.
+socklen_t dns_result_sockaddr(const struct dns_result *result, uint16_t port, struct sockaddr_storage *addr);
+
+// Start a lookup. Numeric hosts and /etc/hosts entries finish immediately.
+// Returns 1 if the lookup is already finished, 0 if queries are in flight.
+int dns_query_start(struct dns_query *query, const char *host, int timeout_ms);
+
+// Process datagrams on the query sockets. Returns 1 when the lookup is finished.
+int dns_query_read(struct dns_query *query);
+
+// Handle an expired attempt (moves to the next nameserver). Returns 1 when finished.
+int dns_query_check_timeout(struct dns_query *query);
+
+// Next timer of the lookup, in milliseconds on the monotonic clock
+long long dns_query_deadline(const struct dns_query *query);
+
+// Release the sockets of a lookup
+void dns_query_cleanup(struct dns_query *query);
+
+// Resolve host to IPv4 and IPv6 addresses using the nameservers in
+// /etc/resolv.conf. A and AAAA queries are sent in parallel over UDP and the
+// whole lookup is bounded by timeout_ms. Numeric addresses and /etc/hosts
+// entries are answered locally.
+// Returns 0 if at least one address was found, -1 otherwise.
+int dns_resolve(const char *host, int timeout_ms, struct dns_result *result);
+
+#endif // DNS_H
@@ -0,0 +1,224 @@
+#define _POSIX_C_SOURCE 200809L
+#include "dns_cache.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Cached answer for one host name
+struct dns_cache_entry {
+    char host[256];
+    time_t expires; // Wall clock, so entries stay valid across processes
+    struct dns_result result;
+};
+
+static struct dns_cache_entry cache[DNS_CACHE_SIZE];
+static int cache_count = 0;
+static bool cache_dirty = false;
+
+// Find the cache slot for host, -1 if absent
+static int find_entry(const char *host)
+{
+    for (int i = 0; i < cache_count; i++) {
+        if (strcasecmp(cache[i].host, host) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Pick a slot for host, reusing its entry or replacing the one expiring first
+static int slot_for(const char *host)
+{
+    int index = find_entry(host);
+    if (index >= 0) {
+        return index;
+    }
+    if (cache_count < DNS_CACHE_SIZE) {
+        index = cache_count++;
+    } else {
+        index = 0;
+        for (int i = 1; i < cache_count; i++) {
+            if (cache[i].expires < cache[index].expires) {
+                index = i;
+            }
+        }
+    }
+    memset(&cache[index], 0, sizeof(cache[index]));
+    strncpy(cache[index].host, host, sizeof(cache[index].host) - 1);
+    return index;
+}
+
+// Decode one "host expires address..." line into the cache
+static int load_line(char *line, time_t now)
+{
+    char *saveptr = NULL;
+    const char *host = strtok_r(line, " \t\r\n", &saveptr);
+    const char *expires_str = strtok_r(NULL, " \t\r\n", &saveptr);
+    if (!host || !expires_str || host[0] == '#') {
+        return -1;
+    }
+
+    time_t expires = (time_t) strtoll(expires_str, NULL, 10);
+    if (expires + DNS_CACHE_MAX_STALE < now) {
+        return -1; // Too old even for stale use
+    }
+
+    struct dns_result result;
+    memset(&result, 0, sizeof(result));
+    const char *address;
+    while ((address = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL && result.count < DNS_MAX_ADDRESSES) {
+        struct dns_address *entry = &result.addresses[result.count];
+        if (inet_pton(AF_INET, address, entry->addr) == 1) {
+            entry->family = AF_INET;
+            result.count++;
+        } else if (inet_pton(AF_INET6, address, entry->addr) == 1) {
+            entry->family = AF_INET6;
+            result.count++;
+        }
+    }
+    if (result.count == 0) {
+        return -1;
+    }
+
+    int index = slot_for(host);
+    cache[index].expires = expires;
+    cache[index].result = result;
+    return 0;
+}
+
+// Load cached answers from a state file
+int dns_cache_load(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+
+    time_t now = time(NULL);
+    int loaded = 0;
+    char line[2048];
+    while (fgets(line, sizeof(line), file)) {
+        if (load_line(line, now) == 0) {
+            loaded++;
+        }
+    }
+
+    fclose(file);
+    cache_dirty = false;
+    return loaded;
+}
+
+// Write cached answers to a state file if anything changed
+int dns_cache_save(const char *path)
+{
+    if (!cache_dirty) {
+        return 0;
+    }
+
+    // Several short-lived tools may save at once: write a private temp file, then rename
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path, (long) getpid());
+    FILE *file = fopen(tmp_path, "w");
+    if (!file) {
+        return -1;
+    }
+
+    fprintf(file, "# DNS cache: host expires(unix time) addresses...\n");
+    for (int i = 0; i < cache_count; i++) {
+        fprintf(file, "%s %lld", cache[i].host, (long long) cache[i].expires);
+        for (int j = 0; j < cache[i].result.count; j++) {
+            const struct dns_address *entry = &cache[i].result.addresses[j];
+            char text[INET6_ADDRSTRLEN];
+            if (inet_ntop(entry->family, entry->addr, text, sizeof(text))) {
+                fprintf(file, " %s", text);
+            }
+        }
+        fprintf(file, "\n");
+    }
+
+    if (fclose(file) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+
+    cache_dirty = false;
+    return 0;
+}
+
+// Look up host
+dns_cache_status_t dns_cache_lookup(const char *host, struct dns_result *result)
+{
+    int index = find_entry(host);
+    if (index < 0) {
+        return DNS_CACHE_MISS;
+    }
+
+    time_t now = time(NULL);
+    if (cache[index].expires + DNS_CACHE_MAX_STALE < now) {
+        return DNS_CACHE_MISS;
+    }
+
+    *result = cache[index].result;
+    bool fresh = cache[index].expires > now;
+    uint32_t remaining = fresh ? (uint32_t) (cache[index].expires - now) : 0;
+    for (int i = 0; i < result->count; i++) {
+        result->addresses[i].ttl = remaining;
+    }
+    return fresh ? DNS_CACHE_FRESH : DNS_CACHE_STALE;
+}
+
+// Store the answer for host
+void dns_cache_store(const char *host, const struct dns_result *result)
+{
+    if (!host || !result || result->count == 0) {
+        return;
+    }
+
+    uint32_t ttl = DNS_CACHE_MAX_TTL;
+    for (int i = 0; i < result->count; i++) {
+        if (result->addresses[i].ttl < ttl) {
+            ttl = result->addresses[i].ttl;
+        }
+    }
+    if (ttl < DNS_CACHE_MIN_TTL) {
+        ttl = DNS_CACHE_MIN_TTL;
+    }
+
+    int index = slot_for(host);
+    cache[index].expires = time(NULL) + (time_t) ttl;
+    cache[index].result = *result;
+    cache_dirty = true;
+}
+
+// Resolve host through the cache, blocking
+int dns_cache_resolve(const char *host, int timeout_ms, struct dns_result *result)
+{
+    if (dns_resolve_local(host, result) == 0) {
+        return 0;
+    }
+    dns_cache_status_t status = dns_cache_lookup(host, result);
+    if (status == DNS_CACHE_FRESH) {
+        return 0;
+    }
+
+    struct dns_result resolved;
+    if (timeout_ms > 0 && dns_resolve(host, timeout_ms, &resolved) == 0) {
+        dns_cache_store(host, &resolved);
+        *result = resolved;
+        return 0;
+    }
+    return status == DNS_CACHE_STALE ? 0 : -1;
+}
+
+// Free all cached entries
+void dns_cache_clear(void)
+{
+    cache_count = 0;
+    cache_dirty = false;
+}
@@ -0,0 +1,43 @@
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include "dns.h"
+
+#include <stdbool.h>
+
+// Maximum number of host names kept in the cache
+#define DNS_CACHE_SIZE 16
+
+// TTL bounds applied to stored answers (seconds)
+#define DNS_CACHE_MIN_TTL 30
+#define DNS_CACHE_MAX_TTL 86400
+
+// How long an expired entry may still be served when resolution fails (seconds)
+#define DNS_CACHE_MAX_STALE 604800
+
+// Lookup results
+typedef enum { DNS_CACHE_MISS, DNS_CACHE_FRESH, DNS_CACHE_STALE } dns_cache_status_t;
+
+// Load cached answers from a state file.
+// Returns the number of entries loaded, or -1 if the file could not be read.
+int dns_cache_load(const char *path);
+
+// Write cached answers to a state file if anything changed. Returns 0 on success.
+int dns_cache_save(const char *path);
+
+// Look up host. Fresh entries are returned with their remaining TTL; expired
+// entries within DNS_CACHE_MAX_STALE are returned as DNS_CACHE_STALE.
+dns_cache_status_t dns_cache_lookup(const char *host, struct dns_result *result);
+
+// Store the answer for host, expiring after the smallest address TTL
+void dns_cache_store(const char *host, const struct dns_result *result);
+
+// Resolve host for a blocking caller: numeric hosts and /etc/hosts entries,
+// then a fresh cache entry, then the nameservers (the answer is stored), then
+// a stale entry. Returns 0 if an address was found, -1 otherwise.
+int dns_cache_resolve(const char *host, int timeout_ms, struct dns_result *result);
+
+// Free all cached entries
+void dns_cache_clear(void);
+
+#endif // DNS_CACHE_H
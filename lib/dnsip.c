@@ -0,0 +1,427 @@
+#define _POSIX_C_SOURCE 200809L
+#include "dnsip.h"
+
+#include "dns_cache.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+// Milliseconds on the monotonic clock
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Whether a public IP source is a DNS URI
+bool dnsip_is_uri(const char *uri)
+{
+    return uri && strncasecmp(uri, "dns:", 4) == 0;
+}
+
+// Decode one key=value pair of the query part
+static int parse_parameter(const char *param, size_t len, uint16_t *type, uint16_t *qclass)
+{
+    char text[16];
+    if (len >= sizeof(text)) {
+        return -1;
+    }
+    memcpy(text, param, len);
+    text[len] = '\0';
+
+    if (strcasecmp(text, "type=A") == 0) {
+        *type = DNS_TYPE_A;
+    } else if (strcasecmp(text, "type=TXT") == 0) {
+        *type = DNS_TYPE_TXT;
+    } else if (strcasecmp(text, "class=IN") == 0) {
+        *qclass = DNS_CLASS_IN;
+    } else if (strcasecmp(text, "class=CH") == 0) {
+        *qclass = DNS_CLASS_CH;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Split a dns://resolver[:port]/name?type=...;class=... URI
+int dnsip_parse_uri(const char *uri,
+                    char *resolver,
+                    size_t resolver_size,
+                    uint16_t *port,
+                    char *name,
+                    size_t name_size,
+                    uint16_t *type,
+                    uint16_t *qclass)
+{
+    // Only the form naming a resolver is of use: the local one would answer with its own address
+    if (!uri || strncasecmp(uri, "dns://", 6) != 0) {
+        return -1;
+    }
+    const char *authority = uri + 6;
+    const char *slash = strchr(authority, '/');
+    if (!slash) {
+        return -1;
+    }
+
+    const char *host_start = authority;
+    const char *host_end = slash;
+    const char *port_start = NULL;
+    if (*authority == '[') {
+        host_start = authority + 1;
+        host_end = memchr(host_start, ']', (size_t) (slash - host_start));
+        if (!host_end || (host_end[1] != ':' && host_end + 1 != slash)) {
+            return -1;
+        }
+        port_start = host_end[1] == ':' ? host_end + 2 : NULL;
+    } else {
+        const char *colon = memchr(authority, ':', (size_t) (slash - authority));
+        if (colon) {
+            host_end = colon;
+            port_start = colon + 1;
+        }
+    }
+    size_t host_len = (size_t) (host_end - host_start);
+    if (host_len == 0 || host_len >= resolver_size) {
+        return -1;
+    }
+    memcpy(resolver, host_start, host_len);
+    resolver[host_len] = '\0';
+
+    *port = DNSIP_DEFAULT_PORT;
+    if (port_start) {
+        char *end = NULL;
+        long value = strtol(port_start, &end, 10);
+        if (end == port_start || end != slash || value < 1 || value > 65535) {
+            return -1;
+        }
+        *port = (uint16_t) value;
+    }
+
+    const char *name_start = slash + 1;
+    const char *query = strchr(name_start, '?');
+    size_t name_len = query ? (size_t) (query - name_start) : strlen(name_start);
+    if (name_len == 0 || name_len >= name_size) {
+        return -1;
+    }
+    memcpy(name, name_start, name_len);
+    name[name_len] = '\0';
+
+    *type = DNS_TYPE_A;
+    *qclass = DNS_CLASS_IN;
+    while (query && *query) {
+        const char *param = query + 1;
+        size_t len = strcspn(param, ";&");
+        if (parse_parameter(param, len, type, qclass) != 0) {
+            return -1;
+        }
+        query = param + len;
+    }
+    return 0;
+}
+
+// Check that text is an IPv4 or IPv6 address and write it in canonical form
+static int canonical_address(const char *text, char *out, size_t out_size)
+{
+    unsigned char address[16];
+    if (inet_pton(AF_INET, text, address) == 1) {
+        return inet_ntop(AF_INET, address, out, (socklen_t) out_size) ? 0 : -1;
+    }
+    if (inet_pton(AF_INET6, text, address) == 1) {
+        return inet_ntop(AF_INET6, address, out, (socklen_t) out_size) ? 0 : -1;
+    }
+    return -1;
+}
+
+// Find the address in the answers of a response
+int dnsip_answer_address(const struct dns_message *message, uint16_t type, char *out, size_t out_size)
+{
+    for (int i = 0; i < message->answer_count; i++) {
+        const struct dns_answer *answer = &message->answers[i];
+        if (answer->type != type) {
+            continue;
+        }
+        if (type == DNS_TYPE_A && answer->rdlength == 4) {
+            return inet_ntop(AF_INET, answer->rdata, out, (socklen_t) out_size) ? 0 : -1;
+        }
+        if (type != DNS_TYPE_TXT) {
+            continue;
+        }
+
+        // A TXT record holds length-prefixed strings; some resolvers add
+        // strings that are not the address, so try each
+        size_t pos = 0;
+        while (pos < answer->rdlength) {
+            size_t len = answer->rdata[pos++];
+            if (pos + len > answer->rdlength) {
+                break;
+            }
+            char text[INET6_ADDRSTRLEN];
+            if (len < sizeof(text)) {
+                memcpy(text, answer->rdata + pos, len);
+                text[len] = '\0';
+                if (canonical_address(text, out, out_size) == 0) {
+                    return 0;
+                }
+            }
+            pos += len;
+        }
+    }
+    return -1;
+}
+
+// Resolve the resolver named by a URI and take the question from it
+static int prepare_server(const char *uri, struct dnsip_server *server, long long deadline)
+{
+    char host[256];
+    uint16_t port;
+    if (dnsip_parse_uri(uri,
+                        host,
+                        sizeof(host),
+                        &port,
+                        server->name,
+                        sizeof(server->name),
+                        &server->type,
+                        &server->qclass) != 0) {
+        return -1;
+    }
+
+    struct dns_result result;
+    if (dns_cache_resolve(host, (int) (deadline - now_ms()), &result) != 0) {
+        return -1;
+    }
+    server->addr_len = dns_result_sockaddr(&result, port, &server->addr);
+    return 0;
+}
+
+// Open the UDP socket used for one address family
+static int open_query_socket(int family)
+{
+    int fd = socket(family, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Socket slot for a resolver's family
+static int family_slot(const struct sockaddr_storage *addr)
+{
+    return addr->ss_family == AF_INET6 ? 1 : 0;
+}
+
+// Send a resolver its next query and arm its timer
+static void send_query(struct dnsip_query *query, struct dnsip_server *server, long long now)
+{
+    unsigned char packet[DNS_MAX_PACKET];
+    int fd = query->sockfd[family_slot(&server->addr)];
+    int packet_len =
+        dns_build_query_class(packet, sizeof(packet), server->id, server->name, server->type, server->qclass);
+    if (fd < 0 || packet_len < 0 ||
+        sendto(fd, packet, (size_t) packet_len, 0, (const struct sockaddr *) &server->addr, server->addr_len) !=
+            packet_len) {
+        server->done = true;
+        return;
+    }
+
+    // Retries keep the ID, so a late answer to an earlier query still counts
+    if (server->attempts++ == 0) {
+        server->first_sent = now;
+    }
+    long long wait = (long long) DNSIP_ATTEMPT_TIMEOUT_MS << (server->attempts - 1);
+    server->next_timer = now + wait < query->deadline ? now + wait : query->deadline;
+}
+
+// Check that a datagram came from a resolver
+static bool from_server(const struct dnsip_server *server, const struct sockaddr_storage *from)
+{
+    if (from->ss_family != server->addr.ss_family) {
+        return false;
+    }
+    if (from->ss_family == AF_INET) {
+        const struct sockaddr_in *a = (const struct sockaddr_in *) from;
+        const struct sockaddr_in *b = (const struct sockaddr_in *) &server->addr;
+        return a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr;
+    }
+    const struct sockaddr_in6 *a = (const struct sockaddr_in6 *) from;
+    const struct sockaddr_in6 *b = (const struct sockaddr_in6 *) &server->addr;
+    return a->sin6_port == b->sin6_port && memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0;
+}
+
+// Finish once enough resolvers answered, none is left waiting, or time is up
+static int check_finished(struct dnsip_query *query)
+{
+    bool waiting = false;
+    for (int i = 0; i < query->server_count; i++) {
+        waiting = waiting || !query->servers[i].done;
+    }
+    if (query->answered >= query->wanted || !waiting || now_ms() >= query->deadline) {
+        query->done = true;
+    }
+    return query->done ? 1 : 0;
+}
+
+// Start a query
+int dnsip_query_start(struct dnsip_query *query,
+                      const char *const uris[],
+                      int count,
+                      int wanted,
+                      int retries,
+                      int timeout_ms)
+{
+    memset(query, 0, sizeof(*query));
+    query->sockfd[0] = -1;
+    query->sockfd[1] = -1;
+    query->retries = retries > 0 ? retries : 0;
+    query->wanted = wanted > 0 ? wanted : 1;
+    query->deadline = now_ms() + timeout_ms;
+
+    for (int i = 0; i < count && query->server_count < DNSIP_MAX_SERVERS; i++) {
+        struct dnsip_server *server = &query->servers[query->server_count++];
+        if (prepare_server(uris[i], server, query->deadline) != 0) {
+            server->done = true;
+            continue;
+        }
+        int slot = family_slot(&server->addr);
+        if (query->sockfd[slot] < 0) {
+            query->sockfd[slot] = open_query_socket(slot ? AF_INET6 : AF_INET);
+        }
+        server->id = dns_random_id();
+    }
+
+    long long now = now_ms();
+    for (int i = 0; i < query->server_count; i++) {
+        if (!query->servers[i].done) {
+            send_query(query, &query->servers[i], now);
+        }
+    }
+    return check_finished(query);
+}
+
+// Process datagrams waiting on the query sockets
+int dnsip_query_read(struct dnsip_query *query)
+{
+    for (int slot = 0; slot < 2 && !query->done; slot++) {
+        if (query->sockfd[slot] < 0) {
+            continue;
+        }
+
+        unsigned char packet[DNS_MAX_PACKET];
+        struct sockaddr_storage from;
+        socklen_t from_len = sizeof(from);
+        ssize_t received;
+        while ((received = recvfrom(query->sockfd[slot],
+                                    packet,
+                                    sizeof(packet),
+                                    0,
+                                    (struct sockaddr *) &from,
+                                    &from_len)) > 0) {
+            from_len = sizeof(from);
+            struct dns_message message;
+            if (dns_parse_response(packet, (size_t) received, &message) != 0) {
+                continue;
+            }
+            for (int i = 0; i < query->server_count; i++) {
+                struct dnsip_server *server = &query->servers[i];
+                if (server->done || message.id != server->id || !from_server(server, &from)) {
+                    continue;
+                }
+                // A refusal or an answer without an address will not improve on a retry
+                server->done = true;
+                if (message.rcode == DNS_RCODE_NOERROR &&
+                    dnsip_answer_address(&message, server->type, server->address, sizeof(server->address)) == 0) {
+                    server->answered = true;
+                    server->rtt_ms = (int) (now_ms() - server->first_sent);
+                    query->answered++;
+                }
+                break;
+            }
+        }
+    }
+    return check_finished(query);
+}
+
+// Retry, or give up on resolvers that had their last chance
+int dnsip_query_check_timeout(struct dnsip_query *query)
+{
+    if (query->done) {
+        return 1;
+    }
+    long long now = now_ms();
+    if (now >= query->deadline) {
+        return check_finished(query);
+    }
+    for (int i = 0; i < query->server_count; i++) {
+        struct dnsip_server *server = &query->servers[i];
+        if (server->done || now < server->next_timer) {
+            continue;
+        }
+        if (server->attempts > query->retries) {
+            server->done = true;
+        } else {
+            send_query(query, server, now);
+        }
+    }
+    return check_finished(query);
+}
+
+// Time of the next timer on the monotonic clock, in milliseconds
+long long dnsip_query_deadline(const struct dnsip_query *query)
+{
+    long long next = query->deadline;
+    for (int i = 0; i < query->server_count; i++) {
+        if (!query->servers[i].done && query->servers[i].next_timer < next) {
+            next = query->servers[i].next_timer;
+        }
+    }
+    return next;
+}
+
+// Close the query sockets
+void dnsip_query_cleanup(struct dnsip_query *query)
+{
+    for (int slot = 0; slot < 2; slot++) {
+        if (query->sockfd[slot] >= 0) {
+            close(query->sockfd[slot]);
+            query->sockfd[slot] = -1;
+        }
+    }
+}
+
+// Run a started query to completion
+int dnsip_query_run(struct dnsip_query *query)
+{
+    while (!query->done) {
+        struct pollfd pfds[2];
+        nfds_t nfds = 0;
+        for (int slot = 0; slot < 2; slot++) {
+            if (query->sockfd[slot] >= 0) {
+                pfds[nfds].fd = query->sockfd[slot];
+                pfds[nfds].events = POLLIN;
+                pfds[nfds].revents = 0;
+                nfds++;
+            }
+        }
+
+        long long wait_ms = dnsip_query_deadline(query) - now_ms();
+        int ready = poll(pfds, nfds, wait_ms > 0 ? (int) wait_ms : 0);
+        if (ready > 0 && dnsip_query_read(query)) {
+            break;
+        }
+        dnsip_query_check_timeout(query);
+    }
+    return query->answered;
+}
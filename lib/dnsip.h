@@ -0,0 +1,105 @@
+#ifndef DNSIP_H
+#define DNSIP_H
+
+#include "dns.h"
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Limits
+#define DNSIP_MAX_SERVERS 8
+#define DNSIP_DEFAULT_PORT 53
+
+// The first attempt waits this long for an answer, each retry twice as long
+// as the one before
+#define DNSIP_ATTEMPT_TIMEOUT_MS 500
+
+// Retries after the first attempt, unless configured otherwise
+#define DNSIP_DEFAULT_RETRIES 2
+
+// One resolver of a query, the name it is asked and what it answered
+struct dnsip_server {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    char name[256];
+    uint16_t type;   // DNS_TYPE_A or DNS_TYPE_TXT
+    uint16_t qclass; // DNS_CLASS_IN or DNS_CLASS_CH
+    uint16_t id;
+    int attempts;         // Queries sent so far
+    long long first_sent; // Monotonic ms
+    long long next_timer; // Retry or give-up time
+    bool done;            // Answered or given up
+    bool answered;
+    int rtt_ms;                     // From the first query to the answer
+    char address[INET6_ADDRSTRLEN]; // Canonical text form
+};
+
+// Non-blocking queries to several resolvers that answer with the address the
+// query came from, such as OpenDNS for myip.opendns.com or Cloudflare for
+// whoami.cloudflare (class CH, TXT). Drive it like a dns_query: wait for
+// sockfd[] to become readable (calling dnsip_query_read) and for
+// dnsip_query_deadline() (calling dnsip_query_check_timeout) until either
+// returns 1.
+struct dnsip_query {
+    struct dnsip_server servers[DNSIP_MAX_SERVERS];
+    int server_count;
+    int sockfd[2]; // IPv4 and IPv6 UDP sockets, -1 if unused
+    int retries;
+    int wanted; // Answers that end the query
+    int answered;
+    bool done;
+    long long deadline;
+};
+
+// Whether a public IP source is a DNS URI
+bool dnsip_is_uri(const char *uri);
+
+// Split a DNS URI (RFC 4501) naming the resolver to ask:
+// "dns://resolver[:port]/name[?type=A|TXT][;class=IN|CH]". The type defaults
+// to A and the class to IN. type=AAAA is refused: the address found goes
+// into A records. Returns 0 on success, -1 if malformed or refused.
+int dnsip_parse_uri(const char *uri,
+                    char *resolver,
+                    size_t resolver_size,
+                    uint16_t *port,
+                    char *name,
+                    size_t name_size,
+                    uint16_t *type,
+                    uint16_t *qclass);
+
+// Find the address in the answers of a response: the first A record, or the
+// first TXT string that holds an IPv4 or IPv6 address.
+// Writes it in canonical form and returns 0, or -1 if there is none.
+int dnsip_answer_address(const struct dns_message *message, uint16_t type, char *out, size_t out_size);
+
+// Resolve the resolvers and send each its query. A resolver that does not
+// answer is asked again up to retries times. The query finishes once wanted
+// resolvers answered, all of them answered or gave up, or timeout_ms
+// elapsed. Returns 1 if the query is already finished, 0 if queries are in
+// flight.
+int dnsip_query_start(struct dnsip_query *query,
+                      const char *const uris[],
+                      int count,
+                      int wanted,
+                      int retries,
+                      int timeout_ms);
+
+// Process datagrams on the query sockets. Returns 1 when the query is finished.
+int dnsip_query_read(struct dnsip_query *query);
+
+// Retry or give up on resolvers whose timer expired. Returns 1 when finished.
+int dnsip_query_check_timeout(struct dnsip_query *query);
+
+// Next timer of the query, in milliseconds on the monotonic clock
+long long dnsip_query_deadline(const struct dnsip_query *query);
+
+// Release the sockets of a query
+void dnsip_query_cleanup(struct dnsip_query *query);
+
+// Run a started query to completion. Returns the number of resolvers that answered.
+int dnsip_query_run(struct dnsip_query *query);
+
+#endif // DNSIP_H
@@ -0,0 +1,256 @@
+#define _POSIX_C_SOURCE 200809L
+#include "event_loop.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+// Maximum events collected per wait
+#define EVENT_LOOP_BATCH 32
+
+// Registered descriptor
+struct event_watch {
+    int fd;
+    int events;
+    event_handler handler;
+    void *ctx;
+    bool removed; // Unwatched while events for it may still be pending
+    struct event_watch *next;
+};
+
+struct event_loop {
+#ifdef __linux__
+    int epfd;
+#endif
+    struct event_watch *watches;
+    struct event_watch *removed; // Freed once the current dispatch is over
+};
+
+// Find the live watch for fd
+static struct event_watch *find_watch(struct event_loop *loop, int fd)
+{
+    for (struct event_watch *watch = loop->watches; watch; watch = watch->next) {
+        if (watch->fd == fd) {
+            return watch;
+        }
+    }
+    return NULL;
+}
+
+// Free watches removed during the last dispatch
+static void free_removed(struct event_loop *loop)
+{
+    while (loop->removed) {
+        struct event_watch *next = loop->removed->next;
+        free(loop->removed);
+        loop->removed = next;
+    }
+}
+
+// Call a handler unless its watch was removed earlier in the same batch
+static void dispatch(struct event_watch *watch, int events)
+{
+    if (!watch->removed && events) {
+        watch->handler(watch->ctx, watch->fd, events);
+    }
+}
+
+#ifdef __linux__
+
+// Translate watch flags to epoll flags
+static uint32_t to_epoll(int events)
+{
+    uint32_t flags = 0;
+    if (events & EVENT_READ) {
+        flags |= EPOLLIN;
+    }
+    if (events & EVENT_WRITE) {
+        flags |= EPOLLOUT;
+    }
+    return flags;
+}
+
+#endif
+
+// Create an empty loop
+struct event_loop *event_loop_new(void)
+{
+    struct event_loop *loop = calloc(1, sizeof(struct event_loop));
+    if (!loop) {
+        return NULL;
+    }
+#ifdef __linux__
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        free(loop);
+        return NULL;
+    }
+#endif
+    return loop;
+}
+
+// Free the loop
+void event_loop_free(struct event_loop *loop)
+{
+    if (!loop) {
+        return;
+    }
+    while (loop->watches) {
+        struct event_watch *next = loop->watches->next;
+        free(loop->watches);
+        loop->watches = next;
+    }
+    free_removed(loop);
+#ifdef __linux__
+    close(loop->epfd);
+#endif
+    free(loop);
+}
+
+// Watch fd for events
+int event_loop_watch(struct event_loop *loop, int fd, int events, event_handler handler, void *ctx)
+{
+    struct event_watch *watch = find_watch(loop, fd);
+    bool added = watch == NULL;
+    if (added) {
+        watch = calloc(1, sizeof(struct event_watch));
+        if (!watch) {
+            return -1;
+        }
+        watch->fd = fd;
+    }
+
+#ifdef __linux__
+    struct epoll_event event;
+    event.events = to_epoll(events);
+    event.data.ptr = watch;
+    if (epoll_ctl(loop->epfd, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event) != 0) {
+        if (added) {
+            free(watch);
+        }
+        return -1;
+    }
+#endif
+
+    watch->events = events;
+    watch->handler = handler;
+    watch->ctx = ctx;
+    if (added) {
+        watch->next = loop->watches;
+        loop->watches = watch;
+    }
+    return 0;
+}
+
+// Stop watching fd
+void event_loop_unwatch(struct event_loop *loop, int fd)
+{
+    for (struct event_watch **link = &loop->watches; *link; link = &(*link)->next) {
+        struct event_watch *watch = *link;
+        if (watch->fd != fd) {
+            continue;
+        }
+#ifdef __linux__
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+        *link = watch->next;
+        watch->removed = true;
+        watch->next = loop->removed;
+        loop->removed = watch;
+        return;
+    }
+}
+
+#ifdef __linux__
+
+// Wait and dispatch with epoll
+int event_loop_wait(struct event_loop *loop, int timeout_ms)
+{
+    struct epoll_event events[EVENT_LOOP_BATCH];
+    int ready = epoll_wait(loop->epfd, events, EVENT_LOOP_BATCH, timeout_ms);
+    if (ready < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    for (int i = 0; i < ready; i++) {
+        int flags = 0;
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+            flags = EVENT_READ | EVENT_WRITE;
+        }
+        if (events[i].events & EPOLLIN) {
+            flags |= EVENT_READ;
+        }
+        if (events[i].events & EPOLLOUT) {
+            flags |= EVENT_WRITE;
+        }
+        dispatch(events[i].data.ptr, flags);
+    }
+
+    free_removed(loop);
+    return ready;
+}
+
+#else
+
+// Wait and dispatch with poll()
+int event_loop_wait(struct event_loop *loop, int timeout_ms)
+{
+    int count = 0;
+    for (const struct event_watch *watch = loop->watches; watch; watch = watch->next) {
+        count++;
+    }
+
+    struct pollfd *pfds = calloc((size_t) (count > 0 ? count : 1), sizeof(struct pollfd));
+    struct event_watch **map = calloc((size_t) (count > 0 ? count : 1), sizeof(struct event_watch *));
+    if (!pfds || !map) {
+        free(pfds);
+        free(map);
+        return -1;
+    }
+
+    int nfds = 0;
+    for (struct event_watch *watch = loop->watches; watch; watch = watch->next) {
+        pfds[nfds].fd = watch->fd;
+        pfds[nfds].events = (short) (((watch->events & EVENT_READ) ? POLLIN : 0) |
+                                     ((watch->events & EVENT_WRITE) ? POLLOUT : 0));
+        map[nfds++] = watch;
+    }
+
+    int ready = poll(pfds, (nfds_t) nfds, timeout_ms);
+    int poll_errno = errno;
+    int called = 0;
+    for (int i = 0; i < nfds && ready > 0; i++) {
+        if (!pfds[i].revents) {
+            continue;
+        }
+        int flags = 0;
+        if (pfds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            flags = EVENT_READ | EVENT_WRITE;
+        }
+        if (pfds[i].revents & POLLIN) {
+            flags |= EVENT_READ;
+        }
+        if (pfds[i].revents & POLLOUT) {
+            flags |= EVENT_WRITE;
+        }
+        dispatch(map[i], flags);
+        called++;
+    }
+
+    free(pfds);
+    free(map);
+    free_removed(loop);
+    if (ready < 0) {
+        return poll_errno == EINTR ? 0 : -1;
+    }
+    return called;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+// Readiness flags passed to event_loop_watch() and to handlers
+#define EVENT_READ 0x1
+#define EVENT_WRITE 0x2
+
+// Called when a watched descriptor is ready. Errors and hangups are reported
+// as EVENT_READ | EVENT_WRITE so the next read or write sees them.
+typedef void (*event_handler)(void *ctx, int fd, int events);
+
+// Readiness loop over epoll on Linux, poll() elsewhere
+struct event_loop;
+
+// Create an empty loop, NULL on failure
+struct event_loop *event_loop_new(void);
+
+// Free the loop. Watched descriptors are not closed.
+void event_loop_free(struct event_loop *loop);
+
+// Watch fd for events (EVENT_READ and/or EVENT_WRITE), replacing any previous
+// watch on it. Returns 0 on success, -1 on failure.
+int event_loop_watch(struct event_loop *loop, int fd, int events, event_handler handler, void *ctx);
+
+// Stop watching fd. Must be called before the descriptor is closed.
+void event_loop_unwatch(struct event_loop *loop, int fd);
+
+// Wait up to timeout_ms (-1 for no limit) and dispatch ready handlers.
+// Handlers may watch and unwatch descriptors, including their own.
+// Returns the number of handlers called, or -1 on error.
+int event_loop_wait(struct event_loop *loop, int timeout_ms);
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,724 @@
+#define _POSIX_C_SOURCE 200809L
+#include "gateway.h"
+
+#include "socket_http.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Kernel route flag of routes through a gateway
+#define ROUTE_FLAG_GATEWAY 0x0002
+
+// Discovered gateways, loaded from the state file on first use
+static struct gateway_entry cache[GATEWAY_CACHE_SIZE];
+static int cache_count = 0;
+static char *cache_path = NULL;
+static bool cache_loaded = false;
+static bool cache_dirty = false;
+
+// Milliseconds on the monotonic clock
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void put16(unsigned char *p, uint16_t value)
+{
+    p[0] = (unsigned char) (value >> 8);
+    p[1] = (unsigned char) (value & 0xff);
+}
+
+static void put32(unsigned char *p, uint32_t value)
+{
+    p[0] = (unsigned char) (value >> 24);
+    p[1] = (unsigned char) ((value >> 16) & 0xff);
+    p[2] = (unsigned char) ((value >> 8) & 0xff);
+    p[3] = (unsigned char) (value & 0xff);
+}
+
+static uint16_t get16(const unsigned char *p)
+{
+    return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+// Fill a PCP nonce from /dev/urandom
+static void random_nonce(unsigned char nonce[PCP_NONCE_SIZE])
+{
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        ssize_t n = read(fd, nonce, PCP_NONCE_SIZE);
+        close(fd);
+        if (n == PCP_NONCE_SIZE) {
+            return;
+        }
+    }
+    long long seed = now_ms() ^ ((long long) getpid() << 16);
+    for (int i = 0; i < PCP_NONCE_SIZE; i++) {
+        seed = seed * 6364136223846793005LL + 1442695040888963407LL;
+        nonce[i] = (unsigned char) (seed >> 33);
+    }
+}
+
+// Copy text between start and end without surrounding whitespace
+static int copy_trimmed(const char *start, const char *end, char *out, size_t out_size)
+{
+    while (start < end && strchr(" \t\r\n", *start)) {
+        start++;
+    }
+    while (end > start && strchr(" \t\r\n", end[-1])) {
+        end--;
+    }
+    size_t len = (size_t) (end - start);
+    if (len == 0 || len >= out_size) {
+        return -1;
+    }
+    memcpy(out, start, len);
+    out[len] = '\0';
+    return 0;
+}
+
+// Text of the first <tag> element at or after from, NULL-terminated in out
+static const char *element_text(const char *from, const char *tag, char *out, size_t out_size)
+{
+    char open_tag[64];
+    char close_tag[64];
+    snprintf(open_tag, sizeof(open_tag), "<%s>", tag);
+    snprintf(close_tag, sizeof(close_tag), "</%s>", tag);
+    const char *start = strstr(from, open_tag);
+    if (!start) {
+        return NULL;
+    }
+    start += strlen(open_tag);
+    const char *end = strstr(start, close_tag);
+    if (!end || copy_trimmed(start, end, out, out_size) != 0) {
+        return NULL;
+    }
+    return end + strlen(close_tag);
+}
+
+// Whether a public IP source names the gateway
+bool gateway_is_uri(const char *uri)
+{
+    return uri && strncasecmp(uri, "gateway:", 8) == 0;
+}
+
+// Find the IPv4 default gateway
+int gateway_default_route(struct in_addr *gateway)
+{
+    FILE *file = fopen("/proc/net/route", "r");
+    if (!file) {
+        return -1;
+    }
+
+    // Addresses are the kernel's network order values printed in hex
+    int result = -1;
+    char line[256];
+    while (result != 0 && fgets(line, sizeof(line), file)) {
+        char iface[64];
+        unsigned long destination = 0;
+        unsigned long address = 0;
+        unsigned long flags = 0;
+        if (sscanf(line, "%63s %lx %lx %lx", iface, &destination, &address, &flags) == 4 && destination == 0 &&
+            (flags & ROUTE_FLAG_GATEWAY) && address != 0) {
+            gateway->s_addr = (in_addr_t) address;
+            result = 0;
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+// Fill options from a gateway URI
+int gateway_options_init(struct gateway_options *options, const char *uri)
+{
+    memset(options, 0, sizeof(*options));
+    if (!gateway_is_uri(uri)) {
+        return -1;
+    }
+    const char *host = uri + 8;
+    options->natpmp.sin_family = AF_INET;
+    options->natpmp.sin_port = htons(GATEWAY_NATPMP_PORT);
+    if (*host != '\0' ? inet_pton(AF_INET, host, &options->natpmp.sin_addr) != 1
+                      : gateway_default_route(&options->natpmp.sin_addr) != 0) {
+        return -1;
+    }
+    options->ssdp.sin_family = AF_INET;
+    options->ssdp.sin_port = htons(GATEWAY_SSDP_PORT);
+    inet_pton(AF_INET, GATEWAY_SSDP_ADDR, &options->ssdp.sin_addr);
+    return 0;
+}
+
+// Decode a NAT-PMP external address response
+int gateway_natpmp_parse(const unsigned char *buf, size_t len, char *out, size_t out_size)
+{
+    // A PCP-only server answers in its own version
+    if (len >= 4 && buf[0] == PCP_VERSION) {
+        return PCP_UNSUPP_VERSION;
+    }
+    if (len < 8 || buf[0] != NATPMP_VERSION || buf[1] != 128 + NATPMP_OP_EXTERNAL_ADDRESS) {
+        return -1;
+    }
+    uint16_t result = get16(buf + 2);
+    if (result == PCP_UNSUPP_VERSION) {
+        return PCP_UNSUPP_VERSION;
+    }
+
+    // 0.0.0.0 means the gateway has no external address yet
+    static const unsigned char none[4] = {0, 0, 0, 0};
+    if (result != 0 || len < NATPMP_RESPONSE_SIZE || memcmp(buf + 8, none, 4) == 0) {
+        return -1;
+    }
+    return inet_ntop(AF_INET, buf + 8, out, (socklen_t) out_size) ? 0 : -1;
+}
+
+// Encode a PCP MAP request
+size_t gateway_pcp_build_map(unsigned char buf[PCP_MAP_SIZE],
+                             const struct in_addr *client,
+                             uint16_t port,
+                             uint32_t lifetime,
+                             const unsigned char nonce[PCP_NONCE_SIZE])
+{
+    // Addresses are IPv4-mapped IPv6 addresses; the suggested external one is ::ffff:0.0.0.0
+    memset(buf, 0, PCP_MAP_SIZE);
+    buf[0] = PCP_VERSION;
+    buf[1] = PCP_OP_MAP;
+    put32(buf + 4, lifetime);
+    buf[18] = 0xff;
+    buf[19] = 0xff;
+    memcpy(buf + 20, &client->s_addr, 4);
+    memcpy(buf + 24, nonce, PCP_NONCE_SIZE);
+    buf[36] = IPPROTO_UDP;
+    put16(buf + 40, port);
+    put16(buf + 42, port);
+    buf[54] = 0xff;
+    buf[55] = 0xff;
+    return PCP_MAP_SIZE;
+}
+
+// Decode a PCP MAP response
+int gateway_pcp_parse(const unsigned char *buf,
+                      size_t len,
+                      const unsigned char nonce[PCP_NONCE_SIZE],
+                      char *out,
+                      size_t out_size)
+{
+    static const unsigned char mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    if (len < PCP_MAP_SIZE || buf[0] != PCP_VERSION || buf[1] != (0x80 | PCP_OP_MAP) || buf[3] != 0 ||
+        memcmp(buf + 24, nonce, PCP_NONCE_SIZE) != 0 || memcmp(buf + 44, mapped, sizeof(mapped)) != 0) {
+        return -1;
+    }
+    return inet_ntop(AF_INET, buf + 56, out, (socklen_t) out_size) ? 0 : -1;
+}
+
+// Ask a NAT-PMP server, switching to PCP when it speaks only that, until
+// the deadline. Returns 0, or -1 if it did not answer.
+static int natpmp_query(const struct sockaddr_in *server, long long deadline, char *out, size_t out_size)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // Connected, so only the gateway's datagrams arrive and a closed port fails fast
+    struct sockaddr_in local;
+    socklen_t local_len = sizeof(local);
+    if (connect(fd, (const struct sockaddr *) server, sizeof(*server)) != 0 ||
+        getsockname(fd, (struct sockaddr *) &local, &local_len) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    unsigned char request[PCP_MAP_SIZE] = {NATPMP_VERSION, NATPMP_OP_EXTERNAL_ADDRESS};
+    size_t request_len = 2;
+    unsigned char nonce[PCP_NONCE_SIZE];
+    bool pcp = false;
+    int rto = GATEWAY_NATPMP_RTO_MS;
+    long long next_send = now_ms();
+    int result = -1;
+    while (result != 0) {
+        long long now = now_ms();
+        if (now >= deadline) {
+            break;
+        }
+        if (now >= next_send) {
+            send(fd, request, request_len, 0);
+            next_send = now + rto;
+            rto *= 2;
+        }
+        struct pollfd pfd = {.fd = fd, .events = POLLIN, .revents = 0};
+        long long wake = next_send < deadline ? next_send : deadline;
+        if (poll(&pfd, 1, (int) (wake - now)) <= 0) {
+            continue;
+        }
+
+        unsigned char buf[1100];
+        ssize_t received = recv(fd, buf, sizeof(buf), 0);
+        if (received < 0 && errno == ECONNREFUSED) {
+            break; // Nothing listens on the gateway
+        }
+        if (received <= 0) {
+            continue;
+        }
+        if (pcp) {
+            if (gateway_pcp_parse(buf, (size_t) received, nonce, out, out_size) == 0) {
+                // The mapping was only a means to learn the address
+                gateway_pcp_build_map(request, &local.sin_addr, ntohs(local.sin_port), 0, nonce);
+                send(fd, request, request_len, 0);
+                result = 0;
+            }
+        } else {
+            int parsed = gateway_natpmp_parse(buf, (size_t) received, out, out_size);
+            if (parsed == PCP_UNSUPP_VERSION) {
+                random_nonce(nonce);
+                request_len =
+                    gateway_pcp_build_map(request, &local.sin_addr, ntohs(local.sin_port), GATEWAY_PCP_LIFETIME, nonce);
+                pcp = true;
+                rto = GATEWAY_NATPMP_RTO_MS;
+                next_send = now;
+            }
+            result = parsed == 0 ? 0 : -1;
+        }
+    }
+    close(fd);
+    return result;
+}
+
+// Take the plain HTTP LOCATION of an SSDP response
+int gateway_ssdp_location(const char *response, size_t len, char *location, size_t location_size)
+{
+    if (len < 12 || strncmp(response, "HTTP/1.1 200", 12) != 0) {
+        return -1;
+    }
+    const char *end = response + len;
+    const char *line = response;
+    while (line < end) {
+        const char *line_end = memchr(line, '\n', (size_t) (end - line));
+        if (!line_end) {
+            line_end = end;
+        }
+        if ((size_t) (line_end - line) > 9 && strncasecmp(line, "LOCATION:", 9) == 0) {
+            return copy_trimmed(line + 9, line_end, location, location_size) == 0 &&
+                           strncasecmp(location, "http://", 7) == 0
+                       ? 0
+                       : -1;
+        }
+        line = line_end + 1;
+    }
+    return -1;
+}
+
+// Send an M-SEARCH for Internet gateway devices and take the description
+// URL of the first one answering. Returns 0, or -1.
+static int ssdp_search(const struct sockaddr_in *target, long long deadline, char *location, size_t location_size)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    static const char search[] = "M-SEARCH * HTTP/1.1\r\n"
+                                 "HOST: " GATEWAY_SSDP_ADDR ":1900\r\n"
+                                 "MAN: \"ssdp:discover\"\r\n"
+                                 "MX: 1\r\n"
+                                 "ST: urn:schemas-upnp-org:device:InternetGatewayDevice:1\r\n"
+                                 "\r\n";
+    long long end = now_ms() + GATEWAY_SSDP_WAIT_MS;
+    if (end > deadline) {
+        end = deadline;
+    }
+
+    // Multicast is unacknowledged: a second search halfway covers one lost datagram
+    long long resend = now_ms() + GATEWAY_SSDP_WAIT_MS / 2;
+    int sends = 0;
+    int result = -1;
+    while (result != 0) {
+        long long now = now_ms();
+        if (now >= end) {
+            break;
+        }
+        if (sends == 0 || (sends == 1 && now >= resend)) {
+            sendto(fd, search, sizeof(search) - 1, 0, (const struct sockaddr *) target, sizeof(*target));
+            sends++;
+        }
+        struct pollfd pfd = {.fd = fd, .events = POLLIN, .revents = 0};
+        long long wake = sends == 1 && resend < end ? resend : end;
+        if (poll(&pfd, 1, wake > now ? (int) (wake - now) : 0) <= 0) {
+            continue;
+        }
+        char buf[1500];
+        ssize_t received = recv(fd, buf, sizeof(buf), 0);
+        if (received > 0 && gateway_ssdp_location(buf, (size_t) received, location, location_size) == 0) {
+            result = 0;
+        }
+    }
+    close(fd);
+    return result;
+}
+
+// Resolve a control URL against the URL base of the description
+static int resolve_url(const char *base, const char *url, char *out, size_t out_size)
+{
+    if (strncasecmp(url, "http://", 7) == 0) {
+        return (size_t) snprintf(out, out_size, "%s", url) < out_size ? 0 : -1;
+    }
+    const char *authority = strstr(base, "://");
+    if (!authority) {
+        return -1;
+    }
+    const char *path = strchr(authority + 3, '/');
+    int origin_len = path ? (int) (path - base) : (int) strlen(base);
+    int written = snprintf(out, out_size, "%.*s%s%s", origin_len, base, url[0] == '/' ? "" : "/", url);
+    return written > 0 && (size_t) written < out_size ? 0 : -1;
+}
+
+// Find the WAN connection service of a device description
+int gateway_upnp_find_service(const char *xml,
+                              const char *location,
+                              char *control_url,
+                              size_t control_url_size,
+                              char *service,
+                              size_t service_size)
+{
+    // Devices with both list the IP connection first; PPP sessions expose the other
+    static const char *const wanted[] = {"urn:schemas-upnp-org:service:WANIPConnection:",
+                                         "urn:schemas-upnp-org:service:WANPPPConnection:"};
+    char base[512];
+    if (!element_text(xml, "URLBase", base, sizeof(base))) {
+        snprintf(base, sizeof(base), "%s", location);
+    }
+    for (size_t i = 0; i < sizeof(wanted) / sizeof(wanted[0]); i++) {
+        char type[128];
+        const char *pos = xml;
+        while ((pos = element_text(pos, "serviceType", type, sizeof(type)))) {
+            if (strncmp(type, wanted[i], strlen(wanted[i])) != 0) {
+                continue;
+            }
+            // The control URL must belong to the same <service>
+            char control[512];
+            const char *service_end = strstr(pos, "</service>");
+            const char *control_start = strstr(pos, "<controlURL>");
+            if (!control_start || (service_end && control_start > service_end) ||
+                !element_text(control_start, "controlURL", control, sizeof(control)) ||
+                (size_t) snprintf(service, service_size, "%s", type) >= service_size) {
+                continue;
+            }
+            return resolve_url(base, control, control_url, control_url_size);
+        }
+    }
+    return -1;
+}
+
+// Take NewExternalIPAddress from a GetExternalIPAddress response
+int gateway_upnp_parse_address(const char *xml, char *out, size_t out_size)
+{
+    char text[64];
+    struct in_addr address;
+    if (!element_text(xml, "NewExternalIPAddress", text, sizeof(text)) || inet_pton(AF_INET, text, &address) != 1 ||
+        address.s_addr == 0) {
+        return -1;
+    }
+    return inet_ntop(AF_INET, &address, out, (socklen_t) out_size) ? 0 : -1;
+}
+
+static void upnp_done(http_async_t *handle, int result, void *user_data)
+{
+    (void) handle;
+    *(int *) user_data = result;
+}
+
+// One HTTP exchange with the device, on its own loop with a LAN-sized timeout.
+// Returns the body (caller frees), or NULL on failure or a non-2xx status.
+static char *upnp_request(const char *url,
+                          http_method_t method,
+                          const char *body,
+                          struct http_header *headers,
+                          long long deadline)
+{
+    long long remaining = deadline - now_ms();
+    int timeout = remaining < GATEWAY_UPNP_TIMEOUT_MS ? (int) remaining : GATEWAY_UPNP_TIMEOUT_MS;
+    http_loop_t *loop = timeout > 0 ? http_loop_new() : NULL;
+    if (!loop) {
+        return NULL;
+    }
+    struct http_response response;
+    http_response_init(&response);
+    int result = -1;
+    http_async_t *handle = http_async_submit(loop, url, method, body, headers, &response, upnp_done, &result);
+    if (handle) {
+        http_async_set_timeout(handle, timeout);
+        http_loop_run(loop, timeout);
+    }
+    http_loop_free(loop);
+
+    char *data = NULL;
+    if (result == 0 && response.success && response.data) {
+        data = malloc(response.size + 1);
+        if (data) {
+            memcpy(data, response.data, response.size);
+            data[response.size] = '\0';
+        }
+    }
+    http_response_free(&response);
+    return data;
+}
+
+// Call GetExternalIPAddress on a WAN connection service. Returns 0, or -1.
+static int upnp_get_address(const char *control_url,
+                            const char *service,
+                            long long deadline,
+                            char *out,
+                            size_t out_size)
+{
+    char body[768];
+    char action[192];
+    snprintf(body,
+             sizeof(body),
+             "<?xml version=\"1.0\"?>\r\n"
+             "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+             "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+             "<s:Body><u:GetExternalIPAddress xmlns:u=\"%s\"></u:GetExternalIPAddress></s:Body>"
+             "</s:Envelope>\r\n",
+             service);
+    snprintf(action, sizeof(action), "\"%s#GetExternalIPAddress\"", service);
+    struct http_header *headers = http_header_add(NULL, "Content-Type", "text/xml; charset=\"utf-8\"");
+    headers = http_header_add(headers, "SOAPAction", action);
+
+    char *xml = headers ? upnp_request(control_url, HTTP_POST, body, headers, deadline) : NULL;
+    int result = xml ? gateway_upnp_parse_address(xml, out, out_size) : -1;
+    free(xml);
+    http_headers_free(headers);
+    return result;
+}
+
+// Discover the gateway device, find its WAN connection service and ask it.
+// The service found is stored in entry. Returns 0, or -1.
+static int upnp_discover(const struct gateway_options *options,
+                         struct gateway_entry *entry,
+                         long long deadline,
+                         char *out,
+                         size_t out_size)
+{
+    char location[512];
+    if (ssdp_search(&options->ssdp, deadline, location, sizeof(location)) != 0) {
+        return -1;
+    }
+    char *xml = upnp_request(location, HTTP_GET, NULL, NULL, deadline);
+    char control_url[sizeof(entry->control_url)];
+    char service[sizeof(entry->service)];
+    int result = -1;
+    if (xml &&
+        gateway_upnp_find_service(xml, location, control_url, sizeof(control_url), service, sizeof(service)) == 0) {
+        result = upnp_get_address(control_url, service, deadline, out, out_size);
+        if (result == 0) {
+            memcpy(entry->control_url, control_url, sizeof(control_url));
+            memcpy(entry->service, service, sizeof(service));
+        }
+    }
+    free(xml);
+    return result;
+}
+
+// Names of the support states in the state file
+static const char *support_name(gateway_support_t support)
+{
+    return support == GATEWAY_YES ? "yes" : support == GATEWAY_NO ? "no" : "unknown";
+}
+
+static gateway_support_t support_value(const char *name)
+{
+    return strcmp(name, "yes") == 0 ? GATEWAY_YES : strcmp(name, "no") == 0 ? GATEWAY_NO : GATEWAY_UNKNOWN;
+}
+
+// Load the state file on first use
+static void cache_ready(void)
+{
+    if (cache_loaded || !cache_path) {
+        return;
+    }
+    cache_loaded = true;
+    FILE *file = fopen(cache_path, "r");
+    if (!file) {
+        return;
+    }
+    char line[1024];
+    while (cache_count < GATEWAY_CACHE_SIZE && fgets(line, sizeof(line), file)) {
+        struct gateway_entry *entry = &cache[cache_count];
+        char natpmp[16];
+        char upnp[16];
+        long long natpmp_checked = 0;
+        long long upnp_checked = 0;
+        if (line[0] == '#' || sscanf(line,
+                                     "%15s %15s %lld %15s %lld %511s %127s",
+                                     entry->address,
+                                     natpmp,
+                                     &natpmp_checked,
+                                     upnp,
+                                     &upnp_checked,
+                                     entry->control_url,
+                                     entry->service) != 7) {
+            continue;
+        }
+        entry->natpmp = support_value(natpmp);
+        entry->upnp = support_value(upnp);
+        entry->natpmp_checked = (time_t) natpmp_checked;
+        entry->upnp_checked = (time_t) upnp_checked;
+        if (entry->upnp != GATEWAY_YES) {
+            entry->control_url[0] = '\0';
+            entry->service[0] = '\0';
+        }
+        cache_count++;
+    }
+    fclose(file);
+}
+
+// Write the state file if anything changed
+static void cache_save(void)
+{
+    if (!cache_dirty || !cache_path) {
+        return;
+    }
+
+    // Several short-lived tools may save at once: write a private temp file, then rename
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", cache_path, (long) getpid());
+    FILE *file = fopen(tmp_path, "w");
+    if (!file) {
+        return;
+    }
+    fprintf(file, "# Gateways: address natpmp checked upnp checked control_url service\n");
+    for (int i = 0; i < cache_count; i++) {
+        const struct gateway_entry *entry = &cache[i];
+        fprintf(file,
+                "%s %s %lld %s %lld %s %s\n",
+                entry->address,
+                support_name(entry->natpmp),
+                (long long) entry->natpmp_checked,
+                support_name(entry->upnp),
+                (long long) entry->upnp_checked,
+                entry->control_url[0] ? entry->control_url : "-",
+                entry->service[0] ? entry->service : "-");
+    }
+    if (fclose(file) != 0 || rename(tmp_path, cache_path) != 0) {
+        unlink(tmp_path);
+        return;
+    }
+    cache_dirty = false;
+}
+
+// Cached entry of a gateway
+const struct gateway_entry *gateway_cache_get(const char *address)
+{
+    cache_ready();
+    for (int i = 0; i < cache_count; i++) {
+        if (strcmp(cache[i].address, address) == 0) {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+// Entry of a gateway, created (in place of the least recently checked one when full) if new
+static struct gateway_entry *cache_entry(const char *address)
+{
+    struct gateway_entry *entry = (struct gateway_entry *) gateway_cache_get(address);
+    if (entry) {
+        return entry;
+    }
+    if (cache_count < GATEWAY_CACHE_SIZE) {
+        entry = &cache[cache_count++];
+    } else {
+        entry = &cache[0];
+        for (int i = 1; i < cache_count; i++) {
+            time_t checked = cache[i].natpmp_checked > cache[i].upnp_checked ? cache[i].natpmp_checked
+                                                                              : cache[i].upnp_checked;
+            time_t oldest = entry->natpmp_checked > entry->upnp_checked ? entry->natpmp_checked : entry->upnp_checked;
+            if (checked < oldest) {
+                entry = &cache[i];
+            }
+        }
+    }
+    memset(entry, 0, sizeof(*entry));
+    snprintf(entry->address, sizeof(entry->address), "%s", address);
+    cache_dirty = true;
+    return entry;
+}
+
+// Record whether a protocol answered
+static void cache_record(gateway_support_t *support, time_t *checked, bool answered, time_t now)
+{
+    gateway_support_t value = answered ? GATEWAY_YES : GATEWAY_NO;
+    if (*support != value || value == GATEWAY_NO) {
+        cache_dirty = true;
+    }
+    *support = value;
+    *checked = now;
+}
+
+// Whether a protocol is worth asking: not known to be ignored, or not lately
+static bool worth_asking(gateway_support_t support, time_t checked, time_t now)
+{
+    return support != GATEWAY_NO || now - checked >= GATEWAY_RECHECK_S;
+}
+
+// Ask the gateway for its external address
+int gateway_query(const struct gateway_options *options, int timeout_ms, char *out, size_t out_size)
+{
+    char address[INET_ADDRSTRLEN];
+    if (!inet_ntop(AF_INET, &options->natpmp.sin_addr, address, sizeof(address))) {
+        return -1;
+    }
+    struct gateway_entry *entry = cache_entry(address);
+    long long deadline = now_ms() + timeout_ms;
+    time_t now = time(NULL);
+    int result = -1;
+
+    // NAT-PMP gets its own second unless it is the only protocol left
+    if (worth_asking(entry->natpmp, entry->natpmp_checked, now)) {
+        bool upnp_left = worth_asking(entry->upnp, entry->upnp_checked, now);
+        long long natpmp_deadline = now_ms() + GATEWAY_NATPMP_WAIT_MS;
+        if (!upnp_left || natpmp_deadline > deadline) {
+            natpmp_deadline = deadline;
+        }
+        result = natpmp_query(&options->natpmp, natpmp_deadline, out, out_size);
+        cache_record(&entry->natpmp, &entry->natpmp_checked, result == 0, now);
+    }
+
+    // A known control URL saves the discovery; when it stops working the
+    // device may have moved it, so discover again
+    if (result != 0 && entry->upnp == GATEWAY_YES) {
+        result = upnp_get_address(entry->control_url, entry->service, deadline, out, out_size);
+    }
+    if (result != 0 && worth_asking(entry->upnp, entry->upnp_checked, now)) {
+        char previous[sizeof(entry->control_url)];
+        memcpy(previous, entry->control_url, sizeof(previous));
+        result = upnp_discover(options, entry, deadline, out, out_size);
+        if (result != 0) {
+            entry->control_url[0] = '\0';
+            entry->service[0] = '\0';
+        }
+        cache_dirty = cache_dirty || strcmp(previous, entry->control_url) != 0;
+        cache_record(&entry->upnp, &entry->upnp_checked, result == 0, now);
+    }
+
+    cache_save();
+    return result;
+}
+
+// Keep the discovered gateways in a state file
+void gateway_set_cache_file(const char *path)
+{
+    free(cache_path);
+    cache_path = path ? strdup(path) : NULL;
+    cache_loaded = false;
+    cache_count = 0;
+    cache_dirty = false;
+}
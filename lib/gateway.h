@@ -0,0 +1,136 @@
+#ifndef GATEWAY_H
+#define GATEWAY_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// NAT-PMP (RFC 6886) and PCP (RFC 6887) server port on the gateway
+#define GATEWAY_NATPMP_PORT 5351
+
+// Packet formats
+#define NATPMP_VERSION 0
+#define NATPMP_OP_EXTERNAL_ADDRESS 0
+#define NATPMP_RESPONSE_SIZE 12
+#define PCP_VERSION 2
+#define PCP_OP_MAP 1
+#define PCP_MAP_SIZE 60 // Common header and MAP opcode data
+#define PCP_NONCE_SIZE 12
+#define PCP_UNSUPP_VERSION 1
+
+// Retransmission (RFC 6886 section 3.1): the wait doubles from 250 ms. The
+// gateway is on the LAN, so it gets a second to answer before UPnP is tried.
+#define GATEWAY_NATPMP_RTO_MS 250
+#define GATEWAY_NATPMP_WAIT_MS 1000
+
+// A PCP server only reports the external address of a mapping: one that
+// lives this long is requested for the query socket, then deleted
+#define GATEWAY_PCP_LIFETIME 60
+
+// SSDP (UPnP discovery): multicast group and how long devices get to answer
+#define GATEWAY_SSDP_ADDR "239.255.255.250"
+#define GATEWAY_SSDP_PORT 1900
+#define GATEWAY_SSDP_WAIT_MS 1000
+
+// Time allowed for each HTTP exchange with a UPnP device
+#define GATEWAY_UPNP_TIMEOUT_MS 2000
+
+// Default state file of the discovered gateways
+#define GATEWAY_CACHE_FILE "gateway.cache"
+
+// Gateways that answered neither protocol are asked again after this long (seconds)
+#define GATEWAY_RECHECK_S 86400
+
+// Most gateways remembered (one per network the host moves between)
+#define GATEWAY_CACHE_SIZE 4
+
+// How a gateway answered
+typedef enum {
+    GATEWAY_UNKNOWN, // Not asked yet
+    GATEWAY_YES,     // Answered
+    GATEWAY_NO,      // Did not answer when last asked
+} gateway_support_t;
+
+// What is known of one gateway, keyed by its address
+struct gateway_entry {
+    char address[INET_ADDRSTRLEN];
+    gateway_support_t natpmp; // NAT-PMP or PCP
+    gateway_support_t upnp;
+    time_t natpmp_checked; // When each protocol was last asked
+    time_t upnp_checked;
+    char control_url[512]; // WANIPConnection or WANPPPConnection control URL, when upnp is GATEWAY_YES
+    char service[128];     // Its service type
+};
+
+// Where a gateway query is sent
+struct gateway_options {
+    struct sockaddr_in natpmp; // NAT-PMP/PCP server
+    struct sockaddr_in ssdp;   // M-SEARCH destination
+};
+
+// Whether a public IP source names the gateway ("gateway:" or "gateway:address")
+bool gateway_is_uri(const char *uri);
+
+// Fill options from a gateway URI: the address given, or else the default
+// gateway from the routing table, and the SSDP multicast group.
+// Returns 0, or -1 if the URI is malformed or there is no default route.
+int gateway_options_init(struct gateway_options *options, const char *uri);
+
+// Find the IPv4 default gateway in /proc/net/route. Returns 0, or -1.
+int gateway_default_route(struct in_addr *gateway);
+
+// Decode a NAT-PMP external address response into text.
+// Returns 0, PCP_UNSUPP_VERSION if the server wants another protocol
+// version, or -1 if malformed or an error.
+int gateway_natpmp_parse(const unsigned char *buf, size_t len, char *out, size_t out_size);
+
+// Encode a PCP MAP request for a UDP port of client (lifetime 0 deletes the
+// mapping). Returns the packet length.
+size_t gateway_pcp_build_map(unsigned char buf[PCP_MAP_SIZE],
+                             const struct in_addr *client,
+                             uint16_t port,
+                             uint32_t lifetime,
+                             const unsigned char nonce[PCP_NONCE_SIZE]);
+
+// Decode the response to a PCP MAP request with this nonce into the
+// assigned external address. Returns 0, or -1 if malformed, unrelated or an
+// error.
+int gateway_pcp_parse(const unsigned char *buf,
+                      size_t len,
+                      const unsigned char nonce[PCP_NONCE_SIZE],
+                      char *out,
+                      size_t out_size);
+
+// Take the plain HTTP LOCATION of an SSDP response. Returns 0, or -1.
+int gateway_ssdp_location(const char *response, size_t len, char *location, size_t location_size);
+
+// Find the WANIPConnection (or WANPPPConnection) service in a device
+// description fetched from location, and write its absolute control URL and
+// service type. Returns 0, or -1 if the device has neither.
+int gateway_upnp_find_service(const char *xml,
+                              const char *location,
+                              char *control_url,
+                              size_t control_url_size,
+                              char *service,
+                              size_t service_size);
+
+// Take NewExternalIPAddress from a GetExternalIPAddress response. Returns 0, or -1.
+int gateway_upnp_parse_address(const char *xml, char *out, size_t out_size);
+
+// Ask the gateway for its external IPv4 address: over NAT-PMP (PCP when the
+// gateway speaks only that), then UPnP IGD. What the gateway supports and
+// where its UPnP control URL is are cached, so later queries skip a protocol
+// it ignored and the discovery. Returns 0, or -1 if neither answered within
+// timeout_ms.
+int gateway_query(const struct gateway_options *options, int timeout_ms, char *out, size_t out_size);
+
+// Keep the discovered gateways in a state file, loaded on first use and
+// written when something changed. Pass NULL to keep them in memory only.
+void gateway_set_cache_file(const char *path);
+
+// Cached entry of a gateway, NULL if unknown
+const struct gateway_entry *gateway_cache_get(const char *address);
+
+#endif // GATEWAY_H
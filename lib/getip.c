@@ -36,24 +36,37 @@ static char *extract_ip_from_json(const char *json_text)
     return ip_address;
 }
 
+// GET of an entry's A record, compiled on first use
+static const http_template_t *record_query(const cloudflare_config_t *config, cloudflare_entry_t *entry)
+{
+    if (!entry->query) {
+        char api_url[1024];
+        build_cloudflare_dns_url(api_url, sizeof(api_url), entry->zone_id, NULL, entry->domain_name, "A");
+        struct http_header *headers = cloudflare_api_headers(config);
+        entry->query = http_template_new(HTTP_GET, api_url, headers);
+        http_headers_free(headers);
+    }
+    return entry->query;
+}
+
 // Get IP from Cloudflare DNS
 char *get_cloudflare_ip(const char *config_file, const char *token_file, const char *domain_name)
 {
-    cloudflare_config_t *config = load_cloudflare_config(config_file, token_file);
+    cloudflare_config_t *config = cloudflare_config_get(config_file, token_file);
     if (!config) {
         return NULL;
     }
 
     // Determine which entry to use
-    const cloudflare_entry_t *entry = NULL;
+    cloudflare_entry_t *entry = NULL;
     if (domain_name) {
         entry = find_entry_by_domain(config, domain_name);
     } else {
         entry = get_entry_by_index(config, 0);
     }
 
-    if (!entry) {
-        free_cloudflare_config(config);
+    const http_template_t *query = entry ? record_query(config, entry) : NULL;
+    if (!query) {
         return NULL;
     }
 
@@ -62,25 +75,63 @@ char *get_cloudflare_ip(const char *config_file, const char *token_file, const c
 
     http_response_init(&response);
 
-    // Build headers
-    struct http_header *headers = NULL;
-    char auth_header[512];
-    snprintf(auth_header, sizeof(auth_header), "Bearer %s", config->cloudflare_token);
-    headers = http_header_add(headers, "Authorization", auth_header);
-    headers = http_header_add(headers, "Content-Type", "application/json");
-
-    char api_url[1024];
-    build_cloudflare_dns_url(api_url, sizeof(api_url), entry->zone_id, NULL, entry->domain_name, "A");
-
-    // Keep HTTPS for Cloudflare API
-
-    int http_result = http_request(api_url, HTTP_GET, NULL, headers, &response);
+    int http_result = http_request_template(query, NULL, 0, &response);
     if (http_result == 0 && response.success && response.data) {
         result = extract_ip_from_json(response.data);
     }
 
-    http_headers_free(headers);
     http_response_free(&response);
-    free_cloudflare_config(config);
     return result;
 }
+
+// Get the IPs of several domains with one pipelined batch
+int get_cloudflare_ips(const char *config_file, const char *token_file, char **domain_names, int count, char **ips)
+{
+    for (int i = 0; i < count; i++) {
+        ips[i] = NULL;
+    }
+
+    cloudflare_config_t *config = cloudflare_config_get(config_file, token_file);
+    if (!config) {
+        return 0;
+    }
+
+    struct http_batch_request *batch = calloc((size_t) count, sizeof(struct http_batch_request));
+    int *domain_index = calloc((size_t) count, sizeof(int));
+    if (!batch || !domain_index) {
+        free(batch);
+        free(domain_index);
+        return 0;
+    }
+
+    // One compiled record query per configured domain
+    int batch_count = 0;
+    for (int i = 0; i < count; i++) {
+        cloudflare_entry_t *entry = find_entry_by_domain(config, domain_names[i]);
+        const http_template_t *query = entry ? record_query(config, entry) : NULL;
+        if (!query) {
+            continue;
+        }
+        batch[batch_count].compiled = query;
+        domain_index[batch_count] = i;
+        batch_count++;
+    }
+
+    http_request_batch(batch, batch_count, NULL, HTTP_PIPELINE_DEPTH);
+
+    int found = 0;
+    for (int i = 0; i < batch_count; i++) {
+        struct http_response *response = &batch[i].response;
+        if (batch[i].result == 0 && response->success && response->data) {
+            ips[domain_index[i]] = extract_ip_from_json(response->data);
+            if (ips[domain_index[i]]) {
+                found++;
+            }
+        }
+        http_response_free(response);
+    }
+
+    free(batch);
+    free(domain_index);
+    return found;
+}
@@ -4,4 +4,9 @@
 // Function to get IP from Cloudflare DNS
 char *get_cloudflare_ip(const char *config_file, const char *token_file, const char *domain_name);
 
+// Get the IPs of several domains, reading their records with one pipelined
+// batch of requests. ips[i] receives the IP of domain_names[i] (caller frees)
+// or NULL on failure. Returns the number of domains whose IP was found.
+int get_cloudflare_ips(const char *config_file, const char *token_file, char **domain_names, int count, char **ips);
+
 #endif // GETIP_H
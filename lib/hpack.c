@@ -0,0 +1,644 @@
+#define _POSIX_C_SOURCE 200809L
+#include "hpack.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Entries of the static table (RFC 7541 Appendix A)
+#define HPACK_STATIC_COUNT 61
+
+// Overhead added to each dynamic table entry
+#define HPACK_ENTRY_OVERHEAD 32
+
+// authorization and cookie values shorter than this are never indexed
+#define HPACK_SECRET_MIN_INDEX 20
+
+// Static table, index 1 is the first entry
+static const char *const static_table[HPACK_STATIC_COUNT][2] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// Huffman code for each symbol (RFC 7541 Appendix B), EOS is symbol 256
+static const uint32_t huffman_codes[257] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff,
+};
+
+// Code length in bits for each symbol
+static const uint8_t huffman_lengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+// Huffman decoding tree built from the code table on first use. Children
+// are internal node indexes (> 0) or leaves stored as -(symbol + 1).
+static int16_t huffman_tree[256][2];
+static bool huffman_tree_built = false;
+
+// Build the decoding tree
+static void build_huffman_tree(void)
+{
+    int nodes = 1;
+    memset(huffman_tree, 0, sizeof(huffman_tree));
+    for (int symbol = 0; symbol < 257; symbol++) {
+        int node = 0;
+        for (int bit = huffman_lengths[symbol] - 1; bit >= 0; bit--) {
+            int branch = (int) ((huffman_codes[symbol] >> bit) & 1);
+            if (bit == 0) {
+                huffman_tree[node][branch] = (int16_t) -(symbol + 1);
+            } else {
+                if (huffman_tree[node][branch] == 0) {
+                    huffman_tree[node][branch] = (int16_t) nodes++;
+                }
+                node = huffman_tree[node][branch];
+            }
+        }
+    }
+    huffman_tree_built = true;
+}
+
+// Make room for len more bytes in an output buffer
+static int buffer_reserve(struct hpack_buffer *out, size_t len)
+{
+    if (out->len + len <= out->cap) {
+        return 0;
+    }
+    size_t cap = out->cap ? out->cap : 256;
+    while (cap < out->len + len) {
+        cap *= 2;
+    }
+    unsigned char *data = realloc(out->data, cap);
+    if (!data) {
+        return -1;
+    }
+    out->data = data;
+    out->cap = cap;
+    return 0;
+}
+
+// Free an output buffer
+void hpack_buffer_free(struct hpack_buffer *buffer)
+{
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->len = 0;
+    buffer->cap = 0;
+}
+
+// Initialize a dynamic table
+void hpack_table_init(struct hpack_table *table, size_t max_size)
+{
+    memset(table, 0, sizeof(*table));
+    table->max_size = max_size;
+    table->settings_size = max_size;
+}
+
+// Free all entries of a dynamic table
+void hpack_table_free(struct hpack_table *table)
+{
+    for (size_t i = 0; i < table->count; i++) {
+        struct hpack_entry *entry = &table->entries[(table->first + i) % table->capacity];
+        free(entry->name);
+        free(entry->value);
+    }
+    free(table->entries);
+    table->entries = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    table->size = 0;
+}
+
+// Dynamic table entry by position, 0 being the newest
+static struct hpack_entry *table_get(const struct hpack_table *table, size_t position)
+{
+    return &table->entries[(table->first + position) % table->capacity];
+}
+
+// Evict the oldest entries until size fits in limit
+static void table_evict(struct hpack_table *table, size_t limit)
+{
+    while (table->count > 0 && table->size > limit) {
+        struct hpack_entry *oldest = table_get(table, table->count - 1);
+        table->size -= oldest->size;
+        free(oldest->name);
+        free(oldest->value);
+        table->count--;
+    }
+}
+
+// Add an entry at the front of the dynamic table, taking ownership of the strings
+static int table_add(struct hpack_table *table, char *name, char *value)
+{
+    size_t size = strlen(name) + strlen(value) + HPACK_ENTRY_OVERHEAD;
+    if (size > table->max_size) {
+        // An entry larger than the table empties it (RFC 7541 section 4.4)
+        table_evict(table, 0);
+        free(name);
+        free(value);
+        return 0;
+    }
+    table_evict(table, table->max_size - size);
+
+    if (table->count == table->capacity) {
+        size_t capacity = table->capacity ? table->capacity * 2 : 16;
+        struct hpack_entry *entries = malloc(capacity * sizeof(struct hpack_entry));
+        if (!entries) {
+            free(name);
+            free(value);
+            return -1;
+        }
+        for (size_t i = 0; i < table->count; i++) {
+            entries[i] = *table_get(table, i);
+        }
+        free(table->entries);
+        table->entries = entries;
+        table->capacity = capacity;
+        table->first = 0;
+    }
+
+    table->first = (table->first + table->capacity - 1) % table->capacity;
+    struct hpack_entry *entry = table_get(table, 0);
+    entry->name = name;
+    entry->value = value;
+    entry->size = size;
+    table->size += size;
+    table->count++;
+    return 0;
+}
+
+// Change the size limit of an encoder table
+void hpack_table_set_max_size(struct hpack_table *table, size_t max_size)
+{
+    if (max_size > HPACK_DEFAULT_TABLE_SIZE) {
+        max_size = HPACK_DEFAULT_TABLE_SIZE; // Never use more than the default
+    }
+    table->settings_size = max_size;
+    if (max_size != table->max_size) {
+        table->max_size = max_size;
+        table_evict(table, max_size);
+        table->size_update = true;
+    }
+}
+
+// Append an integer with an N-bit prefix; first carries the pattern bits
+static int encode_integer(struct hpack_buffer *out, unsigned char first, int prefix_bits, size_t value)
+{
+    if (buffer_reserve(out, 16) != 0) {
+        return -1;
+    }
+    size_t max_prefix = ((size_t) 1 << prefix_bits) - 1;
+    if (value < max_prefix) {
+        out->data[out->len++] = (unsigned char) (first | value);
+        return 0;
+    }
+    out->data[out->len++] = (unsigned char) (first | max_prefix);
+    value -= max_prefix;
+    while (value >= 128) {
+        out->data[out->len++] = (unsigned char) ((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out->data[out->len++] = (unsigned char) value;
+    return 0;
+}
+
+// Length of a string once Huffman-coded, in bytes
+static size_t huffman_length(const char *str, size_t len)
+{
+    size_t bits = 0;
+    for (size_t i = 0; i < len; i++) {
+        bits += huffman_lengths[(unsigned char) str[i]];
+    }
+    return (bits + 7) / 8;
+}
+
+// Append a string literal, Huffman-coded when that is shorter
+static int encode_string(struct hpack_buffer *out, const char *str)
+{
+    size_t len = strlen(str);
+    size_t coded_len = huffman_length(str, len);
+    if (coded_len >= len) {
+        if (encode_integer(out, 0x00, 7, len) != 0 || buffer_reserve(out, len) != 0) {
+            return -1;
+        }
+        memcpy(out->data + out->len, str, len);
+        out->len += len;
+        return 0;
+    }
+
+    if (encode_integer(out, 0x80, 7, coded_len) != 0 || buffer_reserve(out, coded_len) != 0) {
+        return -1;
+    }
+    uint64_t bits = 0;
+    int pending = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char symbol = (unsigned char) str[i];
+        bits = (bits << huffman_lengths[symbol]) | huffman_codes[symbol];
+        pending += huffman_lengths[symbol];
+        while (pending >= 8) {
+            pending -= 8;
+            out->data[out->len++] = (unsigned char) (bits >> pending);
+        }
+    }
+    if (pending > 0) {
+        // Pad with the most significant bits of EOS (all ones)
+        out->data[out->len++] = (unsigned char) ((bits << (8 - pending)) | (0xff >> pending));
+    }
+    return 0;
+}
+
+// Find a field in the static and dynamic tables. Returns the index of an
+// exact match, or 0 and the index of a name match in *name_index.
+static size_t find_field(const struct hpack_table *table, const char *name, const char *value, size_t *name_index)
+{
+    *name_index = 0;
+    for (size_t i = 0; i < HPACK_STATIC_COUNT; i++) {
+        if (strcmp(static_table[i][0], name) == 0) {
+            if (strcmp(static_table[i][1], value) == 0) {
+                return i + 1;
+            }
+            if (*name_index == 0) {
+                *name_index = i + 1;
+            }
+        }
+    }
+    for (size_t i = 0; i < table->count; i++) {
+        const struct hpack_entry *entry = table_get(table, i);
+        if (strcmp(entry->name, name) == 0) {
+            if (strcmp(entry->value, value) == 0) {
+                return HPACK_STATIC_COUNT + i + 1;
+            }
+            if (*name_index == 0) {
+                *name_index = HPACK_STATIC_COUNT + i + 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Append one header field to a block
+int hpack_encode(struct hpack_table *table, struct hpack_buffer *out, const char *name, const char *value)
+{
+    if (table->size_update) {
+        if (encode_integer(out, 0x20, 5, table->max_size) != 0) {
+            return -1;
+        }
+        table->size_update = false;
+    }
+
+    size_t name_index;
+    size_t index = find_field(table, name, value, &name_index);
+    if (index > 0) {
+        return encode_integer(out, 0x80, 7, index);
+    }
+
+    bool secret = (strcmp(name, "authorization") == 0 || strcmp(name, "cookie") == 0) &&
+                  strlen(value) < HPACK_SECRET_MIN_INDEX;
+    if (secret || strcmp(name, ":path") == 0) {
+        // Literal without indexing, or never indexed for secrets
+        if (encode_integer(out, secret ? 0x10 : 0x00, 4, name_index) != 0 ||
+            (name_index == 0 && encode_string(out, name) != 0) || encode_string(out, value) != 0) {
+            return -1;
+        }
+        return 0;
+    }
+
+    // Literal with incremental indexing
+    if (encode_integer(out, 0x40, 6, name_index) != 0 || (name_index == 0 && encode_string(out, name) != 0) ||
+        encode_string(out, value) != 0) {
+        return -1;
+    }
+    char *name_copy = strdup(name);
+    char *value_copy = strdup(value);
+    if (!name_copy || !value_copy) {
+        free(name_copy);
+        free(value_copy);
+        return -1;
+    }
+    return table_add(table, name_copy, value_copy);
+}
+
+// Read an integer with an N-bit prefix. Returns 0 on success.
+static int decode_integer(const unsigned char *block, size_t len, size_t *pos, int prefix_bits, size_t *value)
+{
+    if (*pos >= len) {
+        return -1;
+    }
+    size_t max_prefix = ((size_t) 1 << prefix_bits) - 1;
+    *value = block[(*pos)++] & max_prefix;
+    if (*value < max_prefix) {
+        return 0;
+    }
+    for (int shift = 0; shift <= 28; shift += 7) {
+        if (*pos >= len) {
+            return -1;
+        }
+        unsigned char byte = block[(*pos)++];
+        *value += (size_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return 0;
+        }
+    }
+    return -1; // Too large
+}
+
+// Decode a Huffman-coded string into a new NUL-terminated buffer
+static char *huffman_decode(const unsigned char *data, size_t len)
+{
+    if (!huffman_tree_built) {
+        build_huffman_tree();
+    }
+
+    // Codes are at least 5 bits long, so the output is at most 8/5 of the input
+    char *out = malloc(len * 8 / 5 + 1);
+    if (!out) {
+        return NULL;
+    }
+
+    size_t out_len = 0;
+    int node = 0;
+    int depth = 0;       // Bits consumed since the last symbol
+    bool all_ones = true; // Those bits are all ones (valid padding)
+    for (size_t i = 0; i < len; i++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            int branch = (data[i] >> bit) & 1;
+            int next = huffman_tree[node][branch];
+            depth++;
+            all_ones = all_ones && branch == 1;
+            if (next < 0) {
+                if (next == -(256 + 1)) {
+                    free(out); // EOS must not appear in the string
+                    return NULL;
+                }
+                out[out_len++] = (char) (-next - 1);
+                node = 0;
+                depth = 0;
+                all_ones = true;
+            } else if (next == 0) {
+                free(out);
+                return NULL;
+            } else {
+                node = next;
+            }
+        }
+    }
+
+    // Padding is at most 7 bits of the EOS prefix
+    if (depth > 7 || !all_ones) {
+        free(out);
+        return NULL;
+    }
+    out[out_len] = '\0';
+    return out;
+}
+
+// Read a string literal into a new NUL-terminated buffer
+static char *decode_string(const unsigned char *block, size_t len, size_t *pos)
+{
+    if (*pos >= len) {
+        return NULL;
+    }
+    bool huffman = (block[*pos] & 0x80) != 0;
+    size_t str_len;
+    if (decode_integer(block, len, pos, 7, &str_len) != 0 || str_len > len - *pos) {
+        return NULL;
+    }
+
+    const unsigned char *data = block + *pos;
+    *pos += str_len;
+    if (huffman) {
+        return huffman_decode(data, str_len);
+    }
+
+    char *str = malloc(str_len + 1);
+    if (str) {
+        memcpy(str, data, str_len);
+        str[str_len] = '\0';
+    }
+    return str;
+}
+
+// Look up an index in the static and dynamic tables
+static int lookup_index(const struct hpack_table *table, size_t index, const char **name, const char **value)
+{
+    if (index == 0) {
+        return -1;
+    }
+    if (index <= HPACK_STATIC_COUNT) {
+        *name = static_table[index - 1][0];
+        *value = static_table[index - 1][1];
+        return 0;
+    }
+    if (index - HPACK_STATIC_COUNT > table->count) {
+        return -1;
+    }
+    const struct hpack_entry *entry = table_get(table, index - HPACK_STATIC_COUNT - 1);
+    *name = entry->name;
+    *value = entry->value;
+    return 0;
+}
+
+// Free the strings of decoded fields
+void hpack_fields_free(struct hpack_field *fields, int count)
+{
+    for (int i = 0; i < count; i++) {
+        free(fields[i].name);
+        free(fields[i].value);
+        fields[i].name = NULL;
+        fields[i].value = NULL;
+    }
+}
+
+// Decode a complete header block
+int hpack_decode(struct hpack_table *table,
+                 const unsigned char *block,
+                 size_t len,
+                 struct hpack_field *fields,
+                 int max_fields)
+{
+    int count = 0;
+    size_t pos = 0;
+
+    while (pos < len) {
+        unsigned char first = block[pos];
+        size_t index;
+        char *name = NULL;
+        char *value = NULL;
+
+        if ((first & 0xe0) == 0x20) {
+            // Dynamic table size update
+            if (decode_integer(block, len, &pos, 5, &index) != 0 || index > table->settings_size) {
+                goto error;
+            }
+            table->max_size = index;
+            table_evict(table, index);
+            continue;
+        }
+
+        if (first & 0x80) {
+            // Indexed field
+            const char *static_name;
+            const char *static_value;
+            if (decode_integer(block, len, &pos, 7, &index) != 0 ||
+                lookup_index(table, index, &static_name, &static_value) != 0) {
+                goto error;
+            }
+            name = strdup(static_name);
+            value = strdup(static_value);
+        } else {
+            // Literal, with incremental indexing (01), without (0000) or never indexed (0001)
+            bool indexing = (first & 0xc0) == 0x40;
+            if (decode_integer(block, len, &pos, indexing ? 6 : 4, &index) != 0) {
+                goto error;
+            }
+            if (index > 0) {
+                const char *indexed_name;
+                const char *indexed_value;
+                if (lookup_index(table, index, &indexed_name, &indexed_value) != 0) {
+                    goto error;
+                }
+                name = strdup(indexed_name);
+            } else {
+                name = decode_string(block, len, &pos);
+            }
+            value = name ? decode_string(block, len, &pos) : NULL;
+
+            if (name && value && indexing) {
+                char *name_copy = strdup(name);
+                char *value_copy = strdup(value);
+                // table_add() takes ownership of the copies, even on failure
+                bool added = name_copy && value_copy && table_add(table, name_copy, value_copy) == 0;
+                if (!name_copy || !value_copy) {
+                    free(name_copy);
+                    free(value_copy);
+                }
+                if (!added) {
+                    free(name);
+                    free(value);
+                    goto error;
+                }
+            }
+        }
+
+        if (!name || !value || count >= max_fields) {
+            free(name);
+            free(value);
+            goto error;
+        }
+        fields[count].name = name;
+        fields[count].value = value;
+        count++;
+    }
+
+    return count;
+
+error:
+    hpack_fields_free(fields, count);
+    return -1;
+}
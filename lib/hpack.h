@@ -0,0 +1,75 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Default dynamic table size (SETTINGS_HEADER_TABLE_SIZE)
+#define HPACK_DEFAULT_TABLE_SIZE 4096
+
+// Header field
+struct hpack_field {
+    char *name;
+    char *value;
+};
+
+// Dynamic table entry, newest first
+struct hpack_entry {
+    char *name;
+    char *value;
+    size_t size; // name + value + 32, as defined by RFC 7541
+};
+
+// Dynamic table shared by all header blocks in one direction of a connection
+struct hpack_table {
+    struct hpack_entry *entries; // Ring buffer
+    size_t capacity;
+    size_t first;
+    size_t count;
+    size_t size;          // Sum of entry sizes
+    size_t max_size;      // Current limit
+    size_t settings_size; // Limit allowed by SETTINGS_HEADER_TABLE_SIZE
+    bool size_update;     // Encoder: announce max_size at the start of the next block
+};
+
+// Growable output buffer for encoded header blocks
+struct hpack_buffer {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+};
+
+// Initialize a dynamic table with the given size limit
+void hpack_table_init(struct hpack_table *table, size_t max_size);
+
+// Free all entries of a dynamic table
+void hpack_table_free(struct hpack_table *table);
+
+// Change the size limit of an encoder table after the peer's
+// SETTINGS_HEADER_TABLE_SIZE. The change is announced in the next block.
+void hpack_table_set_max_size(struct hpack_table *table, size_t max_size);
+
+// Append one header field to a block. Static and dynamic table matches are
+// indexed, other fields are added to the dynamic table unless indexing them
+// would not pay off (:path) or would expose a short secret (authorization,
+// cookie). Strings are Huffman-coded when that is shorter.
+// Returns 0 on success, -1 if memory is exhausted.
+int hpack_encode(struct hpack_table *table, struct hpack_buffer *out, const char *name, const char *value);
+
+// Decode a complete header block into fields (strings owned by the caller,
+// free them with hpack_fields_free()).
+// Returns the number of fields, or -1 on a compression error or if more than
+// max_fields fields are present.
+int hpack_decode(struct hpack_table *table,
+                 const unsigned char *block,
+                 size_t len,
+                 struct hpack_field *fields,
+                 int max_fields);
+
+// Free the strings of decoded fields
+void hpack_fields_free(struct hpack_field *fields, int count);
+
+// Free an output buffer
+void hpack_buffer_free(struct hpack_buffer *buffer);
+
+#endif // HPACK_H
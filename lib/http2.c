@@ -0,0 +1,898 @@
+#define _POSIX_C_SOURCE 200809L
+#include "http2.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Frame types (RFC 7540 section 6)
+#define FRAME_DATA 0x0
+#define FRAME_HEADERS 0x1
+#define FRAME_PRIORITY 0x2
+#define FRAME_RST_STREAM 0x3
+#define FRAME_SETTINGS 0x4
+#define FRAME_PUSH_PROMISE 0x5
+#define FRAME_PING 0x6
+#define FRAME_GOAWAY 0x7
+#define FRAME_WINDOW_UPDATE 0x8
+#define FRAME_CONTINUATION 0x9
+
+// Frame flags
+#define FLAG_END_STREAM 0x1
+#define FLAG_ACK 0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED 0x8
+#define FLAG_PRIORITY 0x20
+
+// Settings identifiers
+#define SETTINGS_HEADER_TABLE_SIZE 0x1
+#define SETTINGS_ENABLE_PUSH 0x2
+#define SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define SETTINGS_MAX_FRAME_SIZE 0x5
+
+#define FRAME_HEADER_LEN 9
+#define DEFAULT_WINDOW 65535
+#define MAX_WINDOW 0x7fffffff
+#define MAX_STREAM_ID 0x7fffffffU
+
+#define CONNECTION_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+struct http2_session {
+    struct hpack_table encoder;
+    struct hpack_table decoder;
+
+    // Output not yet written; bytes before out_sent have been written
+    struct hpack_buffer out;
+    size_t out_sent;
+
+    // Input not yet forming a complete frame
+    unsigned char *in;
+    size_t in_len;
+    size_t in_cap;
+
+    struct http2_stream *streams;
+    uint32_t next_stream_id;
+
+    // Peer settings
+    uint32_t peer_max_streams;
+    uint32_t peer_max_frame;
+    int64_t peer_initial_window;
+
+    // Connection flow control
+    int64_t send_window;
+    int64_t recv_window;
+    size_t recv_unacked;
+
+    // Header block split over CONTINUATION frames
+    struct hpack_buffer block;
+    uint32_t block_stream; // 0 when no block is in progress
+    bool block_end_stream;
+
+    bool goaway;  // No new streams (GOAWAY sent or received)
+    bool failed;  // Connection error or connection lost
+};
+
+static void put_u32(unsigned char *p, uint32_t value)
+{
+    p[0] = (unsigned char) (value >> 24);
+    p[1] = (unsigned char) (value >> 16);
+    p[2] = (unsigned char) (value >> 8);
+    p[3] = (unsigned char) value;
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static int out_append(struct hpack_buffer *out, const void *data, size_t len)
+{
+    if (out->len + len > out->cap) {
+        size_t cap = out->cap ? out->cap : 1024;
+        while (cap < out->len + len) {
+            cap *= 2;
+        }
+        unsigned char *grown = realloc(out->data, cap);
+        if (!grown) {
+            return -1;
+        }
+        out->data = grown;
+        out->cap = cap;
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+    return 0;
+}
+
+// Queue one frame
+static int queue_frame(struct http2_session *session,
+                       int type,
+                       int flags,
+                       uint32_t stream_id,
+                       const void *payload,
+                       size_t len)
+{
+    unsigned char header[FRAME_HEADER_LEN];
+    header[0] = (unsigned char) (len >> 16);
+    header[1] = (unsigned char) (len >> 8);
+    header[2] = (unsigned char) len;
+    header[3] = (unsigned char) type;
+    header[4] = (unsigned char) flags;
+    put_u32(header + 5, stream_id & MAX_STREAM_ID);
+    if (out_append(&session->out, header, sizeof(header)) < 0) {
+        return -1;
+    }
+    if (len > 0 && out_append(&session->out, payload, len) < 0) {
+        session->out.len -= sizeof(header);
+        return -1;
+    }
+    return 0;
+}
+
+static void queue_u32_frame(struct http2_session *session, int type, uint32_t stream_id, uint32_t value)
+{
+    unsigned char payload[4];
+    put_u32(payload, value);
+    queue_frame(session, type, 0, stream_id, payload, sizeof(payload));
+}
+
+static void queue_goaway(struct http2_session *session, uint32_t error_code)
+{
+    unsigned char payload[8];
+    put_u32(payload, 0); // No server-initiated streams are ever processed
+    put_u32(payload + 4, error_code);
+    queue_frame(session, FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+    session->goaway = true;
+}
+
+struct http2_session *http2_session_new(void)
+{
+    struct http2_session *session = calloc(1, sizeof(*session));
+    if (!session) {
+        return NULL;
+    }
+    hpack_table_init(&session->encoder, HPACK_DEFAULT_TABLE_SIZE);
+    hpack_table_init(&session->decoder, HPACK_DEFAULT_TABLE_SIZE);
+    session->next_stream_id = 1;
+    session->peer_max_streams = HTTP2_MAX_STREAMS;
+    session->peer_max_frame = HTTP2_MAX_FRAME_SIZE;
+    session->peer_initial_window = DEFAULT_WINDOW;
+    session->send_window = DEFAULT_WINDOW;
+    session->recv_window = HTTP2_WINDOW_SIZE;
+
+    // Preface, SETTINGS without server push and with a larger window, and the
+    // matching connection window
+    unsigned char settings[12];
+    settings[0] = 0;
+    settings[1] = SETTINGS_ENABLE_PUSH;
+    put_u32(settings + 2, 0);
+    settings[6] = 0;
+    settings[7] = SETTINGS_INITIAL_WINDOW_SIZE;
+    put_u32(settings + 8, HTTP2_WINDOW_SIZE);
+    unsigned char increment[4];
+    put_u32(increment, HTTP2_WINDOW_SIZE - DEFAULT_WINDOW);
+
+    if (out_append(&session->out, CONNECTION_PREFACE, strlen(CONNECTION_PREFACE)) < 0 ||
+        queue_frame(session, FRAME_SETTINGS, 0, 0, settings, sizeof(settings)) < 0 ||
+        queue_frame(session, FRAME_WINDOW_UPDATE, 0, 0, increment, sizeof(increment)) < 0) {
+        http2_session_free(session);
+        return NULL;
+    }
+    return session;
+}
+
+void http2_stream_free(struct http2_stream *stream)
+{
+    if (!stream) {
+        return;
+    }
+    hpack_fields_free(stream->headers, stream->header_count);
+    free(stream->body);
+    free(stream->pending);
+    free(stream);
+}
+
+void http2_session_free(struct http2_session *session)
+{
+    if (!session) {
+        return;
+    }
+    while (session->streams) {
+        struct http2_stream *next = session->streams->next;
+        http2_stream_free(session->streams);
+        session->streams = next;
+    }
+    hpack_table_free(&session->encoder);
+    hpack_table_free(&session->decoder);
+    hpack_buffer_free(&session->out);
+    hpack_buffer_free(&session->block);
+    free(session->in);
+    free(session);
+}
+
+static struct http2_stream *find_stream(struct http2_session *session, uint32_t id)
+{
+    for (struct http2_stream *stream = session->streams; stream; stream = stream->next) {
+        if (stream->id == id) {
+            return stream;
+        }
+    }
+    return NULL;
+}
+
+static void stream_fail(struct http2_stream *stream, int error, bool retryable)
+{
+    if (stream->done) {
+        return;
+    }
+    stream->done = true;
+    stream->error = error;
+    stream->retryable = retryable;
+}
+
+// Fail every open stream, retryable unless the server had started answering
+static void fail_all(struct http2_session *session, int error)
+{
+    session->failed = true;
+    session->goaway = true;
+    for (struct http2_stream *stream = session->streams; stream; stream = stream->next) {
+        stream_fail(stream, error, stream->status == 0 && stream->body_len == 0);
+    }
+}
+
+static int connection_error(struct http2_session *session, uint32_t error_code)
+{
+    if (!session->failed) {
+        queue_goaway(session, error_code);
+        fail_all(session, (int) error_code);
+    }
+    return -1;
+}
+
+// Send as much pending request body as the flow-control windows allow
+static void flush_data(struct http2_session *session)
+{
+    for (struct http2_stream *stream = session->streams; stream; stream = stream->next) {
+        while (!stream->done && stream->pending && session->send_window > 0 && stream->send_window > 0) {
+            size_t len = stream->pending_len - stream->pending_sent;
+            if (len > session->peer_max_frame) {
+                len = session->peer_max_frame;
+            }
+            if ((int64_t) len > session->send_window) {
+                len = (size_t) session->send_window;
+            }
+            if ((int64_t) len > stream->send_window) {
+                len = (size_t) stream->send_window;
+            }
+            bool last = stream->pending_sent + len == stream->pending_len;
+            if (queue_frame(session,
+                            FRAME_DATA,
+                            last ? FLAG_END_STREAM : 0,
+                            stream->id,
+                            stream->pending + stream->pending_sent,
+                            len) < 0) {
+                return;
+            }
+            stream->pending_sent += len;
+            stream->bytes_sent += FRAME_HEADER_LEN + len;
+            session->send_window -= (int64_t) len;
+            stream->send_window -= (int64_t) len;
+            if (last) {
+                free(stream->pending);
+                stream->pending = NULL;
+            }
+        }
+    }
+}
+
+// Headers that only apply to one HTTP/1.1 connection (RFC 7540 section 8.1.2.2)
+static bool connection_specific(const char *name)
+{
+    static const char *const names[] = {
+        "host", "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade", "te"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcasecmp(name, names[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int encode_field(struct hpack_table *table, struct hpack_buffer *block, const char *name, const char *value)
+{
+    char lower[128];
+    size_t len = strlen(name);
+    if (len >= sizeof(lower)) {
+        return -1;
+    }
+    for (size_t i = 0; i <= len; i++) {
+        char c = name[i];
+        lower[i] = (c >= 'A' && c <= 'Z') ? (char) (c - 'A' + 'a') : c;
+    }
+    return hpack_encode(table, block, lower, value);
+}
+
+struct http2_stream *http2_submit(struct http2_session *session,
+                                  const char *method,
+                                  const char *scheme,
+                                  const char *authority,
+                                  const char *path,
+                                  const struct hpack_field *fields,
+                                  int field_count,
+                                  const char *body,
+                                  size_t body_len,
+                                  void *user_data)
+{
+    if (!http2_can_submit(session)) {
+        return NULL;
+    }
+
+    struct http2_stream *stream = calloc(1, sizeof(*stream));
+    if (!stream) {
+        return NULL;
+    }
+    if (body && body_len > 0) {
+        stream->pending = malloc(body_len);
+        if (!stream->pending) {
+            free(stream);
+            return NULL;
+        }
+        memcpy(stream->pending, body, body_len);
+        stream->pending_len = body_len;
+    }
+
+    // The encoder table changes as fields are added, so a failure past this
+    // point would desynchronize the connection
+    struct hpack_buffer block = {0};
+    bool failed = hpack_encode(&session->encoder, &block, ":method", method) < 0 ||
+                  hpack_encode(&session->encoder, &block, ":scheme", scheme) < 0 ||
+                  hpack_encode(&session->encoder, &block, ":authority", authority) < 0 ||
+                  hpack_encode(&session->encoder, &block, ":path", path) < 0;
+    for (int i = 0; i < field_count && !failed; i++) {
+        if (!connection_specific(fields[i].name)) {
+            failed = encode_field(&session->encoder, &block, fields[i].name, fields[i].value) < 0;
+        }
+    }
+    if (failed) {
+        hpack_buffer_free(&block);
+        http2_stream_free(stream);
+        connection_error(session, HTTP2_INTERNAL_ERROR);
+        return NULL;
+    }
+
+    stream->id = session->next_stream_id;
+    session->next_stream_id += 2;
+    stream->user_data = user_data;
+    stream->send_window = session->peer_initial_window;
+    stream->recv_window = HTTP2_WINDOW_SIZE;
+
+    // HEADERS, then CONTINUATION frames for blocks larger than one frame
+    size_t offset = 0;
+    do {
+        size_t len = block.len - offset;
+        if (len > session->peer_max_frame) {
+            len = session->peer_max_frame;
+        }
+        int flags = offset + len == block.len ? FLAG_END_HEADERS : 0;
+        int type = FRAME_HEADERS;
+        if (offset == 0) {
+            flags |= stream->pending ? 0 : FLAG_END_STREAM;
+        } else {
+            type = FRAME_CONTINUATION;
+        }
+        queue_frame(session, type, flags, stream->id, block.data + offset, len);
+        stream->bytes_sent += FRAME_HEADER_LEN + len;
+        offset += len;
+    } while (offset < block.len);
+    hpack_buffer_free(&block);
+
+    // Append so streams are flushed and reported in submission order
+    struct http2_stream **tail = &session->streams;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = stream;
+
+    flush_data(session);
+    return stream;
+}
+
+static int body_append(struct http2_stream *stream, const unsigned char *data, size_t len)
+{
+    if (stream->body_len + len + 1 > stream->body_cap) {
+        size_t cap = stream->body_cap ? stream->body_cap : 4096;
+        while (cap < stream->body_len + len + 1) {
+            cap *= 2;
+        }
+        char *grown = realloc(stream->body, cap);
+        if (!grown) {
+            return -1;
+        }
+        stream->body = grown;
+        stream->body_cap = cap;
+    }
+    memcpy(stream->body + stream->body_len, data, len);
+    stream->body_len += len;
+    stream->body[stream->body_len] = '\0';
+    return 0;
+}
+
+// Reopen the receive window of a stream once half of it is used
+static void stream_window_update(struct http2_session *session, struct http2_stream *stream)
+{
+    if (stream->recv_unacked >= HTTP2_WINDOW_SIZE / 2) {
+        queue_u32_frame(session, FRAME_WINDOW_UPDATE, stream->id, (uint32_t) stream->recv_unacked);
+        stream->recv_window += (int64_t) stream->recv_unacked;
+        stream->recv_unacked = 0;
+    }
+}
+
+static int handle_data(struct http2_session *session, int flags, uint32_t id, const unsigned char *payload, size_t len)
+{
+    if (id == 0) {
+        return connection_error(session, HTTP2_PROTOCOL_ERROR);
+    }
+
+    // The whole frame, padding included, counts against flow control
+    size_t frame_len = len;
+    session->recv_window -= (int64_t) frame_len;
+    if (session->recv_window < 0) {
+        return connection_error(session, HTTP2_FLOW_CONTROL_ERROR);
+    }
+    session->recv_unacked += frame_len;
+    if (session->recv_unacked >= HTTP2_WINDOW_SIZE / 2) {
+        queue_u32_frame(session, FRAME_WINDOW_UPDATE, 0, (uint32_t) session->recv_unacked);
+        session->recv_window += (int64_t) session->recv_unacked;
+        session->recv_unacked = 0;
+    }
+
+    size_t pad = 0;
+    if (flags & FLAG_PADDED) {
+        if (len < 1 || payload[0] >= len) {
+            return connection_error(session, HTTP2_PROTOCOL_ERROR);
+        }
+        pad = payload[0];
+        payload++;
+        len--;
+    }
+
+    // Data for a stream already reset or taken is dropped
+    struct http2_stream *stream = find_stream(session, id);
+    if (!stream || stream->done) {
+        return 0;
+    }
+    if (stream->status == 0) {
+        return connection_error(session, HTTP2_PROTOCOL_ERROR);
+    }
+    stream->recv_window -= (int64_t) frame_len;
+    if (stream->recv_window < 0) {
+        return connection_error(session, HTTP2_FLOW_CONTROL_ERROR);
+    }
+    if (body_append(stream, payload, len - pad) < 0) {
+        return connection_error(session, HTTP2_INTERNAL_ERROR);
+    }
+
+    if (flags & FLAG_END_STREAM) {
+        stream->done = true;
+        return 0;
+    }
+    if (stream->consume_body) {
+        // The data itself counts once consumed, the padding right away
+        stream->recv_unacked += frame_len - (len - pad);
+    } else {
+        stream->recv_unacked += frame_len;
+        stream_window_update(session, stream);
+    }
+    return 0;
+}
+
+// Decode a complete header block. The block is always decoded, even for a
+// stream that is gone, to keep the dynamic table in sync.
+static int finish_headers(struct http2_session *session)
+{
+    struct hpack_field fields[HTTP2_MAX_HEADERS];
+    int count = hpack_decode(&session->decoder, session->block.data, session->block.len, fields, HTTP2_MAX_HEADERS);
+    uint32_t id = session->block_stream;
+    bool end_stream = session->block_end_stream;
+    session->block.len = 0;
+    session->block_stream = 0;
+    if (count < 0) {
+        return connection_error(session, HTTP2_COMPRESSION_ERROR);
+    }
+
+    struct http2_stream *stream = find_stream(session, id);
+    if (!stream || stream->done) {
+        hpack_fields_free(fields, count);
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(fields[i].name, ":status") == 0) {
+            status = atoi(fields[i].value);
+        }
+    }
+
+    if (stream->status == 0) {
+        if (status < 100 || status > 999) {
+            hpack_fields_free(fields, count);
+            stream_fail(stream, HTTP2_PROTOCOL_ERROR, false);
+            queue_u32_frame(session, FRAME_RST_STREAM, id, HTTP2_PROTOCOL_ERROR);
+            return 0;
+        }
+        // Informational responses are skipped, the final one follows
+        if (status >= 200) {
+            stream->status = status;
+            for (int i = 0; i < count; i++) {
+                if (fields[i].name[0] != ':') {
+                    stream->headers[stream->header_count++] = fields[i];
+                    fields[i].name = NULL;
+                    fields[i].value = NULL;
+                }
+            }
+        }
+    }
+    // Trailers are dropped
+    hpack_fields_free(fields, count);
+
+    if (end_stream) {
+        if (stream->status == 0) {
+            stream_fail(stream, HTTP2_PROTOCOL_ERROR, false);
+        } else {
+            stream->done = true;
+        }
+    }
+    return 0;
+}
+
+static int append_block(struct http2_session *session, const unsigned char *fragment, size_t len)
+{
+    if (session->block.len + len > HTTP2_MAX_HEADER_BLOCK) {
+        return connection_error(session, HTTP2_PROTOCOL_ERROR);
+    }
+    if (out_append(&session->block, fragment, len) < 0) {
+        return connection_error(session, HTTP2_INTERNAL_ERROR);
+    }
+    return 0;
+}
+
+static int handle_headers(struct http2_session *session,
+                          int flags,
+                          uint32_t id,
+                          const unsigned char *payload,
+                          size_t len)
+{
+    if (id == 0) {
+        return connection_error(session, HTTP2_PROTOCOL_ERROR);
+    }
+    size_t pad = 0;
+    if (flags & FLAG_PADDED) {
+        if (len < 1) {
+            return connection_error(session, HTTP2_PROTOCOL_ERROR);
+        }
+        pad = payload[0];
+        payload++;
+        len--;
+    }
+    if (flags & FLAG_PRIORITY) {
+        if (len < 5) {
+            return connection_error(session, HTTP2_PROTOCOL_ERROR);
+        }
+        payload += 5;
+        len -= 5;
+    }
+    if (pad > len) {
+        return connection_error(session, HTTP2_PROTOCOL_ERROR);
+    }
+
+    session->block.len = 0;
+    session->block_stream = id;
+    session->block_end_stream = (flags & FLAG_END_STREAM) != 0;
+    if (append_block(session, payload, len - pad) < 0) {
+        return -1;
+    }
+    return (flags & FLAG_END_HEADERS) ? finish_headers(session) : 0;
+}
+
+static int handle_settings(struct http2_session *session,
+                           int flags,
+                           uint32_t id,
+                           const unsigned char *payload,
+                           size_t len)
+{
+    if (id != 0 || len % 6 != 0 || ((flags & FLAG_ACK) && len != 0)) {
+        return connection_error(session, HTTP2_FRAME_SIZE_ERROR);
+    }
+    if (flags & FLAG_ACK) {
+        return 0;
+    }
+
+    for (size_t pos = 0; pos < len; pos += 6) {
+        int setting = (payload[pos] << 8) | payload[pos + 1];
+        uint32_t value = get_u32(payload + pos + 2);
+        switch (setting) {
+        case SETTINGS_HEADER_TABLE_SIZE:
+            hpack_table_set_max_size(&session->encoder, value);
+            break;
+        case SETTINGS_MAX_CONCURRENT_STREAMS:
+            session->peer_max_streams = value;
+            break;
+        case SETTINGS_INITIAL_WINDOW_SIZE: {
+            if (value > MAX_WINDOW) {
+                return connection_error(session, HTTP2_FLOW_CONTROL_ERROR);
+            }
+            int64_t delta = (int64_t) value - session->peer_initial_window;
+            session->peer_initial_window = value;
+            for (struct http2_stream *stream = session->streams; stream; stream = stream->next) {
+                stream->send_window += delta;
+            }
+            break;
+        }
+        case SETTINGS_MAX_FRAME_SIZE:
+            if (value < 16384 || value > 16777215) {
+                return connection_error(session, HTTP2_PROTOCOL_ERROR);
+            }
+            session->peer_max_frame = value;
+            break;
+        default:
+            break;
+        }
+    }
+
+    queue_frame(session, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+    flush_data(session);
+    return 0;
+}
+
+static int handle_goaway(struct http2_session *session, const unsigned char *payload, size_t len)
+{
+    if (len < 8) {
+        return connection_error(session, HTTP2_FRAME_SIZE_ERROR);
+    }
+    uint32_t last_id = get_u32(payload) & MAX_STREAM_ID;
+    session->goaway = true;
+
+    // Streams above last_id were never processed and may be sent again
+    for (struct http2_stream *stream = session->streams; stream; stream = stream->next) {
+        if (stream->id > last_id) {
+            stream_fail(stream, HTTP2_REFUSED_STREAM, true);
+        }
+    }
+    return 0;
+}
+
+static int handle_window_update(struct http2_session *session, uint32_t id, const unsigned char *payload, size_t len)
+{
+    if (len != 4) {
+        return connection_error(session, HTTP2_FRAME_SIZE_ERROR);
+    }
+    uint32_t increment = get_u32(payload) & MAX_STREAM_ID;
+    if (id == 0) {
+        if (increment == 0) {
+            return connection_error(session, HTTP2_PROTOCOL_ERROR);
+        }
+        session->send_window += increment;
+        if (session->send_window > MAX_WINDOW) {
+            return connection_error(session, HTTP2_FLOW_CONTROL_ERROR);
+        }
+    } else {
+        struct http2_stream *stream = find_stream(session, id);
+        if (stream && !stream->done) {
+            stream->send_window += increment;
+            if (increment == 0 || stream->send_window > MAX_WINDOW) {
+                stream_fail(stream, HTTP2_FLOW_CONTROL_ERROR, false);
+                queue_u32_frame(session, FRAME_RST_STREAM, id, HTTP2_FLOW_CONTROL_ERROR);
+            }
+        }
+    }
+    flush_data(session);
+    return 0;
+}
+
+static int handle_frame(struct http2_session *session,
+                        int type,
+                        int flags,
+                        uint32_t id,
+                        const unsigned char *payload,
+                        size_t len)
+{
+    // A header block must not be interleaved with other frames
+    if (session->block_stream != 0) {
+        if (type != FRAME_CONTINUATION || id != session->block_stream) {
+            return connection_error(session, HTTP2_PROTOCOL_ERROR);
+        }
+        if (append_block(session, payload, len) < 0) {
+            return -1;
+        }
+        return (flags & FLAG_END_HEADERS) ? finish_headers(session) : 0;
+    }
+
+    switch (type) {
+    case FRAME_DATA:
+        return handle_data(session, flags, id, payload, len);
+    case FRAME_HEADERS:
+        return handle_headers(session, flags, id, payload, len);
+    case FRAME_RST_STREAM: {
+        if (id == 0 || len != 4) {
+            return connection_error(session, HTTP2_PROTOCOL_ERROR);
+        }
+        struct http2_stream *stream = find_stream(session, id);
+        if (stream) {
+            uint32_t code = get_u32(payload);
+            stream_fail(stream, (int) code, code == HTTP2_REFUSED_STREAM);
+        }
+        return 0;
+    }
+    case FRAME_SETTINGS:
+        return handle_settings(session, flags, id, payload, len);
+    case FRAME_PUSH_PROMISE:
+        // Push was disabled in our SETTINGS
+        return connection_error(session, HTTP2_PROTOCOL_ERROR);
+    case FRAME_PING:
+        if (id != 0 || len != 8) {
+            return connection_error(session, HTTP2_FRAME_SIZE_ERROR);
+        }
+        if (!(flags & FLAG_ACK)) {
+            queue_frame(session, FRAME_PING, FLAG_ACK, 0, payload, len);
+        }
+        return 0;
+    case FRAME_GOAWAY:
+        return handle_goaway(session, payload, len);
+    case FRAME_WINDOW_UPDATE:
+        return handle_window_update(session, id, payload, len);
+    case FRAME_CONTINUATION:
+        // Only valid inside a header block
+        return connection_error(session, HTTP2_PROTOCOL_ERROR);
+    default:
+        // PRIORITY and unknown frame types are ignored
+        return 0;
+    }
+}
+
+int http2_feed(struct http2_session *session, const unsigned char *data, size_t len)
+{
+    if (session->failed) {
+        return -1;
+    }
+    if (session->in_len + len > session->in_cap) {
+        size_t cap = session->in_cap ? session->in_cap : HTTP2_MAX_FRAME_SIZE + FRAME_HEADER_LEN;
+        while (cap < session->in_len + len) {
+            cap *= 2;
+        }
+        unsigned char *grown = realloc(session->in, cap);
+        if (!grown) {
+            return connection_error(session, HTTP2_INTERNAL_ERROR);
+        }
+        session->in = grown;
+        session->in_cap = cap;
+    }
+    memcpy(session->in + session->in_len, data, len);
+    session->in_len += len;
+
+    size_t pos = 0;
+    while (session->in_len - pos >= FRAME_HEADER_LEN) {
+        const unsigned char *header = session->in + pos;
+        size_t frame_len = ((size_t) header[0] << 16) | ((size_t) header[1] << 8) | header[2];
+        if (frame_len > HTTP2_MAX_FRAME_SIZE) {
+            return connection_error(session, HTTP2_FRAME_SIZE_ERROR);
+        }
+        if (session->in_len - pos < FRAME_HEADER_LEN + frame_len) {
+            break;
+        }
+        uint32_t id = get_u32(header + 5) & MAX_STREAM_ID;
+        struct http2_stream *stream = id != 0 ? find_stream(session, id) : NULL;
+        if (stream) {
+            stream->bytes_received += FRAME_HEADER_LEN + frame_len;
+        }
+        if (handle_frame(session, header[3], header[4], id, header + FRAME_HEADER_LEN, frame_len) < 0) {
+            return -1;
+        }
+        pos += FRAME_HEADER_LEN + frame_len;
+    }
+
+    memmove(session->in, session->in + pos, session->in_len - pos);
+    session->in_len -= pos;
+    return 0;
+}
+
+void http2_connection_lost(struct http2_session *session)
+{
+    fail_all(session, HTTP2_INTERNAL_ERROR);
+}
+
+size_t http2_pending_output(struct http2_session *session, const unsigned char **data)
+{
+    *data = session->out.data + session->out_sent;
+    return session->out.len - session->out_sent;
+}
+
+void http2_output_sent(struct http2_session *session, size_t len)
+{
+    session->out_sent += len;
+    if (session->out_sent >= session->out.len) {
+        session->out.len = 0;
+        session->out_sent = 0;
+    }
+}
+
+struct http2_stream *http2_take_done(struct http2_session *session)
+{
+    for (struct http2_stream **link = &session->streams; *link; link = &(*link)->next) {
+        struct http2_stream *stream = *link;
+        if (stream->done) {
+            *link = stream->next;
+            stream->next = NULL;
+            return stream;
+        }
+    }
+    return NULL;
+}
+
+void http2_consume(struct http2_session *session, struct http2_stream *stream, size_t len)
+{
+    if (len < stream->body_len) {
+        memmove(stream->body, stream->body + len, stream->body_len - len);
+    }
+    stream->body_len -= len;
+    if (stream->body) {
+        stream->body[stream->body_len] = '\0';
+    }
+    if (!stream->done && !session->failed) {
+        stream->recv_unacked += len;
+        stream_window_update(session, stream);
+    }
+}
+
+void http2_cancel(struct http2_session *session, struct http2_stream *stream)
+{
+    for (struct http2_stream **link = &session->streams; *link; link = &(*link)->next) {
+        if (*link == stream) {
+            *link = stream->next;
+            break;
+        }
+    }
+    if (!stream->done && !session->failed) {
+        queue_u32_frame(session, FRAME_RST_STREAM, stream->id, HTTP2_CANCEL);
+    }
+    http2_stream_free(stream);
+}
+
+void http2_shutdown(struct http2_session *session)
+{
+    if (!session->failed && !session->goaway) {
+        queue_goaway(session, HTTP2_NO_ERROR);
+    }
+}
+
+int http2_active_streams(const struct http2_session *session)
+{
+    int count = 0;
+    for (const struct http2_stream *stream = session->streams; stream; stream = stream->next) {
+        if (!stream->done) {
+            count++;
+        }
+    }
+    return count;
+}
+
+bool http2_is_usable(const struct http2_session *session)
+{
+    return !session->failed && !session->goaway && session->next_stream_id < MAX_STREAM_ID;
+}
+
+bool http2_can_submit(const struct http2_session *session)
+{
+    uint32_t limit = session->peer_max_streams < HTTP2_MAX_STREAMS ? session->peer_max_streams : HTTP2_MAX_STREAMS;
+    return http2_is_usable(session) && (uint32_t) http2_active_streams(session) < limit;
+}
+
+const char *http2_stream_header(const struct http2_stream *stream, const char *name)
+{
+    for (int i = 0; i < stream->header_count; i++) {
+        if (strcmp(stream->headers[i].name, name) == 0) {
+            return stream->headers[i].value;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,133 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include "hpack.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// ALPN protocol list offered when HTTP/2 is enabled (wire format)
+#define HTTP2_ALPN "\x02h2\x08http/1.1"
+#define HTTP2_ALPN_LEN 12
+
+// Local limits
+#define HTTP2_MAX_FRAME_SIZE 16384   // Largest frame accepted (the protocol default)
+#define HTTP2_WINDOW_SIZE 1048576    // Receive window per stream and for the connection
+#define HTTP2_MAX_STREAMS 100        // Concurrent streams when the server sets no lower limit
+#define HTTP2_MAX_HEADERS 64         // Response header fields kept per stream
+#define HTTP2_MAX_HEADER_BLOCK 65536 // Largest header block accepted
+
+// Error codes (RFC 7540 section 7)
+#define HTTP2_NO_ERROR 0x0
+#define HTTP2_PROTOCOL_ERROR 0x1
+#define HTTP2_INTERNAL_ERROR 0x2
+#define HTTP2_FLOW_CONTROL_ERROR 0x3
+#define HTTP2_FRAME_SIZE_ERROR 0x6
+#define HTTP2_REFUSED_STREAM 0x7
+#define HTTP2_CANCEL 0x8
+#define HTTP2_COMPRESSION_ERROR 0x9
+
+// Request stream. Owned by the session until http2_take_done() returns it.
+struct http2_stream {
+    uint32_t id;
+    void *user_data;
+
+    // Response
+    int status; // :status of the final response, 0 until received
+    struct hpack_field headers[HTTP2_MAX_HEADERS];
+    int header_count;
+    char *body; // NUL-terminated once allocated
+    size_t body_len;
+    size_t body_cap;
+    bool done;      // Response complete or stream failed
+    int error;      // HTTP/2 error code when the stream failed, HTTP2_NO_ERROR otherwise
+    bool retryable; // Failed before the server processed the request
+
+    // Frame bytes sent and received on this stream, frame headers included
+    size_t bytes_sent;
+    size_t bytes_received;
+
+    // Request body not yet sent, limited by flow control
+    unsigned char *pending;
+    size_t pending_len;
+    size_t pending_sent;
+    int64_t send_window;
+
+    // Flow control for the response. When consume_body is set the window only
+    // reopens as the caller drains the body with http2_consume().
+    int64_t recv_window;
+    size_t recv_unacked;
+    bool consume_body;
+
+    struct http2_stream *next;
+};
+
+// HTTP/2 client connection state, independent of the transport. Bytes read
+// from the connection go to http2_feed(); bytes to write are taken from
+// http2_pending_output().
+struct http2_session;
+
+// Create a session. The connection preface and SETTINGS are queued for output.
+struct http2_session *http2_session_new(void);
+
+// Free a session and every stream it still owns
+void http2_session_free(struct http2_session *session);
+
+// Open a stream for a request. Header names are sent in lower case and
+// connection-specific headers (Host, Connection, ...) are dropped.
+// Returns the stream, or NULL if no stream can be opened now.
+struct http2_stream *http2_submit(struct http2_session *session,
+                                  const char *method,
+                                  const char *scheme,
+                                  const char *authority,
+                                  const char *path,
+                                  const struct hpack_field *fields,
+                                  int field_count,
+                                  const char *body,
+                                  size_t body_len,
+                                  void *user_data);
+
+// Process bytes received from the server. Returns 0, or -1 on a connection
+// error (a GOAWAY is queued and every open stream fails).
+int http2_feed(struct http2_session *session, const unsigned char *data, size_t len);
+
+// The server closed the connection: every open stream fails
+void http2_connection_lost(struct http2_session *session);
+
+// Bytes waiting to be written, 0 if none
+size_t http2_pending_output(struct http2_session *session, const unsigned char **data);
+
+// Mark len bytes of the pending output as written
+void http2_output_sent(struct http2_session *session, size_t len);
+
+// Take a finished stream out of the session, NULL if none. Free it with http2_stream_free().
+struct http2_stream *http2_take_done(struct http2_session *session);
+
+// Free a stream returned by http2_take_done()
+void http2_stream_free(struct http2_stream *stream);
+
+// Drop the first len bytes of the body received on a stream, once the caller
+// has used them, and reopen the stream's receive window by that much. The
+// session is not touched once the stream is done and may then be NULL.
+void http2_consume(struct http2_session *session, struct http2_stream *stream, size_t len);
+
+// Reset an open stream (RST_STREAM CANCEL) and free it
+void http2_cancel(struct http2_session *session, struct http2_stream *stream);
+
+// Queue a GOAWAY before closing an idle connection
+void http2_shutdown(struct http2_session *session);
+
+// Check whether another stream can be opened now
+bool http2_can_submit(const struct http2_session *session);
+
+// Check whether the connection can still carry new streams later
+bool http2_is_usable(const struct http2_session *session);
+
+// Number of streams that have not finished
+int http2_active_streams(const struct http2_session *session);
+
+// Look up a response header by name (lower case), NULL if absent
+const char *http2_stream_header(const struct http2_stream *stream, const char *name);
+
+#endif // HTTP2_H
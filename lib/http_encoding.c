@@ -0,0 +1,167 @@
+#define _POSIX_C_SOURCE 200809L
+#include "http_encoding.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Parse a Content-Encoding value
+int http_coding_parse(const char *value, http_coding_t *coding)
+{
+    if (!value) {
+        *coding = HTTP_CODING_IDENTITY;
+        return 0;
+    }
+
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+    size_t len = strlen(value);
+    while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t')) {
+        len--;
+    }
+
+    // A single coding is all servers send in practice; stacked codings are refused
+    if (len == 0 || (len == 8 && strncasecmp(value, "identity", 8) == 0)) {
+        *coding = HTTP_CODING_IDENTITY;
+    } else if ((len == 4 && strncasecmp(value, "gzip", 4) == 0) ||
+               (len == 6 && strncasecmp(value, "x-gzip", 6) == 0)) {
+        *coding = HTTP_CODING_GZIP;
+    } else if (len == 7 && strncasecmp(value, "deflate", 7) == 0) {
+        *coding = HTTP_CODING_DEFLATE;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Start inflating: gzip framing, zlib framing, or raw deflate
+static int decoder_start(struct http_decoder *decoder, int window_bits)
+{
+    memset(&decoder->zs, 0, sizeof(decoder->zs));
+    return inflateInit2(&decoder->zs, window_bits) == Z_OK ? 0 : -1;
+}
+
+// Initialize a decoder
+int http_decoder_init(struct http_decoder *decoder, http_coding_t coding)
+{
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->coding = coding;
+    return decoder_start(decoder, coding == HTTP_CODING_GZIP ? 15 + 16 : 15);
+}
+
+// Free a decoder
+void http_decoder_free(struct http_decoder *decoder)
+{
+    inflateEnd(&decoder->zs);
+    free(decoder->data);
+    decoder->data = NULL;
+    decoder->len = 0;
+    decoder->cap = 0;
+}
+
+// Make room for at least extra more decoded bytes plus a NUL terminator
+static int decoder_reserve(struct http_decoder *decoder, size_t extra)
+{
+    size_t needed = decoder->len + extra + 1;
+    if (needed <= decoder->cap) {
+        return 0;
+    }
+
+    size_t new_cap = decoder->cap ? decoder->cap * 2 : 4096;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+
+    char *new_data = realloc(decoder->data, new_cap);
+    if (!new_data) {
+        return -1;
+    }
+    decoder->data = new_data;
+    decoder->cap = new_cap;
+    return 0;
+}
+
+// Decode compressed bytes as they arrive
+ssize_t http_decoder_feed(
+    struct http_decoder *decoder, const char *data, size_t len, http_decoder_output output, void *user_data)
+{
+    bool first = decoder->encoded == 0;
+
+    decoder->zs.next_in = (Bytef *) data;
+    decoder->zs.avail_in = (uInt) len;
+    while (!decoder->done && (decoder->zs.avail_in > 0 || decoder->full)) {
+        if (decoder_reserve(decoder, HTTP_DECODE_PIECE) != 0) {
+            return -1;
+        }
+        size_t space = decoder->cap - decoder->len - 1;
+        if (output && space > HTTP_DECODE_PIECE) {
+            space = HTTP_DECODE_PIECE;
+        }
+        decoder->zs.next_out = (Bytef *) decoder->data + decoder->len;
+        decoder->zs.avail_out = (uInt) space;
+
+        int status = inflate(&decoder->zs, Z_NO_FLUSH);
+        decoder->full = decoder->zs.avail_out == 0;
+        decoder->len += space - decoder->zs.avail_out;
+        decoder->data[decoder->len] = '\0';
+
+        if (status == Z_DATA_ERROR && first && decoder->coding == HTTP_CODING_DEFLATE && decoder->zs.total_out == 0) {
+            // Some servers send "deflate" without the zlib header
+            inflateEnd(&decoder->zs);
+            if (decoder_start(decoder, -15) != 0) {
+                return -1;
+            }
+            decoder->zs.next_in = (Bytef *) data;
+            decoder->zs.avail_in = (uInt) len;
+            first = false;
+            continue;
+        }
+        if (status == Z_STREAM_END) {
+            // Anything after the compressed stream is ignored
+            decoder->done = true;
+            decoder->full = false;
+        } else if (status == Z_BUF_ERROR) {
+            decoder->full = false; // Needs more input
+        } else if (status != Z_OK) {
+            return -1;
+        }
+
+        if (output && decoder->len > 0) {
+            size_t piece = decoder->len;
+            decoder->len = 0;
+            if (output(decoder->data, piece, user_data) != 0) {
+                break;
+            }
+        }
+        if (status == Z_BUF_ERROR) {
+            break;
+        }
+    }
+
+    // Input after the end of the compressed stream counts as consumed
+    size_t consumed = decoder->done ? len : len - decoder->zs.avail_in;
+    decoder->encoded += consumed;
+    return (ssize_t) consumed;
+}
+
+// Signal the end of the body
+int http_decoder_finish(struct http_decoder *decoder)
+{
+    // Bodiless responses (204, 304) may still name the coding
+    return decoder->done || decoder->encoded == 0 ? 0 : -1;
+}
+
+// Take ownership of the decoded bytes
+char *http_decoder_take(struct http_decoder *decoder, size_t *size)
+{
+    if (!decoder->data && decoder_reserve(decoder, 0) == 0) {
+        decoder->data[0] = '\0';
+    }
+    char *data = decoder->data;
+    *size = data ? decoder->len : 0;
+    decoder->data = NULL;
+    decoder->len = 0;
+    decoder->cap = 0;
+    return data;
+}
@@ -0,0 +1,62 @@
+#ifndef HTTP_ENCODING_H
+#define HTTP_ENCODING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+// Accept-Encoding sent when compression is enabled
+#define HTTP_ACCEPT_ENCODING "gzip, deflate"
+
+// Largest piece of decoded output passed to an output callback
+#define HTTP_DECODE_PIECE 16384
+
+// Content codings of a response body
+typedef enum { HTTP_CODING_IDENTITY, HTTP_CODING_GZIP, HTTP_CODING_DEFLATE } http_coding_t;
+
+// Incremental decoder for a gzip or deflate body
+struct http_decoder {
+    http_coding_t coding;
+    z_stream zs;
+    bool done;      // End of the compressed stream seen
+    bool full;      // Output space ran out, zlib may hold more output
+    size_t encoded; // Compressed bytes consumed so far
+
+    // Decoded bytes, grown geometrically (NUL-terminated once allocated)
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+// Parse a Content-Encoding value (NULL means identity).
+// Returns -1 for codings that cannot be decoded.
+int http_coding_parse(const char *value, http_coding_t *coding);
+
+// Initialize a decoder for a gzip or deflate body. Returns 0, or -1 on failure.
+int http_decoder_init(struct http_decoder *decoder, http_coding_t coding);
+
+// Free a decoder and the decoded bytes it still holds
+void http_decoder_free(struct http_decoder *decoder);
+
+// Receives decoded output. A non-zero return stops decoding after this piece.
+typedef int (*http_decoder_output)(const char *data, size_t len, void *user_data);
+
+// Decode compressed bytes as they arrive. Without an output callback the
+// output is appended to decoder->data. With one it is passed on in pieces of
+// at most HTTP_DECODE_PIECE bytes; when the callback stops decoding, the input
+// not consumed must be fed again later (feeding no input still flushes output
+// zlib holds back). Returns the input bytes consumed, or -1 on corrupt data or
+// when memory is exhausted.
+ssize_t http_decoder_feed(
+    struct http_decoder *decoder, const char *data, size_t len, http_decoder_output output, void *user_data);
+
+// Signal the end of the body. Returns 0 if the compressed stream was
+// complete, -1 if it was truncated.
+int http_decoder_finish(struct http_decoder *decoder);
+
+// Take ownership of the decoded bytes, NUL-terminated; *size is their length.
+// Returns NULL when memory is exhausted.
+char *http_decoder_take(struct http_decoder *decoder, size_t *size);
+
+#endif // HTTP_ENCODING_H
@@ -0,0 +1,554 @@
+#define _POSIX_C_SOURCE 200809L
+#include "http_parser.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Initialize a parser for a new response
+void http_parser_init(struct http_parser *parser)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->state = HTTP_PARSE_HEAD;
+}
+
+// Free memory held by the parser
+void http_parser_free(struct http_parser *parser)
+{
+    if (parser) {
+        free(parser->head);
+        free(parser->body);
+        parser->head = NULL;
+        parser->body = NULL;
+        parser->head_len = 0;
+        parser->body_len = 0;
+    }
+}
+
+// Make room for at least extra more body bytes plus a NUL terminator
+static int body_reserve(struct http_parser *parser, size_t extra)
+{
+    size_t needed = parser->body_len + extra + 1;
+    if (needed <= parser->body_cap) {
+        return 0;
+    }
+
+    size_t new_cap = parser->body_cap ? parser->body_cap : 1024;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+
+    char *new_body = realloc(parser->body, new_cap);
+    if (!new_body) {
+        return -1;
+    }
+    parser->body = new_body;
+    parser->body_cap = new_cap;
+    return 0;
+}
+
+// Make room for at least extra more header bytes plus a NUL terminator
+static int head_reserve(struct http_parser *parser, size_t extra)
+{
+    size_t needed = parser->head_len + extra + 1;
+    if (needed <= parser->head_cap) {
+        return 0;
+    }
+
+    size_t new_cap = parser->head_cap ? parser->head_cap * 2 : 1024;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+
+    char *new_head = realloc(parser->head, new_cap);
+    if (!new_head) {
+        return -1;
+    }
+    parser->head = new_head;
+    parser->head_cap = new_cap;
+    return 0;
+}
+
+// Append decoded body bytes. Bytes received in place already are in the body
+// buffer and only move down over the chunk framing removed before them; they
+// are not NUL-terminated, the byte after them may belong to the next response.
+static int body_append(struct http_parser *parser, const char *data, size_t len, bool in_place)
+{
+    if (in_place) {
+        if (data != parser->body + parser->body_len) {
+            memmove(parser->body + parser->body_len, data, len);
+        }
+        parser->body_len += len;
+        return 0;
+    }
+
+    if (body_reserve(parser, len) != 0) {
+        return -1;
+    }
+    memcpy(parser->body + parser->body_len, data, len);
+    parser->body_len += len;
+    parser->body[parser->body_len] = '\0';
+    return 0;
+}
+
+// Trim trailing spaces, tabs and CR from a NUL-terminated string in place
+static void trim_right(char *str)
+{
+    size_t len = strlen(str);
+    while (len > 0 && (str[len - 1] == ' ' || str[len - 1] == '\t' || str[len - 1] == '\r')) {
+        str[--len] = '\0';
+    }
+}
+
+// Check whether a comma separated header value contains a token
+static bool header_has_token(const char *value, const char *token)
+{
+    size_t token_len = strlen(token);
+    const char *pos = value;
+
+    while (*pos) {
+        while (*pos == ' ' || *pos == '\t' || *pos == ',') {
+            pos++;
+        }
+        const char *end = pos;
+        while (*end && *end != ',' && *end != ' ' && *end != '\t' && *end != ';') {
+            end++;
+        }
+        if ((size_t) (end - pos) == token_len && strncasecmp(pos, token, token_len) == 0) {
+            return true;
+        }
+        while (*end && *end != ',') {
+            end++;
+        }
+        pos = end;
+    }
+
+    return false;
+}
+
+// Split the buffered header block into the status code and header table,
+// then decide how the body is framed
+static int parse_head(struct http_parser *parser)
+{
+    char *line = parser->head;
+    char *line_end = strchr(line, '\n');
+    if (!line_end) {
+        return -1;
+    }
+    *line_end = '\0';
+    trim_right(line);
+
+    // Status line: "HTTP/1.1 200 OK"
+    if (strncmp(line, "HTTP/1.", 7) != 0 || line[7] < '0' || line[7] > '9' || line[8] != ' ') {
+        return -1;
+    }
+    parser->version_minor = line[7] - '0';
+    parser->status_code = atoi(line + 9);
+    if (parser->status_code < 100 || parser->status_code > 999) {
+        return -1;
+    }
+
+    bool connection_close = false;
+    bool connection_keep_alive = false;
+    bool have_length = false;
+
+    parser->header_count = 0;
+    parser->chunked = false;
+
+    line = line_end + 1;
+    while (*line && *line != '\r' && *line != '\n') {
+        line_end = strchr(line, '\n');
+        if (line_end) {
+            *line_end = '\0';
+        }
+        trim_right(line);
+
+        char *colon = strchr(line, ':');
+        if (colon) {
+            *colon = '\0';
+            char *value = colon + 1;
+            while (*value == ' ' || *value == '\t') {
+                value++;
+            }
+
+            if (parser->header_count < HTTP_PARSER_MAX_HEADERS) {
+                parser->headers[parser->header_count].name = line;
+                parser->headers[parser->header_count].value = value;
+                parser->header_count++;
+            }
+
+            // Framing headers are inspected even if the table is full
+            if (strcasecmp(line, "Transfer-Encoding") == 0) {
+                parser->chunked = header_has_token(value, "chunked");
+            } else if (strcasecmp(line, "Content-Length") == 0) {
+                char *endptr = NULL;
+                unsigned long long length = strtoull(value, &endptr, 10);
+                if (endptr == value) {
+                    return -1;
+                }
+                parser->content_length = (size_t) length;
+                have_length = true;
+            } else if (strcasecmp(line, "Connection") == 0) {
+                connection_close = header_has_token(value, "close");
+                connection_keep_alive = header_has_token(value, "keep-alive");
+            }
+        }
+
+        if (!line_end) {
+            break;
+        }
+        line = line_end + 1;
+    }
+
+    if (parser->version_minor >= 1) {
+        parser->keep_alive = !connection_close;
+    } else {
+        parser->keep_alive = connection_keep_alive;
+    }
+
+    // 1xx, 204 and 304 responses never carry a body
+    int status = parser->status_code;
+    if ((status >= 100 && status < 200) || status == 204 || status == 304) {
+        parser->state = HTTP_PARSE_DONE;
+    } else if (parser->chunked) {
+        parser->state = HTTP_PARSE_CHUNK_SIZE;
+        parser->line_len = 0;
+    } else if (have_length) {
+        parser->remaining = parser->content_length;
+        // A streamed body only ever holds what one read decodes
+        size_t reserve = parser->streaming ? HTTP_PARSER_READ_SIZE : parser->content_length;
+        if (body_reserve(parser, reserve) != 0) {
+            return -1;
+        }
+        parser->body[0] = '\0';
+        parser->state = parser->remaining > 0 ? HTTP_PARSE_BODY_LENGTH : HTTP_PARSE_DONE;
+    } else {
+        // Body delimited by connection close
+        parser->keep_alive = false;
+        parser->state = HTTP_PARSE_BODY_CLOSE;
+    }
+
+    return 0;
+}
+
+// Buffer header bytes until the blank line ending the header block. Bytes
+// received in place already are at the end of the head buffer.
+// Returns the number of bytes consumed or -1 on error.
+static ssize_t feed_head(struct http_parser *parser, const char *data, size_t len, bool in_place)
+{
+    size_t old_len = parser->head_len;
+    size_t take = len;
+    if (old_len + take > HTTP_PARSER_MAX_HEAD_SIZE) {
+        take = HTTP_PARSER_MAX_HEAD_SIZE - old_len;
+    }
+
+    if (!in_place) {
+        if (head_reserve(parser, take) != 0) {
+            return -1;
+        }
+        memcpy(parser->head + old_len, data, take);
+    }
+    parser->head_len = old_len + take;
+
+    // Look for "\n\r\n" or "\n\n" starting where the previous scan stopped
+    size_t end = 0;
+    for (size_t i = parser->head_scan; i < parser->head_len; i++) {
+        if (parser->head[i] != '\n') {
+            continue;
+        }
+        if (i + 1 < parser->head_len && parser->head[i + 1] == '\n') {
+            end = i + 2;
+            break;
+        }
+        if (i + 2 < parser->head_len && parser->head[i + 1] == '\r' && parser->head[i + 2] == '\n') {
+            end = i + 3;
+            break;
+        }
+    }
+
+    if (end == 0) {
+        if (parser->head_len >= HTTP_PARSER_MAX_HEAD_SIZE) {
+            return -1;
+        }
+        // The terminator may straddle the next read
+        parser->head_scan = parser->head_len > 2 ? parser->head_len - 2 : 0;
+        return (ssize_t) take;
+    }
+
+    // Terminate the block while parsing it; in place the next byte may be body
+    parser->head_len = end;
+    char next = parser->head[end];
+    parser->head[end] = '\0';
+    int result = parse_head(parser);
+    parser->head[end] = next;
+    if (result != 0) {
+        return -1;
+    }
+
+    return (ssize_t) (end - old_len);
+}
+
+// Accumulate a CRLF terminated line (chunk size or trailer).
+// Returns bytes consumed; *complete is set when the line is finished.
+static ssize_t feed_line(struct http_parser *parser, const char *data, size_t len, bool *complete)
+{
+    *complete = false;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '\n') {
+            parser->line[parser->line_len] = '\0';
+            trim_right(parser->line);
+            *complete = true;
+            return (ssize_t) (i + 1);
+        }
+        if (parser->line_len + 1 >= sizeof(parser->line)) {
+            // Only chunk extensions or trailers can be this long, keep the prefix
+            continue;
+        }
+        parser->line[parser->line_len++] = data[i];
+    }
+    return (ssize_t) len;
+}
+
+// Run the state machine over received bytes, either copied from the
+// caller's buffer or already in the parser's buffer (in_place). *rest is
+// set to the bytes following the consumed ones.
+static ssize_t parse(struct http_parser *parser, const char *data, size_t len, bool in_place, const char **rest)
+{
+    size_t consumed = 0;
+
+    while (len > 0 && parser->state != HTTP_PARSE_DONE && parser->state != HTTP_PARSE_ERROR) {
+        ssize_t used = 0;
+        bool complete = false;
+
+        switch (parser->state) {
+            case HTTP_PARSE_HEAD:
+                used = feed_head(parser, data, len, in_place);
+                if (used >= 0 && parser->state == HTTP_PARSE_DONE && parser->status_code < 200 &&
+                    parser->status_code != 101) {
+                    // Interim response (e.g. 100 Continue), the real one follows.
+                    // The head buffer is kept since it may hold the bytes left.
+                    char *head = parser->head;
+                    size_t head_cap = parser->head_cap;
+                    bool streaming = parser->streaming;
+                    http_parser_init(parser);
+                    parser->head = head;
+                    parser->head_cap = head_cap;
+                    parser->streaming = streaming;
+                    if (in_place) {
+                        consumed += (size_t) used;
+                        len -= (size_t) used;
+                        memmove(parser->head, data + used, len);
+                        data = parser->head;
+                        continue;
+                    }
+                } else if (used >= 0 && parser->state != HTTP_PARSE_HEAD) {
+                    // Body bytes that arrived with the header block are copied
+                    in_place = false;
+                }
+                break;
+
+            case HTTP_PARSE_BODY_LENGTH: {
+                size_t take = len < parser->remaining ? len : parser->remaining;
+                if (body_append(parser, data, take, in_place) != 0) {
+                    used = -1;
+                    break;
+                }
+                parser->remaining -= take;
+                used = (ssize_t) take;
+                if (parser->remaining == 0) {
+                    parser->state = HTTP_PARSE_DONE;
+                }
+                break;
+            }
+
+            case HTTP_PARSE_BODY_CLOSE:
+                used = body_append(parser, data, len, in_place) == 0 ? (ssize_t) len : -1;
+                break;
+
+            case HTTP_PARSE_CHUNK_SIZE:
+                used = feed_line(parser, data, len, &complete);
+                if (complete) {
+                    char *endptr = NULL;
+                    unsigned long long size = strtoull(parser->line, &endptr, 16);
+                    if (endptr == parser->line) {
+                        used = -1;
+                        break;
+                    }
+                    parser->line_len = 0;
+                    parser->remaining = (size_t) size;
+                    parser->state = size > 0 ? HTTP_PARSE_CHUNK_DATA : HTTP_PARSE_TRAILER;
+                }
+                break;
+
+            case HTTP_PARSE_CHUNK_DATA: {
+                size_t take = len < parser->remaining ? len : parser->remaining;
+                if (body_append(parser, data, take, in_place) != 0) {
+                    used = -1;
+                    break;
+                }
+                parser->remaining -= take;
+                used = (ssize_t) take;
+                if (parser->remaining == 0) {
+                    parser->state = HTTP_PARSE_CHUNK_DATA_END;
+                }
+                break;
+            }
+
+            case HTTP_PARSE_CHUNK_DATA_END:
+                // CRLF after the chunk data
+                used = feed_line(parser, data, len, &complete);
+                if (complete) {
+                    if (parser->line[0] != '\0') {
+                        used = -1;
+                        break;
+                    }
+                    parser->line_len = 0;
+                    parser->state = HTTP_PARSE_CHUNK_SIZE;
+                }
+                break;
+
+            case HTTP_PARSE_TRAILER:
+                // Trailer fields are skipped, an empty line ends the message
+                used = feed_line(parser, data, len, &complete);
+                if (complete) {
+                    bool empty = parser->line[0] == '\0';
+                    parser->line_len = 0;
+                    if (empty) {
+                        parser->state = HTTP_PARSE_DONE;
+                    }
+                }
+                break;
+
+            case HTTP_PARSE_DONE:
+            case HTTP_PARSE_ERROR:
+                break;
+        }
+
+        if (used < 0) {
+            parser->state = HTTP_PARSE_ERROR;
+            return -1;
+        }
+        data += used;
+        len -= (size_t) used;
+        consumed += (size_t) used;
+    }
+
+    if (rest) {
+        *rest = data;
+    }
+    if (parser->state == HTTP_PARSE_ERROR) {
+        return -1;
+    }
+    return (ssize_t) consumed;
+}
+
+// Feed received bytes to the parser
+ssize_t http_parser_feed(struct http_parser *parser, const char *data, size_t len)
+{
+    return parse(parser, data, len, false, NULL);
+}
+
+// Get the buffer the next read should go to
+char *http_parser_recv_buffer(struct http_parser *parser, size_t *space)
+{
+    switch (parser->state) {
+        case HTTP_PARSE_HEAD:
+            if (head_reserve(parser, HTTP_PARSER_READ_SIZE) != 0) {
+                return NULL;
+            }
+            *space = parser->head_cap - parser->head_len - 1;
+            return parser->head + parser->head_len;
+
+        case HTTP_PARSE_BODY_LENGTH: {
+            // Reading no further than the body leaves the next pipelined
+            // response on the connection
+            size_t wanted = parser->remaining < HTTP_PARSER_READ_SIZE ? parser->remaining : HTTP_PARSER_READ_SIZE;
+            if (body_reserve(parser, wanted) != 0) {
+                return NULL;
+            }
+            *space = parser->body_cap - parser->body_len - 1;
+            if (*space > parser->remaining) {
+                *space = parser->remaining;
+            }
+            return parser->body + parser->body_len;
+        }
+
+        case HTTP_PARSE_DONE:
+        case HTTP_PARSE_ERROR:
+            return NULL;
+
+        default:
+            if (body_reserve(parser, HTTP_PARSER_READ_SIZE) != 0) {
+                return NULL;
+            }
+            *space = parser->body_cap - parser->body_len - 1;
+            return parser->body + parser->body_len;
+    }
+}
+
+// Parse bytes read into the buffer from http_parser_recv_buffer()
+ssize_t http_parser_received(struct http_parser *parser, size_t len, const char **rest)
+{
+    char *data = parser->state == HTTP_PARSE_HEAD ? parser->head + parser->head_len : parser->body + parser->body_len;
+    return parse(parser, data, len, true, rest);
+}
+
+// Drop the body bytes decoded so far
+void http_parser_consume_body(struct http_parser *parser, size_t len)
+{
+    if (len < parser->body_len) {
+        memmove(parser->body, parser->body + len, parser->body_len - len);
+    }
+    parser->body_len -= len;
+}
+
+// Signal that the peer closed the connection
+int http_parser_finish(struct http_parser *parser)
+{
+    if (parser->state == HTTP_PARSE_BODY_CLOSE) {
+        if (body_reserve(parser, 0) != 0) {
+            parser->state = HTTP_PARSE_ERROR;
+            return -1;
+        }
+        parser->body[parser->body_len] = '\0';
+        parser->state = HTTP_PARSE_DONE;
+    }
+
+    return parser->state == HTTP_PARSE_DONE ? 0 : -1;
+}
+
+// Check whether a complete response has been parsed
+bool http_parser_is_complete(const struct http_parser *parser)
+{
+    return parser->state == HTTP_PARSE_DONE;
+}
+
+// Look up a response header by name (case-insensitive), NULL if absent
+const char *http_parser_get_header(const struct http_parser *parser, const char *name)
+{
+    for (int i = 0; i < parser->header_count; i++) {
+        if (strcasecmp(parser->headers[i].name, name) == 0) {
+            return parser->headers[i].value;
+        }
+    }
+    return NULL;
+}
+
+// Take ownership of the decoded body
+char *http_parser_take_body(struct http_parser *parser, size_t *size)
+{
+    // Bodiless responses still yield an empty string, bodies received in
+    // place are terminated now
+    if (parser->body || body_reserve(parser, 0) == 0) {
+        parser->body[parser->body_len] = '\0';
+    }
+
+    char *body = parser->body;
+    if (size) {
+        *size = parser->body_len;
+    }
+    parser->body = NULL;
+    parser->body_len = 0;
+    parser->body_cap = 0;
+    return body;
+}
@@ -0,0 +1,108 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Maximum number of response headers kept in the header table
+#define HTTP_PARSER_MAX_HEADERS 32
+
+// Maximum size of the status line and header block
+#define HTTP_PARSER_MAX_HEAD_SIZE 65536
+
+// Minimum room offered by http_parser_recv_buffer() for one read
+#define HTTP_PARSER_READ_SIZE 4096
+
+// Parser states
+typedef enum {
+    HTTP_PARSE_HEAD,
+    HTTP_PARSE_BODY_LENGTH,
+    HTTP_PARSE_BODY_CLOSE,
+    HTTP_PARSE_CHUNK_SIZE,
+    HTTP_PARSE_CHUNK_DATA,
+    HTTP_PARSE_CHUNK_DATA_END,
+    HTTP_PARSE_TRAILER,
+    HTTP_PARSE_DONE,
+    HTTP_PARSE_ERROR
+} http_parse_state_t;
+
+// Header table entry, name and value point into the parser's head buffer
+struct http_parser_header {
+    const char *name;
+    const char *value;
+};
+
+// Incremental HTTP/1.1 response parser
+struct http_parser {
+    http_parse_state_t state;
+
+    // Status line and header block
+    char *head;
+    size_t head_len;
+    size_t head_cap;
+    size_t head_scan; // Where to resume looking for the end of the header block
+    int status_code;
+    int version_minor;
+    struct http_parser_header headers[HTTP_PARSER_MAX_HEADERS];
+    int header_count;
+
+    // Framing
+    bool chunked;
+    bool keep_alive;        // Connection can be reused once the response is complete
+    size_t content_length;  // Declared Content-Length, if any
+    size_t remaining;       // Bytes left in the body or the current chunk
+    char line[128];         // Chunk size or trailer line being accumulated
+    size_t line_len;
+
+    // Decoded body, grown geometrically (NUL-terminated by http_parser_take_body())
+    char *body;
+    size_t body_len;
+    size_t body_cap;
+    bool streaming; // Body drained with http_parser_consume_body() rather than kept whole
+};
+
+// Initialize a parser for a new response
+void http_parser_init(struct http_parser *parser);
+
+// Free memory held by the parser
+void http_parser_free(struct http_parser *parser);
+
+// Feed received bytes to the parser.
+// Returns the number of bytes consumed (less than len once the response is
+// complete and extra bytes follow it), or -1 on a malformed response.
+ssize_t http_parser_feed(struct http_parser *parser, const char *data, size_t len);
+
+// Get the buffer the next read should go to, and the room in it (*space).
+// Reading straight into the parser avoids copying the response: the header
+// block is parsed where it lands and body bytes land in the body buffer, with
+// chunk framing removed in place. Returns NULL once the response is complete
+// or if memory is exhausted.
+char *http_parser_recv_buffer(struct http_parser *parser, size_t *space);
+
+// Parse len bytes read into the buffer from http_parser_recv_buffer().
+// Returns the number of bytes consumed, as http_parser_feed(). Bytes past the
+// end of the response start at *rest (if not NULL) and stay there until the
+// body is taken, so they can be fed to the parser of the next response first.
+ssize_t http_parser_received(struct http_parser *parser, size_t len, const char **rest);
+
+// Drop the first len body bytes decoded so far, once the caller has used them.
+// Set parser->streaming before feeding a response whose body is drained this
+// way, so the body buffer stays at the size of one read instead of the whole body.
+void http_parser_consume_body(struct http_parser *parser, size_t len);
+
+// Signal that the peer closed the connection.
+// Returns 0 if this completes the response, -1 if the response was truncated.
+int http_parser_finish(struct http_parser *parser);
+
+// Check whether a complete response has been parsed
+bool http_parser_is_complete(const struct http_parser *parser);
+
+// Look up a response header by name (case-insensitive), NULL if absent
+const char *http_parser_get_header(const struct http_parser *parser, const char *name);
+
+// Take ownership of the decoded body, NUL-terminated; *size is its length
+// (the body may contain NUL bytes). The parser no longer references it.
+char *http_parser_take_body(struct http_parser *parser, size_t *size);
+
+#endif // HTTP_PARSER_H
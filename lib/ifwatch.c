@@ -0,0 +1,202 @@
+#define _DEFAULT_SOURCE
+#include "ifwatch.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+
+// IPv4 ranges that are not routable on the internet
+static bool ipv4_is_public(const unsigned char *a)
+{
+    return !(a[0] == 0 || a[0] == 10 || a[0] == 127 ||                   // this network, private, loopback
+             a[0] >= 224 ||                                             // multicast and reserved
+             (a[0] == 100 && (a[1] & 0xc0) == 64) ||                    // shared address space (carrier-grade NAT)
+             (a[0] == 169 && a[1] == 254) ||                            // link-local
+             (a[0] == 172 && (a[1] & 0xf0) == 16) ||                    // private
+             (a[0] == 192 && a[1] == 168) ||                            // private
+             (a[0] == 192 && a[1] == 0 && (a[2] == 0 || a[2] == 2)) ||  // protocol assignments, documentation
+             (a[0] == 198 && (a[1] & 0xfe) == 18) ||                    // benchmarking
+             (a[0] == 198 && a[1] == 51 && a[2] == 100) ||              // documentation
+             (a[0] == 203 && a[1] == 0 && a[2] == 113));                // documentation
+}
+
+// IPv6: global unicast (2000::/3) outside the documentation prefix
+static bool ipv6_is_public(const unsigned char *a)
+{
+    return (a[0] & 0xe0) == 0x20 && !(a[0] == 0x20 && a[1] == 0x01 && a[2] == 0x0d && a[3] == 0xb8);
+}
+
+// Whether an address is routable on the internet
+bool ifwatch_is_public(const char *address)
+{
+    unsigned char a[16];
+    if (inet_pton(AF_INET, address, a) == 1) {
+        return ipv4_is_public(a);
+    }
+    if (inet_pton(AF_INET6, address, a) == 1) {
+        return ipv6_is_public(a);
+    }
+    return false;
+}
+
+// First public address of one family on an interface
+static int find_address(const struct ifaddrs *list, const char *ifname, int family, char *out, size_t out_size)
+{
+    for (const struct ifaddrs *ifa = list; ifa; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != family || strcmp(ifa->ifa_name, ifname) != 0) {
+            continue;
+        }
+        const void *addr = family == AF_INET ? (const void *) &((const struct sockaddr_in *) ifa->ifa_addr)->sin_addr
+                                             : (const void *) &((const struct sockaddr_in6 *) ifa->ifa_addr)->sin6_addr;
+        if ((family == AF_INET ? ipv4_is_public(addr) : ipv6_is_public(addr)) &&
+            inet_ntop(family, addr, out, (socklen_t) out_size)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Read the public address of an interface
+int ifwatch_get_address(const char *ifname, int family, char *out, size_t out_size)
+{
+    struct ifaddrs *list = NULL;
+    if (!ifname || getifaddrs(&list) != 0) {
+        return -1;
+    }
+    int result = -1;
+    if (family == AF_INET || family == AF_UNSPEC) {
+        result = find_address(list, ifname, AF_INET, out, out_size);
+    }
+    if (result != 0 && (family == AF_INET6 || family == AF_UNSPEC)) {
+        result = find_address(list, ifname, AF_INET6, out, out_size);
+    }
+    freeifaddrs(list);
+    return result;
+}
+
+#ifdef __linux__
+
+// Subscribe to address changes
+int ifwatch_open(struct ifwatch *watch, const char *ifname)
+{
+    memset(watch, 0, sizeof(*watch));
+    watch->fd = -1;
+    if (!ifname || strlen(ifname) >= sizeof(watch->ifname)) {
+        return -1;
+    }
+    strcpy(watch->ifname, ifname);
+
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    watch->fd = fd;
+    return 0;
+}
+
+// Check a batch of rtnetlink messages
+int ifwatch_parse(const struct ifwatch *watch, const void *buf, size_t len)
+{
+    // Looked up per batch: the index changes when the interface is recreated
+    unsigned int index = if_nametoindex(watch->ifname);
+    for (const struct nlmsghdr *nh = buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+        if (nh->nlmsg_type == NLMSG_OVERRUN) {
+            return 1;
+        }
+        if ((nh->nlmsg_type == RTM_NEWADDR || nh->nlmsg_type == RTM_DELADDR) &&
+            nh->nlmsg_len >= NLMSG_LENGTH(sizeof(struct ifaddrmsg))) {
+            const struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+            if (index != 0 && ifa->ifa_index == index) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Wait for the interface's addresses to change
+int ifwatch_wait(struct ifwatch *watch, int timeout_ms)
+{
+    if (watch->fd < 0) {
+        return -1;
+    }
+    struct pollfd pfd = {.fd = watch->fd, .events = POLLIN, .revents = 0};
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready <= 0) {
+        return ready < 0 && errno != EINTR ? -1 : 0;
+    }
+
+    int changed = 0;
+    uint32_t buf[2048]; // Aligned for struct nlmsghdr
+    for (;;) {
+        ssize_t received = recv(watch->fd, buf, sizeof(buf), 0);
+        if (received < 0) {
+            // The kernel dropped messages: what they said is unknown, so assume a change
+            if (errno == ENOBUFS) {
+                changed = 1;
+                continue;
+            }
+            break;
+        }
+        if (received == 0) {
+            break;
+        }
+        changed = changed || ifwatch_parse(watch, buf, (size_t) received);
+    }
+    return changed;
+}
+
+#else
+
+int ifwatch_open(struct ifwatch *watch, const char *ifname)
+{
+    (void) ifname;
+    memset(watch, 0, sizeof(*watch));
+    watch->fd = -1;
+    return -1;
+}
+
+int ifwatch_parse(const struct ifwatch *watch, const void *buf, size_t len)
+{
+    (void) watch;
+    (void) buf;
+    (void) len;
+    return 0;
+}
+
+int ifwatch_wait(struct ifwatch *watch, int timeout_ms)
+{
+    (void) watch;
+    (void) timeout_ms;
+    return -1;
+}
+
+#endif // __linux__
+
+// Close the netlink socket
+void ifwatch_close(struct ifwatch *watch)
+{
+    if (watch->fd >= 0) {
+        close(watch->fd);
+        watch->fd = -1;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef IFWATCH_H
+#define IFWATCH_H
+
+#include <net/if.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Whether an address is routable on the internet: not private, shared
+// (carrier-grade NAT), loopback, link-local, documentation or multicast
+bool ifwatch_is_public(const char *address);
+
+// Read the addresses of an interface with getifaddrs() and write the first
+// public one of the family (AF_INET, AF_INET6, or AF_UNSPEC for IPv4 before
+// IPv6) to out. Returns 0, or -1 when the interface has none, as behind NAT.
+int ifwatch_get_address(const char *ifname, int family, char *out, size_t out_size);
+
+// Address changes of one interface, announced by the kernel over rtnetlink
+// (RTM_NEWADDR and RTM_DELADDR). The interface is matched by name, so one
+// that is recreated with another index (a PPP link, say) is still followed.
+struct ifwatch {
+    int fd; // -1 when closed
+    char ifname[IF_NAMESIZE];
+};
+
+// Subscribe to the address changes of an interface.
+// Returns 0, or -1 if rtnetlink is not available (outside Linux).
+int ifwatch_open(struct ifwatch *watch, const char *ifname);
+
+// Check a batch of rtnetlink messages. Returns 1 if one of them adds or
+// removes an address of the interface, or reports lost messages.
+int ifwatch_parse(const struct ifwatch *watch, const void *buf, size_t len);
+
+// Wait up to timeout_ms (-1 for no limit) for the interface's addresses to
+// change, reading every pending message. Returns 1 on a change, 0 on
+// timeout or an unrelated event, -1 on error.
+int ifwatch_wait(struct ifwatch *watch, int timeout_ms);
+
+// Close the netlink socket
+void ifwatch_close(struct ifwatch *watch);
+
+#endif // IFWATCH_H
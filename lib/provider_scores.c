@@ -0,0 +1,226 @@
+#define _POSIX_C_SOURCE 200809L
+#include "provider_scores.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static struct provider_score scores[PROVIDER_SCORES_SIZE];
+static int score_count = 0;
+static bool scores_dirty = false;
+
+// Find the slot of a provider, -1 if absent
+static int find_score(const char *url)
+{
+    for (int i = 0; i < score_count; i++) {
+        if (strcmp(scores[i].url, url) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Pick a slot for a provider, reusing its entry or replacing the one used least recently
+static int slot_for(const char *url)
+{
+    int index = find_score(url);
+    if (index >= 0) {
+        return index;
+    }
+    if (score_count < PROVIDER_SCORES_SIZE) {
+        index = score_count++;
+    } else {
+        index = 0;
+        for (int i = 1; i < score_count; i++) {
+            if (scores[i].last_used < scores[index].last_used) {
+                index = i;
+            }
+        }
+    }
+    memset(&scores[index], 0, sizeof(scores[index]));
+    strncpy(scores[index].url, url, sizeof(scores[index].url) - 1);
+    return index;
+}
+
+// Decode one "url latency failure_rate requests failures last_used last_failure samples..." line
+static int load_line(char *line)
+{
+    char *saveptr = NULL;
+    const char *url = strtok_r(line, " \t\r\n", &saveptr);
+    const char *fields[6];
+    for (int i = 0; i < 6; i++) {
+        fields[i] = url ? strtok_r(NULL, " \t\r\n", &saveptr) : NULL;
+    }
+    if (!url || url[0] == '#' || !fields[5] || strlen(url) >= sizeof(scores[0].url)) {
+        return -1;
+    }
+
+    struct provider_score score;
+    memset(&score, 0, sizeof(score));
+    strcpy(score.url, url);
+    score.latency_ms = strtod(fields[0], NULL);
+    score.failure_rate = strtod(fields[1], NULL);
+    score.requests = strtoul(fields[2], NULL, 10);
+    score.failures = strtoul(fields[3], NULL, 10);
+    score.last_used = (time_t) strtoll(fields[4], NULL, 10);
+    score.last_failure = (time_t) strtoll(fields[5], NULL, 10);
+    if (score.latency_ms < 0 || score.failure_rate < 0 || score.failure_rate > 1) {
+        return -1;
+    }
+
+    // Samples are written oldest first
+    const char *sample;
+    while ((sample = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL && score.sample_count < PROVIDER_SCORE_SAMPLES) {
+        score.samples[score.sample_count++] = atoi(sample);
+    }
+    score.sample_next = score.sample_count % PROVIDER_SCORE_SAMPLES;
+
+    scores[slot_for(url)] = score;
+    return 0;
+}
+
+// Load scores from a state file
+int provider_scores_load(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+
+    int loaded = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        if (load_line(line) == 0) {
+            loaded++;
+        }
+    }
+
+    fclose(file);
+    scores_dirty = false;
+    return loaded;
+}
+
+// Write the scores to a state file
+int provider_scores_save(const char *path)
+{
+    if (!scores_dirty) {
+        return 0;
+    }
+
+    // Several short-lived tools may save at once: write a private temp file, then rename
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path, (long) getpid());
+    FILE *file = fopen(tmp_path, "w");
+    if (!file) {
+        return -1;
+    }
+
+    fprintf(file,
+            "# Public IP providers: url latency(ms) failure_rate requests failures last_used last_failure "
+            "samples...\n");
+    for (int i = 0; i < score_count; i++) {
+        const struct provider_score *score = &scores[i];
+        fprintf(file,
+                "%s %.1f %.4f %lu %lu %lld %lld",
+                score->url,
+                score->latency_ms,
+                score->failure_rate,
+                score->requests,
+                score->failures,
+                (long long) score->last_used,
+                (long long) score->last_failure);
+        int first = score->sample_count < PROVIDER_SCORE_SAMPLES ? 0 : score->sample_next;
+        for (int j = 0; j < score->sample_count; j++) {
+            fprintf(file, " %d", score->samples[(first + j) % PROVIDER_SCORE_SAMPLES]);
+        }
+        fprintf(file, "\n");
+    }
+
+    if (fclose(file) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+
+    scores_dirty = false;
+    return 0;
+}
+
+// Get the score of a provider
+const struct provider_score *provider_score_get(const char *url)
+{
+    int index = find_score(url);
+    return index >= 0 ? &scores[index] : NULL;
+}
+
+// Record how a request to a provider ended
+void provider_score_record(const char *url, provider_outcome_t outcome, long latency_ms)
+{
+    struct provider_score *score = &scores[slot_for(url)];
+    time_t now = time(NULL);
+    score->last_used = now;
+    scores_dirty = true;
+
+    score->requests++;
+    if (outcome == PROVIDER_FAILED) {
+        score->failures++;
+        score->last_failure = now;
+        score->failure_rate += PROVIDER_SCORE_ALPHA * (1.0 - score->failure_rate);
+        return;
+    }
+    if (outcome == PROVIDER_ANSWERED) {
+        score->failure_rate -= PROVIDER_SCORE_ALPHA * score->failure_rate;
+    }
+
+    // The first answer time seeds the average
+    latency_ms = latency_ms < 0 ? 0 : latency_ms;
+    if (score->sample_count == 0) {
+        score->latency_ms = (double) latency_ms;
+    } else {
+        score->latency_ms += PROVIDER_SCORE_ALPHA * ((double) latency_ms - score->latency_ms);
+    }
+    score->samples[score->sample_next] = (int) latency_ms;
+    score->sample_next = (score->sample_next + 1) % PROVIDER_SCORE_SAMPLES;
+    if (score->sample_count < PROVIDER_SCORE_SAMPLES) {
+        score->sample_count++;
+    }
+}
+
+static int compare_ints(const void *a, const void *b)
+{
+    int x = *(const int *) a;
+    int y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+// 95th percentile of the recent answer times
+int provider_score_p95(const struct provider_score *score)
+{
+    if (!score || score->sample_count == 0) {
+        return -1;
+    }
+    int sorted[PROVIDER_SCORE_SAMPLES];
+    memcpy(sorted, score->samples, sizeof(int) * (size_t) score->sample_count);
+    qsort(sorted, (size_t) score->sample_count, sizeof(int), compare_ints);
+
+    // Nearest rank: the smallest sample with at least 95% of them at or below it
+    int rank = (score->sample_count * 95 + 99) / 100;
+    return sorted[rank - 1];
+}
+
+// Whether a provider may be tried first
+bool provider_score_healthy(const struct provider_score *score, time_t now)
+{
+    if (!score || score->failure_rate < PROVIDER_SCORE_UNHEALTHY) {
+        return true;
+    }
+    return now - score->last_failure >= PROVIDER_SCORE_COOLDOWN;
+}
+
+// Forget all scores
+void provider_scores_clear(void)
+{
+    memset(scores, 0, sizeof(scores));
+    score_count = 0;
+    scores_dirty = false;
+}
@@ -0,0 +1,67 @@
+#ifndef PROVIDER_SCORES_H
+#define PROVIDER_SCORES_H
+
+#include <stdbool.h>
+#include <time.h>
+
+// Maximum number of providers tracked
+#define PROVIDER_SCORES_SIZE 16
+
+// Weight of the newest observation in the moving averages
+#define PROVIDER_SCORE_ALPHA 0.2
+
+// Recent answer times kept for the 95th percentile
+#define PROVIDER_SCORE_SAMPLES 20
+
+// A provider failing at least this often is unhealthy...
+#define PROVIDER_SCORE_UNHEALTHY 0.5
+
+// ...until this long after its last failure (seconds), when it is tried again
+#define PROVIDER_SCORE_COOLDOWN 3600
+
+// How a request to a provider ended
+typedef enum {
+    PROVIDER_ANSWERED,  // A valid answer, after latency_ms
+    PROVIDER_FAILED,    // An error, a timeout or an invalid answer
+    PROVIDER_OVERTAKEN, // Cancelled unanswered after latency_ms because another provider answered
+} provider_outcome_t;
+
+// Observed latency and reliability of one provider
+struct provider_score {
+    char url[256];
+    double latency_ms;   // Moving average of answer times
+    double failure_rate; // Moving average of failures, 0 to 1
+    unsigned long requests;
+    unsigned long failures;
+    time_t last_used;
+    time_t last_failure;
+    int samples[PROVIDER_SCORE_SAMPLES]; // Answer times in ms, oldest overwritten first
+    int sample_count;
+    int sample_next;
+};
+
+// Load scores from a state file.
+// Returns the number of providers loaded, or -1 if the file could not be read.
+int provider_scores_load(const char *path);
+
+// Write the scores to a state file if anything changed. Returns 0 on success.
+int provider_scores_save(const char *path);
+
+// Get the score of a provider, NULL if it has not been used yet
+const struct provider_score *provider_score_get(const char *url);
+
+// Record how a request to a provider ended. An overtaken request counts its
+// time so far as an answer time, so a provider that stalls sinks in the
+// ranking, but it is not held against its reliability.
+void provider_score_record(const char *url, provider_outcome_t outcome, long latency_ms);
+
+// 95th percentile of the recent answer times in ms, -1 without any
+int provider_score_p95(const struct provider_score *score);
+
+// Whether a provider fails rarely enough, or long enough ago, to be tried first
+bool provider_score_healthy(const struct provider_score *score, time_t now);
+
+// Forget all scores
+void provider_scores_clear(void);
+
+#endif // PROVIDER_SCORES_H
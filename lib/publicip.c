@@ -1,53 +1,638 @@
 #define _POSIX_C_SOURCE 200809L
 #include "publicip.h"
 
+#include "cloudflare_utils.h"
+#include "dnsip.h"
+#include "gateway.h"
+#include "ifwatch.h"
+#include "provider_scores.h"
 #include "socket_http.h"
+#include "stun.h"
 
+#include <arpa/inet.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-// Helper function to trim whitespace
-static char *trim_whitespace(char *str)
+// Configuration file naming the sources, NULL for the default source
+static char *config_path = NULL;
+
+// State file of the provider scores, NULL to keep them in memory only
+static char *score_path = NULL;
+static bool scores_loaded = false;
+
+// Whether a STUN or DNS source is well formed (HTTP sources are checked when used)
+static bool source_valid(const char *source)
+{
+    char host[256];
+    char name[256];
+    uint16_t port;
+    uint16_t type;
+    uint16_t qclass;
+    if (stun_is_uri(source)) {
+        return stun_parse_uri(source, host, sizeof(host), &port) == 0;
+    }
+    if (dnsip_is_uri(source)) {
+        return dnsip_parse_uri(source, host, sizeof(host), &port, name, sizeof(name), &type, &qclass) == 0;
+    }
+    return true;
+}
+
+// Initialize a configuration with the default source
+int publicip_config_init(struct publicip_config *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->quorum = 1;
+    config->timeout_ms = PUBLICIP_TIMEOUT_MS;
+    config->dns_retries = DNSIP_DEFAULT_RETRIES;
+    config->sources[0] = strdup(PUBLICIP_DEFAULT_SOURCE);
+    config->source_count = config->sources[0] ? 1 : 0;
+    return config->sources[0] ? 0 : -1;
+}
+
+// Free the sources of a configuration
+void publicip_config_free(struct publicip_config *config)
+{
+    for (int i = 0; i < PUBLICIP_MAX_SOURCES; i++) {
+        free(config->sources[i]);
+        config->sources[i] = NULL;
+    }
+    config->source_count = 0;
+}
+
+// Read the public IP sources from a configuration file
+int publicip_config_load(struct publicip_config *config, const char *path)
 {
-    char *end = NULL;
+    memset(config, 0, sizeof(*config));
+    config->quorum = 1;
+    config->timeout_ms = PUBLICIP_TIMEOUT_MS;
+    config->dns_retries = DNSIP_DEFAULT_RETRIES;
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open config file '%s'\n", path);
+        return -1;
+    }
+
+    // Sources are kept at their index, then packed in index order
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        char *trimmed = trim_whitespace(line);
+        if (*trimmed == '\0' || *trimmed == '#') {
+            continue;
+        }
+        char *equals = strchr(trimmed, '=');
+        if (!equals) {
+            continue;
+        }
+        *equals = '\0';
+        const char *key = trim_whitespace(trimmed);
+        const char *value = trim_whitespace(equals + 1);
 
-    // Trim leading space
-    while (*str == ' ' || *str == '\t' || *str == '\n' || *str == '\r')
-        str++;
+        int index = -1;
+        char bracket = '\0';
+        if (sscanf(key, "IP_SOURCE[%d%c", &index, &bracket) == 2 && bracket == ']') {
+            if (index < 0 || index >= PUBLICIP_MAX_SOURCES) {
+                fprintf(stderr, "Warning: Ignoring %s, sources are numbered 0 to %d\n", key, PUBLICIP_MAX_SOURCES - 1);
+                continue;
+            }
+            if (*value == '\0') {
+                continue;
+            }
+            if (!source_valid(value)) {
+                fprintf(stderr,
+                        "Warning: Ignoring %s '%s', expected stun:host[:port] or "
+                        "dns://resolver[:port]/name[?type=A|TXT][;class=IN|CH]\n",
+                        key,
+                        value);
+                continue;
+            }
+            free(config->sources[index]);
+            config->sources[index] = strdup(value);
+        } else if (strcmp(key, "IP_SOURCE_MODE") == 0) {
+            config->race = strcmp(value, "race") == 0;
+            if (!config->race && strcmp(value, "adaptive") != 0) {
+                fprintf(stderr, "Warning: Unknown IP_SOURCE_MODE '%s', using adaptive\n", value);
+            }
+        } else if (strcmp(key, "IP_SOURCE_QUORUM") == 0) {
+            config->quorum = atoi(value);
+        } else if (strcmp(key, "IP_SOURCE_TIMEOUT_MS") == 0) {
+            config->timeout_ms = atoi(value);
+        } else if (strcmp(key, "IP_SOURCE_DNS_RETRIES") == 0) {
+            config->dns_retries = atoi(value);
+        } else if (strcmp(key, "WAN_INTERFACE") == 0) {
+            if (strlen(value) >= sizeof(config->interface)) {
+                fprintf(stderr, "Warning: Ignoring WAN_INTERFACE '%s', the name is too long\n", value);
+                continue;
+            }
+            strcpy(config->interface, value);
+        }
+    }
+    fclose(file);
 
-    if (*str == 0)
-        return str;
+    for (int i = 0; i < PUBLICIP_MAX_SOURCES; i++) {
+        if (config->sources[i]) {
+            char *source = config->sources[i];
+            config->sources[i] = NULL;
+            config->sources[config->source_count++] = source;
+        }
+    }
+    if (config->source_count == 0) {
+        config->sources[0] = strdup(PUBLICIP_DEFAULT_SOURCE);
+        config->source_count = config->sources[0] ? 1 : 0;
+    }
+    if (config->timeout_ms <= 0) {
+        config->timeout_ms = PUBLICIP_TIMEOUT_MS;
+    }
+
+    if (config->source_count == 0 || config->quorum < 1 || config->quorum > config->source_count) {
+        fprintf(stderr,
+                "Error: IP_SOURCE_QUORUM must be between 1 and the number of sources (%d)\n",
+                config->source_count);
+        publicip_config_free(config);
+        return -1;
+    }
+    return 0;
+}
 
-    // Trim trailing space
-    end = str + strlen(str) - 1;
-    while (end > str && (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r'))
-        end--;
+// Check that a body is an IPv4 address, and write it in canonical form so
+// different spellings of one address agree. IPv6 answers are rejected: the
+// address goes into A records. Returns 0 if valid.
+static int normalize_ip(const char *data, size_t size, char *out, size_t out_size)
+{
+    char text[INET6_ADDRSTRLEN + 8];
+    if (!data || size == 0 || size >= sizeof(text)) {
+        return -1;
+    }
+    memcpy(text, data, size);
+    text[size] = '\0';
+    const char *trimmed = trim_whitespace(text);
 
-    // Write new null terminator
-    end[1] = '\0';
+    struct in_addr address;
+    if (inet_pton(AF_INET, trimmed, &address) != 1) {
+        return -1;
+    }
+    return inet_ntop(AF_INET, &address, out, (socklen_t) out_size) ? 0 : -1;
+}
 
-    return str;
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-// Get public IP from ipinfo.io
-char *get_public_ip(void)
+// Load the provider scores on first use
+static void scores_ready(void)
+{
+    if (score_path && !scores_loaded) {
+        provider_scores_load(score_path);
+        scores_loaded = true;
+    }
+}
+
+// Whether a source is asked over UDP before the HTTP sources: the gateway
+// (NAT-PMP, or UPnP found over SSDP), a STUN server or a DNS resolver
+static bool is_udp_source(const char *source)
+{
+    return gateway_is_uri(source) || stun_is_uri(source) || dnsip_is_uri(source);
+}
+
+// Order the sources best first: healthy before failing ones, then providers
+// with answer times before new ones (in configuration order), then by their
+// average answer time
+int publicip_rank(const struct publicip_config *config, int order[])
+{
+    scores_ready();
+    time_t now = time(NULL);
+    int tier[PUBLICIP_MAX_SOURCES];
+    double latency[PUBLICIP_MAX_SOURCES];
+    for (int i = 0; i < config->source_count; i++) {
+        const struct provider_score *score = provider_score_get(config->sources[i]);
+        bool known = score && score->sample_count > 0;
+        tier[i] = (provider_score_healthy(score, now) ? 0 : 2) + (known ? 0 : 1);
+        latency[i] = known ? score->latency_ms : 0;
+    }
+
+    // Insertion sort keeps the configuration order among equals
+    for (int i = 0; i < config->source_count; i++) {
+        int source = i;
+        int j = i;
+        while (j > 0 && (tier[order[j - 1]] > tier[source] ||
+                         (tier[order[j - 1]] == tier[source] && latency[order[j - 1]] > latency[source]))) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = source;
+    }
+    return config->source_count;
+}
+
+// How long to wait for a source before starting the next one as well
+int publicip_fallback_delay(const char *source, int timeout_ms)
+{
+    scores_ready();
+    int p95 = provider_score_p95(provider_score_get(source));
+    int delay = p95 < 0 ? PUBLICIP_FALLBACK_DEFAULT_MS : p95 + p95 / 2;
+    if (delay < PUBLICIP_FALLBACK_MIN_MS) {
+        delay = PUBLICIP_FALLBACK_MIN_MS;
+    }
+    return delay < timeout_ms ? delay : timeout_ms;
+}
+
+// Sources queried, and the answers they gave
+struct race {
+    const struct publicip_config *config;
+    http_loop_t *loop;
+    http_async_t *handles[PUBLICIP_MAX_SOURCES]; // NULL when not running
+    struct http_response responses[PUBLICIP_MAX_SOURCES];
+    long long started[PUBLICIP_MAX_SOURCES];
+    char answers[PUBLICIP_MAX_SOURCES][INET6_ADDRSTRLEN]; // Empty until a valid answer arrives
+    int pending;
+    int waiting;                     // Sources not started yet
+    int order[PUBLICIP_MAX_SOURCES]; // Adaptive mode: the order sources are started in...
+    int next;
+    long long fallback_at; // ...and when the next one joins
+    bool over;
+    char *winner;
+};
+
+static void race_answered(http_async_t *handle, int result, void *user_data);
+
+// Start the request to one source
+static void race_start(struct race *race, int index)
+{
+    const struct publicip_config *config = race->config;
+    race->waiting--;
+    race->started[index] = now_ms();
+    race->handles[index] = http_async_submit(
+        race->loop, config->sources[index], HTTP_GET, NULL, NULL, &race->responses[index], race_answered, race);
+    if (!race->handles[index]) {
+        provider_score_record(config->sources[index], PROVIDER_FAILED, 0);
+        return;
+    }
+    http_async_set_timeout(race->handles[index], config->timeout_ms);
+    race->pending++;
+}
+
+// Start the next source of the adaptive order
+static void race_next(struct race *race)
+{
+    int index = race->order[race->next++];
+    race->fallback_at = now_ms() + publicip_fallback_delay(race->config->sources[index], race->config->timeout_ms);
+    race_start(race, index);
+}
+
+// Stop the requests still running
+static void race_end(struct race *race)
+{
+    race->over = true;
+    for (int i = 0; i < race->config->source_count; i++) {
+        http_async_cancel(race->handles[i]);
+    }
+}
+
+// Matching answers for the most common answer so far
+static int race_best(const struct race *race, int *best_index)
+{
+    int best = 0;
+    for (int i = 0; i < race->config->source_count; i++) {
+        if (race->answers[i][0] == '\0') {
+            continue;
+        }
+        int agree = 0;
+        for (int j = 0; j < race->config->source_count; j++) {
+            agree += strcmp(race->answers[i], race->answers[j]) == 0;
+        }
+        if (agree > best) {
+            best = agree;
+            *best_index = i;
+        }
+    }
+    return best;
+}
+
+// A source answered or failed: score it, and decide once the quorum is met
+// or out of reach
+static void race_answered(http_async_t *handle, int result, void *user_data)
 {
-    struct http_response response;
-    char *result = NULL;
+    struct race *race = user_data;
+    char *const *sources = race->config->sources;
+    int index = 0;
+    while (index < race->config->source_count && race->handles[index] != handle) {
+        index++;
+    }
+    if (index == race->config->source_count) {
+        return;
+    }
+    race->handles[index] = NULL;
+    race->pending--;
+
+    const struct http_response *response = &race->responses[index];
+    if (result == HTTP_ASYNC_CANCELLED) {
+        provider_score_record(sources[index], PROVIDER_OVERTAKEN, (long) (now_ms() - race->started[index]));
+        return;
+    }
+    if (result != 0 || !response->success ||
+        normalize_ip(response->data, response->size, race->answers[index], sizeof(race->answers[index])) != 0) {
+        race->answers[index][0] = '\0';
+        provider_score_record(sources[index], PROVIDER_FAILED, 0);
+        if (!race->over && race->waiting > 0) {
+            race_next(race); // Adaptive mode moves on at once
+        }
+    } else {
+        provider_score_record(sources[index], PROVIDER_ANSWERED, response->timing.total_us / 1000);
+    }
+    if (race->over) {
+        return;
+    }
+
+    int best_index = 0;
+    int best = race_best(race, &best_index);
+    if (best >= race->config->quorum) {
+        race->winner = strdup(race->answers[best_index]);
+        race_end(race);
+    } else if (best + race->pending + race->waiting < race->config->quorum) {
+        race_end(race); // The sources left cannot make up the quorum
+    }
+}
+
+// Start the best source alone, and the next one each time the sources
+// running fail or take longer than their fallback delay
+static void race_adaptive(struct race *race, long long deadline)
+{
+    int order[PUBLICIP_MAX_SOURCES];
+    int count = publicip_rank(race->config, order);
+    int http_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (!is_udp_source(race->config->sources[order[i]])) {
+            race->order[http_count++] = order[i];
+        }
+    }
+    while (!race->over) {
+        long long now = now_ms();
+        if (now >= deadline) {
+            return;
+        }
+        if (race->waiting > 0 && (race->pending == 0 || now >= race->fallback_at)) {
+            race_next(race);
+            continue;
+        }
+        if (race->pending == 0) {
+            return; // Every source failed
+        }
+        long long wake = race->waiting > 0 && race->fallback_at < deadline ? race->fallback_at : deadline;
+        http_loop_run(race->loop, (int) (wake - now));
+    }
+}
+
+// Score how a UDP source fared: answered, overtaken by the others while still
+// waiting, or failed
+static void record_udp(const char *source, bool answered, int rtt_ms, bool overtaken, long long first_sent)
+{
+    if (answered) {
+        provider_score_record(source, PROVIDER_ANSWERED, rtt_ms);
+    } else if (overtaken) {
+        provider_score_record(source, PROVIDER_OVERTAKEN, (long) (now_ms() - first_sent));
+    } else {
+        provider_score_record(source, PROVIDER_FAILED, 0);
+    }
+}
+
+// Ask the gateway on the LAN, before any source on the internet. A gateway
+// that is itself behind NAT (carrier-grade NAT, or a second router) reports
+// a private external address, which counts as a failure.
+static void race_gateway(struct race *race, long long deadline)
+{
+    const struct publicip_config *config = race->config;
+    time_t now = time(NULL);
+    for (int i = 0; i < config->source_count; i++) {
+        const char *source = config->sources[i];
+        if (!gateway_is_uri(source) ||
+            (config->source_count > 1 && !provider_score_healthy(provider_score_get(source), now))) {
+            continue;
+        }
+        struct gateway_options options;
+        long long started = now_ms();
+        char *answer = race->answers[i];
+        bool answered = gateway_options_init(&options, source) == 0 &&
+                        gateway_query(&options, (int) (deadline - started), answer, INET6_ADDRSTRLEN) == 0 &&
+                        ifwatch_is_public(answer);
+        if (!answered) {
+            answer[0] = '\0';
+        }
+        record_udp(source, answered, (int) (now_ms() - started), false, started);
+    }
+}
+
+// Ask the STUN servers and DNS resolvers among the sources, all at once: one
+// UDP round trip each, without TCP or TLS, until wanted of them answered.
+// Their answers count like any other; when they fall short of the quorum the
+// HTTP sources get the time left. Sources that keep failing (UDP filtered, say) are passed over while
+// HTTP sources exist.
+static void race_udp(struct race *race, int wanted, long long deadline)
+{
+    const struct publicip_config *config = race->config;
+    const char *stun_uris[PUBLICIP_MAX_SOURCES];
+    const char *dns_uris[PUBLICIP_MAX_SOURCES];
+    int stun_indices[PUBLICIP_MAX_SOURCES];
+    int dns_indices[PUBLICIP_MAX_SOURCES];
+    int stun_count = 0;
+    int dns_count = 0;
+    time_t now = time(NULL);
+    for (int i = 0; i < config->source_count; i++) {
+        const char *source = config->sources[i];
+        if (race->waiting > 0 && !provider_score_healthy(provider_score_get(source), now)) {
+            continue;
+        }
+        if (stun_is_uri(source)) {
+            stun_uris[stun_count] = source;
+            stun_indices[stun_count++] = i;
+        } else if (dnsip_is_uri(source)) {
+            dns_uris[dns_count] = source;
+            dns_indices[dns_count++] = i;
+        }
+    }
+    if (stun_count + dns_count == 0) {
+        return;
+    }
+
+    long long remaining = deadline - now_ms();
+    if (race->waiting > 0 && remaining > PUBLICIP_UDP_WAIT_MS) {
+        remaining = PUBLICIP_UDP_WAIT_MS;
+    }
+    struct stun_query stun;
+    struct dnsip_query dns;
+    int stun_done = stun_query_start(&stun, stun_uris, stun_count, wanted, (int) remaining);
+    int dns_done = dnsip_query_start(&dns, dns_uris, dns_count, wanted, config->dns_retries, (int) remaining);
+
+    // Both run on one poll() until the quorum could be met or both are finished
+    while (!(stun_done && dns_done) && stun.answered + dns.answered < wanted) {
+        struct pollfd pfds[4];
+        nfds_t nfds = 0;
+        for (int slot = 0; slot < 2; slot++) {
+            int fds[2] = {stun_done ? -1 : stun.sockfd[slot], dns_done ? -1 : dns.sockfd[slot]};
+            for (int k = 0; k < 2; k++) {
+                if (fds[k] >= 0) {
+                    pfds[nfds].fd = fds[k];
+                    pfds[nfds].events = POLLIN;
+                    pfds[nfds].revents = 0;
+                    nfds++;
+                }
+            }
+        }
+        long long wake = stun_done ? LLONG_MAX : stun_query_deadline(&stun);
+        if (!dns_done && dnsip_query_deadline(&dns) < wake) {
+            wake = dnsip_query_deadline(&dns);
+        }
+        long long wait_ms = wake - now_ms();
+        if (poll(pfds, nfds, wait_ms > 0 ? (int) wait_ms : 0) > 0) {
+            stun_done = stun_done || stun_query_read(&stun);
+            dns_done = dns_done || dnsip_query_read(&dns);
+        }
+        stun_done = stun_done || stun_query_check_timeout(&stun);
+        dns_done = dns_done || dnsip_query_check_timeout(&dns);
+    }
+
+    bool settled = stun.answered + dns.answered >= wanted;
+    for (int i = 0; i < stun_count; i++) {
+        const struct stun_server *server = &stun.servers[i];
+        char *answer = race->answers[stun_indices[i]];
+        bool answered = server->answered && server->mapped.family == AF_INET &&
+                        inet_ntop(AF_INET, server->mapped.addr, answer, INET6_ADDRSTRLEN);
+        bool overtaken = settled && !server->done && server->requests > 0;
+        record_udp(stun_uris[i], answered, server->rtt_ms, overtaken, server->first_sent);
+    }
+    for (int i = 0; i < dns_count; i++) {
+        const struct dnsip_server *server = &dns.servers[i];
+        struct in_addr address;
+        bool answered = server->answered && inet_pton(AF_INET, server->address, &address) == 1;
+        if (answered) {
+            memcpy(race->answers[dns_indices[i]], server->address, sizeof(server->address));
+        }
+        bool overtaken = settled && !server->done && server->attempts > 0;
+        record_udp(dns_uris[i], answered, server->rtt_ms, overtaken, server->first_sent);
+    }
+    stun_query_cleanup(&stun);
+    dnsip_query_cleanup(&dns);
+}
+
+// Query the sources
+char *publicip_query(const struct publicip_config *config)
+{
+    // An address on the WAN interface itself needs no source
+    char address[INET6_ADDRSTRLEN];
+    if (config->interface[0] != '\0' &&
+        ifwatch_get_address(config->interface, AF_INET, address, sizeof(address)) == 0) {
+        return strdup(address);
+    }
+
+    scores_ready();
+
+    // A single HTTP source goes through http_request() so the retry policy applies
+    if (config->source_count == 1 && !is_udp_source(config->sources[0])) {
+        struct http_response response;
+        http_response_init(&response);
+        char answer[INET6_ADDRSTRLEN];
+        char *result = NULL;
+        if (http_request(config->sources[0], HTTP_GET, NULL, NULL, &response) == 0 && response.success &&
+            normalize_ip(response.data, response.size, answer, sizeof(answer)) == 0) {
+            result = strdup(answer);
+            provider_score_record(config->sources[0], PROVIDER_ANSWERED, response.timing.total_us / 1000);
+        } else {
+            provider_score_record(config->sources[0], PROVIDER_FAILED, 0);
+        }
+        http_response_free(&response);
+        if (score_path) {
+            provider_scores_save(score_path);
+        }
+        return result;
+    }
 
-    http_response_init(&response);
+    struct race race;
+    memset(&race, 0, sizeof(race));
+    race.config = config;
+    race.loop = http_loop_new();
+    if (!race.loop) {
+        return NULL;
+    }
+    for (int i = 0; i < config->source_count; i++) {
+        http_response_init(&race.responses[i]);
+        race.waiting += !is_udp_source(config->sources[i]);
+    }
 
-    int http_result = http_request("https://ipinfo.io/ip", HTTP_GET, NULL, NULL, &response);
+    long long deadline = now_ms() + config->timeout_ms;
+    race_gateway(&race, deadline);
+    int best_index = 0;
+    int best = race_best(&race, &best_index);
+    if (best < config->quorum) {
+        race_udp(&race, config->quorum - best, deadline);
+        best = race_best(&race, &best_index);
+    }
+    if (best >= config->quorum) {
+        race.winner = strdup(race.answers[best_index]);
+    } else if (best + race.waiting >= config->quorum) {
+        if (config->race || config->quorum > 1) {
+            for (int i = 0; i < config->source_count; i++) {
+                if (!is_udp_source(config->sources[i])) {
+                    race_start(&race, i);
+                }
+            }
+            long long remaining = deadline - now_ms();
+            http_loop_run(race.loop, remaining > 0 ? (int) remaining : 0);
+        } else {
+            race_adaptive(&race, deadline);
+        }
+    }
 
-    if (http_result == 0 && response.success && response.data && response.size > 0) {
-        // Trim any whitespace/newlines from the response
-        const char *trimmed_ip = trim_whitespace(response.data);
-        if (trimmed_ip && strlen(trimmed_ip) > 0) {
-            result = strdup(trimmed_ip);
+    // Requests cancelled once the answer was settled report from the next
+    // run. Those still running at the deadline are cancelled by
+    // http_loop_free(), without their callbacks.
+    http_loop_run(race.loop, 0);
+    for (int i = 0; i < config->source_count; i++) {
+        if (race.handles[i]) {
+            provider_score_record(config->sources[i], PROVIDER_FAILED, 0);
         }
     }
+    http_loop_free(race.loop);
+    for (int i = 0; i < config->source_count; i++) {
+        http_response_free(&race.responses[i]);
+    }
+    if (score_path) {
+        provider_scores_save(score_path);
+    }
+    return race.winner;
+}
 
-    http_response_free(&response);
+// Take the sources from a configuration file
+void publicip_set_config_file(const char *path)
+{
+    free(config_path);
+    config_path = path ? strdup(path) : NULL;
+}
+
+// Keep the provider scores in a state file
+void publicip_set_score_file(const char *path)
+{
+    free(score_path);
+    score_path = path ? strdup(path) : NULL;
+    scores_loaded = false;
+}
+
+// Get the current public IP from the configured sources
+char *get_public_ip(void)
+{
+    struct publicip_config config;
+    int loaded = config_path ? publicip_config_load(&config, config_path) : publicip_config_init(&config);
+    if (loaded != 0) {
+        return NULL;
+    }
+    char *result = publicip_query(&config);
+    publicip_config_free(&config);
     return result;
 }
@@ -1,7 +1,89 @@
 #ifndef PUBLICIP_H
 #define PUBLICIP_H
 
-// Function to get current public IP from ipinfo.io
+#include <net/if.h>
+#include <stdbool.h>
+
+// Most sources queried at once
+#define PUBLICIP_MAX_SOURCES 8
+
+// Queried when the configuration names no source
+#define PUBLICIP_DEFAULT_SOURCE "https://ipinfo.io/ip"
+
+// Time allowed for the sources to answer
+#define PUBLICIP_TIMEOUT_MS 5000
+
+// Time STUN servers and DNS resolvers get to answer before the HTTP sources
+// are asked
+#define PUBLICIP_UDP_WAIT_MS 1500
+
+// State file of the provider scores
+#define PUBLICIP_SCORE_FILE "publicip.scores"
+
+// Wait before falling back to the next source: 1.5 times the 95th percentile
+// of the source's answer times, at least the minimum, or the default while
+// it has no answer times yet
+#define PUBLICIP_FALLBACK_MIN_MS 250
+#define PUBLICIP_FALLBACK_DEFAULT_MS 1000
+
+// Sources of the public IP and how their answers are combined
+struct publicip_config {
+    char *sources[PUBLICIP_MAX_SOURCES]; // HTTP URLs answering with the address as plain text, or UDP sources
+    int source_count;
+    int quorum;                  // Matching answers needed: 1 takes the first valid answer
+    int timeout_ms;              // For all sources together
+    bool race;                   // Start every source at once, even for a quorum of 1
+    int dns_retries;             // Queries resent to a DNS resolver that does not answer
+    char interface[IF_NAMESIZE]; // WAN interface read first, empty for none
+};
+
+// Initialize a configuration with the default source alone.
+// Returns 0, or -1 when memory is exhausted.
+int publicip_config_init(struct publicip_config *config);
+
+// Read IP_SOURCE[n], IP_SOURCE_MODE (adaptive or race), IP_SOURCE_QUORUM,
+// IP_SOURCE_TIMEOUT_MS, IP_SOURCE_DNS_RETRIES and WAN_INTERFACE from a
+// configuration file such as cloudflare.conf; without IP_SOURCE entries the
+// default source is used, and malformed STUN and DNS sources are skipped.
+// Returns 0, or -1 if the file cannot be read or the quorum cannot be met by
+// the sources given.
+int publicip_config_load(struct publicip_config *config, const char *path);
+
+// Free the sources of a configuration
+void publicip_config_free(struct publicip_config *config);
+
+// Query the sources. With a WAN interface that holds a public IPv4 address,
+// that address is the answer and no source is asked; behind NAT it holds a
+// private one and the sources are queried. An answer counts once it parses
+// as an IPv4 address, as it goes into A records; as soon as quorum answers
+// agree the result is returned and the other requests are cancelled. The
+// router ("gateway:") is asked first, then STUN servers ("stun:host[:port]")
+// and DNS resolvers ("dns://resolver/name?type=...") together. Then, with a
+// quorum of 1 and the adaptive mode, the best ranked HTTP source is asked
+// alone, and the next one joins when those running fail or outlast their
+// fallback delay; otherwise every HTTP source is started at once. Each
+// request updates the provider scores.
+// Returns the address (caller frees), or NULL when the sources fail or
+// disagree.
+char *publicip_query(const struct publicip_config *config);
+
+// Fill order[] with the source indices best first: healthy providers before
+// failing ones, providers with answer times (fastest average first) before
+// new ones. Returns the number of sources.
+int publicip_rank(const struct publicip_config *config, int order[]);
+
+// Delay before a source gets company from the next one, in ms
+int publicip_fallback_delay(const char *source, int timeout_ms);
+
+// Keep the provider scores in a state file, loaded on first use and written
+// after every query. Pass NULL to keep them in memory only.
+void publicip_set_score_file(const char *path);
+
+// Take the sources for get_public_ip() from a configuration file.
+// Pass NULL to use the default source alone.
+void publicip_set_config_file(const char *path);
+
+// Get the current public IP from the configured sources
 char *get_public_ip(void);
 
 #endif // PUBLICIP_H
@@ -0,0 +1,148 @@
+#define _POSIX_C_SOURCE 200809L
+#include "schedule.h"
+
+#include "cloudflare_utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Shortest delay between checks in ms, so a settle time already over still waits a little
+#define SCHEDULE_MIN_DELAY_MS 1000
+
+void schedule_policy_init(struct schedule_policy *policy)
+{
+    policy->interval_s = SCHEDULE_INTERVAL_S;
+    policy->min_interval_s = SCHEDULE_MIN_INTERVAL_S;
+    policy->max_interval_s = SCHEDULE_MAX_INTERVAL_S;
+    policy->backoff = SCHEDULE_BACKOFF;
+    policy->jitter_s = SCHEDULE_JITTER_S;
+    policy->settle_s = SCHEDULE_SETTLE_S;
+}
+
+// Parse a number of seconds of at least min into *out. Returns 0, or -1.
+static int parse_seconds(const char *key, const char *value, int min, int *out)
+{
+    char *end = NULL;
+    long seconds = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || seconds < min || seconds > 86400 * 7) {
+        fprintf(stderr, "Warning: Ignoring %s '%s', expected seconds from %d\n", key, value, min);
+        return -1;
+    }
+    *out = (int) seconds;
+    return 0;
+}
+
+int schedule_policy_load(struct schedule_policy *policy, const char *path)
+{
+    schedule_policy_init(policy);
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open config file '%s'\n", path);
+        return -1;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        char *trimmed = trim_whitespace(line);
+        if (*trimmed == '\0' || *trimmed == '#') {
+            continue;
+        }
+        char *equals = strchr(trimmed, '=');
+        if (!equals) {
+            continue;
+        }
+        *equals = '\0';
+        const char *key = trim_whitespace(trimmed);
+        const char *value = trim_whitespace(equals + 1);
+
+        if (strcmp(key, "POLL_INTERVAL") == 0) {
+            parse_seconds(key, value, 1, &policy->interval_s);
+        } else if (strcmp(key, "POLL_INTERVAL_MIN") == 0) {
+            parse_seconds(key, value, 1, &policy->min_interval_s);
+        } else if (strcmp(key, "POLL_INTERVAL_MAX") == 0) {
+            parse_seconds(key, value, 1, &policy->max_interval_s);
+        } else if (strcmp(key, "POLL_JITTER") == 0) {
+            parse_seconds(key, value, 0, &policy->jitter_s);
+        } else if (strcmp(key, "CHANGE_SETTLE") == 0) {
+            parse_seconds(key, value, 0, &policy->settle_s);
+        } else if (strcmp(key, "POLL_BACKOFF") == 0) {
+            char *end = NULL;
+            double backoff = strtod(value, &end);
+            if (end == value || *end != '\0' || backoff < 1.0 || backoff > 16.0) {
+                fprintf(stderr, "Warning: Ignoring POLL_BACKOFF '%s', expected a factor from 1 to 16\n", value);
+                continue;
+            }
+            policy->backoff = backoff;
+        }
+    }
+    fclose(file);
+
+    // Keep the first interval within the bounds
+    if (policy->max_interval_s < policy->min_interval_s) {
+        fprintf(stderr, "Warning: POLL_INTERVAL_MAX is below POLL_INTERVAL_MIN, using %d\n", policy->min_interval_s);
+        policy->max_interval_s = policy->min_interval_s;
+    }
+    if (policy->interval_s < policy->min_interval_s) {
+        policy->interval_s = policy->min_interval_s;
+    } else if (policy->interval_s > policy->max_interval_s) {
+        policy->interval_s = policy->max_interval_s;
+    }
+    return 0;
+}
+
+void schedule_init(struct schedule *schedule, const struct schedule_policy *policy)
+{
+    memset(schedule, 0, sizeof(*schedule));
+    schedule->policy = *policy;
+    schedule->interval_s = policy->interval_s;
+}
+
+schedule_action_t schedule_observe(struct schedule *schedule, const char *ip, const char *published, time_t now)
+{
+    const struct schedule_policy *policy = &schedule->policy;
+    if (published && strcmp(ip, published) == 0) {
+        if (schedule->candidate[0] != '\0') {
+            // Just written, or flapped back: the address is not settled for long yet
+            schedule->candidate[0] = '\0';
+            schedule->interval_s = policy->min_interval_s;
+        } else {
+            double next = schedule->interval_s * policy->backoff;
+            schedule->interval_s = next < policy->max_interval_s ? (int) next : policy->max_interval_s;
+        }
+        return SCHEDULE_KEEP;
+    }
+
+    schedule->interval_s = policy->min_interval_s;
+    if (!published) {
+        // Nothing published yet, so nothing a flap could undo
+        return SCHEDULE_WRITE;
+    }
+    if (strcmp(ip, schedule->candidate) != 0) {
+        snprintf(schedule->candidate, sizeof(schedule->candidate), "%s", ip);
+        schedule->candidate_since = now;
+    }
+    return now - schedule->candidate_since >= policy->settle_s ? SCHEDULE_WRITE : SCHEDULE_WAIT;
+}
+
+void schedule_failed(struct schedule *schedule)
+{
+    schedule->interval_s = schedule->policy.min_interval_s;
+}
+
+long long schedule_next_ms(const struct schedule *schedule, time_t now)
+{
+    const struct schedule_policy *policy = &schedule->policy;
+    long long delay_ms = schedule->interval_s * 1000LL;
+    if (schedule->candidate[0] != '\0') {
+        // Until it settles; a settled change still waiting to be written keeps the interval
+        long long settle_ms = (long long) (schedule->candidate_since + policy->settle_s - now) * 1000;
+        if (settle_ms > 0 && settle_ms < delay_ms) {
+            delay_ms = settle_ms;
+        }
+    } else {
+        delay_ms += (long long) (policy->jitter_s * 1000 * random_fraction());
+    }
+    return delay_ms < SCHEDULE_MIN_DELAY_MS ? SCHEDULE_MIN_DELAY_MS : delay_ms;
+}
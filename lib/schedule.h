@@ -0,0 +1,64 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <time.h>
+
+// Defaults of the policy, in seconds
+#define SCHEDULE_INTERVAL_S 300      // First interval while the IP is stable
+#define SCHEDULE_MIN_INTERVAL_S 30   // Interval after a change or a failed check
+#define SCHEDULE_MAX_INTERVAL_S 3600 // Longest interval the backoff reaches
+#define SCHEDULE_BACKOFF 2.0         // Growth of the interval per stable check
+#define SCHEDULE_JITTER_S 30         // Random delay added while stable
+#define SCHEDULE_SETTLE_S 60         // How long a new IP must hold before it is written
+
+// When to check the public IP and when a change is written, from cloudflare.conf
+struct schedule_policy {
+    int interval_s;     // POLL_INTERVAL
+    int min_interval_s; // POLL_INTERVAL_MIN
+    int max_interval_s; // POLL_INTERVAL_MAX
+    double backoff;     // POLL_BACKOFF
+    int jitter_s;       // POLL_JITTER
+    int settle_s;       // CHANGE_SETTLE: 0 writes every change at once
+};
+
+// State of the polling: the current interval and a new IP waiting to settle
+struct schedule {
+    struct schedule_policy policy;
+    int interval_s;
+    char candidate[64]; // Empty when none
+    time_t candidate_since;
+};
+
+// What to do with the IP seen by a check
+typedef enum {
+    SCHEDULE_KEEP,  // It is the published IP
+    SCHEDULE_WAIT,  // It changed, but has not held for the settle time yet
+    SCHEDULE_WRITE, // It changed and settled: update the records
+} schedule_action_t;
+
+// Fill a policy with the defaults
+void schedule_policy_init(struct schedule_policy *policy);
+
+// Read the POLL_* and CHANGE_SETTLE keys of a configuration file over the
+// defaults. Values out of range are reported and left at their default.
+// Returns 0, or -1 if the file could not be read.
+int schedule_policy_load(struct schedule_policy *policy, const char *path);
+
+// Start polling at the policy's first interval
+void schedule_init(struct schedule *schedule, const struct schedule_policy *policy);
+
+// Take the IP a check found, with the one the records hold (NULL if
+// unknown). An unchanged IP lengthens the interval by the backoff; a change
+// polls fast and is held back until the same IP has been seen for the settle
+// time, so an address flapping back and forth is written once, or never if it
+// returns to the published one.
+schedule_action_t schedule_observe(struct schedule *schedule, const char *ip, const char *published, time_t now);
+
+// A check failed: poll fast until one succeeds
+void schedule_failed(struct schedule *schedule);
+
+// Delay until the next check in ms: the interval (with jitter while stable),
+// or less when a pending change settles sooner
+long long schedule_next_ms(const struct schedule *schedule, time_t now);
+
+#endif // SCHEDULE_H
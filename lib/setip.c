@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include "setip.h"
 
 #include "cloudflare_utils.h"
@@ -8,6 +9,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+// Longest the pool runs its loop before checking for retries that came due
+#define UPDATE_POLL_MS 100
 
 // Helper function to build update JSON
 static struct json_root *build_update_json(const char *ip_address, const char *domain_name)
@@ -32,62 +37,52 @@ static struct json_root *build_update_json(const char *ip_address, const char *d
     return root;
 }
 
-// Set IP in Cloudflare DNS
-int set_cloudflare_ip(const char *config_file, const char *token_file, const char *ip_address, const char *domain_name)
+// PUT of an entry's record, compiled on first use. The update JSON is built
+// once with an empty IP and split there, so each update only adds the IP.
+static const http_template_t *record_update(const cloudflare_config_t *config, cloudflare_entry_t *entry)
 {
-    cloudflare_config_t *config = load_cloudflare_config(config_file, token_file);
-    if (!config) {
-        return 1;
-    }
-
-    // Determine which entry to use
-    const cloudflare_entry_t *entry = NULL;
-    if (domain_name) {
-        entry = find_entry_by_domain(config, domain_name);
-    } else {
-        entry = get_entry_by_index(config, 0);
-    }
-
-    if (!entry) {
-        free_cloudflare_config(config);
-        return 1;
+    if (entry->update) {
+        return entry->update;
     }
 
-    // Build the JSON structure
-    struct json_root *json_root = build_update_json(ip_address, entry->domain_name);
-    if (!json_root) {
-        free_cloudflare_config(config);
-        return 1;
+    struct json_root *json_root = build_update_json("", entry->domain_name);
+    char *json_string = json_root ? json_to_string(json_root) : NULL;
+    free(json_root);
+    char *split = json_string ? strstr(json_string, "\"content\":\"") : NULL;
+    if (!split) {
+        free(json_string);
+        return NULL;
     }
-
-    char *json_string = json_to_string(json_root);
-    if (!json_string) {
-        free_cloudflare_config(config);
-        free(json_root);
-        return 1;
+    split += strlen("\"content\":\"");
+    char *after = strdup(split);
+    if (!after) {
+        free(json_string);
+        return NULL;
     }
-
-    struct http_response response;
-    int result = 1; // Default to failure
-
-    http_response_init(&response);
-
-    // Build headers
-    struct http_header *headers = NULL;
-    char auth_header[512];
-    snprintf(auth_header, sizeof(auth_header), "Bearer %s", config->cloudflare_token);
-    headers = http_header_add(headers, "Authorization", auth_header);
-    headers = http_header_add(headers, "Content-Type", "application/json");
+    *split = '\0';
 
     char url[1024];
     build_cloudflare_dns_url(url, sizeof(url), entry->zone_id, entry->dns_record_id, NULL, NULL);
+    struct http_header *headers = cloudflare_api_headers(config);
+    entry->update = http_template_new(HTTP_PUT, url, headers);
+    http_headers_free(headers);
+    if (!entry->update) {
+        free(json_string);
+        free(after);
+        return NULL;
+    }
+    entry->update_body[0] = json_string;
+    entry->update_body[1] = after;
+    return entry->update;
+}
 
-    // Keep HTTPS for Cloudflare API
-
-    int http_result = http_request(url, HTTP_PUT, json_string, headers, &response);
-    if (http_result == 0 && response.success && response.data) {
+// Whether the response to an update reports the record holding ip_address
+static bool update_succeeded(const struct http_response *response, const char *ip_address)
+{
+    bool result = false;
+    if (response->success && response->data) {
         // Parse the response to check if update was successful
-        struct json_root *response_root = parse_json(response.data);
+        struct json_root *response_root = parse_json(response->data);
         if (response_root) {
             int success_count = 0;
             bool *success_values = get_boolean_values(response_root, "success", &success_count);
@@ -105,7 +100,7 @@ int set_cloudflare_ip(const char *config_file, const char *token_file, const cha
 
                 if (content_values && content_count > 0) {
                     if (strcmp(content_values[0], ip_address) == 0) {
-                        result = 0; // Success
+                        result = true;
                     }
 
                     // Free the content values
@@ -120,11 +115,246 @@ int set_cloudflare_ip(const char *config_file, const char *token_file, const cha
         }
     }
 
-    http_headers_free(headers);
-    http_response_free(&response);
-    free(json_string);
-    free_cloudflare_config(config);
-    free(json_root);
+    return result;
+}
+
+// Set IP in Cloudflare DNS
+int set_cloudflare_ip(const char *config_file, const char *token_file, const char *ip_address, const char *domain_name)
+{
+    cloudflare_config_t *config = cloudflare_config_get(config_file, token_file);
+    if (!config) {
+        return 1;
+    }
+
+    // Determine which entry to use
+    cloudflare_entry_t *entry = NULL;
+    if (domain_name) {
+        entry = find_entry_by_domain(config, domain_name);
+    } else {
+        entry = get_entry_by_index(config, 0);
+    }
 
+    const http_template_t *update = entry ? record_update(config, entry) : NULL;
+    if (!update) {
+        return 1;
+    }
+
+    struct http_response response;
+    int result = 1; // Default to failure
+
+    http_response_init(&response);
+
+    // The compiled body with the IP in the middle
+    struct iovec body[3] = {{entry->update_body[0], strlen(entry->update_body[0])},
+                            {(char *) ip_address, strlen(ip_address)},
+                            {entry->update_body[1], strlen(entry->update_body[1])}};
+    int http_result = http_request_template(update, body, 3, &response);
+    if (http_result == 0 && update_succeeded(&response, ip_address)) {
+        result = 0; // Success
+    }
+
+    http_response_free(&response);
     return result;
 }
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// One update of set_cloudflare_ips()
+struct update_job {
+    struct update_pool *pool;
+    const cloudflare_entry_t *entry;
+    const http_template_t *update; // NULL if the domain is not configured
+    struct iovec body[3];
+    struct http_response response;
+    bool started;       // An attempt is in flight
+    bool done;          // No further attempt follows
+    int attempts;       // Attempts started so far
+    long long retry_at; // When a failed attempt may be repeated (monotonic ms)
+    int result;         // 0 once the record holds the IP
+};
+
+// Updates of set_cloudflare_ips() and the limits on those in flight
+struct update_pool {
+    http_loop_t *loop;
+    struct update_job *jobs;
+    int count;
+    int running;
+    int concurrency;
+    int zone_concurrency;
+    const char *ip_address;
+};
+
+// Updates of a zone in flight
+static int zone_running(const struct update_pool *pool, const char *zone_id)
+{
+    int running = 0;
+    for (int i = 0; i < pool->count; i++) {
+        const struct update_job *job = &pool->jobs[i];
+        if (job->started && !job->done && strcmp(job->entry->zone_id, zone_id) == 0) {
+            running++;
+        }
+    }
+    return running;
+}
+
+static void update_done(http_async_t *handle, int result, void *user_data);
+
+// Start waiting updates that are due in order, as far as the limits allow.
+// Each attempt gets the retry policy's attempt timeout.
+static void pool_fill(struct update_pool *pool)
+{
+    long long now = now_ms();
+    for (int i = 0; i < pool->count && pool->running < pool->concurrency; i++) {
+        struct update_job *job = &pool->jobs[i];
+        if (job->started || job->done || job->retry_at > now ||
+            zone_running(pool, job->entry->zone_id) >= pool->zone_concurrency) {
+            continue;
+        }
+        job->started = true;
+        job->attempts++;
+        http_async_t *handle =
+            http_async_submit_template(pool->loop, job->update, job->body, 3, &job->response, update_done, job);
+        if (!handle) {
+            job->done = true;
+            continue;
+        }
+        http_async_set_timeout(handle, http_retry_attempt_timeout());
+        pool->running++;
+    }
+}
+
+// Delay until the next failed update may be repeated, -1 if none waits
+static long long pool_next_retry(const struct update_pool *pool)
+{
+    long long next = -1;
+    long long now = now_ms();
+    for (int i = 0; i < pool->count; i++) {
+        const struct update_job *job = &pool->jobs[i];
+        if (job->started || job->done) {
+            continue;
+        }
+        long long delay = job->retry_at > now ? job->retry_at - now : 0;
+        if (next < 0 || delay < next) {
+            next = delay;
+        }
+    }
+    return next;
+}
+
+// An attempt ended: a transient failure (connection error, timeout, 429 or
+// 5xx) is queued again after the delay of the retry policy, which honours
+// Retry-After
+static void update_done(http_async_t *handle, int result, void *user_data)
+{
+    (void) handle;
+    struct update_job *job = user_data;
+    struct update_pool *pool = job->pool;
+    job->started = false;
+    pool->running--;
+    if (result == 0 && update_succeeded(&job->response, pool->ip_address)) {
+        job->result = 0;
+        job->done = true;
+    } else {
+        long delay = http_retry_delay(job->update, result, &job->response, job->attempts);
+        if (delay < 0) {
+            job->done = true;
+        } else {
+            job->retry_at = now_ms() + delay;
+            http_response_free(&job->response);
+            http_response_init(&job->response);
+        }
+    }
+    pool_fill(pool);
+}
+
+// Set the IP of several domains concurrently
+int set_cloudflare_ips(const char *config_file,
+                       const char *token_file,
+                       const char *ip_address,
+                       char **domain_names,
+                       int count,
+                       int *results)
+{
+    for (int i = 0; i < count; i++) {
+        results[i] = 1;
+    }
+
+    cloudflare_config_t *config = cloudflare_config_get(config_file, token_file);
+    if (!config || count <= 0) {
+        return 0;
+    }
+
+    struct update_pool pool = {
+        .loop = http_loop_new(),
+        .jobs = calloc((size_t) count, sizeof(struct update_job)),
+        .count = count,
+        .concurrency = config->update_concurrency,
+        .zone_concurrency = config->zone_concurrency,
+        .ip_address = ip_address,
+    };
+    if (!pool.loop || !pool.jobs) {
+        // Without a loop, one at a time
+        http_loop_free(pool.loop);
+        free(pool.jobs);
+        int updated = 0;
+        for (int i = 0; i < count; i++) {
+            results[i] = set_cloudflare_ip(config_file, token_file, ip_address, domain_names[i]);
+            updated += results[i] == 0;
+        }
+        return updated;
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct update_job *job = &pool.jobs[i];
+        job->pool = &pool;
+        job->result = 1;
+        http_response_init(&job->response);
+        cloudflare_entry_t *entry = find_entry_by_domain(config, domain_names[i]);
+        job->update = entry ? record_update(config, entry) : NULL;
+        if (!job->update) {
+            job->done = true;
+            continue;
+        }
+        job->entry = entry;
+        job->body[0] = (struct iovec){entry->update_body[0], strlen(entry->update_body[0])};
+        job->body[1] = (struct iovec){(char *) ip_address, strlen(ip_address)};
+        job->body[2] = (struct iovec){entry->update_body[1], strlen(entry->update_body[1])};
+    }
+
+    // Until every update is done, or the deadline passes with some still in
+    // flight or waiting to be repeated
+    pool_fill(&pool);
+    for (;;) {
+        long long retry = pool_next_retry(&pool);
+        long long left = http_deadline_left();
+        if ((pool.running == 0 && retry < 0) || left == 0) {
+            break;
+        }
+        long long wait = retry >= 0 && (left < 0 || retry < left) ? retry : left;
+        if (pool.running > 0) {
+            // Retries queued by the updates ending meanwhile are started on
+            // time. Updates already due wait for a slot; update_done() starts
+            // them, so the loop still has to wait for I/O rather than spin.
+            http_loop_run(pool.loop, wait <= 0 || wait > UPDATE_POLL_MS ? UPDATE_POLL_MS : (int) wait);
+        } else if (wait > 0) {
+            struct timespec ts = {wait / 1000, (wait % 1000) * 1000000};
+            nanosleep(&ts, NULL);
+        }
+        pool_fill(&pool);
+    }
+    http_loop_free(pool.loop);
+
+    int updated = 0;
+    for (int i = 0; i < count; i++) {
+        results[i] = pool.jobs[i].result;
+        updated += results[i] == 0;
+        http_response_free(&pool.jobs[i].response);
+    }
+    free(pool.jobs);
+    return updated;
+}
@@ -5,4 +5,16 @@
 // Returns 0 on success, 1 on failure
 int set_cloudflare_ip(const char *config_file, const char *token_file, const char *ip_address, const char *domain_name);
 
+// Set the IP of several domains, running updates concurrently on one event
+// loop, within the UPDATE_CONCURRENCY and UPDATE_ZONE_CONCURRENCY limits of
+// the configuration; updates share an HTTP/2 connection when the API speaks
+// it. results[i] receives 0 once the record of domain_names[i] holds
+// ip_address, 1 otherwise. Returns the number of domains updated.
+int set_cloudflare_ips(const char *config_file,
+                       const char *token_file,
+                       const char *ip_address,
+                       char **domain_names,
+                       int count,
+                       int *results);
+
 #endif // SETIP_H
@@ -1,26 +1,257 @@
 #define _POSIX_C_SOURCE 200809L
 #include "socket_http.h"
 
+#include "cloudflare_utils.h"
+#include "dns.h"
+#include "dns_cache.h"
+#include "event_loop.h"
+#include "http2.h"
+#include "http_encoding.h"
+#include "http_parser.h"
+#include "tls_session.h"
+
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <openssl/bio.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
-#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
+// Keep-alive connection pool limits
+#define HTTP_POOL_SIZE 8
+#define HTTP_POOL_IDLE_TIMEOUT 30 // seconds
+
+// Connection establishment limits
+#define HTTP_RESOLVE_TIMEOUT_MS 3000
+#define HTTP_RESOLVE_STALE_TIMEOUT_MS 1000 // When a stale cached answer can be used instead
+#define HTTP_SYSTEM_RESOLVE_TTL 60         // Cache time for getaddrinfo() answers (seconds)
+#define HTTP_CONNECT_TIMEOUT_MS 5000
+#define HTTP_CONNECT_ATTEMPT_DELAY_MS 250 // RFC 8305 Connection Attempt Delay
+
+// Inactivity limit for the TLS handshake, sending and receiving
+#define HTTP_IO_TIMEOUT_MS 5000
+
+// Returned by conn_read() and conn_write() when the connection is not ready
+#define HTTP_IO_AGAIN -2
+
+// Largest part of a request copied into one TLS write
+#define HTTP_TLS_WRITE_SIZE 16384
+
+// Keeps a write to a connection the server closed from raising SIGPIPE.
+// Without MSG_NOSIGNAL (macOS) sockets are given SO_NOSIGPIPE instead.
+#ifdef MSG_NOSIGNAL
+#define HTTP_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define HTTP_SEND_FLAGS 0
+#endif
+
+// Request whose method, URL and headers are compiled once
+struct http_template {
+    http_method_t method;
+    char host[256];
+    int port;
+    bool is_https;
+    char *path;
+    char *head; // Request line, Host and headers, without the blank line
+    size_t head_len;
+    bool accept_encoding;       // The headers choose the accepted encodings
+    struct hpack_field *fields; // The headers again, for HTTP/2
+    int field_count;
+};
+
+// HTTP/1.1 request laid out for one gather write
+struct http_wire {
+    struct iovec iov[2 + HTTP_MAX_BODY_SEGMENTS]; // Head, tail, body
+    int count;
+    size_t len;
+    char tail[96]; // Accept-Encoding, Content-Length and the blank line
+};
+
+// Connection to a host:port, kept open between requests when possible
+struct http_conn {
+    char host[256];
+    int port;
+    bool is_https;
+    int sockfd;
+    SSL *ssl;
+    time_t last_used;
+
+    // HTTP/2 session when the server selected h2. While streams are open the
+    // connection is driven by one loop and shared by its requests.
+    struct http2_session *h2;
+    http_loop_t *loop;
+    struct http_conn *next; // In the loop's list of HTTP/2 connections
+    int events;             // Events watched on sockfd
+    int read_want;          // Events a TLS read is waiting for besides EVENT_READ
+    long long last_read;
+    bool busy; // Streams are being completed, do not release the connection yet
+};
+
+// Progress of an asynchronous request
+typedef enum {
+    HTTP_REQ_RESOLVING,
+    HTTP_REQ_CONNECTING,
+    HTTP_REQ_TLS_HANDSHAKE,
+    HTTP_REQ_SENDING,
+    HTTP_REQ_RECEIVING,
+    HTTP_REQ_WAITING,   // For another request's handshake that may offer an HTTP/2 connection
+    HTTP_REQ_H2_STREAM, // Sent as a stream on an HTTP/2 connection
+    HTTP_REQ_DONE
+} http_req_state_t;
+
+// Asynchronous request, driven by the readiness of its descriptors
+struct http_async_request {
+    http_loop_t *loop;
+    struct http_async_request *next;
+    http_async_cb callback;
+    void *user_data;
+    struct http_response *response;
+
+    char host[256];
+    int port;
+    bool is_https;
+    const struct http_template *tmpl;
+    struct http_template *own_tmpl; // Compiled for this request alone
+    char *own_body;                 // Body copied by http_async_submit()
+    struct http_wire wire;
+    size_t sent;
+
+    http_req_state_t state;
+    int result;
+    bool reused;       // Sent on a pooled connection
+    bool retried;      // Already retried after a stale pooled connection
+    bool fast_open;    // The connection's SYN carried data
+    bool no_fast_open; // Reconnecting after a Fast Open connection failed
+
+    // Name resolution
+    struct dns_query dns;
+    bool dns_active;
+    bool have_stale;
+    struct dns_result stale;
+
+    // Happy Eyeballs connection race
+    struct sockaddr_storage addrs[DNS_MAX_ADDRESSES];
+    socklen_t lengths[DNS_MAX_ADDRESSES];
+    int addr_count;
+    int attempt_fds[DNS_MAX_ADDRESSES];
+    int attempts_started;
+    int attempts_pending;
+    long long next_attempt;
+    long long connect_deadline;
+
+    // Exchange on the connection
+    struct http_conn *conn;
+    int conn_events; // Events watched on conn->sockfd
+    bool offered_session;
+    bool early_data;     // The request goes out as TLS 1.3 early data
+    bool early_accepted; // The server took it
+    size_t early_sent;   // Bytes of the request written as early data
+    struct http_parser parser;
+    bool parser_active;
+    bool received_any;
+    bool keep_alive;
+    long long io_deadline;
+    int connect_timeout_ms;
+    int io_timeout_ms;
+
+    // Phase timings, kept in response->timing
+    long long submitted;
+    long long phase_start; // When the phase in progress began (microseconds)
+    bool first_byte;       // The response has started arriving
+
+    // Stream on an HTTP/2 connection
+    struct http_conn *h2_conn;
+    struct http2_stream *stream;
+
+    // Body delivered to a sink instead of the response
+    http_body_sink sink;
+    void *sink_data;
+    bool paused;                   // The sink asked to stop reading
+    bool resumed;                  // Resumed, picked up by the next loop iteration
+    struct http2_stream *finished; // Stream that finished while paused
+
+    // Decoding of a gzip or deflate body
+    struct http_decoder decoder;
+    bool coding_checked;
+    bool decoding;
+};
+
+// Requests sharing one event loop
+struct http_loop {
+    struct event_loop *events;
+    struct http_async_request *requests;
+    int pending;
+    struct http_conn *h2_conns; // HTTP/2 connections with open streams
+    bool closing;
+};
+
 // Global SSL context
 static SSL_CTX *ssl_ctx = NULL;
 static bool ssl_initialized = false;
 
+// TLS session state file, NULL when sessions are not persisted
+static char *session_cache_path = NULL;
+static bool session_cache_loaded = false;
+
+// DNS cache state file, NULL when answers are only cached in memory
+static char *dns_cache_path = NULL;
+static bool dns_cache_loaded = false;
+
+// Offer h2 with ALPN
+static bool http2_enabled = false;
+
+// Offer gzip/deflate and decode compressed bodies
+static bool compression_enabled = false;
+
+// TCP Fast Open on new connections, TLS 1.3 early data for GETs
+static bool fast_open_enabled = false;
+static bool early_data_enabled = false;
+
+// Receives the timings of every completed request
+static http_timing_cb timing_callback = NULL;
+static void *timing_user_data = NULL;
+
+// Retries of blocking requests, and the deadline they share
+static struct http_retry_policy retry_policy;
+static bool retry_enabled = false;
+static long long run_deadline = 0; // Monotonic milliseconds, 0 for none
+
+// Idle keep-alive connections, NULL for a free slot
+static struct http_conn *conn_pool[HTTP_POOL_SIZE];
+
+// Connection statistics for this process
+static struct http_stats stats;
+
+static void pool_close_all(void);
+static bool h2_conn_revive(struct http_conn *conn);
+static ssize_t conn_write(struct http_conn *conn, const char *data, size_t len, int *want);
+
+// Remember new sessions and TLS 1.3 tickets for the connection's host:port
+static int new_session_cb(SSL *ssl, SSL_SESSION *session)
+{
+    const struct http_conn *conn = SSL_get_app_data(ssl);
+    if (!conn) {
+        return 0;
+    }
+    tls_session_cache_put(conn->host, conn->port, session);
+    return 1; // The cache keeps the reference
+}
+
 // Initialize OpenSSL
 static int init_openssl(void)
 {
@@ -40,6 +271,20 @@ static int init_openssl(void)
     // Set verification mode (for production, you might want stricter verification)
     SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
 
+    // Sessions are cached per host:port by tls_session, not by OpenSSL
+    SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ssl_ctx, new_session_cb);
+
+    // HTTP/2 output grows between retries of a non-blocking write
+    SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    // Writing to a connection the server already closed must fail with
+    // EPIPE instead of killing the process
+    struct sigaction sa;
+    if (sigaction(SIGPIPE, NULL, &sa) == 0 && sa.sa_handler == SIG_DFL) {
+        signal(SIGPIPE, SIG_IGN);
+    }
+
     ssl_initialized = true;
     return 0;
 }
@@ -60,16 +305,39 @@ static void cleanup_openssl(void)
 // cppcheck-suppress unusedFunction
 void http_cleanup(void)
 {
+    pool_close_all();
+    if (session_cache_path) {
+        tls_session_cache_save(session_cache_path);
+    }
+    tls_session_cache_clear();
+    session_cache_loaded = false;
+    if (dns_cache_path) {
+        dns_cache_save(dns_cache_path);
+    }
+    dns_cache_clear();
+    dns_cache_loaded = false;
     cleanup_openssl();
 }
 
+// Persist TLS sessions in a state file so later runs can resume them
+void http_set_session_cache_file(const char *path)
+{
+    free(session_cache_path);
+    session_cache_path = path ? strdup(path) : NULL;
+    session_cache_loaded = false;
+}
+
 // Initialize an HTTP response structure
 void http_response_init(struct http_response *response)
 {
     response->data = NULL;
     response->size = 0;
+    response->encoded_size = 0;
     response->status_code = 0;
     response->success = false;
+    response->retry_after = -1;
+    response->attempts = 0;
+    memset(&response->timing, 0, sizeof(response->timing));
 }
 
 // Free memory allocated for HTTP response
@@ -79,6 +347,7 @@ void http_response_free(struct http_response *response)
         free(response->data);
         response->data = NULL;
         response->size = 0;
+        response->encoded_size = 0;
         response->status_code = 0;
         response->success = false;
     }
@@ -187,356 +456,2915 @@ parse_url(const char *url, char *host, size_t host_size, int *port, char *path,
     return 0;
 }
 
-// Helper function to build HTTP request string
-// cppcheck-suppress staticFunction
-static char *build_http_request(const char *host,
-                                const char *path,
-                                http_method_t method,
-                                const char *body,
-                                struct http_header *headers)
+// Request method as sent on the wire
+static const char *method_name(http_method_t method)
 {
-    // Calculate total size needed
-    size_t total_size = 1024; // Base size for request line and basic headers
-    if (body) {
-        total_size += strlen(body);
+    switch (method) {
+        case HTTP_POST:
+            return "POST";
+        case HTTP_PUT:
+            return "PUT";
+        case HTTP_DELETE:
+            return "DELETE";
+        case HTTP_GET:
+        default:
+            return "GET";
     }
+}
 
-    // Add header sizes
-    struct http_header *h = headers;
-    while (h) {
-        total_size += strlen(h->name) + strlen(h->value) + 4; // ": \r\n"
-        h = h->next;
+// Check whether a header list sets a header (case-insensitive)
+static bool headers_have(const struct http_header *headers, const char *name)
+{
+    for (const struct http_header *h = headers; h; h = h->next) {
+        if (strcasecmp(h->name, name) == 0) {
+            return true;
+        }
     }
+    return false;
+}
 
-    char *request = malloc(total_size);
-    if (!request) {
+// Compile a request: format the HTTP/1.1 head and build the HTTP/2 fields once
+http_template_t *http_template_new(http_method_t method, const char *url, struct http_header *headers)
+{
+    if (!url) {
+        return NULL;
+    }
+    struct http_template *tmpl = calloc(1, sizeof(*tmpl));
+    if (!tmpl) {
+        return NULL;
+    }
+    char path[1024];
+    if (parse_url(url, tmpl->host, sizeof(tmpl->host), &tmpl->port, path, sizeof(path), &tmpl->is_https) != 0) {
+        free(tmpl);
         return NULL;
     }
+    tmpl->method = method;
+    tmpl->accept_encoding = headers_have(headers, "Accept-Encoding");
+
+    size_t head_size = strlen(method_name(method)) + strlen(path) + strlen(tmpl->host) + 32;
+    int count = 0;
+    for (const struct http_header *h = headers; h; h = h->next) {
+        head_size += strlen(h->name) + strlen(h->value) + 4; // ": \r\n"
+        count++;
+    }
 
-    // Build request line
-    const char *method_str = "GET";
-    switch (method) {
-        case HTTP_GET:
-            method_str = "GET";
-            break;
-        case HTTP_POST:
-            method_str = "POST";
-            break;
-        case HTTP_PUT:
-            method_str = "PUT";
-            break;
-        case HTTP_DELETE:
-            method_str = "DELETE";
-            break;
+    if (count > HTTP2_MAX_HEADERS) {
+        free(tmpl); // More than an HTTP/2 stream can carry
+        return NULL;
+    }
+
+    tmpl->path = strdup(path);
+    tmpl->head = malloc(head_size);
+    tmpl->fields = calloc((size_t) (count > 0 ? count : 1), sizeof(struct hpack_field));
+    if (!tmpl->path || !tmpl->head || !tmpl->fields) {
+        http_template_free(tmpl);
+        return NULL;
     }
 
-    int pos = snprintf(request, total_size, "%s %s HTTP/1.1\r\n", method_str, path);
+    int pos = snprintf(tmpl->head, head_size, "%s %s HTTP/1.1\r\nHost: %s\r\n", method_name(method), path, tmpl->host);
+    for (const struct http_header *h = headers; h; h = h->next) {
+        pos += snprintf(tmpl->head + pos, head_size - (size_t) pos, "%s: %s\r\n", h->name, h->value);
+        struct hpack_field *field = &tmpl->fields[tmpl->field_count++];
+        field->name = strdup(h->name);
+        field->value = strdup(h->value);
+        if (!field->name || !field->value) {
+            http_template_free(tmpl);
+            return NULL;
+        }
+    }
+    tmpl->head_len = (size_t) pos;
+    return tmpl;
+}
 
-    // Add Host header
-    pos += snprintf(request + pos, total_size - pos, "Host: %s\r\n", host);
+// Free a template
+void http_template_free(http_template_t *tmpl)
+{
+    if (!tmpl) {
+        return;
+    }
+    if (tmpl->fields) {
+        hpack_fields_free(tmpl->fields, tmpl->field_count);
+        free(tmpl->fields);
+    }
+    free(tmpl->head);
+    free(tmpl->path);
+    free(tmpl);
+}
 
-    // Add custom headers
-    h = headers;
-    while (h && pos < (int) (total_size - 10)) {
-        pos += snprintf(request + pos, total_size - pos, "%s: %s\r\n", h->name, h->value);
-        h = h->next;
+// Pass the timings of a completed request to the timing callback
+static void timing_report(const struct http_template *tmpl, const struct http_response *response)
+{
+    if (!timing_callback) {
+        return;
     }
 
-    // Add Content-Length if there's a body
-    if (body) {
-        pos += snprintf(request + pos, total_size - pos, "Content-Length: %zu\r\n", strlen(body));
+    char port[16] = "";
+    if (tmpl->port != (tmpl->is_https ? 443 : 80)) {
+        snprintf(port, sizeof(port), ":%d", tmpl->port);
     }
+    char url[1400];
+    snprintf(url, sizeof(url), "%s://%s%s%s", tmpl->is_https ? "https" : "http", tmpl->host, port, tmpl->path);
+    timing_callback(method_name(tmpl->method), url, response, timing_user_data);
+}
 
-    // End headers
-    pos += snprintf(request + pos, total_size - pos, "\r\n");
+// Lay out a compiled request for sending: the head, the headers that vary per
+// request and the body segments
+static void wire_build(struct http_wire *wire,
+                       const struct http_template *tmpl,
+                       const struct iovec *body,
+                       int body_count)
+{
+    size_t body_len = 0;
+    for (int i = 0; i < body_count; i++) {
+        body_len += body[i].iov_len;
+    }
 
-    // Add body if present
-    if (body) {
-        strncpy(request + pos, body, total_size - pos - 1);
-        request[total_size - 1] = '\0';
+    // Offer compressed bodies unless the caller chose the encodings
+    int pos = 0;
+    if (compression_enabled && !tmpl->accept_encoding) {
+        pos += snprintf(wire->tail, sizeof(wire->tail), "Accept-Encoding: %s\r\n", HTTP_ACCEPT_ENCODING);
+    }
+    if (body_count > 0) {
+        pos += snprintf(wire->tail + pos, sizeof(wire->tail) - (size_t) pos, "Content-Length: %zu\r\n", body_len);
     }
+    pos += snprintf(wire->tail + pos, sizeof(wire->tail) - (size_t) pos, "\r\n");
+
+    wire->iov[0].iov_base = tmpl->head;
+    wire->iov[0].iov_len = tmpl->head_len;
+    wire->iov[1].iov_base = wire->tail;
+    wire->iov[1].iov_len = (size_t) pos;
+    wire->count = 2;
+    wire->len = tmpl->head_len + (size_t) pos + body_len;
+    for (int i = 0; i < body_count; i++) {
+        wire->iov[wire->count++] = body[i];
+    }
+}
 
-    return request;
+// Close a connection and free it
+static void conn_close(struct http_conn *conn)
+{
+    if (!conn) {
+        return;
+    }
+    if (conn->h2) {
+        // Best-effort GOAWAY so the server does not wait for more streams
+        http2_shutdown(conn->h2);
+        const unsigned char *data;
+        size_t len = http2_pending_output(conn->h2, &data);
+        int want = 0;
+        if (len > 0) {
+            conn_write(conn, (const char *) data, len, &want);
+        }
+        http2_session_free(conn->h2);
+    }
+    if (conn->ssl) {
+        SSL_shutdown(conn->ssl);
+        SSL_free(conn->ssl);
+    }
+    if (conn->sockfd >= 0) {
+        close(conn->sockfd);
+    }
+    free(conn);
 }
 
-// Perform HTTP request using POSIX sockets
-int http_request(const char *url,
-                 http_method_t method,
-                 const char *body,
-                 struct http_header *headers,
-                 struct http_response *response)
+// Check whether an idle pooled connection is still usable.
+// An idle keep-alive socket must not be readable: readability means the
+// server sent a close (EOF / TLS close_notify) or unexpected data.
+// HTTP/2 connections are checked by h2_conn_revive() instead.
+static bool conn_is_alive(const struct http_conn *conn)
 {
-    if (!url || !response) {
-        return -1;
+    struct pollfd pfd;
+    pfd.fd = conn->sockfd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int ready = poll(&pfd, 1, 0);
+    if (ready < 0) {
+        return false;
     }
+    return ready == 0;
+}
 
-    // HTTP request starting
+// Drop pooled connections that have been idle for too long
+static void pool_evict_idle(time_t now)
+{
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        if (conn_pool[i] && now - conn_pool[i]->last_used > HTTP_POOL_IDLE_TIMEOUT) {
+            conn_close(conn_pool[i]);
+            conn_pool[i] = NULL;
+            stats.connections_evicted++;
+        }
+    }
+}
 
-    char host[256];
-    char path[1024];
-    int port;
-    bool is_https;
-    int sockfd = -1;
-    int result = -1;
+// Take an idle connection for host:port out of the pool.
+// Returns NULL if no live connection is available.
+static struct http_conn *pool_acquire(const char *host, int port, bool is_https)
+{
+    pool_evict_idle(time(NULL));
 
-    // Parse URL
-    if (parse_url(url, host, sizeof(host), &port, path, sizeof(path), &is_https) != 0) {
-        return -1;
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        struct http_conn *conn = conn_pool[i];
+        if (!conn || conn->port != port || conn->is_https != is_https || strcmp(conn->host, host) != 0) {
+            continue;
+        }
+
+        conn_pool[i] = NULL;
+        if (conn->h2 ? !h2_conn_revive(conn) : !conn_is_alive(conn)) {
+            // Server closed the idle connection, discard it
+            conn_close(conn);
+            stats.connections_evicted++;
+            continue;
+        }
+
+        return conn;
     }
 
-    // Initialize OpenSSL if needed for HTTPS
-    if (is_https && init_openssl() != 0) {
-        return -1;
+    return NULL;
+}
+
+// Return a connection to the pool for later reuse.
+// When the pool is full the least recently used connection is replaced.
+static void pool_release(struct http_conn *conn)
+{
+    conn->last_used = time(NULL);
+
+    int slot = -1;
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        if (!conn_pool[i]) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 || conn_pool[i]->last_used < conn_pool[slot]->last_used) {
+            slot = i;
+        }
     }
 
-    // SSL initialized
+    if (conn_pool[slot]) {
+        conn_close(conn_pool[slot]);
+        stats.connections_evicted++;
+    }
+    conn_pool[slot] = conn;
+}
 
-    // Create socket
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        return -1;
+// Close every pooled connection
+static void pool_close_all(void)
+{
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        conn_close(conn_pool[i]);
+        conn_pool[i] = NULL;
     }
+}
+
+// Milliseconds on the monotonic clock
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Microseconds on the monotonic clock, for request timings
+static long long now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-    // Set socket timeout (5 seconds)
-    struct timeval timeout;
-    timeout.tv_sec = 5;
-    timeout.tv_usec = 0;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
-        close(sockfd);
+// Days from 1970-01-01 to a date of the proleptic Gregorian calendar
+static long days_from_civil(long year, int month, int day)
+{
+    year -= month <= 2;
+    long era = (year >= 0 ? year : year - 399) / 400;
+    long year_of_era = year - era * 400;
+    long day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    long day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+// Seconds to wait from a Retry-After value: delay-seconds, or an IMF-fixdate
+// such as "Sun, 06 Nov 1994 08:49:37 GMT". Returns -1 if absent or invalid.
+static int parse_retry_after(const char *value)
+{
+    if (!value) {
         return -1;
     }
-    if (setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
-        close(sockfd);
-        return -1;
+    char *end = NULL;
+    long seconds = strtol(value, &end, 10);
+    if (end != value && *end == '\0') {
+        return seconds < 0 ? -1 : seconds > INT_MAX ? INT_MAX : (int) seconds;
     }
 
-    // Get server address
-    const struct hostent *server = gethostbyname(host);
-    if (!server) {
-        close(sockfd);
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month[4];
+    int day;
+    int year;
+    int hour;
+    int minute;
+    int second;
+    if (sscanf(value, "%*3s, %d %3s %d %d:%d:%d GMT", &day, month, &year, &hour, &minute, &second) != 6) {
         return -1;
     }
+    const char *found = strstr(months, month);
+    if (strlen(month) != 3 || !found || (found - months) % 3 != 0) {
+        return -1;
+    }
+    long long at = (long long) days_from_civil(year, (int) (found - months) / 3 + 1, day) * 86400 + hour * 3600 +
+                   minute * 60 + second;
+    long long wait = at - (long long) time(NULL);
+    return wait < 0 ? 0 : wait > INT_MAX ? INT_MAX : (int) wait;
+}
 
-    // Setup server address structure
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    memcpy(&server_addr.sin_addr.s_addr, server->h_addr_list[0], server->h_length);
-
-    // Connect to server
-    if (connect(sockfd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
-        close(sockfd);
+// Resolve host with the system resolver (search domains, NSS, TCP fallback).
+// getaddrinfo() does not report TTLs, so answers get HTTP_SYSTEM_RESOLVE_TTL.
+// This is the only step of a request that blocks, and only runs when the
+// in-tree resolver failed and no cached answer exists.
+static int system_resolve(const char *host, struct dns_result *result)
+{
+    struct addrinfo hints;
+    struct addrinfo *list = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &list) != 0) {
         return -1;
     }
 
-    // Setup SSL connection if HTTPS
-    SSL *ssl = NULL;
-    if (is_https) {
-        ssl = SSL_new(ssl_ctx);
-        if (!ssl) {
-            close(sockfd);
-            return -1;
+    memset(result, 0, sizeof(*result));
+    for (const struct addrinfo *ai = list; ai && result->count < DNS_MAX_ADDRESSES; ai = ai->ai_next) {
+        struct dns_address *entry = &result->addresses[result->count];
+        entry->ttl = HTTP_SYSTEM_RESOLVE_TTL;
+        if (ai->ai_family == AF_INET) {
+            entry->family = AF_INET;
+            memcpy(entry->addr, &((struct sockaddr_in *) ai->ai_addr)->sin_addr, 4);
+            result->count++;
+        } else if (ai->ai_family == AF_INET6) {
+            entry->family = AF_INET6;
+            memcpy(entry->addr, &((struct sockaddr_in6 *) ai->ai_addr)->sin6_addr, 16);
+            result->count++;
         }
+    }
+    freeaddrinfo(list);
+    return result->count > 0 ? 0 : -1;
+}
 
-        if (SSL_set_fd(ssl, sockfd) != 1) {
-            SSL_free(ssl);
-            close(sockfd);
-            return -1;
+// Turn resolved addresses into socket addresses ordered for Happy Eyeballs
+// (RFC 8305): families alternate, starting with IPv6 when it is available.
+// Returns the number of addresses.
+static int order_addresses(const struct dns_result *result,
+                           int port,
+                           struct sockaddr_storage *addrs,
+                           socklen_t *lengths,
+                           int max)
+{
+    int v6[DNS_MAX_ADDRESSES];
+    int v4[DNS_MAX_ADDRESSES];
+    int v6_count = 0;
+    int v4_count = 0;
+    for (int i = 0; i < result->count; i++) {
+        if (result->addresses[i].family == AF_INET6) {
+            v6[v6_count++] = i;
+        } else {
+            v4[v4_count++] = i;
         }
+    }
 
-        if (SSL_connect(ssl) != 1) {
-            SSL_free(ssl);
-            close(sockfd);
-            return -1;
+    int count = 0;
+    for (int i = 0; (i < v6_count || i < v4_count) && count < max; i++) {
+        for (int family = 0; family < 2 && count < max; family++) {
+            int index;
+            if (family == 0 && i < v6_count) {
+                index = v6[i];
+            } else if (family == 1 && i < v4_count) {
+                index = v4[i];
+            } else {
+                continue;
+            }
+
+            const struct dns_address *entry = &result->addresses[index];
+            memset(&addrs[count], 0, sizeof(addrs[count]));
+            if (entry->family == AF_INET6) {
+                struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &addrs[count];
+                sin6->sin6_family = AF_INET6;
+                sin6->sin6_port = htons(port);
+                memcpy(&sin6->sin6_addr, entry->addr, 16);
+                lengths[count] = sizeof(*sin6);
+            } else {
+                struct sockaddr_in *sin = (struct sockaddr_in *) &addrs[count];
+                sin->sin_family = AF_INET;
+                sin->sin_port = htons(port);
+                memcpy(&sin->sin_addr, entry->addr, 4);
+                lengths[count] = sizeof(*sin);
+            }
+            count++;
         }
     }
 
-    // Build HTTP request
-    char *http_request = build_http_request(host, path, method, body, headers);
-    if (!http_request) {
-        if (ssl)
-            SSL_free(ssl);
-        close(sockfd);
+    return count;
+}
+
+// Set or clear O_NONBLOCK on a descriptor
+static int set_nonblocking(int fd, bool enable)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
         return -1;
     }
+    flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(fd, F_SETFL, flags);
+}
 
-    // Send request
-    size_t request_len = strlen(http_request);
-    ssize_t sent;
-    if (ssl) {
-        sent = SSL_write(ssl, http_request, request_len);
-    } else {
-        sent = send(sockfd, http_request, request_len, 0);
+// Events an SSL call is waiting for, 0 if it failed
+static int ssl_want(int error)
+{
+    switch (error) {
+        case SSL_ERROR_WANT_READ:
+            return EVENT_READ;
+        case SSL_ERROR_WANT_WRITE:
+            return EVENT_WRITE;
+        default:
+            return 0;
     }
-    free(http_request);
+}
 
-    if (sent != (ssize_t) request_len) {
-        if (ssl)
-            SSL_free(ssl);
-        close(sockfd);
-        return -1;
+// Write to a connection without blocking. Returns the bytes written,
+// HTTP_IO_AGAIN with *want set when the connection is not ready, or -1.
+static ssize_t conn_write(struct http_conn *conn, const char *data, size_t len, int *want)
+{
+    if (conn->ssl) {
+        int written = SSL_write(conn->ssl, data, (int) len);
+        if (written > 0) {
+            return written;
+        }
+        *want = ssl_want(SSL_get_error(conn->ssl, written));
+        return *want ? HTTP_IO_AGAIN : -1;
     }
 
-    // Receive response
-    char buffer[4096];
-    size_t total_received = 0;
-    char *response_data = NULL;
+    ssize_t written = send(conn->sockfd, data, len, HTTP_SEND_FLAGS);
+    if (written >= 0) {
+        return written;
+    }
+    // EINPROGRESS: a Fast Open connect is still waiting for the SYN-ACK
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == EINPROGRESS) {
+        *want = EVENT_WRITE;
+        return HTTP_IO_AGAIN;
+    }
+    return -1;
+}
 
-    while (1) {
-        ssize_t received;
-        if (ssl) {
-            received = SSL_read(ssl, buffer, sizeof(buffer) - 1);
-        } else {
-            received = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
-        }
+// Copy segments into one buffer, as much as fits. Returns the bytes copied.
+static size_t wire_copy(const struct iovec *iov, int count, char *buffer, size_t size)
+{
+    size_t len = 0;
+    for (int i = 0; i < count && len < size; i++) {
+        size_t n = iov[i].iov_len < size - len ? iov[i].iov_len : size - len;
+        memcpy(buffer + len, iov[i].iov_base, n);
+        len += n;
+    }
+    return len;
+}
 
-        if (received <= 0) {
-            // Check if this is a clean connection close or an error
-            if (ssl) {
-                int ssl_error = SSL_get_error(ssl, received);
-                if (ssl_error == SSL_ERROR_ZERO_RETURN) {
-                    // SSL connection closed cleanly
-                } else {
-                    // SSL error
-                }
-            }
-            break;
+// Write a request laid out in segments, from offset bytes in. A plain socket
+// takes the segments in one sendmsg(); over TLS they are copied into a single
+// SSL_write() so the head and body share records. Returns as conn_write().
+static ssize_t conn_writev(struct http_conn *conn, const struct http_wire *wire, size_t offset, int *want)
+{
+    struct iovec rest[2 + HTTP_MAX_BODY_SEGMENTS];
+    int count = 0;
+    for (int i = 0; i < wire->count; i++) {
+        if (offset >= wire->iov[i].iov_len) {
+            offset -= wire->iov[i].iov_len;
+            continue;
         }
+        rest[count].iov_base = (char *) wire->iov[i].iov_base + offset;
+        rest[count].iov_len = wire->iov[i].iov_len - offset;
+        offset = 0;
+        count++;
+    }
 
-        // Reallocate response buffer
-        char *new_data = realloc(response_data, total_received + received + 1);
-        if (!new_data) {
-            free(response_data);
-            if (ssl)
-                SSL_free(ssl);
-            close(sockfd);
-            return -1;
+    if (conn->ssl) {
+        if (count == 1) {
+            return conn_write(conn, rest[0].iov_base, rest[0].iov_len, want);
         }
-        response_data = new_data;
-
-        // Copy new data directly (don't null-terminate buffer)
-        memcpy(response_data + total_received, buffer, received);
-        total_received += received;
-
-        // For now, just receive all available data without early termination
-        // TODO: Implement proper response completion detection
+        // A retry after SSL_ERROR_WANT_WRITE copies the same bytes again
+        char buffer[HTTP_TLS_WRITE_SIZE];
+        size_t len = wire_copy(rest, count, buffer, sizeof(buffer));
+        return conn_write(conn, buffer, len, want);
     }
 
-    // Null-terminate the response
-    if (response_data) {
-        response_data[total_received] = '\0';
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = rest;
+    msg.msg_iovlen = (size_t) count;
+    ssize_t written = sendmsg(conn->sockfd, &msg, HTTP_SEND_FLAGS);
+    if (written >= 0) {
+        return written;
     }
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == EINPROGRESS) {
+        *want = EVENT_WRITE;
+        return HTTP_IO_AGAIN;
+    }
+    return -1;
+}
 
-    // Response received
-
-    if (ssl)
-        SSL_free(ssl);
-    close(sockfd);
+// Read from a connection without blocking. Returns the bytes read, 0 when
+// the peer closed, HTTP_IO_AGAIN with *want set when no data is ready, or -1.
+static ssize_t conn_read(struct http_conn *conn, char *buffer, size_t len, int *want)
+{
+    if (conn->ssl) {
+        int received = SSL_read(conn->ssl, buffer, len > INT_MAX ? INT_MAX : (int) len);
+        if (received > 0) {
+            return received;
+        }
+        int error = SSL_get_error(conn->ssl, received);
+        if (error == SSL_ERROR_ZERO_RETURN) {
+            return 0;
+        }
+        *want = ssl_want(error);
+        return *want ? HTTP_IO_AGAIN : -1;
+    }
 
-    if (!response_data) {
-        return -1;
+    ssize_t received = recv(conn->sockfd, buffer, len, 0);
+    if (received >= 0) {
+        return received;
     }
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        *want = EVENT_READ;
+        return HTTP_IO_AGAIN;
+    }
+    return -1;
+}
 
-    // Response received successfully
-
-    // Parse HTTP status code (use a copy to avoid modifying original)
-    char *response_copy = strdup(response_data);
-    if (response_copy) {
-        const char *status_line = strtok(response_copy, "\r\n");
-        if (status_line) {
-            // Find status code in "HTTP/1.1 200 OK" format
-            char *status_start = strchr(status_line, ' ');
-            if (status_start) {
-                status_start++; // Skip space
-                char *status_end = strchr(status_start, ' ');
-                if (status_end) {
-                    *status_end = '\0';
-                    response->status_code = atoi(status_start);
-                }
-            }
+// Read what an idle pooled HTTP/2 connection received (SETTINGS, PING,
+// GOAWAY) and check that it still accepts new streams
+static bool h2_conn_revive(struct http_conn *conn)
+{
+    char buffer[4096];
+    for (;;) {
+        int want = 0;
+        ssize_t received = conn_read(conn, buffer, sizeof(buffer), &want);
+        if (received == HTTP_IO_AGAIN) {
+            break;
+        }
+        if (received <= 0 || http2_feed(conn->h2, (const unsigned char *) buffer, (size_t) received) != 0) {
+            return false;
         }
-        free(response_copy);
     }
+    return http2_is_usable(conn->h2);
+}
 
-    // Find start of response body (after \r\n\r\n or \n\n)
-    char *body_start = strstr(response_data, "\r\n\r\n");
-    if (!body_start) {
-        body_start = strstr(response_data, "\n\n");
-        if (body_start) {
-            body_start += 2; // Skip \n\n
+// Write queued frames without blocking. Returns -1 if the connection failed.
+static int h2_conn_flush(struct http_conn *conn)
+{
+    const unsigned char *data;
+    size_t len;
+    while ((len = http2_pending_output(conn->h2, &data)) > 0) {
+        int want = 0;
+        ssize_t written = conn_write(conn, (const char *) data, len, &want);
+        if (written == HTTP_IO_AGAIN) {
+            return 0;
         }
-    } else {
-        body_start += 4; // Skip \r\n\r\n
+        if (written <= 0) {
+            return -1;
+        }
+        http2_output_sent(conn->h2, (size_t) written);
     }
+    return 0;
+}
 
-    if (body_start) {
-        // Check if response uses chunked encoding
-        bool is_chunked = (strstr(response_data, "Transfer-Encoding: chunked") != NULL);
+static void req_start(struct http_async_request *req);
+static void req_on_event(void *ctx, int fd, int events);
+static void h2_conn_on_event(void *ctx, int fd, int events);
+static void h2_conn_settle(struct http_conn *conn);
+static void loop_wake_waiters(const struct http_async_request *leader);
 
-        if (is_chunked) {
-            // Handle chunked encoding
-            char *unchunked_data = NULL;
-            size_t unchunked_size = 0;
-            char *chunk_ptr = body_start;
+// Watch an HTTP/2 connection for frames from the server, and for
+// writability while frames are queued
+static int h2_conn_watch(struct http_conn *conn)
+{
+    const unsigned char *data;
+    int events = EVENT_READ | conn->read_want;
+    if (http2_pending_output(conn->h2, &data) > 0) {
+        events |= EVENT_WRITE;
+    }
+    if (events == conn->events) {
+        return 0;
+    }
+    if (event_loop_watch(conn->loop->events, conn->sockfd, events, h2_conn_on_event, conn) != 0) {
+        return -1;
+    }
+    conn->events = events;
+    return 0;
+}
 
-            while (*chunk_ptr) {
-                // Read chunk size (hex)
-                char *chunk_size_end = strstr(chunk_ptr, "\r\n");
-                if (!chunk_size_end)
-                    break;
+// Let a loop drive an HTTP/2 connection
+static void h2_conn_attach(http_loop_t *loop, struct http_conn *conn)
+{
+    conn->loop = loop;
+    conn->events = 0;
+    conn->read_want = 0;
+    conn->last_read = now_ms();
+    conn->next = loop->h2_conns;
+    loop->h2_conns = conn;
+}
 
-                *chunk_size_end = '\0';
-                long chunk_size = strtol(chunk_ptr, NULL, 16);
-                *chunk_size_end = '\r';
+// Take an HTTP/2 connection out of its loop
+static void h2_conn_detach(struct http_conn *conn)
+{
+    http_loop_t *loop = conn->loop;
+    event_loop_unwatch(loop->events, conn->sockfd);
+    for (struct http_conn **link = &loop->h2_conns; *link; link = &(*link)->next) {
+        if (*link == conn) {
+            *link = conn->next;
+            break;
+        }
+    }
+    conn->next = NULL;
+    conn->loop = NULL;
+    conn->events = 0;
+}
 
-                if (chunk_size == 0)
-                    break; // End of chunks
+// Find a connection of the loop that can take another stream to host:port
+static struct http_conn *loop_find_h2(http_loop_t *loop, const char *host, int port)
+{
+    for (struct http_conn *conn = loop->h2_conns; conn; conn = conn->next) {
+        if (conn->port == port && strcmp(conn->host, host) == 0 && http2_can_submit(conn->h2)) {
+            return conn;
+        }
+    }
+    return NULL;
+}
 
-                // Move to chunk data
-                char *chunk_data = chunk_size_end + 2;
+// Check whether a request is setting up a connection that may negotiate h2
+static bool req_is_leader(const struct http_async_request *req)
+{
+    return req->is_https && http2_enabled &&
+           (req->state == HTTP_REQ_RESOLVING || req->state == HTTP_REQ_CONNECTING ||
+            req->state == HTTP_REQ_TLS_HANDSHAKE);
+}
 
-                // Reallocate buffer for unchunked data
-                char *new_data = realloc(unchunked_data, unchunked_size + chunk_size + 1);
-                if (!new_data) {
-                    free(unchunked_data);
-                    free(response_data);
-                    return -1;
-                }
-                unchunked_data = new_data;
+// Check whether another request of the loop is setting up a connection to the same host:port
+static bool loop_has_leader(const struct http_async_request *req)
+{
+    for (const struct http_async_request *other = req->loop->requests; other; other = other->next) {
+        if (other != req && req_is_leader(other) && other->port == req->port && strcmp(other->host, req->host) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
 
-                // Copy chunk data
-                memcpy(unchunked_data + unchunked_size, chunk_data, chunk_size);
-                unchunked_size += chunk_size;
+// Free the template and body a request owns
+static void req_free_parts(struct http_async_request *req)
+{
+    http_template_free(req->own_tmpl);
+    free(req->own_body);
+    req->own_tmpl = NULL;
+    req->own_body = NULL;
+    req->tmpl = NULL;
+}
 
-                // Move to next chunk
-                chunk_ptr = chunk_data + chunk_size + 2; // Skip chunk data + \r\n
-            }
+// Stop the DNS lookup of a request
+static void req_stop_resolve(struct http_async_request *req)
+{
+    if (!req->dns_active) {
+        return;
+    }
+    for (int slot = 0; slot < 2; slot++) {
+        if (req->dns.sockfd[slot] >= 0) {
+            event_loop_unwatch(req->loop->events, req->dns.sockfd[slot]);
+        }
+    }
+    dns_query_cleanup(&req->dns);
+    req->dns_active = false;
+}
 
-            if (unchunked_data) {
-                unchunked_data[unchunked_size] = '\0';
-                response->data = unchunked_data;
-                response->size = unchunked_size;
-                response->success = (response->status_code >= 200 && response->status_code < 300);
-                result = 0;
-            }
-        } else {
-            // Normal response (not chunked)
-            size_t body_size = strlen(body_start);
-
-            // Allocate new buffer for just the body
-            response->data = malloc(body_size + 1);
-            if (response->data) {
-                strcpy(response->data, body_start);
-                response->size = body_size;
-                response->success = (response->status_code >= 200 && response->status_code < 300);
-                result = 0;
-            }
+// Close every connection attempt still in flight
+static void req_stop_connect(struct http_async_request *req)
+{
+    for (int i = 0; i < req->attempts_started; i++) {
+        if (req->attempt_fds[i] >= 0) {
+            event_loop_unwatch(req->loop->events, req->attempt_fds[i]);
+            close(req->attempt_fds[i]);
+            req->attempt_fds[i] = -1;
         }
-    } else {
-        // No body separator found
     }
+    req->attempts_pending = 0;
+}
 
-    free(response_data);
-    return result;
+// Start decoding the body if the server compressed it, once the response
+// headers are in. Returns -1 for a coding that cannot be decoded.
+static int req_check_coding(struct http_async_request *req, const char *content_encoding)
+{
+    if (req->coding_checked || !compression_enabled) {
+        return 0;
+    }
+    req->coding_checked = true;
+
+    http_coding_t coding;
+    if (http_coding_parse(content_encoding, &coding) != 0) {
+        return -1;
+    }
+    if (coding == HTTP_CODING_IDENTITY) {
+        return 0;
+    }
+    if (http_decoder_init(&req->decoder, coding) != 0) {
+        http_decoder_free(&req->decoder);
+        return -1;
+    }
+    req->decoding = true;
+    return 0;
+}
+
+// Check that a compressed body ended, and give the decoded bytes to the
+// response unless they went to the sink
+static int req_end_decoding(struct http_async_request *req)
+{
+    if (http_decoder_finish(&req->decoder) != 0) {
+        return -1;
+    }
+    if (!req->sink) {
+        req->response->data = http_decoder_take(&req->decoder, &req->response->size);
+        if (!req->response->data) {
+            return -1;
+        }
+    }
+    stats.bytes_compressed += req->response->encoded_size;
+    stats.bytes_decompressed += req->response->size;
+    return 0;
+}
+
+// Add the time since the phase in progress began to *phase and start the next one
+static void req_phase_end(struct http_async_request *req, long *phase)
+{
+    long long now = now_us();
+    *phase += (long) (now - req->phase_start);
+    req->phase_start = now;
+}
+
+// The response started arriving: the wait for the server is over
+static void req_first_byte(struct http_async_request *req)
+{
+    if (!req->first_byte) {
+        req->first_byte = true;
+        req_phase_end(req, &req->response->timing.ttfb_us);
+    }
+}
+
+// Complete a request: release its connection, fill the response and mark it
+// for its callback. On success a reusable connection goes back to the pool.
+static void req_finish(struct http_async_request *req, int result)
+{
+    if (req->state == HTTP_REQ_DONE) {
+        return;
+    }
+
+    bool leading = req_is_leader(req);
+    req_stop_resolve(req);
+    req_stop_connect(req);
+
+    if (req->stream) {
+        http2_cancel(req->h2_conn->h2, req->stream);
+        req->stream = NULL;
+        h2_conn_settle(req->h2_conn);
+    }
+    req->h2_conn = NULL;
+    if (req->finished) {
+        http2_stream_free(req->finished);
+        req->finished = NULL;
+    }
+
+    if (result == 0 && req->parser_active) {
+        req->response->status_code = req->parser.status_code;
+        req->response->retry_after = parse_retry_after(http_parser_get_header(&req->parser, "Retry-After"));
+        if (req->decoding) {
+            result = req_end_decoding(req);
+        } else if (!req->sink) {
+            req->response->data = http_parser_take_body(&req->parser, &req->response->size);
+            req->response->encoded_size = req->response->size;
+            if (!req->response->data) {
+                result = -1;
+            }
+        }
+        req->response->success = result == 0 && req->response->status_code >= 200 && req->response->status_code < 300;
+    }
+    if (req->decoding) {
+        http_decoder_free(&req->decoder);
+        req->decoding = false;
+    }
+
+    if (result != HTTP_ASYNC_CANCELLED) {
+        if (req->first_byte) {
+            req_phase_end(req, &req->response->timing.transfer_us);
+        }
+        req->response->timing.total_us = (long) (now_us() - req->submitted);
+        timing_report(req->tmpl, req->response);
+    }
+
+    if (req->conn) {
+        event_loop_unwatch(req->loop->events, req->conn->sockfd);
+        if (result == 0 && req->keep_alive) {
+            pool_release(req->conn);
+        } else {
+            conn_close(req->conn);
+        }
+        req->conn = NULL;
+    }
+
+    if (req->parser_active) {
+        http_parser_free(&req->parser);
+        req->parser_active = false;
+    }
+
+    req_free_parts(req);
+    req->state = HTTP_REQ_DONE;
+    req->result = result;
+    req->loop->pending--;
+
+    if (leading) {
+        loop_wake_waiters(req);
+    }
+}
+
+// Watch the request's connection for events
+static int req_watch_conn(struct http_async_request *req, int events)
+{
+    if (events == req->conn_events) {
+        return 0;
+    }
+    if (event_loop_watch(req->loop->events, req->conn->sockfd, events, req_on_event, req) != 0) {
+        return -1;
+    }
+    req->conn_events = events;
+    return 0;
+}
+
+// Whether a request that failed on its connection may be sent again: the
+// server may have acted on a POST it got any of, so only GET, PUT and DELETE
+// are repeated once bytes went out
+static bool req_may_resend(const struct http_async_request *req)
+{
+    return req->tmpl->method != HTTP_POST || req->sent == 0;
+}
+
+// A connection opened with TCP Fast Open failed before the server sent
+// anything back, perhaps because a middlebox dropped the SYN with data:
+// reconnect once without Fast Open, if the request may be sent again.
+// Returns false when this does not apply.
+static bool req_fast_open_fallback(struct http_async_request *req)
+{
+    if (!req->fast_open || !req_may_resend(req)) {
+        return false;
+    }
+
+    event_loop_unwatch(req->loop->events, req->conn->sockfd);
+    conn_close(req->conn);
+    req->conn = NULL;
+    req->conn_events = 0;
+    if (req->parser_active) {
+        http_parser_free(&req->parser);
+        req->parser_active = false;
+    }
+
+    stats.fast_open_fallbacks++;
+    req->fast_open = false;
+    req->no_fast_open = true;
+    req_start(req);
+    return true;
+}
+
+// Handle a failed exchange. A pooled connection may have been closed by the
+// server while idle without us noticing yet; in that case nothing was
+// received and the request is retried once on a fresh connection, if it may
+// be sent again.
+static void req_fail_exchange(struct http_async_request *req)
+{
+    // Over TLS the handshake already came back, so Fast Open got through
+    if (!req->conn->ssl && !req->received_any && req_fast_open_fallback(req)) {
+        return;
+    }
+    if (!req->reused || req->received_any || req->retried || !req_may_resend(req)) {
+        req_finish(req, -1);
+        return;
+    }
+
+    event_loop_unwatch(req->loop->events, req->conn->sockfd);
+    conn_close(req->conn);
+    req->conn = NULL;
+    req->conn_events = 0;
+    http_parser_free(&req->parser);
+    req->parser_active = false;
+
+    stats.stale_retries++;
+    req->retried = true;
+    req_start(req);
+}
+
+// Hand decoded body bytes to the request's sink, returns its verdict
+static int req_deliver(struct http_async_request *req, int status, const char *data, size_t len)
+{
+    req->response->status_code = status;
+    req->response->success = status >= 200 && status < 300;
+    if (len == 0) {
+        return HTTP_SINK_CONTINUE;
+    }
+
+    req->response->size += len;
+    int verdict = req->sink(data, len, req->response, req->sink_data);
+    req->paused = verdict == HTTP_SINK_PAUSE;
+    return verdict;
+}
+
+// Decoded output on its way to a sink
+struct piece_context {
+    struct http_async_request *req;
+    int status;
+    int verdict;
+};
+
+// A pause or abort stops the decoder right after the piece
+static int deliver_decoded(const char *data, size_t len, void *user_data)
+{
+    struct piece_context *context = user_data;
+    context->verdict = req_deliver(context->req, context->status, data, len);
+    return context->verdict != HTTP_SINK_CONTINUE;
+}
+
+// Take a piece of the body as received: decode it, then hand it to the sink
+// if there is one. *consumed is set to the bytes taken; the rest is offered
+// again once a paused request resumes. Returns the sink's verdict, or -1 on
+// corrupt compressed data.
+static int req_body_piece(struct http_async_request *req, int status, const char *data, size_t len, size_t *consumed)
+{
+    if (!req->decoding) {
+        *consumed = len;
+        req->response->encoded_size += len;
+        return req_deliver(req, status, data, len);
+    }
+
+    // Without a sink the decoded body is kept whole
+    struct piece_context context = {req, status, HTTP_SINK_CONTINUE};
+    ssize_t used = http_decoder_feed(&req->decoder, data, len, req->sink ? deliver_decoded : NULL, &context);
+    if (used < 0) {
+        return -1;
+    }
+    *consumed = (size_t) used;
+    req->response->encoded_size += (size_t) used;
+    return context.verdict;
+}
+
+// Completion result for a body piece's verdict
+static int piece_result(int verdict)
+{
+    if (verdict < 0) {
+        return -1;
+    }
+    return verdict == HTTP_SINK_ABORT ? HTTP_SINK_ABORTED : 0;
+}
+
+// Pass the body decoded so far on to the content decoder and the sink.
+// Returns -1 when reading stops because the request failed, or the sink
+// aborted or paused it; body bytes not taken yet stay in the parser.
+static int req_stream_body(struct http_async_request *req)
+{
+    if (req->parser.state == HTTP_PARSE_HEAD) {
+        return 0;
+    }
+    if (req_check_coding(req, http_parser_get_header(&req->parser, "Content-Encoding")) != 0) {
+        req_finish(req, -1);
+        return -1;
+    }
+    if (!req->sink && !req->decoding) {
+        return 0;
+    }
+
+    size_t consumed = 0;
+    int verdict = req_body_piece(req, req->parser.status_code, req->parser.body, req->parser.body_len, &consumed);
+    http_parser_consume_body(&req->parser, consumed);
+    if (verdict < 0 || verdict == HTTP_SINK_ABORT) {
+        req_finish(req, piece_result(verdict));
+        return -1;
+    }
+    if (req->paused) {
+        // Unread data stays in the socket buffers, which holds the server back
+        event_loop_unwatch(req->loop->events, req->conn->sockfd);
+        req->conn_events = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// Read the response straight into the parser's buffers until the body is complete
+static void req_receive(struct http_async_request *req)
+{
+    while (!http_parser_is_complete(&req->parser)) {
+        size_t space = 0;
+        char *buffer = http_parser_recv_buffer(&req->parser, &space);
+        if (!buffer) {
+            req_finish(req, -1);
+            return;
+        }
+
+        int want = 0;
+        ssize_t received = conn_read(req->conn, buffer, space, &want);
+        if (received == HTTP_IO_AGAIN) {
+            if (req_watch_conn(req, want) != 0) {
+                req_finish(req, -1);
+            }
+            return;
+        }
+        if (received <= 0) {
+            // Connection closed: only a close-delimited body is complete now
+            if (!req->received_any || http_parser_finish(&req->parser) != 0) {
+                req_fail_exchange(req);
+                return;
+            }
+            req->keep_alive = false;
+            break;
+        }
+        req->received_any = true;
+        req->io_deadline = now_ms() + req->io_timeout_ms;
+        req->response->timing.bytes_received += (size_t) received;
+        req_first_byte(req);
+
+        ssize_t consumed = http_parser_received(&req->parser, (size_t) received, NULL);
+        if (consumed < 0) {
+            req_finish(req, -1);
+            return;
+        }
+
+        // Bytes after the end of the response mean the stream is out of sync
+        req->keep_alive = req->parser.keep_alive && (size_t) consumed == (size_t) received;
+
+        if (req_stream_body(req) != 0) {
+            return;
+        }
+    }
+
+    req_finish(req, 0);
+}
+
+// Write as much of the request as the connection accepts
+static void req_send(struct http_async_request *req)
+{
+    while (req->sent < req->wire.len) {
+        int want = 0;
+        ssize_t sent = conn_writev(req->conn, &req->wire, req->sent, &want);
+        if (sent == HTTP_IO_AGAIN) {
+            if (req_watch_conn(req, want) != 0) {
+                req_finish(req, -1);
+            }
+            return;
+        }
+        if (sent <= 0) {
+            req_fail_exchange(req);
+            return;
+        }
+        req->sent += (size_t) sent;
+        req->io_deadline = now_ms() + req->io_timeout_ms;
+        req->response->timing.bytes_sent += (size_t) sent;
+    }
+
+    req->state = HTTP_REQ_RECEIVING;
+    if (req_watch_conn(req, EVENT_READ) != 0) {
+        req_finish(req, -1);
+    }
+}
+
+// Send the request on an established connection
+static void req_begin_exchange(struct http_async_request *req)
+{
+    http_parser_init(&req->parser);
+    req->parser.streaming = req->sink != NULL;
+    req->parser_active = true;
+    req->sent = req->early_accepted ? req->early_sent : 0;
+    req->received_any = false;
+    req->keep_alive = false;
+    req->first_byte = false;
+    req->phase_start = now_us();
+    req->state = HTTP_REQ_SENDING;
+    req->io_deadline = now_ms() + req->io_timeout_ms;
+    req_send(req);
+}
+
+// Send the request as a stream on an HTTP/2 connection
+static void req_h2_attach(struct http_async_request *req, struct http_conn *conn)
+{
+    char authority[300];
+    if (req->port == 443) {
+        snprintf(authority, sizeof(authority), "%s", req->host);
+    } else {
+        snprintf(authority, sizeof(authority), "%s:%d", req->host, req->port);
+    }
+
+    // The compiled fields, then those that vary per request
+    const struct http_template *tmpl = req->tmpl;
+    struct hpack_field fields[HTTP2_MAX_HEADERS + 2];
+    int field_count = tmpl->field_count;
+    memcpy(fields, tmpl->fields, (size_t) field_count * sizeof(fields[0]));
+    char length[32];
+    int body_count = req->wire.count - 2;
+    size_t body_len = req->wire.len - req->wire.iov[0].iov_len - req->wire.iov[1].iov_len;
+    if (body_count > 0) {
+        snprintf(length, sizeof(length), "%zu", body_len);
+        fields[field_count].name = "content-length";
+        fields[field_count++].value = length;
+    }
+    if (compression_enabled && !tmpl->accept_encoding) {
+        fields[field_count].name = "accept-encoding";
+        fields[field_count++].value = HTTP_ACCEPT_ENCODING;
+    }
+
+    // DATA frames need the body in one piece
+    const struct iovec *body = &req->wire.iov[2];
+    char small[1024];
+    char *joined = body_count > 1 ? (body_len <= sizeof(small) ? small : malloc(body_len)) : NULL;
+    if (joined) {
+        size_t pos = 0;
+        for (int i = 0; i < body_count; i++) {
+            memcpy(joined + pos, body[i].iov_base, body[i].iov_len);
+            pos += body[i].iov_len;
+        }
+    }
+
+    if (body_count <= 1 || joined) {
+        req->stream = http2_submit(conn->h2,
+                                   method_name(tmpl->method),
+                                   "https",
+                                   authority,
+                                   tmpl->path,
+                                   fields,
+                                   field_count,
+                                   joined ? joined : body_count == 1 ? body[0].iov_base : NULL,
+                                   body_len,
+                                   req);
+    }
+    if (joined && joined != small) {
+        free(joined);
+    }
+    if (!req->stream) {
+        req_finish(req, -1);
+        h2_conn_settle(conn);
+        return;
+    }
+    stats.http2_streams++;
+    req->stream->consume_body = req->sink != NULL;
+    req->first_byte = false;
+    req->phase_start = now_us();
+    req->h2_conn = conn;
+    req->state = HTTP_REQ_H2_STREAM;
+    req->io_deadline = now_ms() + req->io_timeout_ms;
+
+    // Frames queued by every request started in this iteration go out in one write
+    if (h2_conn_watch(conn) != 0) {
+        req_finish(req, -1);
+    }
+}
+
+// A stream finished: complete its request, or retry it once when the server
+// did not process it (REFUSED_STREAM, GOAWAY, connection lost before any response)
+static void req_h2_done(struct http_async_request *req, struct http2_stream *stream)
+{
+    req->stream = NULL;
+    req->h2_conn = NULL;
+
+    bool answered = stream->error == HTTP2_NO_ERROR && stream->status > 0;
+    if (answered) {
+        req->response->retry_after = parse_retry_after(http2_stream_header(stream, "retry-after"));
+    }
+    if (answered && req_check_coding(req, http2_stream_header(stream, "content-encoding")) != 0) {
+        req_finish(req, -1);
+    } else if (answered && (req->sink || req->decoding)) {
+        int verdict = HTTP_SINK_CONTINUE;
+        if (!req->paused) {
+            size_t consumed = 0;
+            verdict = req_body_piece(req, stream->status, stream->body, stream->body_len, &consumed);
+            http2_consume(NULL, stream, consumed);
+        }
+        if (req->paused) {
+            // The rest is delivered once the request is resumed
+            req->finished = stream;
+            return;
+        }
+        int result = piece_result(verdict);
+        if (result == 0 && req->decoding) {
+            result = req_end_decoding(req);
+        }
+        req->response->status_code = stream->status;
+        req->response->success = result == 0 && stream->status >= 200 && stream->status < 300;
+        req_finish(req, result);
+    } else if (answered) {
+        req->response->status_code = stream->status;
+        req->response->data = stream->body ? stream->body : strdup("");
+        req->response->size = stream->body_len;
+        req->response->encoded_size = stream->body_len;
+        req->response->success = req->response->status_code >= 200 && req->response->status_code < 300;
+        stream->body = NULL;
+        req_finish(req, req->response->data ? 0 : -1);
+    } else if (stream->retryable && !req->retried && !req->loop->closing) {
+        stats.stale_retries++;
+        req->retried = true;
+        req_start(req);
+    } else {
+        req_finish(req, -1);
+    }
+    http2_stream_free(stream);
+}
+
+// Pass the body received on a stream so far on to the decoder and the sink.
+// The stream's window reopens as the data is taken; a stream the sink aborts
+// is reset while the connection carries on.
+static void req_h2_stream_body(struct http_async_request *req)
+{
+    struct http2_stream *stream = req->stream;
+    if (stream->status == 0) {
+        return;
+    }
+
+    size_t consumed = 0;
+    int verdict = req_body_piece(req, stream->status, stream->body, stream->body_len, &consumed);
+    http2_consume(req->h2_conn->h2, stream, consumed);
+    if (verdict < 0 || verdict == HTTP_SINK_ABORT) {
+        req_finish(req, piece_result(verdict));
+    }
+}
+
+// Complete the requests of finished streams, after passing the data received
+// on streamed ones to their sinks
+static void h2_conn_dispatch(struct http_conn *conn)
+{
+    for (struct http_async_request *req = conn->loop ? conn->loop->requests : NULL; req; req = req->next) {
+        if (req->h2_conn != conn || !req->stream || req->stream->status == 0) {
+            continue;
+        }
+        req_first_byte(req);
+        if (req->stream->done) {
+            continue;
+        }
+        if (req_check_coding(req, http2_stream_header(req->stream, "content-encoding")) != 0) {
+            req_finish(req, -1);
+            continue;
+        }
+        req->stream->consume_body = req->sink || req->decoding;
+        if (req->stream->consume_body && !req->paused) {
+            req_h2_stream_body(req);
+        }
+    }
+
+    struct http2_stream *stream;
+    while ((stream = http2_take_done(conn->h2))) {
+        struct http_async_request *req = stream->user_data;
+        req->response->timing.bytes_sent += stream->bytes_sent;
+        req->response->timing.bytes_received += stream->bytes_received;
+        req_h2_done(req, stream);
+    }
+}
+
+// Flush an HTTP/2 connection and complete its finished streams. Once no
+// stream is open the connection leaves the loop: back to the pool, or closed
+// when it no longer accepts streams.
+static void h2_conn_settle(struct http_conn *conn)
+{
+    if (conn->busy) {
+        return;
+    }
+
+    // Sinks fed by the dispatch reopen stream windows, so the flush follows it
+    conn->busy = true;
+    h2_conn_dispatch(conn);
+    if (h2_conn_flush(conn) != 0 || (http2_active_streams(conn->h2) > 0 && h2_conn_watch(conn) != 0)) {
+        http2_connection_lost(conn->h2);
+        h2_conn_dispatch(conn);
+    }
+    conn->busy = false;
+
+    if (http2_active_streams(conn->h2) > 0) {
+        return;
+    }
+    h2_conn_detach(conn);
+    if (http2_is_usable(conn->h2)) {
+        pool_release(conn);
+    } else {
+        conn_close(conn);
+    }
+}
+
+// Readiness on an HTTP/2 connection: feed the frames received to the session,
+// then write queued frames and complete finished streams
+static void h2_conn_on_event(void *ctx, int fd, int events)
+{
+    struct http_conn *conn = ctx;
+    char buffer[16384];
+    (void) fd;
+    (void) events;
+
+    // TLS records already decrypted do not make the socket readable, so read
+    // until the connection has nothing more
+    conn->busy = true;
+    conn->read_want = 0;
+    for (;;) {
+        int want = 0;
+        ssize_t received = conn_read(conn, buffer, sizeof(buffer), &want);
+        if (received == HTTP_IO_AGAIN) {
+            conn->read_want = want & ~EVENT_READ;
+            break;
+        }
+        if (received <= 0) {
+            http2_connection_lost(conn->h2);
+            break;
+        }
+        conn->last_read = now_ms();
+        if (http2_feed(conn->h2, (const unsigned char *) buffer, (size_t) received) != 0) {
+            break;
+        }
+    }
+    conn->busy = false;
+
+    h2_conn_settle(conn);
+}
+
+// The server selected h2: the connection is shared by the loop's requests to
+// this host:port, starting with this one
+static void req_begin_http2(struct http_async_request *req)
+{
+    struct http_conn *conn = req->conn;
+    conn->h2 = http2_session_new();
+    if (!conn->h2) {
+        req_finish(req, -1);
+        return;
+    }
+    stats.http2_connections++;
+
+    event_loop_unwatch(req->loop->events, conn->sockfd);
+    req->conn = NULL;
+    req->conn_events = 0;
+    h2_conn_attach(req->loop, conn);
+    req_h2_attach(req, conn);
+}
+
+// A request finished setting up its connection, or failed: restart the
+// requests that waited to share it
+static void loop_wake_waiters(const struct http_async_request *leader)
+{
+    http_loop_t *loop = leader->loop;
+    if (loop->closing) {
+        return;
+    }
+    for (struct http_async_request *req = loop->requests; req; req = req->next) {
+        if (req->state == HTTP_REQ_WAITING && req->port == leader->port && strcmp(req->host, leader->host) == 0) {
+            req_start(req);
+        }
+    }
+}
+
+// Give up on a TLS handshake. A cached session the server choked on is dropped.
+static void req_tls_failed(struct http_async_request *req)
+{
+    bool silent = BIO_number_read(SSL_get_rbio(req->conn->ssl)) == 0;
+
+    // Do not send close_notify on a failed handshake
+    SSL_free(req->conn->ssl);
+    req->conn->ssl = NULL;
+    if (silent && req_fast_open_fallback(req)) {
+        return;
+    }
+    if (req->offered_session) {
+        tls_session_cache_remove(req->host, req->port);
+    }
+    req_finish(req, -1);
+}
+
+// Advance the non-blocking TLS handshake
+static void req_tls_step(struct http_async_request *req)
+{
+    struct http_conn *conn = req->conn;
+    if (req->early_data && req->early_sent == 0) {
+        // Goes out right behind the ClientHello; a retry passes the same bytes
+        char buffer[HTTP_TLS_WRITE_SIZE];
+        size_t len = wire_copy(req->wire.iov, req->wire.count, buffer, sizeof(buffer));
+        if (SSL_write_early_data(conn->ssl, buffer, len, &req->early_sent) != 1) {
+            int want = ssl_want(SSL_get_error(conn->ssl, 0));
+            if (!want || req_watch_conn(req, want) != 0) {
+                req_tls_failed(req);
+            }
+            return;
+        }
+        req->response->timing.bytes_sent += req->early_sent;
+    }
+
+    int ret = SSL_connect(conn->ssl);
+    if (ret != 1) {
+        int want = ssl_want(SSL_get_error(conn->ssl, ret));
+        if (!want || req_watch_conn(req, want) != 0) {
+            req_tls_failed(req);
+        }
+        return;
+    }
+    req_phase_end(req, &req->response->timing.tls_us);
+
+    if (req->early_data) {
+        req->early_accepted = SSL_get_early_data_status(conn->ssl) == SSL_EARLY_DATA_ACCEPTED;
+        if (req->early_accepted) {
+            stats.early_data_accepted++;
+        } else {
+            stats.early_data_rejected++;
+        }
+    }
+
+    if (SSL_session_reused(conn->ssl)) {
+        stats.tls_resumed++;
+    } else {
+        stats.tls_full_handshakes++;
+        if (req->offered_session) {
+            // Server declined the cached session, a new one arrives via new_session_cb
+            tls_session_cache_remove(req->host, req->port);
+        }
+    }
+
+    const unsigned char *alpn = NULL;
+    unsigned int alpn_len = 0;
+    SSL_get0_alpn_selected(conn->ssl, &alpn, &alpn_len);
+    if (alpn_len == 2 && memcmp(alpn, "h2", 2) == 0) {
+        req_begin_http2(req);
+    } else {
+        req_begin_exchange(req);
+    }
+    loop_wake_waiters(req);
+}
+
+// Whether a GET may go out as early data on a session being resumed. The
+// whole request must fit the session's limit and one write, and the session
+// must not have been for HTTP/2, which needs its preface and SETTINGS first.
+// OpenSSL also refuses early data when the ALPN list we offer has changed.
+static bool early_data_allowed(const struct http_async_request *req, const SSL_SESSION *session)
+{
+    if (!early_data_enabled || req->tmpl->method != HTTP_GET || req->wire.count != 2) {
+        return false;
+    }
+    if (req->wire.len > SSL_SESSION_get_max_early_data(session) || req->wire.len > HTTP_TLS_WRITE_SIZE) {
+        return false;
+    }
+
+    const unsigned char *alpn = NULL;
+    size_t alpn_len = 0;
+    SSL_SESSION_get0_alpn_selected(session, &alpn, &alpn_len);
+    if (alpn_len == 0) {
+        return !http2_enabled;
+    }
+    return http2_enabled && alpn_len == 8 && memcmp(alpn, "http/1.1", 8) == 0;
+}
+
+// Start the TLS handshake on a connected socket, offering a cached session
+// for this host:port when one is available
+static void req_start_tls(struct http_async_request *req)
+{
+    struct http_conn *conn = req->conn;
+
+    if (session_cache_path && !session_cache_loaded) {
+        tls_session_cache_load(session_cache_path);
+        session_cache_loaded = true;
+    }
+
+    conn->ssl = SSL_new(ssl_ctx);
+    if (!conn->ssl || SSL_set_fd(conn->ssl, conn->sockfd) != 1) {
+        req_finish(req, -1);
+        return;
+    }
+    SSL_set_app_data(conn->ssl, conn);
+
+    // Send SNI so virtual-hosted endpoints pick the right certificate
+    SSL_set_tlsext_host_name(conn->ssl, conn->host);
+
+    if (http2_enabled) {
+        SSL_set_alpn_protos(conn->ssl, (const unsigned char *) HTTP2_ALPN, HTTP2_ALPN_LEN);
+    }
+
+    SSL_SESSION *session = tls_session_cache_get(conn->host, conn->port);
+    req->offered_session = session != NULL;
+    if (session) {
+        SSL_set_session(conn->ssl, session);
+    }
+    req->early_data = session && early_data_allowed(req, session);
+    req->early_accepted = false;
+    req->early_sent = 0;
+
+    stats.tls_handshakes++;
+    req->phase_start = now_us();
+    req->state = HTTP_REQ_TLS_HANDSHAKE;
+    req->io_deadline = now_ms() + req->io_timeout_ms;
+    req_tls_step(req);
+}
+
+// The connection attempt at index won the race: close the others and
+// continue with TLS or the request itself
+static void req_connected(struct http_async_request *req, int index)
+{
+    int fd = req->attempt_fds[index];
+    event_loop_unwatch(req->loop->events, fd);
+    req->attempt_fds[index] = -1;
+    req_stop_connect(req);
+    req_phase_end(req, &req->response->timing.connect_us);
+
+    req->conn = calloc(1, sizeof(struct http_conn));
+    if (!req->conn) {
+        close(fd);
+        req_finish(req, -1);
+        return;
+    }
+    req->conn->sockfd = fd;
+    req->conn->port = req->port;
+    req->conn->is_https = req->is_https;
+    strncpy(req->conn->host, req->host, sizeof(req->conn->host) - 1);
+    req->conn_events = 0;
+    stats.connections_opened++;
+
+    if (req->is_https) {
+        req_start_tls(req);
+    } else {
+        req_begin_exchange(req);
+    }
+}
+
+// Start connection attempts until one is in flight (Happy Eyeballs).
+// A new attempt starts every HTTP_CONNECT_ATTEMPT_DELAY_MS, or immediately
+// when an earlier one fails.
+static void req_next_attempt(struct http_async_request *req)
+{
+    while (req->attempts_started < req->addr_count) {
+        int index = req->attempts_started++;
+        int fd = socket(req->addrs[index].ss_family, SOCK_STREAM, 0);
+        if (fd < 0) {
+            continue;
+        }
+        if (set_nonblocking(fd, true) != 0) {
+            close(fd);
+            continue;
+        }
+#ifdef SO_NOSIGPIPE
+        int no_sigpipe = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &no_sigpipe, sizeof(no_sigpipe));
+#endif
+
+        // With a Fast Open cookie at hand the connect completes at once and
+        // the SYN leaves with the first write
+        bool fast_open = false;
+#ifdef TCP_FASTOPEN_CONNECT
+        int one = 1;
+        fast_open = fast_open_enabled && !req->no_fast_open &&
+                    setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof(one)) == 0;
+#endif
+
+        stats.connect_attempts++;
+        if (connect(fd, (const struct sockaddr *) &req->addrs[index], req->lengths[index]) == 0) {
+            req->fast_open = fast_open;
+            if (fast_open) {
+                stats.fast_open_connects++;
+            }
+            req->attempt_fds[index] = fd;
+            req_connected(req, index);
+            return;
+        }
+        if (errno != EINPROGRESS || event_loop_watch(req->loop->events, fd, EVENT_WRITE, req_on_event, req) != 0) {
+            close(fd);
+            continue;
+        }
+
+        req->attempt_fds[index] = fd;
+        req->attempts_pending++;
+        req->next_attempt = now_ms() + HTTP_CONNECT_ATTEMPT_DELAY_MS;
+        return;
+    }
+
+    if (req->attempts_pending == 0) {
+        req_finish(req, -1); // Every address failed
+    }
+}
+
+// A connection attempt became writable: it either connected or failed
+static void req_attempt_ready(struct http_async_request *req, int fd)
+{
+    for (int i = 0; i < req->attempts_started; i++) {
+        if (req->attempt_fds[i] != fd) {
+            continue;
+        }
+
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == 0 && error == 0) {
+            req_connected(req, i);
+            return;
+        }
+
+        // This address failed, start the next one right away
+        event_loop_unwatch(req->loop->events, fd);
+        close(fd);
+        req->attempt_fds[i] = -1;
+        req->attempts_pending--;
+        req_next_attempt(req);
+        return;
+    }
+}
+
+// Start racing connects across the resolved addresses
+static void req_start_connect(struct http_async_request *req, const struct dns_result *result)
+{
+    req_phase_end(req, &req->response->timing.resolve_us);
+    req->addr_count = order_addresses(result, req->port, req->addrs, req->lengths, DNS_MAX_ADDRESSES);
+    for (int i = 0; i < DNS_MAX_ADDRESSES; i++) {
+        req->attempt_fds[i] = -1;
+    }
+    req->attempts_started = 0;
+    req->attempts_pending = 0;
+    req->state = HTTP_REQ_CONNECTING;
+    req->connect_deadline = now_ms() + req->connect_timeout_ms;
+    req_next_attempt(req);
+}
+
+// The DNS lookup finished. A failed lookup falls back to getaddrinfo() when
+// nothing is cached, otherwise to the stale cached answer.
+static void req_resolved(struct http_async_request *req)
+{
+    struct dns_result result = req->dns.result;
+    req_stop_resolve(req);
+
+    if (result.count > 0 || (!req->have_stale && system_resolve(req->host, &result) == 0)) {
+        dns_cache_store(req->host, &result);
+        req_start_connect(req, &result);
+        return;
+    }
+
+    if (req->have_stale) {
+        stats.dns_stale_answers++;
+        req_start_connect(req, &req->stale);
+        return;
+    }
+    req_finish(req, -1);
+}
+
+// Resolve the host through /etc/hosts, the DNS cache and the in-tree
+// resolver. When only a stale cache entry exists the resolver gets a shorter
+// deadline, and the stale answer is used if it fails.
+static void req_start_resolve(struct http_async_request *req)
+{
+    req->phase_start = now_us();
+    struct dns_result result;
+    if (dns_resolve_local(req->host, &result) == 0) {
+        req_start_connect(req, &result);
+        return;
+    }
+
+    if (dns_cache_path && !dns_cache_loaded) {
+        dns_cache_load(dns_cache_path);
+        dns_cache_loaded = true;
+    }
+
+    dns_cache_status_t cached = dns_cache_lookup(req->host, &result);
+    if (cached == DNS_CACHE_FRESH) {
+        stats.dns_cache_hits++;
+        req_start_connect(req, &result);
+        return;
+    }
+
+    stats.dns_lookups++;
+    req->have_stale = cached == DNS_CACHE_STALE;
+    if (req->have_stale) {
+        req->stale = result;
+    }
+
+    req->state = HTTP_REQ_RESOLVING;
+    req->dns_active = true;
+    int timeout_ms = req->have_stale ? HTTP_RESOLVE_STALE_TIMEOUT_MS : HTTP_RESOLVE_TIMEOUT_MS;
+    if (dns_query_start(&req->dns, req->host, timeout_ms) != 0) {
+        req_resolved(req);
+        return;
+    }
+    for (int slot = 0; slot < 2; slot++) {
+        if (req->dns.sockfd[slot] >= 0 &&
+            event_loop_watch(req->loop->events, req->dns.sockfd[slot], EVENT_READ, req_on_event, req) != 0) {
+            req_finish(req, -1);
+            return;
+        }
+    }
+}
+
+// Start (or restart) a request on a shared HTTP/2 connection, a pooled
+// connection or a new one
+static void req_start(struct http_async_request *req)
+{
+    if (req->is_https && http2_enabled) {
+        struct http_conn *conn = loop_find_h2(req->loop, req->host, req->port);
+        if (conn) {
+            stats.connections_reused++;
+            req->response->timing.reused = true;
+            req_h2_attach(req, conn);
+            return;
+        }
+        // Another request's handshake may bring a connection to share
+        if (loop_has_leader(req)) {
+            req->state = HTTP_REQ_WAITING;
+            return;
+        }
+    }
+
+    req->conn = pool_acquire(req->host, req->port, req->is_https);
+    req->reused = req->conn != NULL;
+    if (req->reused) {
+        stats.connections_reused++;
+        req->response->timing.reused = true;
+        if (req->conn->h2) {
+            struct http_conn *conn = req->conn;
+            req->conn = NULL;
+            h2_conn_attach(req->loop, conn);
+            req_h2_attach(req, conn);
+            return;
+        }
+        req->conn_events = 0;
+        req_begin_exchange(req);
+        return;
+    }
+    req_start_resolve(req);
+}
+
+// Readiness on one of the request's descriptors
+static void req_on_event(void *ctx, int fd, int events)
+{
+    struct http_async_request *req = ctx;
+    (void) events;
+
+    switch (req->state) {
+        case HTTP_REQ_RESOLVING:
+            if (dns_query_read(&req->dns)) {
+                req_resolved(req);
+            }
+            break;
+        case HTTP_REQ_CONNECTING:
+            req_attempt_ready(req, fd);
+            break;
+        case HTTP_REQ_TLS_HANDSHAKE:
+            req_tls_step(req);
+            break;
+        case HTTP_REQ_SENDING:
+            req_send(req);
+            break;
+        case HTTP_REQ_RECEIVING:
+            req_receive(req);
+            break;
+        case HTTP_REQ_WAITING:
+        case HTTP_REQ_H2_STREAM:
+        case HTTP_REQ_DONE:
+            break;
+    }
+}
+
+// Pick up a request resumed after its sink paused it
+static void req_continue(struct http_async_request *req)
+{
+    req->io_deadline = now_ms() + req->io_timeout_ms;
+    if (req->finished) {
+        struct http2_stream *stream = req->finished;
+        req->finished = NULL;
+        req_h2_done(req, stream);
+    } else if (req->stream) {
+        struct http_conn *conn = req->h2_conn;
+        req_h2_stream_body(req);
+        h2_conn_settle(conn);
+    } else if (req->state == HTTP_REQ_RECEIVING) {
+        // Body bytes held back by the pause go first
+        if (req_stream_body(req) != 0) {
+            return;
+        }
+        if (http_parser_is_complete(&req->parser)) {
+            req_finish(req, 0);
+        } else {
+            req_receive(req);
+        }
+    }
+}
+
+// Next timer of a request on the monotonic clock
+static long long req_deadline(const struct http_async_request *req)
+{
+    // A resumed request runs right away, a paused one has no timeout
+    if (req->resumed) {
+        return 0;
+    }
+    if (req->paused) {
+        return LLONG_MAX;
+    }
+
+    switch (req->state) {
+        case HTTP_REQ_RESOLVING:
+            return dns_query_deadline(&req->dns);
+        case HTTP_REQ_CONNECTING:
+            if (req->attempts_started < req->addr_count && req->next_attempt < req->connect_deadline) {
+                return req->next_attempt;
+            }
+            return req->connect_deadline;
+        case HTTP_REQ_TLS_HANDSHAKE:
+        case HTTP_REQ_SENDING:
+        case HTTP_REQ_RECEIVING:
+            return req->io_deadline;
+        case HTTP_REQ_H2_STREAM: {
+            // Frames for other streams also show the connection is alive
+            long long conn_deadline = req->h2_conn->last_read + req->io_timeout_ms;
+            return conn_deadline > req->io_deadline ? conn_deadline : req->io_deadline;
+        }
+        case HTTP_REQ_WAITING:
+        case HTTP_REQ_DONE:
+            break;
+    }
+    return LLONG_MAX;
+}
+
+// Handle expired timers of a request
+static void req_check_timers(struct http_async_request *req, long long now)
+{
+    if (req->resumed) {
+        req->resumed = false;
+        req_continue(req);
+        return;
+    }
+    if (req->paused) {
+        return;
+    }
+
+    switch (req->state) {
+        case HTTP_REQ_RESOLVING:
+            if (dns_query_check_timeout(&req->dns)) {
+                req_resolved(req);
+            }
+            break;
+        case HTTP_REQ_CONNECTING:
+            if (now >= req->connect_deadline) {
+                req_finish(req, -1);
+            } else if (req->attempts_started < req->addr_count && now >= req->next_attempt) {
+                req_next_attempt(req);
+            }
+            break;
+        case HTTP_REQ_TLS_HANDSHAKE:
+            if (now >= req->io_deadline) {
+                req_tls_failed(req);
+            }
+            break;
+        case HTTP_REQ_SENDING:
+            if (now >= req->io_deadline) {
+                req_fail_exchange(req);
+            }
+            break;
+        case HTTP_REQ_RECEIVING:
+            if (now >= req->io_deadline) {
+                // Timed out: only a close-delimited body is complete now
+                if (req->received_any && http_parser_finish(&req->parser) == 0) {
+                    req->keep_alive = false;
+                    req_finish(req, 0);
+                } else {
+                    req_fail_exchange(req);
+                }
+            }
+            break;
+        case HTTP_REQ_H2_STREAM:
+            if (now >= req_deadline(req)) {
+                req_finish(req, -1);
+            }
+            break;
+        case HTTP_REQ_WAITING:
+        case HTTP_REQ_DONE:
+            break;
+    }
+}
+
+// Create an event loop for asynchronous requests
+http_loop_t *http_loop_new(void)
+{
+    http_loop_t *loop = calloc(1, sizeof(http_loop_t));
+    if (!loop) {
+        return NULL;
+    }
+    loop->events = event_loop_new();
+    if (!loop->events) {
+        free(loop);
+        return NULL;
+    }
+    return loop;
+}
+
+// Free a loop, cancelling its pending requests without calling their callbacks
+void http_loop_free(http_loop_t *loop)
+{
+    if (!loop) {
+        return;
+    }
+    loop->closing = true;
+    for (struct http_async_request *req = loop->requests; req; req = req->next) {
+        req_finish(req, HTTP_ASYNC_CANCELLED);
+    }
+    while (loop->requests) {
+        struct http_async_request *next = loop->requests->next;
+        free(loop->requests);
+        loop->requests = next;
+    }
+    while (loop->h2_conns) {
+        struct http_conn *conn = loop->h2_conns;
+        h2_conn_detach(conn);
+        conn_close(conn);
+    }
+    event_loop_free(loop->events);
+    free(loop);
+}
+
+// Queue a compiled request on a loop and start it. The request takes over
+// own_tmpl and own_body (freed on failure too); the template and body
+// segments it does not own must outlive it.
+static struct http_async_request *loop_submit(http_loop_t *loop,
+                                              const struct http_template *tmpl,
+                                              const struct iovec *body,
+                                              int body_count,
+                                              struct http_template *own_tmpl,
+                                              char *own_body,
+                                              struct http_response *response,
+                                              http_async_cb callback,
+                                              void *user_data)
+{
+    // Initialize OpenSSL if needed for HTTPS
+    struct http_async_request *req = NULL;
+    if (body_count <= HTTP_MAX_BODY_SEGMENTS && (!tmpl->is_https || init_openssl() == 0)) {
+        req = calloc(1, sizeof(struct http_async_request));
+    }
+    if (!req) {
+        http_template_free(own_tmpl);
+        free(own_body);
+        return NULL;
+    }
+
+    memcpy(req->host, tmpl->host, sizeof(req->host));
+    req->port = tmpl->port;
+    req->is_https = tmpl->is_https;
+    req->tmpl = tmpl;
+    req->own_tmpl = own_tmpl;
+    req->own_body = own_body;
+    wire_build(&req->wire, tmpl, body, body_count);
+
+    req->loop = loop;
+    req->response = response;
+    req->callback = callback;
+    req->user_data = user_data;
+
+    // Keep submission order so callbacks of requests completing together run in order
+    struct http_async_request **tail = &loop->requests;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = req;
+    loop->pending++;
+    stats.requests++;
+
+    memset(&response->timing, 0, sizeof(response->timing));
+    response->retry_after = -1;
+    req->connect_timeout_ms = HTTP_CONNECT_TIMEOUT_MS;
+    req->io_timeout_ms = HTTP_IO_TIMEOUT_MS;
+    req->submitted = now_us();
+    req_start(req);
+    return req;
+}
+
+// Submit a request to a loop
+http_async_t *http_async_submit(http_loop_t *loop,
+                                const char *url,
+                                http_method_t method,
+                                const char *body,
+                                struct http_header *headers,
+                                struct http_response *response,
+                                http_async_cb callback,
+                                void *user_data)
+{
+    if (!loop || !url || !response) {
+        return NULL;
+    }
+
+    // Compiled for this request alone, with its own copy of the body
+    struct http_template *tmpl = http_template_new(method, url, headers);
+    char *copy = body ? strdup(body) : NULL;
+    if (!tmpl || (body && !copy)) {
+        http_template_free(tmpl);
+        free(copy);
+        return NULL;
+    }
+    struct iovec segment = {copy, body ? strlen(body) : 0};
+    return loop_submit(loop, tmpl, &segment, body ? 1 : 0, tmpl, copy, response, callback, user_data);
+}
+
+// Submit a compiled request to a loop
+http_async_t *http_async_submit_template(http_loop_t *loop,
+                                         const http_template_t *tmpl,
+                                         const struct iovec *body,
+                                         int body_count,
+                                         struct http_response *response,
+                                         http_async_cb callback,
+                                         void *user_data)
+{
+    if (!loop || !tmpl || !response || body_count < 0) {
+        return NULL;
+    }
+    return loop_submit(loop, tmpl, body, body_count, NULL, NULL, response, callback, user_data);
+}
+
+// Cancel a request that has not completed yet
+void http_async_cancel(http_async_t *handle)
+{
+    if (handle) {
+        req_finish(handle, HTTP_ASYNC_CANCELLED);
+    }
+}
+
+// Replace the connect and I/O timeouts of a request
+void http_async_set_timeout(http_async_t *handle, int timeout_ms)
+{
+    if (!handle || handle->state == HTTP_REQ_DONE || timeout_ms <= 0) {
+        return;
+    }
+    handle->connect_timeout_ms = timeout_ms;
+    handle->io_timeout_ms = timeout_ms;
+
+    // The submission already armed the deadline of the phase it started
+    long long now = now_ms();
+    handle->connect_deadline = now + timeout_ms;
+    handle->io_deadline = now + timeout_ms;
+}
+
+// Deliver the body of a request to a sink
+void http_async_set_sink(http_async_t *handle, http_body_sink sink, void *user_data)
+{
+    if (!handle || handle->state == HTTP_REQ_DONE) {
+        return;
+    }
+    handle->sink = sink;
+    handle->sink_data = user_data;
+    if (handle->parser_active) {
+        handle->parser.streaming = sink != NULL;
+    }
+    if (handle->stream) {
+        handle->stream->consume_body = sink != NULL;
+    }
+}
+
+// Resume reading a request paused by its sink
+void http_async_resume(http_async_t *handle)
+{
+    if (handle && handle->paused && handle->state != HTTP_REQ_DONE) {
+        handle->paused = false;
+        handle->resumed = true;
+    }
+}
+
+// Run the callbacks of completed requests and free them
+static void loop_reap(http_loop_t *loop)
+{
+    struct http_async_request *done = NULL;
+    struct http_async_request **done_tail = &done;
+    struct http_async_request **link = &loop->requests;
+    while (*link) {
+        struct http_async_request *req = *link;
+        if (req->state == HTTP_REQ_DONE) {
+            *link = req->next;
+            req->next = NULL;
+            *done_tail = req;
+            done_tail = &req->next;
+        } else {
+            link = &req->next;
+        }
+    }
+
+    // Callbacks may submit new requests to the loop
+    while (done) {
+        struct http_async_request *next = done->next;
+        if (done->callback) {
+            done->callback(done, done->result, done->user_data);
+        }
+        free(done);
+        done = next;
+    }
+}
+
+// Drive the requests of a loop
+int http_loop_run(http_loop_t *loop, int timeout_ms)
+{
+    if (!loop) {
+        return -1;
+    }
+
+    long long deadline = timeout_ms >= 0 ? now_ms() + timeout_ms : LLONG_MAX;
+    for (;;) {
+        loop_reap(loop);
+        if (loop->pending == 0) {
+            return 0;
+        }
+
+        long long now = now_ms();
+        if (now >= deadline) {
+            return loop->pending;
+        }
+
+        long long wake = deadline;
+        for (const struct http_async_request *req = loop->requests; req; req = req->next) {
+            long long next = req_deadline(req);
+            if (next < wake) {
+                wake = next;
+            }
+        }
+        long long wait_ms = wake - now;
+        if (wait_ms < 0) {
+            wait_ms = 0;
+        } else if (wait_ms > INT_MAX) {
+            wait_ms = INT_MAX;
+        }
+
+        if (event_loop_wait(loop->events, (int) wait_ms) < 0) {
+            return -1;
+        }
+
+        now = now_ms();
+        for (struct http_async_request *req = loop->requests; req; req = req->next) {
+            req_check_timers(req, now);
+        }
+    }
+}
+
+// Completion callback of the blocking wrapper
+static void request_done(http_async_t *handle, int result, void *user_data)
+{
+    (void) handle;
+    *(int *) user_data = result;
+}
+
+// Sink of the blocking wrapper, where nothing could resume a paused request
+struct blocking_sink {
+    http_body_sink sink;
+    void *user_data;
+};
+
+static int blocking_sink_deliver(const char *data, size_t len, const struct http_response *response, void *user_data)
+{
+    const struct blocking_sink *target = user_data;
+    int verdict = target->sink(data, len, response, target->user_data);
+    return verdict == HTTP_SINK_PAUSE ? HTTP_SINK_CONTINUE : verdict;
+}
+
+// Time the next blocking attempt may take: the policy's attempt timeout, cut
+// to what is left before the deadline. -1 for no limit, 0 once the deadline passed.
+static int attempt_budget(void)
+{
+    long long budget = http_retry_attempt_timeout() > 0 ? http_retry_attempt_timeout() : -1;
+    long long left = http_deadline_left();
+    if (left >= 0 && (budget < 0 || left < budget)) {
+        budget = left;
+    }
+    return (int) budget;
+}
+
+// Run one attempt of a blocking request on its own loop
+static int request_attempt(const struct http_template *tmpl,
+                           const struct iovec *body,
+                           int body_count,
+                           struct http_response *response,
+                           struct blocking_sink *sink)
+{
+    int budget = attempt_budget();
+    if (budget == 0) {
+        return -1;
+    }
+    http_loop_t *loop = http_loop_new();
+    if (!loop) {
+        return -1;
+    }
+
+    // The template and body outlive the loop, so the request borrows them
+    int result = -1;
+    http_async_t *handle = loop_submit(loop, tmpl, body, body_count, NULL, NULL, response, request_done, &result);
+    if (handle) {
+        if (sink) {
+            http_async_set_sink(handle, blocking_sink_deliver, sink);
+        }
+        if (retry_enabled && retry_policy.attempt_timeout_ms > 0) {
+            http_async_set_timeout(handle, retry_policy.attempt_timeout_ms);
+        }
+        // An attempt still pending at the end of its budget is cancelled with the loop
+        http_loop_run(loop, budget);
+    }
+    http_loop_free(loop);
+    return result;
+}
+
+// Check whether a failed attempt is worth repeating (see struct http_retry_policy)
+static bool attempt_retryable(const struct http_template *tmpl,
+                              int result,
+                              const struct http_response *response,
+                              const struct blocking_sink *sink)
+{
+    if (sink && response->size > 0) {
+        return false; // The sink already has part of the body
+    }
+    int status = response->status_code;
+    if (result == 0) {
+        if (status != 408 && status != 429 && (status < 500 || status == 501 || status == 505)) {
+            return false;
+        }
+    } else if (result != -1) {
+        return false; // Aborted by the sink
+    }
+    if (tmpl->method != HTTP_POST) {
+        return true;
+    }
+    return response->timing.bytes_sent == 0 || (result == 0 && status == 429);
+}
+
+// Delay before retrying after attempt number attempt, -1 when the server asks
+// for a longer wait than the policy allows
+static long retry_delay(int attempt, const struct http_response *response)
+{
+    long backoff = retry_policy.backoff_ms > 0 ? retry_policy.backoff_ms : 1;
+    for (int i = 1; i < attempt && backoff < retry_policy.backoff_max_ms; i++) {
+        backoff *= 2;
+    }
+    if (retry_policy.backoff_max_ms > 0 && backoff > retry_policy.backoff_max_ms) {
+        backoff = retry_policy.backoff_max_ms;
+    }
+    long delay = backoff / 2 + (long) ((backoff - backoff / 2) * random_fraction());
+
+    int status = response->status_code;
+    if ((status == 429 || status == 503) && response->retry_after >= 0) {
+        if ((long long) response->retry_after * 1000 > retry_policy.retry_after_max_ms) {
+            return -1;
+        }
+        if (response->retry_after * 1000L > delay) {
+            delay = response->retry_after * 1000L;
+        }
+    }
+    return delay;
+}
+
+// Delay before the attempt after attempt number attempt, which ended with
+// result, or -1 if the policy does not retry it. A retry is counted.
+static long retry_decide(const struct http_template *tmpl,
+                         int result,
+                         const struct http_response *response,
+                         const struct blocking_sink *sink,
+                         int attempt)
+{
+    if (!retry_enabled || attempt >= retry_policy.max_attempts || !attempt_retryable(tmpl, result, response, sink)) {
+        return -1;
+    }
+    long delay = retry_delay(attempt, response);
+    if (delay < 0 || (run_deadline && now_ms() + delay >= run_deadline)) {
+        return -1;
+    }
+    stats.retries++;
+    return delay;
+}
+
+// Decide whether to retry after attempt number attempt ended with result. If
+// so, wait out the delay and clear the response for the next attempt.
+static bool retry_next(const struct http_template *tmpl,
+                       int result,
+                       struct http_response *response,
+                       const struct blocking_sink *sink,
+                       int attempt)
+{
+    long delay = retry_decide(tmpl, result, response, sink, attempt);
+    if (delay < 0) {
+        return false;
+    }
+
+    struct timespec ts = {delay / 1000, (delay % 1000) * 1000000};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+    http_response_free(response);
+    http_response_init(response);
+    return true;
+}
+
+// Run attempts of a blocking request after the first one, which ended with
+// result, for as long as the retry policy allows
+static int request_retry(const struct http_template *tmpl,
+                         const struct iovec *body,
+                         int body_count,
+                         struct http_response *response,
+                         struct blocking_sink *sink,
+                         int result)
+{
+    response->attempts = 1;
+    for (int attempt = 1; retry_next(tmpl, result, response, sink, attempt); attempt++) {
+        result = request_attempt(tmpl, body, body_count, response, sink);
+        response->attempts = attempt + 1;
+    }
+    return result;
+}
+
+// Run a blocking request, retried as the retry policy allows
+static int request_run(const struct http_template *tmpl,
+                       const struct iovec *body,
+                       int body_count,
+                       struct http_response *response,
+                       struct blocking_sink *sink)
+{
+    int result = request_attempt(tmpl, body, body_count, response, sink);
+    return request_retry(tmpl, body, body_count, response, sink, result);
+}
+
+// Compile a one-off request and run it
+static int request_run_url(const char *url,
+                           http_method_t method,
+                           const char *body,
+                           struct http_header *headers,
+                           struct http_response *response,
+                           struct blocking_sink *sink)
+{
+    if (!url || !response) {
+        return -1;
+    }
+    struct http_template *tmpl = http_template_new(method, url, headers);
+    if (!tmpl) {
+        return -1;
+    }
+    struct iovec segment = {(char *) body, body ? strlen(body) : 0};
+    int result = request_run(tmpl, &segment, body ? 1 : 0, response, sink);
+    http_template_free(tmpl);
+    return result;
+}
+
+// Perform HTTP request using POSIX sockets
+int http_request(const char *url,
+                 http_method_t method,
+                 const char *body,
+                 struct http_header *headers,
+                 struct http_response *response)
+{
+    return request_run_url(url, method, body, headers, response, NULL);
+}
+
+// Perform a compiled request
+int http_request_template(const http_template_t *tmpl,
+                          const struct iovec *body,
+                          int body_count,
+                          struct http_response *response)
+{
+    if (!tmpl || !response) {
+        return -1;
+    }
+    return request_run(tmpl, body, body_count, response, NULL);
+}
+
+// Perform a request delivering the body to a sink
+int http_request_stream(const char *url,
+                        http_method_t method,
+                        const char *body,
+                        struct http_header *headers,
+                        struct http_response *response,
+                        http_body_sink sink,
+                        void *user_data)
+{
+    if (!sink) {
+        return -1;
+    }
+    struct blocking_sink target = {sink, user_data};
+    return request_run_url(url, method, body, headers, response, &target);
+}
+
+// Wait until the connection is ready for events, up to the I/O deadline.
+// Returns 0 when ready, -1 on timeout or error.
+static int conn_wait(const struct http_conn *conn, int events, long long deadline)
+{
+    struct pollfd pfd;
+    pfd.fd = conn->sockfd;
+    pfd.events = (short) (((events & EVENT_READ) ? POLLIN : 0) | ((events & EVENT_WRITE) ? POLLOUT : 0));
+    pfd.revents = 0;
+
+    long long wait_ms = deadline - now_ms();
+    if (wait_ms <= 0) {
+        return -1;
+    }
+    int ready = poll(&pfd, 1, (int) wait_ms);
+    if (ready < 0 && errno == EINTR) {
+        return 0;
+    }
+    return ready > 0 ? 0 : -1;
+}
+
+// Decode a compressed pipelined body once it is complete
+static int batch_decode(struct http_response *response, const char *content_encoding)
+{
+    http_coding_t coding;
+    if (http_coding_parse(content_encoding, &coding) != 0) {
+        return -1;
+    }
+    if (coding == HTTP_CODING_IDENTITY) {
+        return 0;
+    }
+
+    struct http_decoder decoder;
+    int result = http_decoder_init(&decoder, coding);
+    if (result == 0) {
+        result = http_decoder_feed(&decoder, response->data, response->size, NULL, NULL) < 0 ? -1 : 0;
+    }
+    if (result == 0) {
+        result = http_decoder_finish(&decoder);
+    }
+    char *data = NULL;
+    size_t size = 0;
+    if (result == 0 && !(data = http_decoder_take(&decoder, &size))) {
+        result = -1;
+    }
+    http_decoder_free(&decoder);
+    if (result != 0) {
+        return -1;
+    }
+
+    stats.bytes_compressed += response->size;
+    stats.bytes_decompressed += size;
+    free(response->data);
+    response->data = data;
+    response->size = size;
+    return 0;
+}
+
+// Move a complete response out of the parser into a batch entry
+static void batch_complete(struct http_batch_request *request, struct http_parser *parser)
+{
+    request->response.status_code = parser->status_code;
+    request->response.retry_after = parse_retry_after(http_parser_get_header(parser, "Retry-After"));
+    request->response.data = http_parser_take_body(parser, &request->response.size);
+    request->response.encoded_size = request->response.size;
+    request->result = request->response.data ? 0 : -1;
+    if (request->result == 0 && compression_enabled) {
+        request->result = batch_decode(&request->response, http_parser_get_header(parser, "Content-Encoding"));
+    }
+    request->response.success =
+        request->result == 0 && request->response.status_code >= 200 && request->response.status_code < 300;
+}
+
+// Fill in the timings of a pipelined request just answered and report them.
+// Its connection was already open, so only the exchange is timed.
+static void pipeline_timing(struct http_batch_request *request,
+                            const struct http_template *tmpl,
+                            long long started,
+                            long long first_byte,
+                            size_t received)
+{
+    struct http_timing *timing = &request->response.timing;
+    long long now = now_us();
+    timing->ttfb_us = (long) (first_byte - started);
+    timing->transfer_us = (long) (now - first_byte);
+    timing->total_us = (long) (now - started);
+    timing->bytes_received = received;
+    timing->reused = true;
+    timing_report(tmpl, &request->response);
+}
+
+// Deadline of the next read or write of a pipeline: the time an attempt may
+// take under the retry policy and run deadline, or the default I/O timeout
+static long long pipeline_io_deadline(void)
+{
+    int budget = attempt_budget();
+    return now_ms() + (budget < 0 ? HTTP_IO_TIMEOUT_MS : budget);
+}
+
+// Write GETs back-to-back on one connection, keeping up to depth of them
+// unanswered, and read the responses in order. Stops when every request is
+// answered or the server closes the connection, and returns the number of
+// requests answered. The connection is pooled again if it is still usable.
+static int pipeline_run(struct http_conn *conn,
+                        struct http_batch_request *requests,
+                        int count,
+                        struct http_header *headers,
+                        int depth)
+{
+    if (attempt_budget() == 0) {
+        pool_release(conn);
+        return 0; // The run deadline passed
+    }
+
+    // Entries not compiled by the caller are compiled here
+    struct http_wire *wire = calloc((size_t) count, sizeof(struct http_wire));
+    const struct http_template **tmpl = calloc((size_t) count, sizeof(struct http_template *));
+    struct http_template **owned = calloc((size_t) count, sizeof(struct http_template *));
+    long long *started = calloc((size_t) count, sizeof(long long));
+    if (!wire || !tmpl || !owned || !started) {
+        free(wire);
+        free((void *) tmpl);
+        free((void *) owned);
+        free(started);
+        pool_release(conn);
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        tmpl[i] = requests[i].compiled;
+        if (!tmpl[i] && !(tmpl[i] = owned[i] = http_template_new(HTTP_GET, requests[i].url, headers))) {
+            count = i; // Only pipeline the requests before this one
+            break;
+        }
+        wire_build(&wire[i], tmpl[i], NULL, 0);
+    }
+
+    struct http_parser parser;
+    http_parser_init(&parser);
+    int sent = 0;      // Requests completely written
+    size_t offset = 0; // Bytes of requests[sent] written
+    int answered = 0;
+    bool usable = true;
+    long long io_deadline = pipeline_io_deadline();
+    long long first_byte = 0; // When the response being read started arriving
+    size_t response_bytes = 0;
+
+    while (usable && answered < count) {
+        int want = 0;
+
+        // Fill the window
+        while (sent < count && sent - answered < depth) {
+            size_t len = wire[sent].len;
+            if (offset == 0 && started[sent] == 0) {
+                started[sent] = now_us();
+            }
+            int write_want = 0;
+            ssize_t written = conn_writev(conn, &wire[sent], offset, &write_want);
+            if (written == HTTP_IO_AGAIN) {
+                want |= write_want;
+                break;
+            }
+            if (written <= 0) {
+                usable = false;
+                break;
+            }
+            offset += (size_t) written;
+            io_deadline = pipeline_io_deadline();
+            if (offset == len) {
+                stats.requests++;
+                stats.connections_reused++;
+                requests[sent].response.timing.bytes_sent = len;
+                sent++;
+                offset = 0;
+            }
+        }
+
+        // Read responses to the requests written so far
+        while (usable && answered < sent) {
+            size_t space = 0;
+            char *buffer = http_parser_recv_buffer(&parser, &space);
+            if (!buffer) {
+                usable = false;
+                break;
+            }
+
+            int read_want = 0;
+            ssize_t received = conn_read(conn, buffer, space, &read_want);
+            if (received == HTTP_IO_AGAIN) {
+                want |= read_want;
+                break;
+            }
+            if (received <= 0) {
+                // Server closed the pipeline: only a close-delimited body is complete now
+                if (parser.state != HTTP_PARSE_HEAD && http_parser_finish(&parser) == 0) {
+                    batch_complete(&requests[answered], &parser);
+                    pipeline_timing(&requests[answered], tmpl[answered], started[answered], first_byte, response_bytes);
+                    answered++;
+                    stats.requests_pipelined++;
+                }
+                usable = false;
+                break;
+            }
+            io_deadline = pipeline_io_deadline();
+            long long read_at = now_us();
+            if (!first_byte) {
+                first_byte = read_at;
+            }
+
+            const char *rest = NULL;
+            ssize_t consumed = http_parser_received(&parser, (size_t) received, &rest);
+            if (consumed < 0) {
+                usable = false;
+                break;
+            }
+            response_bytes += (size_t) consumed;
+
+            // Bytes past this response belong to the next ones. They are copied
+            // out before the body is taken, which terminates it in place.
+            size_t extra_len = (size_t) received - (size_t) consumed;
+            char *extra = extra_len > 0 ? malloc(extra_len) : NULL;
+            if (extra_len > 0 && !extra) {
+                usable = false;
+                break;
+            }
+            if (extra) {
+                memcpy(extra, rest, extra_len);
+            }
+
+            size_t pos = 0;
+            while (http_parser_is_complete(&parser)) {
+                bool keep_alive = parser.keep_alive;
+                batch_complete(&requests[answered], &parser);
+                pipeline_timing(&requests[answered], tmpl[answered], started[answered], first_byte, response_bytes);
+                answered++;
+                stats.requests_pipelined++;
+                first_byte = 0;
+                response_bytes = 0;
+                http_parser_free(&parser);
+                http_parser_init(&parser);
+
+                // After Connection: close the remaining requests are dropped, and
+                // bytes beyond the last request written mean the stream is out of sync
+                if (!keep_alive || (answered == sent && pos < extra_len)) {
+                    usable = false;
+                    break;
+                }
+                if (pos == extra_len) {
+                    break;
+                }
+                first_byte = read_at;
+                consumed = http_parser_feed(&parser, extra + pos, extra_len - pos);
+                if (consumed < 0) {
+                    usable = false;
+                    break;
+                }
+                pos += (size_t) consumed;
+                response_bytes += (size_t) consumed;
+            }
+            free(extra);
+        }
+
+        if (usable && answered < count && want && conn_wait(conn, want, io_deadline) != 0) {
+            usable = false;
+        }
+    }
+
+    http_parser_free(&parser);
+    for (int i = 0; i < count; i++) {
+        http_template_free(owned[i]);
+    }
+    free((void *) owned);
+    free((void *) tmpl);
+    free(started);
+    free(wire);
+
+    if (usable) {
+        pool_release(conn);
+    } else {
+        conn_close(conn);
+    }
+    return answered;
+}
+
+// Run one batch entry as a standalone request
+static void batch_single(struct http_batch_request *request, struct http_header *headers)
+{
+    if (request->compiled) {
+        request->result = http_request_template(request->compiled, NULL, 0, &request->response);
+    } else {
+        request->result = http_request(request->url, HTTP_GET, NULL, headers, &request->response);
+    }
+}
+
+// Run batch entries concurrently on one loop, as streams of the pooled HTTP/2 connection
+static void batch_multiplexed(struct http_batch_request *requests, int count, struct http_header *headers)
+{
+    http_loop_t *loop = http_loop_new();
+    if (!loop) {
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        struct http_response *response = &requests[i].response;
+        if (requests[i].compiled) {
+            loop_submit(loop, requests[i].compiled, NULL, 0, NULL, NULL, response, request_done, &requests[i].result);
+        } else {
+            http_async_submit(loop,
+                              requests[i].url,
+                              HTTP_GET,
+                              NULL,
+                              headers,
+                              response,
+                              request_done,
+                              &requests[i].result);
+        }
+    }
+    http_loop_run(loop, attempt_budget());
+    http_loop_free(loop);
+}
+
+// Give a batch entry that failed in a pipeline or on a multiplexed connection
+// the retries of a single request
+static void batch_retry(struct http_batch_request *request, struct http_header *headers)
+{
+    // Entries run by batch_single() were retried already, and nothing starts after the deadline
+    if (!retry_enabled || request->response.attempts > 0 || (request->result == 0 && request->response.success) ||
+        http_deadline_left() == 0) {
+        return;
+    }
+    const struct http_template *tmpl = request->compiled;
+    struct http_template *own = tmpl ? NULL : http_template_new(HTTP_GET, request->url, headers);
+    if (own) {
+        tmpl = own;
+    }
+    if (tmpl) {
+        request->result = request_retry(tmpl, NULL, 0, &request->response, NULL, request->result);
+    }
+    http_template_free(own);
+}
+
+// Scheme, host and port a batch entry goes to
+static int entry_origin(const struct http_batch_request *entry, char *host, size_t host_size, int *port, bool *is_https)
+{
+    if (entry->compiled) {
+        snprintf(host, host_size, "%s", entry->compiled->host);
+        *port = entry->compiled->port;
+        *is_https = entry->compiled->is_https;
+        return 0;
+    }
+    char path[1024];
+    return parse_url(entry->url, host, host_size, port, path, sizeof(path), is_https);
+}
+
+// Check whether two batch entries share scheme, host and port
+static bool same_origin(const struct http_batch_request *a, const struct http_batch_request *b)
+{
+    char host_a[256];
+    char host_b[256];
+    int port_a;
+    int port_b;
+    bool https_a;
+    bool https_b;
+    if (entry_origin(a, host_a, sizeof(host_a), &port_a, &https_a) != 0 ||
+        entry_origin(b, host_b, sizeof(host_b), &port_b, &https_b) != 0) {
+        return false;
+    }
+    return port_a == port_b && https_a == https_b && strcmp(host_a, host_b) == 0;
+}
+
+// Perform a batch of GET requests, pipelined per origin
+int http_request_batch(struct http_batch_request *requests, int count, struct http_header *headers, int depth)
+{
+    if (!requests || count < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        http_response_init(&requests[i].response);
+        requests[i].result = -1;
+    }
+
+    int start = 0;
+    while (start < count) {
+        // Consecutive requests to the same origin share one pipeline
+        int end = start + 1;
+        while (end < count && same_origin(&requests[start], &requests[end])) {
+            end++;
+        }
+
+        int next = start;
+        char host[256];
+        int port;
+        bool is_https;
+        if (depth > 1 && end - start > 1 && entry_origin(&requests[start], host, sizeof(host), &port, &is_https) == 0) {
+            // The first request opens the connection (or finds a pooled one)
+            // and shows whether the server keeps it alive
+            struct http_conn *conn = pool_acquire(host, port, is_https);
+            if (!conn) {
+                batch_single(&requests[next++], headers);
+                conn = pool_acquire(host, port, is_https);
+            }
+            if (conn && conn->h2) {
+                // HTTP/2 multiplexes the rest instead of pipelining it
+                pool_release(conn);
+                batch_multiplexed(&requests[next], end - next, headers);
+                next = end;
+            } else if (conn) {
+                next += pipeline_run(conn, &requests[next], end - next, headers, depth);
+                stats.pipeline_fallbacks += (unsigned long) (end - next);
+            }
+        }
+
+        // Sequential requests, also used for what the pipeline did not answer
+        for (; next < end; next++) {
+            batch_single(&requests[next], headers);
+        }
+        start = end;
+    }
+
+    for (int i = 0; i < count; i++) {
+        batch_retry(&requests[i], headers);
+    }
+    for (int i = 0; i < count; i++) {
+        if (requests[i].result != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Report the timings of every request
+void http_set_timing_callback(http_timing_cb callback, void *user_data)
+{
+    timing_callback = callback;
+    timing_user_data = user_data;
+}
+
+// Format timings on one line
+void http_timing_format(const struct http_timing *timing, char *buffer, size_t size)
+{
+    snprintf(buffer,
+             size,
+             "resolve %.1f ms, connect %.1f ms, tls %.1f ms, ttfb %.1f ms, transfer %.1f ms, total %.1f ms, "
+             "sent %zu B, received %zu B%s",
+             timing->resolve_us / 1000.0,
+             timing->connect_us / 1000.0,
+             timing->tls_us / 1000.0,
+             timing->ttfb_us / 1000.0,
+             timing->transfer_us / 1000.0,
+             timing->total_us / 1000.0,
+             timing->bytes_sent,
+             timing->bytes_received,
+             timing->reused ? ", reused" : "");
+}
+
+// Print the timings of a request
+void http_print_timing(const char *method, const char *url, const struct http_response *response, void *user_data)
+{
+    FILE *out = user_data ? user_data : stderr;
+    char timing[256];
+    http_timing_format(&response->timing, timing, sizeof(timing));
+    fprintf(out, "%s %s -> %d: %s\n", method, url, response->status_code, timing);
+}
+
+// Retry blocking requests with a policy
+void http_set_retry_policy(const struct http_retry_policy *policy)
+{
+    retry_enabled = policy != NULL;
+    if (policy) {
+        retry_policy = *policy;
+    }
+}
+
+// Set the deadline of blocking requests
+void http_set_deadline(int deadline_ms)
+{
+    run_deadline = deadline_ms > 0 ? now_ms() + deadline_ms : 0;
+}
+
+// Attempt timeout of the retry policy
+int http_retry_attempt_timeout(void)
+{
+    return retry_enabled ? retry_policy.attempt_timeout_ms : 0;
+}
+
+// Time left before the deadline
+long long http_deadline_left(void)
+{
+    if (!run_deadline) {
+        return -1;
+    }
+    long long left = run_deadline - now_ms();
+    return left > 0 ? left : 0;
+}
+
+// Retry decision for requests the caller runs itself
+long http_retry_delay(const http_template_t *tmpl, int result, const struct http_response *response, int attempt)
+{
+    return retry_decide(tmpl, result, response, NULL, attempt);
+}
+
+// Offer compressed response bodies
+void http_set_compression(bool enable)
+{
+    compression_enabled = enable;
+}
+
+// Open connections with TCP Fast Open
+void http_set_fast_open(bool enable)
+{
+    fast_open_enabled = enable;
+}
+
+// Send GETs as early data on resumed sessions
+void http_set_early_data(bool enable)
+{
+    early_data_enabled = enable;
+}
+
+// Offer HTTP/2 with ALPN on new HTTPS connections
+void http_set_http2(bool enable)
+{
+    http2_enabled = enable;
+}
+
+// Persist resolved API endpoint addresses in a state file shared between processes
+void http_set_dns_cache_file(const char *path)
+{
+    free(dns_cache_path);
+    dns_cache_path = path ? strdup(path) : NULL;
+    dns_cache_loaded = false;
+}
+
+// Get connection statistics for this process
+void http_get_stats(struct http_stats *out)
+{
+    if (out) {
+        *out = stats;
+    }
 }
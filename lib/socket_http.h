@@ -3,16 +3,48 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <sys/uio.h>
+
+// Default number of pipelined requests awaiting a response on one connection
+#define HTTP_PIPELINE_DEPTH 4
+
+// Default TLS session state file, shared by all tools run from the same directory
+#define HTTP_SESSION_CACHE_FILE "tls_session.cache"
+
+// Default DNS cache state file
+#define HTTP_DNS_CACHE_FILE "dns.cache"
+
+// Most body segments a compiled request is sent with
+#define HTTP_MAX_BODY_SEGMENTS 8
 
 // HTTP method types
 typedef enum { HTTP_GET, HTTP_POST, HTTP_PUT, HTTP_DELETE } http_method_t;
 
+// Phase timings of a request, in microseconds on the monotonic clock. Phases
+// a request skips (a cached DNS answer, a pooled connection, TLS on plain
+// HTTP) stay 0; a retried request adds the phases it repeats.
+struct http_timing {
+    long resolve_us;       // Name resolution
+    long connect_us;       // TCP connect, including the Happy Eyeballs race
+    long tls_us;           // TLS handshake
+    long ttfb_us;          // From sending the request to the first byte of the response
+    long transfer_us;      // From the first byte to the end of the response
+    long total_us;         // From submission to completion, waits included
+    size_t bytes_sent;     // Request bytes written (HTTP/2 frames on a multiplexed connection)
+    size_t bytes_received; // Response bytes read, head included
+    bool reused;           // Sent on a pooled or shared connection
+};
+
 // HTTP response structure
 struct http_response {
     char *data;
     size_t size;
+    size_t encoded_size; // Body bytes received, before gzip/deflate decoding
     int status_code;
     bool success;
+    int retry_after; // Seconds from a Retry-After header, -1 if absent
+    int attempts;    // Attempts made by a blocking request, more than 1 when retried
+    struct http_timing timing;
 };
 
 // HTTP header structure
@@ -22,6 +54,44 @@ struct http_header {
     struct http_header *next;
 };
 
+// Request compiled by http_template_new()
+typedef struct http_template http_template_t;
+
+// GET request in a pipelined batch
+struct http_batch_request {
+    const char *url;
+    const http_template_t *compiled; // Sent instead of url and the batch headers when set
+    struct http_response response; // Filled in by http_request_batch()
+    int result;                    // 0 on success, -1 on failure
+};
+
+// Connection statistics, accumulated over the life of the process
+struct http_stats {
+    unsigned long requests;            // Requests sent
+    unsigned long dns_cache_hits;      // Host names answered from the DNS cache
+    unsigned long dns_lookups;         // Host names sent to the resolver
+    unsigned long dns_stale_answers;   // Expired cache entries used because the resolver failed
+    unsigned long connections_opened;  // New TCP connections
+    unsigned long connect_attempts;    // TCP connects started, including losers of the Happy Eyeballs race
+    unsigned long connections_reused;  // Requests served on a pooled keep-alive connection
+    unsigned long tls_handshakes;      // TLS handshakes performed
+    unsigned long tls_resumed;         // Handshakes that resumed a cached session
+    unsigned long tls_full_handshakes; // Handshakes that needed a full key exchange
+    unsigned long connections_evicted; // Pooled connections dropped (idle timeout, closed by server, pool full)
+    unsigned long stale_retries;       // Requests retried because a pooled connection had gone away
+    unsigned long requests_pipelined;  // Requests answered on a pipelined connection
+    unsigned long pipeline_fallbacks;  // Pipelined requests resent one by one after the server closed
+    unsigned long http2_connections;   // Connections where the server selected HTTP/2 with ALPN
+    unsigned long http2_streams;       // Requests sent as HTTP/2 streams
+    unsigned long bytes_compressed;    // Body bytes received gzip/deflate encoded
+    unsigned long bytes_decompressed;  // The same bodies after decoding
+    unsigned long retries;             // Blocking requests sent again after a transient failure
+    unsigned long fast_open_connects;  // Connections whose SYN carried data with a TCP Fast Open cookie
+    unsigned long fast_open_fallbacks; // Requests reconnected without Fast Open after hearing nothing back
+    unsigned long early_data_accepted; // GETs the server took as TLS 1.3 early data
+    unsigned long early_data_rejected; // Early data refused by the server, resent after the handshake
+};
+
 // Initialize an HTTP response structure
 void http_response_init(struct http_response *response);
 
@@ -34,16 +104,248 @@ struct http_header *http_header_add(struct http_header *headers, const char *nam
 // Free all headers in the list
 void http_headers_free(struct http_header *headers);
 
-// Perform HTTP request using POSIX sockets
+// Perform HTTP request using POSIX sockets.
+// Blocking wrapper that runs a single request on its own event loop,
+// retried as the retry policy allows.
 int http_request(const char *url,
                  http_method_t method,
                  const char *body,
                  struct http_header *headers,
                  struct http_response *response);
 
+// Retries of blocking requests
+//
+// With a retry policy set, http_request(), http_request_template(),
+// http_request_stream() and the entries of http_request_batch() are retried
+// after transient failures: connection errors, timeouts, and 408, 429 and 5xx
+// responses (501 and 505 excepted). GET, PUT and DELETE are idempotent and
+// retried after any of them. A POST may already have been processed, so it is
+// retried only when it never reached the server or the server answered 429.
+// A streamed request is retried only while its sink has received nothing.
+//
+// The delay before retry n is backoff_ms * 2^(n-1), capped at backoff_max_ms,
+// of which the upper half is random so clients that failed together spread
+// out. The Retry-After of a 429 or 503 response raises the delay to what the
+// server asked for.
+struct http_retry_policy {
+    int max_attempts;       // Attempts per request, the first included
+    int attempt_timeout_ms; // Connect and I/O timeout of an attempt, and the most it may take (0 for the defaults)
+    int backoff_ms;         // Delay before the first retry
+    int backoff_max_ms;     // Longest delay between attempts
+    int retry_after_max_ms; // Longest Retry-After honoured; a server asking for more ends the retries
+};
+
+// Retry blocking requests with this policy (copied). NULL, the default,
+// disables retries.
+void http_set_retry_policy(const struct http_retry_policy *policy);
+
+// Give the blocking requests of this process deadline_ms from now: attempts
+// are cut short at the deadline and no attempt starts after it, so a run
+// cannot outlast its schedule. 0 removes the deadline.
+void http_set_deadline(int deadline_ms);
+
+// Compiled requests
+//
+// A template fixes the method, URL and headers of a request that is sent
+// repeatedly. The request line, Host and headers are formatted once (and the
+// HTTP/2 header fields built once); sending it only adds Content-Length and
+// the body, written together with the head in one gather write (one copy into
+// a single TLS write on HTTPS).
+
+// Compile a request. The headers are copied. Returns NULL if the URL is
+// invalid or memory is exhausted.
+http_template_t *http_template_new(http_method_t method, const char *url, struct http_header *headers);
+
+// Free a template
+void http_template_free(http_template_t *tmpl);
+
+// Perform a compiled request. The body is the concatenation of body_count
+// segments (at most HTTP_MAX_BODY_SEGMENTS); body_count 0 sends none.
+// Returns as http_request().
+int http_request_template(const http_template_t *tmpl,
+                          const struct iovec *body,
+                          int body_count,
+                          struct http_response *response);
+
+// Streamed response bodies
+//
+// A body sink receives the body in pieces as they are decoded (chunked
+// framing removed), so large responses never sit whole in memory. The
+// response's status_code and success are set before the first call; its size
+// counts the bytes delivered and data stays NULL. The sink returns one of:
+#define HTTP_SINK_CONTINUE 0 // Keep reading
+#define HTTP_SINK_PAUSE 1    // Stop reading until http_async_resume(), holding the server back
+#define HTTP_SINK_ABORT 2    // Stop the request now; it completes with HTTP_SINK_ABORTED
+
+// Result of a request whose sink returned HTTP_SINK_ABORT
+#define HTTP_SINK_ABORTED -3
+
+typedef int (*http_body_sink)(const char *data, size_t len, const struct http_response *response, void *user_data);
+
+// Perform a request delivering the body to a sink instead of response->data.
+// The sink runs between reads, so a slow sink already holds the server back;
+// HTTP_SINK_PAUSE is treated as HTTP_SINK_CONTINUE here.
+// Returns 0 on success, HTTP_SINK_ABORTED or -1.
+int http_request_stream(const char *url,
+                        http_method_t method,
+                        const char *body,
+                        struct http_header *headers,
+                        struct http_response *response,
+                        http_body_sink sink,
+                        void *user_data);
+
+// Perform a batch of idempotent GET requests. Consecutive requests to the
+// same scheme://host:port are pipelined on one keep-alive connection: up to
+// depth requests are written ahead of the response being read, and the
+// responses are read in order. Requests left unanswered when the server
+// closes the connection are resent one at a time. depth <= 1 sends every
+// request sequentially. An entry may give a compiled GET instead of a URL.
+// Each entry gets its own response and result; the caller frees the
+// responses. Returns 0 if every request succeeded, -1 otherwise.
+int http_request_batch(struct http_batch_request *requests, int count, struct http_header *headers, int depth);
+
+// Asynchronous requests
+//
+// Requests submitted to a loop run concurrently on non-blocking sockets and
+// non-blocking TLS, driven by http_loop_run() from a single epoll (poll()
+// outside Linux) wait. Each request completes exactly once: its callback is
+// called from http_loop_run() with result 0 on success, -1 on failure or
+// HTTP_ASYNC_CANCELLED. The response is filled in before the callback runs
+// and the handle is freed when the callback returns.
+
+// Result passed to the callback of a cancelled request
+#define HTTP_ASYNC_CANCELLED -2
+
+typedef struct http_loop http_loop_t;
+typedef struct http_async_request http_async_t;
+typedef void (*http_async_cb)(http_async_t *handle, int result, void *user_data);
+
+// Create an event loop for asynchronous requests, NULL on failure
+http_loop_t *http_loop_new(void);
+
+// Free a loop. Pending requests are cancelled without calling their callbacks.
+void http_loop_free(http_loop_t *loop);
+
+// Start a request. The body and headers are copied, so the caller may free
+// them right away; response must stay valid until the callback runs.
+// Returns the request handle, or NULL (without calling the callback) if the
+// URL is invalid or memory is exhausted.
+http_async_t *http_async_submit(http_loop_t *loop,
+                                const char *url,
+                                http_method_t method,
+                                const char *body,
+                                struct http_header *headers,
+                                struct http_response *response,
+                                http_async_cb callback,
+                                void *user_data);
+
+// Start a compiled request (see http_request_template()). The template and
+// the memory the body segments point to must stay valid until the callback
+// runs; the segment array itself is copied. Returns as http_async_submit().
+http_async_t *http_async_submit_template(http_loop_t *loop,
+                                         const http_template_t *tmpl,
+                                         const struct iovec *body,
+                                         int body_count,
+                                         struct http_response *response,
+                                         http_async_cb callback,
+                                         void *user_data);
+
+// Cancel a request whose callback has not run yet. The callback still runs,
+// from the next http_loop_run(), with HTTP_ASYNC_CANCELLED.
+void http_async_cancel(http_async_t *handle);
+
+// Replace the default 5 second connect and I/O timeouts of a request. Call
+// right after http_async_submit(); timeout_ms must be positive.
+void http_async_set_timeout(http_async_t *handle, int timeout_ms);
+
+// Asynchronous requests are not retried by the library. A caller that runs
+// them under the retry policy and deadline of the blocking requests sets the
+// policy's attempt timeout on each (0 without a policy, or for the defaults),
+// stops once no time is left before the deadline (-1 without one, 0 once it
+// passed), and resubmits a failed attempt after http_retry_delay().
+int http_retry_attempt_timeout(void);
+long long http_deadline_left(void);
+
+// Delay in ms before retrying a request of tmpl whose attempt number attempt
+// ended with result and response, -1 if it is not retried: no policy, the
+// attempts are used up, the failure was not transient, the server asked for
+// a longer wait than allowed, or the retry would start after the deadline.
+// A retry is counted in the statistics.
+long http_retry_delay(const http_template_t *tmpl, int result, const struct http_response *response, int attempt);
+
+// Deliver the body of a request to a sink (see http_request_stream()). Call
+// right after http_async_submit(), before the loop runs again.
+void http_async_set_sink(http_async_t *handle, http_body_sink sink, void *user_data);
+
+// Resume reading a request whose sink returned HTTP_SINK_PAUSE. A paused
+// request has no I/O timeout; the next http_loop_run() picks it up again.
+void http_async_resume(http_async_t *handle);
+
+// Run the loop until every request has completed or timeout_ms elapses
+// (-1 for no limit; every request has its own connect and I/O timeouts).
+// Callbacks may submit further requests. Returns the number of requests
+// still pending, or -1 on error.
+int http_loop_run(http_loop_t *loop, int timeout_ms);
+
+// Offer HTTP/2 with ALPN on HTTPS connections (disabled by default). When the
+// server selects h2, requests of a loop to the same host:port run as
+// concurrent streams on one connection and batches are multiplexed instead of
+// pipelined; the request and response structures are the same. Servers that
+// only speak HTTP/1.1 are unaffected.
+void http_set_http2(bool enable);
+
+// Send Accept-Encoding: gzip, deflate (disabled by default) and decode
+// compressed bodies incrementally as they arrive. response->data and the
+// sink get the decoded body; response->encoded_size counts the bytes received.
+void http_set_compression(bool enable);
+
+// Open connections with TCP Fast Open (disabled by default). Once the kernel
+// holds a cookie for a server, the first bytes of the TLS handshake or the
+// request ride in the SYN. A connection that fails before the server sent
+// anything back is opened once more without Fast Open, since some middleboxes
+// drop SYNs that carry data.
+void http_set_fast_open(bool enable);
+
+// Send GET requests as TLS 1.3 early data when resuming a session that allows
+// it (disabled by default), saving a round trip. Early data can be replayed,
+// so other methods always wait for the handshake. When the server rejects it
+// the request is sent again once the handshake completes.
+void http_set_early_data(bool enable);
+
+// Persist TLS sessions and tickets per host:port in a state file so the next
+// process can resume them. Pass NULL to keep sessions in memory only.
+// Sessions are written back by http_cleanup().
+void http_set_session_cache_file(const char *path);
+
+// Persist resolved addresses, with their TTLs, in a state file so short-lived
+// processes share lookups. Expired entries are used when the resolver fails.
+// Pass NULL to cache in memory only. The file is written by http_cleanup().
+void http_set_dns_cache_file(const char *path);
+
+// Called as each request completes (cancelled ones excepted), before its own
+// callback, with the method, the URL and the response with its timings
+typedef void (*http_timing_cb)(const char *method,
+                               const char *url,
+                               const struct http_response *response,
+                               void *user_data);
+
+// Report the timings of every request of this process. Pass NULL to stop.
+void http_set_timing_callback(http_timing_cb callback, void *user_data);
+
+// Format timings on one line, e.g. "resolve 0.4 ms, connect 1.1 ms, tls 9.8 ms,
+// ttfb 52.0 ms, transfer 0.2 ms, total 64.1 ms, sent 391 B, received 1502 B"
+void http_timing_format(const struct http_timing *timing, char *buffer, size_t size);
+
+// Timing callback printing each request as "METHOD URL -> status: timings"
+// on the FILE * passed as user_data, or on stderr if it is NULL
+void http_print_timing(const char *method, const char *url, const struct http_response *response, void *user_data);
+
+// Get connection statistics for this process
+void http_get_stats(struct http_stats *stats);
+
 // Helper functions are now internal (static) and not exposed in the public API
 
-// Cleanup function for OpenSSL resources
+// Cleanup function for pooled connections and OpenSSL resources
 void http_cleanup(void);
 
 #endif // SOCKET_HTTP_H
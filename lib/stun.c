@@ -0,0 +1,409 @@
+#define _POSIX_C_SOURCE 200809L
+#include "stun.h"
+
+#include "dns.h"
+#include "dns_cache.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+// Milliseconds on the monotonic clock
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void put16(unsigned char *p, uint16_t value)
+{
+    p[0] = (unsigned char) (value >> 8);
+    p[1] = (unsigned char) (value & 0xff);
+}
+
+static void put32(unsigned char *p, uint32_t value)
+{
+    p[0] = (unsigned char) (value >> 24);
+    p[1] = (unsigned char) ((value >> 16) & 0xff);
+    p[2] = (unsigned char) ((value >> 8) & 0xff);
+    p[3] = (unsigned char) (value & 0xff);
+}
+
+static uint16_t get16(const unsigned char *p)
+{
+    return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+// Encode a Binding request: a bare header, no attributes
+int stun_build_request(unsigned char *buf, size_t size, const unsigned char txid[STUN_TXID_SIZE])
+{
+    if (size < STUN_HEADER_SIZE) {
+        return -1;
+    }
+    put16(buf, STUN_BINDING_REQUEST);
+    put16(buf + 2, 0);
+    put32(buf + 4, STUN_MAGIC_COOKIE);
+    memcpy(buf + 8, txid, STUN_TXID_SIZE);
+    return STUN_HEADER_SIZE;
+}
+
+// Decode a MAPPED-ADDRESS value, undoing the XOR of an XOR-MAPPED-ADDRESS
+// with the magic cookie and transaction ID (the first 16 bytes of the header)
+static int parse_address(const unsigned char *value,
+                         size_t len,
+                         const unsigned char *header,
+                         bool xored,
+                         struct stun_address *mapped)
+{
+    if (len < 4) {
+        return -1;
+    }
+    size_t addr_len;
+    if (value[1] == 0x01 && len >= 8) {
+        mapped->family = AF_INET;
+        addr_len = 4;
+    } else if (value[1] == 0x02 && len >= 20) {
+        mapped->family = AF_INET6;
+        addr_len = 16;
+    } else {
+        return -1;
+    }
+
+    mapped->port = get16(value + 2);
+    memset(mapped->addr, 0, sizeof(mapped->addr));
+    for (size_t i = 0; i < addr_len; i++) {
+        mapped->addr[i] = (unsigned char) (value[4 + i] ^ (xored ? header[4 + i] : 0));
+    }
+    if (xored) {
+        mapped->port ^= (uint16_t) (STUN_MAGIC_COOKIE >> 16);
+    }
+    return 0;
+}
+
+// Decode a Binding success response
+int stun_parse_response(const unsigned char *buf,
+                        size_t len,
+                        const unsigned char txid[STUN_TXID_SIZE],
+                        struct stun_address *mapped)
+{
+    if (len < STUN_HEADER_SIZE || get16(buf) != STUN_BINDING_SUCCESS || get32(buf + 4) != STUN_MAGIC_COOKIE ||
+        memcmp(buf + 8, txid, STUN_TXID_SIZE) != 0) {
+        return -1;
+    }
+    size_t message_len = get16(buf + 2);
+    if (message_len % 4 != 0 || STUN_HEADER_SIZE + message_len > len) {
+        return -1;
+    }
+
+    // Routers rewriting addresses in payloads can mangle a plain
+    // MAPPED-ADDRESS, so the XOR form wins when both are present
+    bool found = false;
+    size_t pos = STUN_HEADER_SIZE;
+    size_t end = STUN_HEADER_SIZE + message_len;
+    while (pos + 4 <= end) {
+        uint16_t type = get16(buf + pos);
+        size_t value_len = get16(buf + pos + 2);
+        if (pos + 4 + value_len > end) {
+            return -1;
+        }
+        const unsigned char *value = buf + pos + 4;
+        if (type == STUN_ATTR_XOR_MAPPED_ADDRESS && parse_address(value, value_len, buf, true, mapped) == 0) {
+            return 0;
+        }
+        if (type == STUN_ATTR_MAPPED_ADDRESS && !found) {
+            found = parse_address(value, value_len, buf, false, mapped) == 0;
+        }
+        pos += 4 + ((value_len + 3) & ~(size_t) 3);
+    }
+    return found ? 0 : -1;
+}
+
+// Whether a public IP source names a STUN server
+bool stun_is_uri(const char *uri)
+{
+    return uri && strncasecmp(uri, "stun:", 5) == 0;
+}
+
+// Split a stun:host[:port] URI
+int stun_parse_uri(const char *uri, char *host, size_t host_size, uint16_t *port)
+{
+    if (stun_is_uri(uri)) {
+        uri += 5;
+    }
+
+    const char *host_start = uri;
+    const char *host_end;
+    const char *rest;
+    if (*uri == '[') {
+        host_start = uri + 1;
+        host_end = strchr(host_start, ']');
+        if (!host_end) {
+            return -1;
+        }
+        rest = host_end + 1;
+    } else {
+        host_end = strchr(uri, ':');
+        if (!host_end) {
+            host_end = uri + strlen(uri);
+        }
+        rest = host_end;
+    }
+
+    size_t host_len = (size_t) (host_end - host_start);
+    if (host_len == 0 || host_len >= host_size) {
+        return -1;
+    }
+    memcpy(host, host_start, host_len);
+    host[host_len] = '\0';
+
+    *port = STUN_DEFAULT_PORT;
+    if (*rest == ':') {
+        char *end = NULL;
+        long value = strtol(rest + 1, &end, 10);
+        if (end == rest + 1 || *end != '\0' || value < 1 || value > 65535) {
+            return -1;
+        }
+        *port = (uint16_t) value;
+    } else if (*rest != '\0') {
+        return -1;
+    }
+    return 0;
+}
+
+// Fill a transaction ID from /dev/urandom
+static void random_txid(unsigned char txid[STUN_TXID_SIZE])
+{
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        ssize_t n = read(fd, txid, STUN_TXID_SIZE);
+        close(fd);
+        if (n == STUN_TXID_SIZE) {
+            return;
+        }
+    }
+    long long seed = now_ms() ^ ((long long) getpid() << 16);
+    for (int i = 0; i < STUN_TXID_SIZE; i++) {
+        seed = seed * 6364136223846793005LL + 1442695040888963407LL;
+        txid[i] = (unsigned char) (seed >> 33);
+    }
+}
+
+// Resolve the server of a URI, through the DNS cache shared with the HTTP client
+static int resolve_server(const char *uri, struct stun_server *server, long long deadline)
+{
+    char host[256];
+    uint16_t port;
+    if (stun_parse_uri(uri, host, sizeof(host), &port) != 0) {
+        return -1;
+    }
+
+    struct dns_result result;
+    if (dns_cache_resolve(host, (int) (deadline - now_ms()), &result) != 0) {
+        return -1;
+    }
+
+    server->addr_len = dns_result_sockaddr(&result, port, &server->addr);
+    return 0;
+}
+
+// Open the UDP socket used for one address family
+static int open_query_socket(int family)
+{
+    int fd = socket(family, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Socket slot for a server's family
+static int family_slot(const struct stun_server *server)
+{
+    return server->addr.ss_family == AF_INET6 ? 1 : 0;
+}
+
+// Send a server its next Binding request and arm its timer
+static void send_request(struct stun_query *query, struct stun_server *server, long long now)
+{
+    unsigned char packet[STUN_HEADER_SIZE];
+    int fd = query->sockfd[family_slot(server)];
+    int packet_len = stun_build_request(packet, sizeof(packet), server->txid);
+    if (fd < 0 ||
+        sendto(fd, packet, (size_t) packet_len, 0, (const struct sockaddr *) &server->addr, server->addr_len) !=
+            packet_len) {
+        server->done = true;
+        return;
+    }
+
+    // Every request keeps the transaction ID, so a late answer to an earlier one still counts
+    if (server->requests++ == 0) {
+        server->first_sent = now;
+    }
+    long long wait = server->requests < STUN_MAX_REQUESTS ? (long long) STUN_RTO_MS << (server->requests - 1)
+                                                            : (long long) STUN_RTO_MS * STUN_LAST_WAIT_RTO;
+    server->next_timer = now + wait < query->deadline ? now + wait : query->deadline;
+}
+
+// Finish once enough servers answered, none is left waiting, or time is up
+static int check_finished(struct stun_query *query)
+{
+    bool waiting = false;
+    for (int i = 0; i < query->server_count; i++) {
+        waiting = waiting || !query->servers[i].done;
+    }
+    if (query->answered >= query->wanted || !waiting || now_ms() >= query->deadline) {
+        query->done = true;
+    }
+    return query->done ? 1 : 0;
+}
+
+// Start a query
+int stun_query_start(struct stun_query *query, const char *const uris[], int count, int wanted, int timeout_ms)
+{
+    memset(query, 0, sizeof(*query));
+    query->sockfd[0] = -1;
+    query->sockfd[1] = -1;
+    query->wanted = wanted > 0 ? wanted : 1;
+    query->deadline = now_ms() + timeout_ms;
+
+    for (int i = 0; i < count && query->server_count < STUN_MAX_SERVERS; i++) {
+        struct stun_server *server = &query->servers[query->server_count++];
+        if (resolve_server(uris[i], server, query->deadline) != 0) {
+            server->done = true;
+            continue;
+        }
+        int slot = family_slot(server);
+        if (query->sockfd[slot] < 0) {
+            query->sockfd[slot] = open_query_socket(slot ? AF_INET6 : AF_INET);
+        }
+        random_txid(server->txid);
+    }
+
+    // All requests leave together once the names are resolved
+    long long now = now_ms();
+    for (int i = 0; i < query->server_count; i++) {
+        if (!query->servers[i].done) {
+            send_request(query, &query->servers[i], now);
+        }
+    }
+    return check_finished(query);
+}
+
+// Process datagrams waiting on the query sockets
+int stun_query_read(struct stun_query *query)
+{
+    for (int slot = 0; slot < 2 && !query->done; slot++) {
+        if (query->sockfd[slot] < 0) {
+            continue;
+        }
+
+        unsigned char packet[STUN_MAX_PACKET];
+        ssize_t received;
+        while ((received = recvfrom(query->sockfd[slot], packet, sizeof(packet), 0, NULL, NULL)) > 0) {
+            // The 96-bit transaction ID tells which server answered
+            for (int i = 0; i < query->server_count; i++) {
+                struct stun_server *server = &query->servers[i];
+                if (server->answered ||
+                    stun_parse_response(packet, (size_t) received, server->txid, &server->mapped) != 0) {
+                    continue;
+                }
+                server->answered = true;
+                server->done = true;
+                server->rtt_ms = (int) (now_ms() - server->first_sent);
+                query->answered++;
+                break;
+            }
+        }
+    }
+    return check_finished(query);
+}
+
+// Retransmit, or give up on servers that had their last chance
+int stun_query_check_timeout(struct stun_query *query)
+{
+    if (query->done) {
+        return 1;
+    }
+    long long now = now_ms();
+    if (now >= query->deadline) {
+        return check_finished(query);
+    }
+    for (int i = 0; i < query->server_count; i++) {
+        struct stun_server *server = &query->servers[i];
+        if (server->done || now < server->next_timer) {
+            continue;
+        }
+        if (server->requests >= STUN_MAX_REQUESTS) {
+            server->done = true;
+        } else {
+            send_request(query, server, now);
+        }
+    }
+    return check_finished(query);
+}
+
+// Time of the next timer on the monotonic clock, in milliseconds
+long long stun_query_deadline(const struct stun_query *query)
+{
+    long long next = query->deadline;
+    for (int i = 0; i < query->server_count; i++) {
+        if (!query->servers[i].done && query->servers[i].next_timer < next) {
+            next = query->servers[i].next_timer;
+        }
+    }
+    return next;
+}
+
+// Close the query sockets
+void stun_query_cleanup(struct stun_query *query)
+{
+    for (int slot = 0; slot < 2; slot++) {
+        if (query->sockfd[slot] >= 0) {
+            close(query->sockfd[slot]);
+            query->sockfd[slot] = -1;
+        }
+    }
+}
+
+// Run a started query to completion
+int stun_query_run(struct stun_query *query)
+{
+    while (!query->done) {
+        struct pollfd pfds[2];
+        nfds_t nfds = 0;
+        for (int slot = 0; slot < 2; slot++) {
+            if (query->sockfd[slot] >= 0) {
+                pfds[nfds].fd = query->sockfd[slot];
+                pfds[nfds].events = POLLIN;
+                pfds[nfds].revents = 0;
+                nfds++;
+            }
+        }
+
+        long long wait_ms = stun_query_deadline(query) - now_ms();
+        int ready = poll(pfds, nfds, wait_ms > 0 ? (int) wait_ms : 0);
+        if (ready > 0 && stun_query_read(query)) {
+            break;
+        }
+        stun_query_check_timeout(query);
+    }
+    return query->answered;
+}
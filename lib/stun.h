@@ -0,0 +1,104 @@
+#ifndef STUN_H
+#define STUN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Message and attribute types (RFC 5389)
+#define STUN_BINDING_REQUEST 0x0001
+#define STUN_BINDING_SUCCESS 0x0101
+#define STUN_ATTR_MAPPED_ADDRESS 0x0001
+#define STUN_ATTR_XOR_MAPPED_ADDRESS 0x0020
+#define STUN_MAGIC_COOKIE 0x2112A442
+
+// Limits
+#define STUN_HEADER_SIZE 20
+#define STUN_TXID_SIZE 12
+#define STUN_MAX_PACKET 548
+#define STUN_MAX_SERVERS 8
+#define STUN_DEFAULT_PORT 3478
+
+// Retransmission (RFC 5389 section 7.2.1): the wait doubles from STUN_RTO_MS
+// over STUN_MAX_REQUESTS requests, then the last one gets 16 RTO
+#define STUN_RTO_MS 500
+#define STUN_MAX_REQUESTS 7
+#define STUN_LAST_WAIT_RTO 16
+
+// Transport address reported by a server
+struct stun_address {
+    int family; // AF_INET or AF_INET6
+    unsigned char addr[16];
+    uint16_t port;
+};
+
+// One server of a query and what it answered
+struct stun_server {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    unsigned char txid[STUN_TXID_SIZE];
+    int requests;         // Binding requests sent so far
+    long long first_sent; // Monotonic ms
+    long long next_timer; // Retransmission or give-up time
+    bool done;            // Answered or given up
+    bool answered;
+    int rtt_ms; // From the first request to the answer
+    struct stun_address mapped;
+};
+
+// Non-blocking Binding requests to several servers at once, each with its own
+// retransmission timer. Drive it like a dns_query: wait for sockfd[] to
+// become readable (calling stun_query_read) and for stun_query_deadline()
+// (calling stun_query_check_timeout) until either returns 1.
+struct stun_query {
+    struct stun_server servers[STUN_MAX_SERVERS];
+    int server_count;
+    int sockfd[2]; // IPv4 and IPv6 UDP sockets, -1 if unused
+    int wanted;    // Answers that end the query
+    int answered;
+    bool done;
+    long long deadline;
+};
+
+// Encode a Binding request with the given transaction ID into buf.
+// Returns the packet length or -1 if buf is too small.
+int stun_build_request(unsigned char *buf, size_t size, const unsigned char txid[STUN_TXID_SIZE]);
+
+// Decode a Binding success response to the transaction txid, taking the
+// XOR-MAPPED-ADDRESS or, from older servers, the MAPPED-ADDRESS.
+// Returns 0 on success, -1 if malformed, unrelated or an error response.
+int stun_parse_response(const unsigned char *buf,
+                        size_t len,
+                        const unsigned char txid[STUN_TXID_SIZE],
+                        struct stun_address *mapped);
+
+// Split a "stun:host[:port]" URI (RFC 7064; the scheme may be left out, IPv6
+// hosts go in brackets). Returns 0 on success, -1 if malformed.
+int stun_parse_uri(const char *uri, char *host, size_t host_size, uint16_t *port);
+
+// Whether a public IP source names a STUN server
+bool stun_is_uri(const char *uri);
+
+// Resolve the servers and send each a Binding request. The query finishes
+// once wanted servers answered, all of them answered or gave up, or
+// timeout_ms elapsed. Returns 1 if the query is already finished, 0 if
+// requests are in flight.
+int stun_query_start(struct stun_query *query, const char *const uris[], int count, int wanted, int timeout_ms);
+
+// Process datagrams on the query sockets. Returns 1 when the query is finished.
+int stun_query_read(struct stun_query *query);
+
+// Retransmit or give up on servers whose timer expired. Returns 1 when finished.
+int stun_query_check_timeout(struct stun_query *query);
+
+// Next timer of the query, in milliseconds on the monotonic clock
+long long stun_query_deadline(const struct stun_query *query);
+
+// Release the sockets of a query
+void stun_query_cleanup(struct stun_query *query);
+
+// Run a started query to completion. Returns the number of servers that answered.
+int stun_query_run(struct stun_query *query);
+
+#endif // STUN_H
@@ -0,0 +1,236 @@
+#define _POSIX_C_SOURCE 200809L
+#include "tls_session.h"
+
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Largest encoded session accepted from the state file
+#define TLS_SESSION_MAX_DER 8192
+
+// Cached session for one host:port
+struct tls_session_entry {
+    char host[256];
+    int port;
+    SSL_SESSION *session;
+};
+
+static struct tls_session_entry cache[TLS_SESSION_CACHE_SIZE];
+static int cache_count = 0;
+static bool cache_dirty = false;
+
+// Find the cache slot for host:port, -1 if absent
+static int find_entry(const char *host, int port)
+{
+    for (int i = 0; i < cache_count; i++) {
+        if (cache[i].port == port && strcmp(cache[i].host, host) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Check whether a session can still be offered for resumption
+static bool session_usable(const SSL_SESSION *session, time_t now)
+{
+    if (!session || !SSL_SESSION_is_resumable(session)) {
+        return false;
+    }
+    long expires = SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session);
+    return expires > (long) now;
+}
+
+// Store a session without marking the cache dirty
+static void cache_store(const char *host, int port, SSL_SESSION *session)
+{
+    int index = find_entry(host, port);
+    if (index < 0) {
+        if (cache_count < TLS_SESSION_CACHE_SIZE) {
+            index = cache_count++;
+        } else {
+            // Replace the oldest session
+            index = 0;
+            for (int i = 1; i < cache_count; i++) {
+                if (SSL_SESSION_get_time(cache[i].session) < SSL_SESSION_get_time(cache[index].session)) {
+                    index = i;
+                }
+            }
+            SSL_SESSION_free(cache[index].session);
+            cache[index].session = NULL;
+        }
+        strncpy(cache[index].host, host, sizeof(cache[index].host) - 1);
+        cache[index].host[sizeof(cache[index].host) - 1] = '\0';
+        cache[index].port = port;
+    } else {
+        SSL_SESSION_free(cache[index].session);
+    }
+    cache[index].session = session;
+}
+
+// Decode one "host port base64" line into the cache
+static int load_line(char *line, time_t now)
+{
+    char *host = strtok(line, " \t\r\n");
+    const char *port_str = strtok(NULL, " \t\r\n");
+    const char *encoded = strtok(NULL, " \t\r\n");
+    if (!host || !port_str || !encoded || host[0] == '#') {
+        return -1;
+    }
+
+    size_t encoded_len = strlen(encoded);
+    if (encoded_len == 0 || encoded_len % 4 != 0 || encoded_len / 4 * 3 > TLS_SESSION_MAX_DER) {
+        return -1;
+    }
+
+    unsigned char der[TLS_SESSION_MAX_DER];
+    int der_len = EVP_DecodeBlock(der, (const unsigned char *) encoded, (int) encoded_len);
+    if (der_len <= 0) {
+        return -1;
+    }
+    // EVP_DecodeBlock counts the padding as decoded zero bytes
+    if (encoded[encoded_len - 1] == '=') {
+        der_len--;
+        if (encoded[encoded_len - 2] == '=') {
+            der_len--;
+        }
+    }
+
+    const unsigned char *p = der;
+    SSL_SESSION *session = d2i_SSL_SESSION(NULL, &p, der_len);
+    if (!session) {
+        return -1;
+    }
+    if (!session_usable(session, now)) {
+        SSL_SESSION_free(session);
+        return -1;
+    }
+
+    cache_store(host, atoi(port_str), session);
+    return 0;
+}
+
+// Load cached sessions from a state file
+int tls_session_cache_load(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+
+    time_t now = time(NULL);
+    int loaded = 0;
+    char line[TLS_SESSION_MAX_DER * 2];
+    while (fgets(line, sizeof(line), file)) {
+        if (load_line(line, now) == 0) {
+            loaded++;
+        }
+    }
+
+    fclose(file);
+    cache_dirty = false;
+    return loaded;
+}
+
+// Write the cached sessions to a state file if anything changed
+int tls_session_cache_save(const char *path)
+{
+    if (!cache_dirty) {
+        return 0;
+    }
+
+    // Sessions carry resumption secrets: write a private temp file, then rename
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        return -1;
+    }
+    FILE *file = fdopen(fd, "w");
+    if (!file) {
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    fprintf(file, "# TLS sessions: host port base64(DER)\n");
+
+    time_t now = time(NULL);
+    for (int i = 0; i < cache_count; i++) {
+        if (!session_usable(cache[i].session, now)) {
+            continue;
+        }
+
+        int der_len = i2d_SSL_SESSION(cache[i].session, NULL);
+        if (der_len <= 0 || der_len > TLS_SESSION_MAX_DER) {
+            continue;
+        }
+
+        unsigned char der[TLS_SESSION_MAX_DER];
+        unsigned char *p = der;
+        i2d_SSL_SESSION(cache[i].session, &p);
+
+        char encoded[TLS_SESSION_MAX_DER * 2];
+        EVP_EncodeBlock((unsigned char *) encoded, der, der_len);
+        fprintf(file, "%s %d %s\n", cache[i].host, cache[i].port, encoded);
+    }
+
+    if (fclose(file) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+
+    cache_dirty = false;
+    return 0;
+}
+
+// Get the cached session for host:port
+SSL_SESSION *tls_session_cache_get(const char *host, int port)
+{
+    int index = find_entry(host, port);
+    if (index < 0 || !session_usable(cache[index].session, time(NULL))) {
+        return NULL;
+    }
+    return cache[index].session;
+}
+
+// Store a session (or a newer ticket) for host:port
+void tls_session_cache_put(const char *host, int port, SSL_SESSION *session)
+{
+    if (!host || !session) {
+        return;
+    }
+    cache_store(host, port, session);
+    cache_dirty = true;
+}
+
+// Drop a session that the server refused to resume
+void tls_session_cache_remove(const char *host, int port)
+{
+    int index = find_entry(host, port);
+    if (index < 0) {
+        return;
+    }
+
+    SSL_SESSION_free(cache[index].session);
+    cache[index] = cache[cache_count - 1];
+    cache[cache_count - 1].session = NULL;
+    cache_count--;
+    cache_dirty = true;
+}
+
+// Free all cached sessions
+void tls_session_cache_clear(void)
+{
+    for (int i = 0; i < cache_count; i++) {
+        SSL_SESSION_free(cache[i].session);
+        cache[i].session = NULL;
+    }
+    cache_count = 0;
+    cache_dirty = false;
+}
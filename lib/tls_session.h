@@ -0,0 +1,31 @@
+#ifndef TLS_SESSION_H
+#define TLS_SESSION_H
+
+#include <openssl/ssl.h>
+
+// Maximum number of host:port entries kept in the cache
+#define TLS_SESSION_CACHE_SIZE 16
+
+// Load cached sessions from a state file, skipping expired ones.
+// Returns the number of sessions loaded, or -1 if the file could not be read.
+int tls_session_cache_load(const char *path);
+
+// Write the cached sessions to a state file (mode 0600) if anything changed.
+// Returns 0 on success.
+int tls_session_cache_save(const char *path);
+
+// Get the cached session for host:port, NULL if none is resumable.
+// The session is still owned by the cache.
+SSL_SESSION *tls_session_cache_get(const char *host, int port);
+
+// Store a session (or a newer ticket) for host:port. The cache takes
+// ownership of the reference passed in.
+void tls_session_cache_put(const char *host, int port, SSL_SESSION *session);
+
+// Drop a session that the server refused to resume
+void tls_session_cache_remove(const char *host, int port);
+
+// Free all cached sessions
+void tls_session_cache_clear(void);
+
+#endif // TLS_SESSION_H
@@ -0,0 +1,82 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../lib/convergence.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static void test_target(void)
+{
+    struct convergence convergence;
+    memset(&convergence, 0, sizeof(convergence));
+    char *domains[] = {"a.example.com", "b.example.com", "c.example.com"};
+    assert(convergence_set_target(&convergence, "1.1.1.1", domains, 3, 1000) == 0);
+    assert(convergence.count == 3 && strcmp(convergence.desired, "1.1.1.1") == 0);
+    assert(convergence_pending(&convergence) == 3);
+    assert(convergence_next_ms(&convergence, 1000) == 0);
+    for (int i = 0; i < 3; i++) {
+        assert(convergence_is_due(&convergence, i, 1000));
+    }
+
+    // Holding the desired IP converges; an old IP or an unreadable record does not
+    convergence_report(&convergence, 0, "1.1.1.1", 1000);
+    convergence_report(&convergence, 1, "9.9.9.9", 1000);
+    convergence_report(&convergence, 2, NULL, 1000);
+    assert(convergence.records[0].converged && !convergence.records[1].converged);
+    assert(strcmp(convergence.records[1].observed, "9.9.9.9") == 0 && convergence.records[2].observed[0] == '\0');
+    assert(convergence_pending(&convergence) == 2);
+    assert(!convergence_is_due(&convergence, 0, 1000) && !convergence_is_due(&convergence, 1, 1000));
+
+    // The same target keeps the state, a new one starts over
+    char *renamed[] = {"b.example.com", "a.example.com", "d.example.com"};
+    assert(convergence_set_target(&convergence, "1.1.1.1", renamed, 3, 1100) == 0);
+    assert(!convergence.records[0].converged && convergence.records[0].failures == 1);
+    assert(convergence.records[1].converged);
+    assert(convergence_is_due(&convergence, 2, 1100) && !convergence_is_due(&convergence, 0, 1100));
+    assert(convergence_set_target(&convergence, "2.2.2.2", renamed, 3, 1200) == 0);
+    assert(convergence_pending(&convergence) == 3 && convergence.records[0].failures == 0);
+    convergence_free(&convergence);
+    assert(convergence.count == 0 && convergence.records == NULL);
+    printf("✓ Records converge on the desired IP, state kept while it stays\n");
+}
+
+static void test_backoff(void)
+{
+    struct convergence convergence;
+    memset(&convergence, 0, sizeof(convergence));
+    char *domains[] = {"a.example.com"};
+    assert(convergence_set_target(&convergence, "1.1.1.1", domains, 1, 0) == 0);
+
+    // Each failure doubles the wait, between half and all of it, up to the maximum
+    long long backoff = CONVERGENCE_RETRY_MS;
+    long long now = 0;
+    for (int failure = 1; failure <= 12; failure++) {
+        convergence_report(&convergence, 0, NULL, now);
+        long long delay = convergence_next_ms(&convergence, now);
+        assert(delay >= backoff / 2 && delay <= backoff);
+        assert(!convergence_is_due(&convergence, 0, now + delay - 1));
+        assert(convergence_is_due(&convergence, 0, now + delay));
+        now += delay;
+        backoff = backoff * 2 < CONVERGENCE_RETRY_MAX_MS ? backoff * 2 : CONVERGENCE_RETRY_MAX_MS;
+    }
+    assert(convergence.records[0].failures == 12);
+
+    // Converging clears the failures and leaves nothing to retry
+    convergence_report(&convergence, 0, "1.1.1.1", now);
+    assert(convergence.records[0].failures == 0);
+    assert(convergence_next_ms(&convergence, now) == -1);
+    convergence_free(&convergence);
+    printf("✓ Failed records retried with capped exponential backoff\n");
+}
+
+int main(void)
+{
+    printf("Testing Record Convergence\n");
+    printf("==========================\n\n");
+
+    test_target();
+    test_backoff();
+
+    printf("\nAll record convergence tests passed!\n");
+    return 0;
+}
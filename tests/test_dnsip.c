@@ -0,0 +1,342 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../lib/dns.h"
+#include "../lib/dnsip.h"
+#include "../lib/provider_scores.h"
+#include "../lib/publicip.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static void test_uri(void)
+{
+    char resolver[64];
+    char name[64];
+    uint16_t port;
+    uint16_t type;
+    uint16_t qclass;
+    assert(dnsip_parse_uri("dns://resolver1.opendns.com/myip.opendns.com",
+                           resolver,
+                           sizeof(resolver),
+                           &port,
+                           name,
+                           sizeof(name),
+                           &type,
+                           &qclass) == 0);
+    assert(strcmp(resolver, "resolver1.opendns.com") == 0 && strcmp(name, "myip.opendns.com") == 0);
+    assert(port == 53 && type == DNS_TYPE_A && qclass == DNS_CLASS_IN);
+    assert(dnsip_parse_uri("DNS://1.1.1.1:5353/whoami.cloudflare?type=TXT;class=CH",
+                           resolver,
+                           sizeof(resolver),
+                           &port,
+                           name,
+                           sizeof(name),
+                           &type,
+                           &qclass) == 0);
+    assert(strcmp(resolver, "1.1.1.1") == 0 && strcmp(name, "whoami.cloudflare") == 0);
+    assert(port == 5353 && type == DNS_TYPE_TXT && qclass == DNS_CLASS_CH);
+    assert(dnsip_parse_uri("dns://[2620:119:35::35]/myip.opendns.com",
+                           resolver,
+                           sizeof(resolver),
+                           &port,
+                           name,
+                           sizeof(name),
+                           &type,
+                           &qclass) == 0);
+    assert(strcmp(resolver, "2620:119:35::35") == 0 && port == 53 && type == DNS_TYPE_A);
+
+    // The local resolver would answer with its own address, so one must be named
+    const char *bad[] = {"dns:myip.opendns.com",
+                         "dns://resolver",
+                         "dns:///myip.opendns.com",
+                         "dns://resolver/",
+                         "dns://resolver:0/name",
+                         "dns://resolver/name?type=MX",
+                         "dns://resolver/name?type=AAAA", // The answer could not go into an A record
+                         "https://ipinfo.io/ip"};
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        assert(dnsip_parse_uri(bad[i], resolver, sizeof(resolver), &port, name, sizeof(name), &type, &qclass) == -1);
+    }
+    assert(dnsip_is_uri("dns://1.1.1.1/whoami.cloudflare") && !dnsip_is_uri("stun:host"));
+    printf("✓ dns:// URIs with resolver, port, type and class\n");
+}
+
+static void test_answer(void)
+{
+    struct dns_message message;
+    memset(&message, 0, sizeof(message));
+    char out[INET6_ADDRSTRLEN];
+
+    // TXT answers may carry other strings before the address
+    struct dns_answer *txt = &message.answers[message.answer_count++];
+    txt->type = DNS_TYPE_TXT;
+    txt->rclass = DNS_CLASS_CH;
+    const char rdata[] = "\x0asubnet 0/0\x0f""2001:DB8:0::0:1";
+    txt->rdlength = sizeof(rdata) - 1;
+    memcpy(txt->rdata, rdata, txt->rdlength);
+    assert(dnsip_answer_address(&message, DNS_TYPE_TXT, out, sizeof(out)) == 0 && strcmp(out, "2001:db8::1") == 0);
+    assert(dnsip_answer_address(&message, DNS_TYPE_A, out, sizeof(out)) == -1);
+
+    // A CNAME ahead of the address is passed over
+    memset(&message, 0, sizeof(message));
+    message.answers[0].type = 5;
+    message.answers[0].rdlength = 4;
+    message.answers[1].type = DNS_TYPE_A;
+    message.answers[1].rdlength = 4;
+    memcpy(message.answers[1].rdata, "\xc6\x33\x64\x07", 4);
+    message.answer_count = 2;
+    assert(dnsip_answer_address(&message, DNS_TYPE_A, out, sizeof(out)) == 0 && strcmp(out, "198.51.100.7") == 0);
+
+    // Queries in class CH
+    unsigned char packet[DNS_MAX_PACKET];
+    int len = dns_build_query_class(packet, sizeof(packet), 0x1234, "whoami.cloudflare", DNS_TYPE_TXT, DNS_CLASS_CH);
+    assert(len == 12 + 19 + 4 && packet[len - 1] == DNS_CLASS_CH && packet[len - 3] == DNS_TYPE_TXT);
+    printf("✓ Addresses found in A and TXT answers\n");
+}
+
+static void test_resolver_address(void)
+{
+    // The AAAA reply arrived first, the IPv4 address is still the one queried
+    struct dns_result result;
+    memset(&result, 0, sizeof(result));
+    result.addresses[0].family = AF_INET6;
+    inet_pton(AF_INET6, "2001:db8::53", result.addresses[0].addr);
+    result.addresses[1].family = AF_INET;
+    inet_pton(AF_INET, "192.0.2.53", result.addresses[1].addr);
+    result.count = 2;
+    struct sockaddr_storage addr;
+    assert(dns_result_sockaddr(&result, 53, &addr) == sizeof(struct sockaddr_in));
+    const struct sockaddr_in *sin = (const struct sockaddr_in *) &addr;
+    char text[INET6_ADDRSTRLEN];
+    assert(sin->sin_family == AF_INET && ntohs(sin->sin_port) == 53);
+    assert(strcmp(inet_ntop(AF_INET, &sin->sin_addr, text, sizeof(text)), "192.0.2.53") == 0);
+
+    // Without one the IPv6 address is used
+    result.count = 1;
+    assert(dns_result_sockaddr(&result, 5353, &addr) == sizeof(struct sockaddr_in6));
+    assert(addr.ss_family == AF_INET6 && ntohs(((const struct sockaddr_in6 *) &addr)->sin6_port) == 5353);
+    printf("✓ Resolvers and STUN servers are reached over IPv4 when they have an address for it\n");
+}
+
+// Loopback resolver answering with the address a query came from: A for
+// myip.opendns.com and TXT in class CH for whoami.cloudflare, an IPv6 TXT
+// answer for whoami6.example, REFUSED for anything else. It drops the very first query.
+static void serve_queries(int fd)
+{
+    for (int received = 0;; received++) {
+        unsigned char packet[DNS_MAX_PACKET];
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(fd, packet, sizeof(packet), 0, (struct sockaddr *) &from, &from_len);
+        if (len < 12 || received == 0) {
+            continue;
+        }
+
+        // Decode the question name
+        char name[256];
+        size_t name_len = 0;
+        size_t pos = 12;
+        while (pos < (size_t) len && packet[pos] != 0 && name_len + packet[pos] + 1 < sizeof(name)) {
+            if (name_len > 0) {
+                name[name_len++] = '.';
+            }
+            memcpy(name + name_len, packet + pos + 1, packet[pos]);
+            name_len += packet[pos];
+            pos += 1 + packet[pos];
+        }
+        name[name_len] = '\0';
+        pos++;
+        if (pos + 4 > (size_t) len) {
+            continue;
+        }
+        uint16_t type = (uint16_t) ((packet[pos] << 8) | packet[pos + 1]);
+        uint16_t qclass = (uint16_t) ((packet[pos + 2] << 8) | packet[pos + 3]);
+        pos += 4;
+
+        packet[2] = 0x81; // QR, RD
+        packet[3] = 0x80; // RA
+        packet[6] = 0;
+        packet[7] = 0;
+        unsigned char *answer = packet + pos;
+        // Name pointer to the question, type, class, TTL 0 and RDLENGTH (low byte set below)
+        const unsigned char header[12] = {
+            0xc0, 0x0c, 0, (unsigned char) type, 0, (unsigned char) qclass, 0, 0, 0, 0, 0, 0};
+        char text[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &from.sin_addr, text, sizeof(text));
+        size_t answer_len = 0;
+        if (strcasecmp(name, "myip.opendns.com") == 0 && type == DNS_TYPE_A && qclass == DNS_CLASS_IN) {
+            memcpy(answer, header, sizeof(header));
+            answer[11] = 4;
+            memcpy(answer + 12, &from.sin_addr, 4);
+            answer_len = 16;
+        } else if (strcasecmp(name, "whoami.cloudflare") == 0 && type == DNS_TYPE_TXT && qclass == DNS_CLASS_CH) {
+            memcpy(answer, header, sizeof(header));
+            answer[11] = (unsigned char) (strlen(text) + 1);
+            answer[12] = (unsigned char) strlen(text);
+            memcpy(answer + 13, text, strlen(text));
+            answer_len = 13 + strlen(text);
+        } else if (strcasecmp(name, "whoami6.example") == 0 && type == DNS_TYPE_TXT) {
+            const char *v6 = "2001:db8::1";
+            memcpy(answer, header, sizeof(header));
+            answer[11] = (unsigned char) (strlen(v6) + 1);
+            answer[12] = (unsigned char) strlen(v6);
+            memcpy(answer + 13, v6, strlen(v6));
+            answer_len = 13 + strlen(v6);
+        } else {
+            packet[3] = 0x85; // RA, REFUSED
+        }
+        packet[7] = answer_len > 0 ? 1 : 0;
+        sendto(fd, packet, pos + answer_len, 0, (struct sockaddr *) &from, from_len);
+    }
+}
+
+// Bind a loopback UDP socket
+static int bind_udp(int *port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    assert(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(getsockname(fd, (struct sockaddr *) &addr, &addr_len) == 0);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static long long elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000LL + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static int stub_port;
+static int silent_port;
+
+static void test_query(void)
+{
+    char opendns[128];
+    char cloudflare[128];
+    char refused[128];
+    char silent[128];
+    snprintf(opendns, sizeof(opendns), "dns://127.0.0.1:%d/myip.opendns.com", stub_port);
+    snprintf(cloudflare, sizeof(cloudflare), "dns://127.0.0.1:%d/whoami.cloudflare?type=TXT;class=CH", stub_port);
+    snprintf(refused, sizeof(refused), "dns://127.0.0.1:%d/example.com", stub_port);
+    snprintf(silent, sizeof(silent), "dns://127.0.0.1:%d/myip.opendns.com", silent_port);
+
+    // The stub drops the first query: the retry gets the answer
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct dnsip_query query;
+    const char *first[] = {opendns};
+    assert(dnsip_query_start(&query, first, 1, 1, 2, 3000) == 0);
+    assert(dnsip_query_run(&query) == 1);
+    long long elapsed = elapsed_ms(&start);
+    assert(elapsed >= DNSIP_ATTEMPT_TIMEOUT_MS && elapsed < 2 * DNSIP_ATTEMPT_TIMEOUT_MS);
+    assert(query.servers[0].attempts == 2 && strcmp(query.servers[0].address, "127.0.0.1") == 0);
+    dnsip_query_cleanup(&query);
+
+    // All resolvers are asked at once; a refusal ends that resolver's part
+    const char *all[] = {refused, cloudflare, opendns};
+    assert(dnsip_query_start(&query, all, 3, 3, 2, 3000) == 0);
+    assert(dnsip_query_run(&query) == 2);
+    assert(query.servers[0].done && !query.servers[0].answered && query.servers[0].attempts == 1);
+    assert(strcmp(query.servers[1].address, "127.0.0.1") == 0 && strcmp(query.servers[2].address, "127.0.0.1") == 0);
+    assert(query.servers[1].rtt_ms < DNSIP_ATTEMPT_TIMEOUT_MS);
+    dnsip_query_cleanup(&query);
+
+    // A silent resolver is retried after 500 ms, then given up 1000 ms later
+    const char *quiet[] = {silent};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert(dnsip_query_start(&query, quiet, 1, 1, 1, 5000) == 0);
+    assert(dnsip_query_run(&query) == 0);
+    elapsed = elapsed_ms(&start);
+    assert(elapsed >= 1500 && elapsed < 1800 && query.servers[0].attempts == 2);
+    dnsip_query_cleanup(&query);
+    printf("✓ Resolvers queried at once, retried, refusals and silence given up\n");
+}
+
+static void test_publicip(void)
+{
+    struct publicip_config config;
+    memset(&config, 0, sizeof(config));
+    config.quorum = 2;
+    config.timeout_ms = 2000;
+    config.dns_retries = 2;
+    char uri[128];
+    snprintf(uri, sizeof(uri), "dns://127.0.0.1:%d/myip.opendns.com", stub_port);
+    config.sources[0] = strdup(uri);
+    snprintf(uri, sizeof(uri), "dns://127.0.0.1:%d/whoami.cloudflare?type=TXT;class=CH", stub_port);
+    config.sources[1] = strdup(uri);
+    config.source_count = 2;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char *ip = publicip_query(&config);
+    assert(ip && strcmp(ip, "127.0.0.1") == 0 && elapsed_ms(&start) < DNSIP_ATTEMPT_TIMEOUT_MS);
+    free(ip);
+    assert(provider_score_get(config.sources[0])->sample_count == 1);
+    assert(provider_score_get(config.sources[1])->sample_count == 1);
+    publicip_config_free(&config);
+    provider_scores_clear();
+
+    // An IPv6 answer cannot go into an A record: it does not count, and the
+    // resolver is scored as failing
+    memset(&config, 0, sizeof(config));
+    config.quorum = 2;
+    config.timeout_ms = 2000;
+    config.dns_retries = 2;
+    snprintf(uri, sizeof(uri), "dns://127.0.0.1:%d/myip.opendns.com", stub_port);
+    config.sources[0] = strdup(uri);
+    snprintf(uri, sizeof(uri), "dns://127.0.0.1:%d/whoami6.example?type=TXT", stub_port);
+    config.sources[1] = strdup(uri);
+    config.source_count = 2;
+    assert(publicip_query(&config) == NULL);
+    assert(provider_score_get(config.sources[0])->failures == 0);
+    assert(provider_score_get(config.sources[1])->failures == 1);
+    publicip_config_free(&config);
+    provider_scores_clear();
+    printf("✓ DNS resolvers as public IP sources, IPv6 answers not counted\n");
+}
+
+int main(void)
+{
+    printf("Testing DNS Public IP Lookup\n");
+    printf("============================\n\n");
+
+    int stub = bind_udp(&stub_port);
+    pid_t server = fork();
+    assert(server >= 0);
+    if (server == 0) {
+        alarm(20);
+        serve_queries(stub);
+        _exit(0);
+    }
+    close(stub);
+    int silent = bind_udp(&silent_port);
+    alarm(20);
+
+    test_uri();
+    test_answer();
+    test_resolver_address();
+    test_query();
+    test_publicip();
+
+    close(silent);
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+
+    printf("\nAll DNS public IP tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,130 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../lib/event_loop.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// State shared with the handlers
+struct pipe_state {
+    struct event_loop *loop;
+    int fds[2];
+    int reads;
+    int writes;
+    int last_events;
+};
+
+static void on_readable(void *ctx, int fd, int events)
+{
+    struct pipe_state *state = ctx;
+    char buffer[16];
+    assert(fd == state->fds[0]);
+    assert(read(fd, buffer, sizeof(buffer)) > 0);
+    state->reads++;
+    state->last_events = events;
+}
+
+static void on_writable(void *ctx, int fd, int events)
+{
+    struct pipe_state *state = ctx;
+    assert(fd == state->fds[1]);
+    state->writes++;
+    state->last_events = events;
+    // Handlers may drop their own watch
+    event_loop_unwatch(state->loop, fd);
+}
+
+static void test_readiness(void)
+{
+    struct pipe_state state = {0};
+    state.loop = event_loop_new();
+    assert(state.loop);
+    assert(pipe(state.fds) == 0);
+
+    assert(event_loop_watch(state.loop, state.fds[0], EVENT_READ, on_readable, &state) == 0);
+    assert(event_loop_wait(state.loop, 0) == 0);
+    assert(state.reads == 0);
+
+    assert(write(state.fds[1], "x", 1) == 1);
+    assert(event_loop_wait(state.loop, 1000) == 1);
+    assert(state.reads == 1);
+    assert(state.last_events & EVENT_READ);
+
+    // Drained: nothing more to report
+    assert(event_loop_wait(state.loop, 10) == 0);
+
+    event_loop_free(state.loop);
+    close(state.fds[0]);
+    close(state.fds[1]);
+
+    printf("✓ Readable descriptor dispatched once\n");
+}
+
+static void test_unwatch(void)
+{
+    struct pipe_state state = {0};
+    state.loop = event_loop_new();
+    assert(state.loop);
+    assert(pipe(state.fds) == 0);
+
+    assert(event_loop_watch(state.loop, state.fds[1], EVENT_WRITE, on_writable, &state) == 0);
+    assert(event_loop_wait(state.loop, 1000) == 1);
+    assert(state.writes == 1);
+    assert(state.last_events & EVENT_WRITE);
+
+    // The handler unwatched itself
+    assert(event_loop_wait(state.loop, 10) == 0);
+    assert(state.writes == 1);
+
+    // Watching again replaces the handler
+    assert(event_loop_watch(state.loop, state.fds[0], EVENT_READ, on_readable, &state) == 0);
+    assert(event_loop_watch(state.loop, state.fds[0], EVENT_READ, on_readable, &state) == 0);
+    assert(write(state.fds[1], "y", 1) == 1);
+    assert(event_loop_wait(state.loop, 1000) == 1);
+    assert(state.reads == 1);
+
+    event_loop_unwatch(state.loop, state.fds[0]);
+    assert(write(state.fds[1], "z", 1) == 1);
+    assert(event_loop_wait(state.loop, 10) == 0);
+    assert(state.reads == 1);
+
+    event_loop_free(state.loop);
+    close(state.fds[0]);
+    close(state.fds[1]);
+
+    printf("✓ Unwatched descriptors are not dispatched\n");
+}
+
+static void test_hangup(void)
+{
+    struct pipe_state state = {0};
+    state.loop = event_loop_new();
+    assert(state.loop);
+    assert(pipe(state.fds) == 0);
+
+    // A closed writer is reported as readable so the next read sees EOF
+    assert(event_loop_watch(state.loop, state.fds[0], EVENT_READ, on_readable, &state) == 0);
+    assert(write(state.fds[1], "x", 1) == 1);
+    close(state.fds[1]);
+    assert(event_loop_wait(state.loop, 1000) == 1);
+    assert(state.reads == 1);
+    assert(state.last_events & EVENT_READ);
+
+    event_loop_free(state.loop);
+    close(state.fds[0]);
+
+    printf("✓ Hangup reported as readable\n");
+}
+
+int main(void)
+{
+    printf("Testing Event Loop\n");
+    printf("==================\n\n");
+
+    test_readiness();
+    test_unwatch();
+    test_hangup();
+
+    printf("\nAll event loop tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,423 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../lib/gateway.h"
+#include "../lib/provider_scores.h"
+#include "../lib/publicip.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Loopback stand-ins for a home gateway: a NAT-PMP server, a PCP-only
+// server, an SSDP responder and the UPnP device's HTTP server
+
+static const char description[] =
+    "<?xml version=\"1.0\"?>\r\n"
+    "<root xmlns=\"urn:schemas-upnp-org:device-1-0\"><device>"
+    "<deviceType>urn:schemas-upnp-org:device:InternetGatewayDevice:1</deviceType><serviceList>"
+    "<service><serviceType>urn:schemas-upnp-org:service:WANCommonInterfaceConfig:1</serviceType>"
+    "<controlURL>/ctl/CmnIfCfg</controlURL></service>"
+    "<service><serviceType>urn:schemas-upnp-org:service:WANIPConnection:1</serviceType>"
+    "<serviceId>urn:upnp-org:serviceId:WANIPConn1</serviceId>"
+    "<controlURL>/ctl/IPConn</controlURL></service>"
+    "</serviceList></device></root>\r\n";
+
+static const char soap_answer[] =
+    "<?xml version=\"1.0\"?>\r\n"
+    "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\"><s:Body>"
+    "<u:GetExternalIPAddressResponse xmlns:u=\"urn:schemas-upnp-org:service:WANIPConnection:1\">"
+    "<NewExternalIPAddress>192.0.2.33</NewExternalIPAddress>"
+    "</u:GetExternalIPAddressResponse></s:Body></s:Envelope>\r\n";
+
+static int bind_socket(int type, const char *address, int *port)
+{
+    int fd = socket(AF_INET, type, 0);
+    assert(fd >= 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t) *port);
+    inet_pton(AF_INET, address, &addr.sin_addr);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    socklen_t addr_len = sizeof(addr);
+    assert(getsockname(fd, (struct sockaddr *) &addr, &addr_len) == 0);
+    *port = ntohs(addr.sin_port);
+    if (type == SOCK_STREAM) {
+        assert(listen(fd, 8) == 0);
+    }
+    return fd;
+}
+
+// Answer a NAT-PMP external address request with an address
+static void serve_natpmp(int fd, const char *external)
+{
+    unsigned char request[64];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len = recvfrom(fd, request, sizeof(request), 0, (struct sockaddr *) &from, &from_len);
+    if (len != 2 || request[0] != NATPMP_VERSION || request[1] != NATPMP_OP_EXTERNAL_ADDRESS) {
+        return;
+    }
+    unsigned char response[NATPMP_RESPONSE_SIZE] = {0, 128, 0, 0, 0, 0, 0x10, 0};
+    inet_pton(AF_INET, external, response + 8);
+    sendto(fd, response, sizeof(response), 0, (struct sockaddr *) &from, from_len);
+}
+
+// A PCP-only server: NAT-PMP requests get UNSUPP_VERSION, MAP requests the address
+static void serve_pcp(int fd)
+{
+    unsigned char request[1100];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len = recvfrom(fd, request, sizeof(request), 0, (struct sockaddr *) &from, &from_len);
+    if (len == 2) {
+        unsigned char response[24] = {PCP_VERSION, 0x80, 0, PCP_UNSUPP_VERSION};
+        sendto(fd, response, sizeof(response), 0, (struct sockaddr *) &from, from_len);
+    } else if (len == PCP_MAP_SIZE && request[0] == PCP_VERSION && request[1] == PCP_OP_MAP) {
+        unsigned char response[PCP_MAP_SIZE];
+        memcpy(response, request, sizeof(response));
+        response[1] = 0x80 | PCP_OP_MAP;
+        response[3] = 0;
+        memset(response + 44, 0, 16);
+        response[54] = 0xff;
+        response[55] = 0xff;
+        inet_pton(AF_INET, "192.0.2.22", response + 56);
+        sendto(fd, response, sizeof(response), 0, (struct sockaddr *) &from, from_len);
+    }
+}
+
+// Answer an M-SEARCH with the description URL
+static void serve_ssdp(int fd, int http_port)
+{
+    char request[1500];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len = recvfrom(fd, request, sizeof(request) - 1, 0, (struct sockaddr *) &from, &from_len);
+    if (len <= 0) {
+        return;
+    }
+    request[len] = '\0';
+    if (strncmp(request, "M-SEARCH", 8) != 0 || !strstr(request, "InternetGatewayDevice")) {
+        return;
+    }
+    char response[512];
+    int response_len = snprintf(response,
+                                sizeof(response),
+                                "HTTP/1.1 200 OK\r\nCACHE-CONTROL: max-age=120\r\n"
+                                "ST: urn:schemas-upnp-org:device:InternetGatewayDevice:1\r\n"
+                                "Location: http://127.0.0.1:%d/rootDesc.xml\r\n\r\n",
+                                http_port);
+    sendto(fd, response, (size_t) response_len, 0, (struct sockaddr *) &from, from_len);
+}
+
+static void write_all(int fd, const char *data)
+{
+    size_t len = strlen(data);
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written <= 0) {
+            return;
+        }
+        data += written;
+        len -= (size_t) written;
+    }
+}
+
+// Serve the description and GetExternalIPAddress on one connection
+static void serve_http(int listener)
+{
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    char request[4096];
+    size_t len = 0;
+    request[0] = '\0';
+    for (;;) {
+        char *head_end = strstr(request, "\r\n\r\n");
+        const char *length = strstr(request, "Content-Length:");
+        if (head_end && (!length || len >= (size_t) (head_end + 4 - request) + (size_t) atoi(length + 15))) {
+            break;
+        }
+        ssize_t received = read(fd, request + len, sizeof(request) - 1 - len);
+        if (received <= 0) {
+            close(fd);
+            return;
+        }
+        len += (size_t) received;
+        request[len] = '\0';
+    }
+
+    const char *body = "";
+    int status = 404;
+    if (strncmp(request, "GET /rootDesc.xml ", 18) == 0) {
+        body = description;
+        status = 200;
+    } else if (strncmp(request, "POST /ctl/IPConn ", 17) == 0 &&
+               strstr(request, "SOAPAction: \"urn:schemas-upnp-org:service:WANIPConnection:1#GetExternalIPAddress\"") &&
+               strstr(request, "<u:GetExternalIPAddress")) {
+        body = soap_answer;
+        status = 200;
+    }
+    char head[256];
+    int head_len = snprintf(head,
+                            sizeof(head),
+                            "HTTP/1.1 %d X\r\nContent-Type: text/xml\r\nContent-Length: %zu\r\n"
+                            "Connection: close\r\n\r\n",
+                            status,
+                            strlen(body));
+    if (write(fd, head, (size_t) head_len) == head_len) {
+        write_all(fd, body);
+    }
+    close(fd);
+}
+
+static int natpmp_port;
+static int pcp_port;
+static int ssdp_port;
+static int http_port;
+static int closed_port;
+
+// Fork the stand-ins. Public answers come from 127.0.0.1:5351, the NAT-PMP
+// port gateway: URIs use, and a carrier-grade NAT one from 127.0.0.2:5351;
+// both are skipped if the port is taken. Returns the process.
+static pid_t start_gateway(bool *well_known)
+{
+    int natpmp = bind_socket(SOCK_DGRAM, "127.0.0.1", &natpmp_port);
+    int pcp = bind_socket(SOCK_DGRAM, "127.0.0.1", &pcp_port);
+    int ssdp = bind_socket(SOCK_DGRAM, "127.0.0.1", &ssdp_port);
+    int http = bind_socket(SOCK_STREAM, "127.0.0.1", &http_port);
+    int port = GATEWAY_NATPMP_PORT;
+    int public = bind_socket(SOCK_DGRAM, "127.0.0.1", &port);
+    port = GATEWAY_NATPMP_PORT;
+    int shared = public >= 0 ? bind_socket(SOCK_DGRAM, "127.0.0.2", &port) : -1;
+    *well_known = public >= 0 && shared >= 0;
+    assert(natpmp >= 0 && pcp >= 0 && ssdp >= 0 && http >= 0);
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        alarm(30);
+        signal(SIGPIPE, SIG_IGN);
+        struct pollfd pfds[6] = {{natpmp, POLLIN, 0},
+                                 {pcp, POLLIN, 0},
+                                 {ssdp, POLLIN, 0},
+                                 {http, POLLIN, 0},
+                                 {public, POLLIN, 0},
+                                 {shared, POLLIN, 0}};
+        for (;;) {
+            if (poll(pfds, 6, -1) < 0) {
+                _exit(1);
+            }
+            if (pfds[0].revents & POLLIN) {
+                serve_natpmp(natpmp, "192.0.2.11");
+            }
+            if (pfds[1].revents & POLLIN) {
+                serve_pcp(pcp);
+            }
+            if (pfds[2].revents & POLLIN) {
+                serve_ssdp(ssdp, http_port);
+            }
+            if (pfds[3].revents & POLLIN) {
+                serve_http(http);
+            }
+            if (pfds[4].revents & POLLIN) {
+                serve_natpmp(public, "8.8.4.4");
+            }
+            if (pfds[5].revents & POLLIN) {
+                serve_natpmp(shared, "100.64.0.7");
+            }
+        }
+    }
+    close(natpmp);
+    close(pcp);
+    close(ssdp);
+    close(http);
+    if (public >= 0) {
+        close(public);
+    }
+    if (shared >= 0) {
+        close(shared);
+    }
+    return pid;
+}
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void set_target(struct sockaddr_in *addr, int port)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons((uint16_t) port);
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+static void test_codecs(void)
+{
+    char out[INET6_ADDRSTRLEN];
+    unsigned char natpmp[NATPMP_RESPONSE_SIZE] = {0, 128, 0, 0, 0, 0, 0, 1, 198, 51, 100, 4};
+    assert(gateway_natpmp_parse(natpmp, sizeof(natpmp), out, sizeof(out)) == 0 && strcmp(out, "198.51.100.4") == 0);
+    natpmp[3] = 3; // Network failure
+    assert(gateway_natpmp_parse(natpmp, sizeof(natpmp), out, sizeof(out)) == -1);
+    natpmp[3] = 0;
+    memset(natpmp + 8, 0, 4); // No address yet
+    assert(gateway_natpmp_parse(natpmp, sizeof(natpmp), out, sizeof(out)) == -1);
+    const unsigned char pcp_reply[24] = {PCP_VERSION, 0x80, 0, PCP_UNSUPP_VERSION};
+    assert(gateway_natpmp_parse(pcp_reply, sizeof(pcp_reply), out, sizeof(out)) == PCP_UNSUPP_VERSION);
+
+    unsigned char nonce[PCP_NONCE_SIZE] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+    struct in_addr client;
+    inet_pton(AF_INET, "192.168.1.20", &client);
+    unsigned char map[PCP_MAP_SIZE];
+    assert(gateway_pcp_build_map(map, &client, 40000, 60, nonce) == PCP_MAP_SIZE);
+    assert(map[0] == 2 && map[1] == 1 && map[7] == 60 && map[19] == 0xff && map[20] == 192 && map[23] == 20);
+    assert(map[36] == IPPROTO_UDP && map[40] == (40000 >> 8) && map[55] == 0xff);
+    map[1] = 0x80 | PCP_OP_MAP;
+    inet_pton(AF_INET, "198.51.100.5", map + 56);
+    assert(gateway_pcp_parse(map, sizeof(map), nonce, out, sizeof(out)) == 0 && strcmp(out, "198.51.100.5") == 0);
+    nonce[0] = 9; // Another request's answer
+    assert(gateway_pcp_parse(map, sizeof(map), nonce, out, sizeof(out)) == -1);
+    printf("✓ NAT-PMP and PCP MAP packets\n");
+}
+
+static void test_upnp_parsing(void)
+{
+    char location[256];
+    const char *ssdp = "HTTP/1.1 200 OK\r\nST: upnp:rootdevice\r\nlocation:  http://192.168.1.1:5000/desc.xml \r\n\r\n";
+    assert(gateway_ssdp_location(ssdp, strlen(ssdp), location, sizeof(location)) == 0);
+    assert(strcmp(location, "http://192.168.1.1:5000/desc.xml") == 0);
+    const char *notify = "NOTIFY * HTTP/1.1\r\nLOCATION: http://192.168.1.1/\r\n\r\n";
+    assert(gateway_ssdp_location(notify, strlen(notify), location, sizeof(location)) == -1);
+
+    char control[256];
+    char service[128];
+    assert(gateway_upnp_find_service(
+               description, "http://192.168.1.1:5000/desc.xml", control, sizeof(control), service, sizeof(service)) ==
+           0);
+    assert(strcmp(control, "http://192.168.1.1:5000/ctl/IPConn") == 0);
+    assert(strcmp(service, "urn:schemas-upnp-org:service:WANIPConnection:1") == 0);
+
+    // A PPP link with a URL base and a relative control URL
+    const char *ppp = "<root><URLBase>http://10.0.0.1:49152</URLBase><serviceList><service>"
+                      "<serviceType>urn:schemas-upnp-org:service:WANPPPConnection:1</serviceType>"
+                      "<controlURL>upnp/control/WANPPPConn1</controlURL></service></serviceList></root>";
+    assert(gateway_upnp_find_service(
+               ppp, "http://10.0.0.1:49152/desc.xml", control, sizeof(control), service, sizeof(service)) == 0);
+    assert(strcmp(control, "http://10.0.0.1:49152/upnp/control/WANPPPConn1") == 0);
+    const char *none = "<root><service><serviceType>urn:schemas-upnp-org:service:Layer3Forwarding:1</serviceType>"
+                       "<controlURL>/ctl/L3F</controlURL></service></root>";
+    assert(gateway_upnp_find_service(none, "http://10.0.0.1/", control, sizeof(control), service, sizeof(service)) ==
+           -1);
+
+    char out[INET6_ADDRSTRLEN];
+    assert(gateway_upnp_parse_address(soap_answer, out, sizeof(out)) == 0 && strcmp(out, "192.0.2.33") == 0);
+    assert(gateway_upnp_parse_address("<NewExternalIPAddress></NewExternalIPAddress>", out, sizeof(out)) == -1);
+    printf("✓ SSDP responses, device descriptions and SOAP answers\n");
+}
+
+static void test_query(void)
+{
+    char path[] = "/tmp/test_gateway_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    gateway_set_cache_file(path);
+
+    struct gateway_options options;
+    char out[INET6_ADDRSTRLEN];
+    set_target(&options.natpmp, natpmp_port);
+    set_target(&options.ssdp, closed_port);
+    assert(gateway_query(&options, 2000, out, sizeof(out)) == 0 && strcmp(out, "192.0.2.11") == 0);
+    assert(gateway_cache_get("127.0.0.1")->natpmp == GATEWAY_YES);
+
+    set_target(&options.natpmp, pcp_port);
+    assert(gateway_query(&options, 2000, out, sizeof(out)) == 0 && strcmp(out, "192.0.2.22") == 0);
+    printf("✓ NAT-PMP answered, and PCP when the gateway speaks only that\n");
+
+    // No NAT-PMP on the gateway (its port is closed): UPnP is discovered
+    set_target(&options.natpmp, closed_port);
+    set_target(&options.ssdp, ssdp_port);
+    assert(gateway_query(&options, 3000, out, sizeof(out)) == 0 && strcmp(out, "192.0.2.33") == 0);
+    const struct gateway_entry *entry = gateway_cache_get("127.0.0.1");
+    assert(entry->natpmp == GATEWAY_NO && entry->upnp == GATEWAY_YES);
+    assert(strstr(entry->control_url, "/ctl/IPConn") && strstr(entry->service, "WANIPConnection:1"));
+
+    // From the state file, the next run asks the control URL straight away
+    gateway_set_cache_file(NULL);
+    gateway_set_cache_file(path);
+    set_target(&options.ssdp, closed_port);
+    long long started = now_ms();
+    assert(gateway_query(&options, 3000, out, sizeof(out)) == 0 && strcmp(out, "192.0.2.33") == 0);
+    assert(now_ms() - started < GATEWAY_SSDP_WAIT_MS);
+    printf("✓ UPnP IGD found over SSDP, its control URL kept between runs\n");
+
+    gateway_set_cache_file(NULL);
+    unlink(path);
+}
+
+static void test_publicip(bool well_known)
+{
+    if (!well_known) {
+        printf("✓ NAT-PMP port taken, public IP source test skipped\n");
+        return;
+    }
+    struct publicip_config config;
+    assert(publicip_config_init(&config) == 0);
+    free(config.sources[0]);
+    config.sources[0] = strdup("gateway:127.0.0.1");
+    char *address = publicip_query(&config);
+    assert(address && strcmp(address, "8.8.4.4") == 0);
+    free(address);
+    assert(provider_score_get("gateway:127.0.0.1")->failures == 0);
+
+    // A gateway behind carrier-grade NAT does not know the public address
+    free(config.sources[0]);
+    config.sources[0] = strdup("gateway:127.0.0.2");
+    assert(publicip_query(&config) == NULL);
+    assert(provider_score_get("gateway:127.0.0.2")->failures == 1);
+    publicip_config_free(&config);
+    printf("✓ gateway: sources answer the public IP query, private answers fail\n");
+}
+
+int main(void)
+{
+    printf("Testing Gateway External IP Discovery\n");
+    printf("=====================================\n\n");
+
+    bool well_known = false;
+    pid_t server = start_gateway(&well_known);
+
+    // A port nothing listens on: NAT-PMP requests are refused, M-SEARCHes unanswered
+    int closed = bind_socket(SOCK_DGRAM, "127.0.0.1", &closed_port);
+    close(closed);
+    alarm(30);
+
+    test_codecs();
+    test_upnp_parsing();
+    test_query();
+    test_publicip(well_known);
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+
+    printf("\nAll gateway tests passed!\n");
+    return 0;
+}
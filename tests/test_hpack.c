@@ -0,0 +1,199 @@
+#include "../lib/hpack.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Convert a hex string to bytes, returns the length
+static size_t from_hex(const char *hex, unsigned char *out)
+{
+    size_t len = 0;
+    for (; hex[0] && hex[1]; hex += 2) {
+        unsigned int byte;
+        assert(sscanf(hex, "%2x", &byte) == 1);
+        out[len++] = (unsigned char) byte;
+    }
+    return len;
+}
+
+// Decode a hex block and compare it with "name: value" lines
+static void expect_block(struct hpack_table *table, const char *hex, const char *const *expected, int expected_count)
+{
+    unsigned char block[512];
+    size_t len = from_hex(hex, block);
+    struct hpack_field fields[16];
+    int count = hpack_decode(table, block, len, fields, 16);
+    assert(count == expected_count);
+    for (int i = 0; i < count; i++) {
+        char line[256];
+        snprintf(line, sizeof(line), "%s: %s", fields[i].name, fields[i].value);
+        assert(strcmp(line, expected[i]) == 0);
+    }
+    hpack_fields_free(fields, count);
+}
+
+// RFC 7541 C.4: requests with Huffman coding sharing one dynamic table
+static void test_rfc_requests(void)
+{
+    struct hpack_table table;
+    hpack_table_init(&table, HPACK_DEFAULT_TABLE_SIZE);
+
+    const char *first[] = {":method: GET", ":scheme: http", ":path: /", ":authority: www.example.com"};
+    expect_block(&table, "828684418cf1e3c2e5f23a6ba0ab90f4ff", first, 4);
+    assert(table.size == 57);
+
+    const char *second[] = {
+        ":method: GET", ":scheme: http", ":path: /", ":authority: www.example.com", "cache-control: no-cache"};
+    expect_block(&table, "828684be5886a8eb10649cbf", second, 5);
+    assert(table.size == 110);
+
+    const char *third[] = {":method: GET",
+                           ":scheme: https",
+                           ":path: /index.html",
+                           ":authority: www.example.com",
+                           "custom-key: custom-value"};
+    expect_block(&table, "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf", third, 5);
+    assert(table.size == 164);
+
+    hpack_table_free(&table);
+    printf("✓ RFC 7541 C.4 request blocks decoded\n");
+}
+
+// RFC 7541 C.6: responses with Huffman coding and evictions in a 256-byte table
+static void test_rfc_responses(void)
+{
+    struct hpack_table table;
+    hpack_table_init(&table, 256);
+
+    const char *first[] = {":status: 302",
+                           "cache-control: private",
+                           "date: Mon, 21 Oct 2013 20:13:21 GMT",
+                           "location: https://www.example.com"};
+    expect_block(&table,
+                 "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff6e919d29ad171863c78f0b97c8e9ae"
+                 "82ae43d3",
+                 first,
+                 4);
+    assert(table.size == 222);
+
+    const char *second[] = {":status: 307",
+                            "cache-control: private",
+                            "date: Mon, 21 Oct 2013 20:13:21 GMT",
+                            "location: https://www.example.com"};
+    expect_block(&table, "4883640effc1c0bf", second, 4);
+    assert(table.size == 222);
+
+    const char *third[] = {":status: 200",
+                           "cache-control: private",
+                           "date: Mon, 21 Oct 2013 20:13:22 GMT",
+                           "location: https://www.example.com",
+                           "content-encoding: gzip",
+                           "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"};
+    expect_block(&table,
+                 "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94e7821dd7f2e6c7b335dfdfcd5b3960"
+                 "d5af27087f3672c1ab270fb5291f9587316065c003ed4ee5b1063d5007",
+                 third,
+                 6);
+    assert(table.size == 215);
+
+    hpack_table_free(&table);
+    printf("✓ RFC 7541 C.6 response blocks decoded with evictions\n");
+}
+
+// Encode a request block and decode it with a separate table
+static size_t round_trip(struct hpack_table *encoder, struct hpack_table *decoder, const char *path, const char *token)
+{
+    struct hpack_buffer out = {0};
+    assert(hpack_encode(encoder, &out, ":method", "GET") == 0);
+    assert(hpack_encode(encoder, &out, ":scheme", "https") == 0);
+    assert(hpack_encode(encoder, &out, ":authority", "api.cloudflare.com") == 0);
+    assert(hpack_encode(encoder, &out, ":path", path) == 0);
+    assert(hpack_encode(encoder, &out, "authorization", token) == 0);
+    assert(hpack_encode(encoder, &out, "content-type", "application/json") == 0);
+
+    struct hpack_field fields[16];
+    int count = hpack_decode(decoder, out.data, out.len, fields, 16);
+    assert(count == 6);
+    assert(strcmp(fields[2].value, "api.cloudflare.com") == 0);
+    assert(strcmp(fields[3].name, ":path") == 0);
+    assert(strcmp(fields[3].value, path) == 0);
+    assert(strcmp(fields[4].value, token) == 0);
+    assert(strcmp(fields[5].value, "application/json") == 0);
+    hpack_fields_free(fields, count);
+
+    size_t len = out.len;
+    hpack_buffer_free(&out);
+    return len;
+}
+
+static void test_encoder_indexing(void)
+{
+    struct hpack_table encoder;
+    struct hpack_table decoder;
+    hpack_table_init(&encoder, HPACK_DEFAULT_TABLE_SIZE);
+    hpack_table_init(&decoder, HPACK_DEFAULT_TABLE_SIZE);
+
+    const char *token = "Bearer 0123456789abcdefghijklmnopqrstuvwxyzABCD";
+    size_t first = round_trip(&encoder, &decoder, "/client/v4/zones/a/dns_records?name=a.example.com", token);
+    size_t second = round_trip(&encoder, &decoder, "/client/v4/zones/a/dns_records?name=b.example.com", token);
+
+    // The repeated authority, token and content type shrink to one byte each
+    assert(second < first);
+    assert(second < 50);
+
+    // A smaller peer table is announced in the next block
+    hpack_table_set_max_size(&encoder, 0);
+    round_trip(&encoder, &decoder, "/", token);
+    assert(decoder.max_size == 0);
+    assert(decoder.count == 0);
+
+    hpack_table_free(&encoder);
+    hpack_table_free(&decoder);
+    printf("✓ Repeated headers indexed (%zu bytes, then %zu)\n", first, second);
+}
+
+static void test_malformed(void)
+{
+    struct hpack_table table;
+    hpack_table_init(&table, HPACK_DEFAULT_TABLE_SIZE);
+    struct hpack_field fields[16];
+    unsigned char block[64];
+
+    // Index 0 and an index past the dynamic table
+    assert(hpack_decode(&table, (const unsigned char *) "\x80", 1, fields, 16) < 0);
+    assert(hpack_decode(&table, (const unsigned char *) "\xbe", 1, fields, 16) < 0);
+
+    // String longer than the block
+    size_t len = from_hex("400a637573746f6d", block);
+    assert(hpack_decode(&table, block, len, fields, 16) < 0);
+
+    // Huffman "a" padded with ones decodes, padded with zeros does not
+    len = from_hex("000161811f", block);
+    assert(hpack_decode(&table, block, len, fields, 16) == 1);
+    assert(strcmp(fields[0].value, "a") == 0);
+    hpack_fields_free(fields, 1);
+    len = from_hex("0001618118", block);
+    assert(hpack_decode(&table, block, len, fields, 16) < 0);
+
+    // Table size update above the settings limit
+    len = from_hex("3fe21f", block);
+    assert(hpack_decode(&table, block, len, fields, 16) < 0);
+
+    hpack_table_free(&table);
+    printf("✓ Malformed blocks rejected\n");
+}
+
+int main(void)
+{
+    printf("Testing HPACK\n");
+    printf("=============\n\n");
+
+    test_rfc_requests();
+    test_rfc_responses();
+    test_encoder_indexing();
+    test_malformed();
+
+    printf("\nAll HPACK tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,566 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../lib/hpack.h"
+#include "../lib/http2.h"
+#include "../lib/socket_http.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PREFACE_LEN 24
+
+// Frame as written by the client
+struct frame {
+    int type;
+    int flags;
+    uint32_t id;
+    const unsigned char *payload;
+    size_t len;
+};
+
+// Split the client output into frames, skipping the connection preface
+static int parse_frames(const unsigned char *data, size_t len, struct frame *frames, int max)
+{
+    size_t pos = 0;
+    if (len >= PREFACE_LEN && memcmp(data, "PRI * HTTP/2.0", 14) == 0) {
+        pos = PREFACE_LEN;
+    }
+    int count = 0;
+    while (pos + 9 <= len && count < max) {
+        size_t frame_len = ((size_t) data[pos] << 16) | ((size_t) data[pos + 1] << 8) | data[pos + 2];
+        assert(pos + 9 + frame_len <= len);
+        frames[count].type = data[pos + 3];
+        frames[count].flags = data[pos + 4];
+        frames[count].id = ((uint32_t) (data[pos + 5] & 0x7f) << 24) | ((uint32_t) data[pos + 6] << 16) |
+                           ((uint32_t) data[pos + 7] << 8) | data[pos + 8];
+        frames[count].payload = data + pos + 9;
+        frames[count].len = frame_len;
+        count++;
+        pos += 9 + frame_len;
+    }
+    return count;
+}
+
+// Take everything the client queued
+static int take_output(struct http2_session *session, struct frame *frames, int max, unsigned char *copy)
+{
+    const unsigned char *data;
+    size_t len = http2_pending_output(session, &data);
+    memcpy(copy, data, len);
+    http2_output_sent(session, len);
+    return parse_frames(copy, len, frames, max);
+}
+
+static size_t put_frame(unsigned char *out, int type, int flags, uint32_t id, const void *payload, size_t len)
+{
+    out[0] = (unsigned char) (len >> 16);
+    out[1] = (unsigned char) (len >> 8);
+    out[2] = (unsigned char) len;
+    out[3] = (unsigned char) type;
+    out[4] = (unsigned char) flags;
+    out[5] = (unsigned char) (id >> 24);
+    out[6] = (unsigned char) (id >> 16);
+    out[7] = (unsigned char) (id >> 8);
+    out[8] = (unsigned char) id;
+    if (len > 0) {
+        memcpy(out + 9, payload, len);
+    }
+    return 9 + len;
+}
+
+static size_t put_u32_frame(unsigned char *out, int type, uint32_t id, uint32_t value)
+{
+    unsigned char payload[4] = {(unsigned char) (value >> 24),
+                                (unsigned char) (value >> 16),
+                                (unsigned char) (value >> 8),
+                                (unsigned char) value};
+    return put_frame(out, type, 0, id, payload, sizeof(payload));
+}
+
+static void test_request_frames(void)
+{
+    struct http2_session *session = http2_session_new();
+    assert(session);
+
+    struct hpack_field fields[] = {
+        {"Host", "api.example.com"}, {"Authorization", "Bearer token"}, {"Content-Type", "application/json"}};
+    struct http2_stream *stream =
+        http2_submit(session, "GET", "https", "api.example.com", "/client/v4/zones", fields, 3, NULL, 0, NULL);
+    assert(stream && stream->id == 1);
+
+    unsigned char copy[4096];
+    struct frame frames[8];
+    int count = take_output(session, frames, 8, copy);
+
+    // SETTINGS, connection WINDOW_UPDATE, then HEADERS ending the stream
+    assert(count == 3);
+    assert(frames[0].type == 0x4 && frames[0].id == 0);
+    assert(frames[1].type == 0x8);
+    assert(frames[2].type == 0x1 && frames[2].id == 1 && frames[2].flags == (0x4 | 0x1));
+    assert(stream->bytes_sent == 9 + frames[2].len);
+
+    struct hpack_table decoder;
+    hpack_table_init(&decoder, HPACK_DEFAULT_TABLE_SIZE);
+    struct hpack_field decoded[16];
+    int field_count = hpack_decode(&decoder, frames[2].payload, frames[2].len, decoded, 16);
+    assert(field_count == 6); // Host is dropped, names are lower case
+    assert(strcmp(decoded[0].name, ":method") == 0 && strcmp(decoded[0].value, "GET") == 0);
+    assert(strcmp(decoded[3].name, ":path") == 0 && strcmp(decoded[3].value, "/client/v4/zones") == 0);
+    assert(strcmp(decoded[4].name, "authorization") == 0);
+    assert(strcmp(decoded[5].name, "content-type") == 0);
+    hpack_fields_free(decoded, field_count);
+    hpack_table_free(&decoder);
+
+    http2_session_free(session);
+    printf("✓ Preface, SETTINGS and request HEADERS written\n");
+}
+
+static void test_response(void)
+{
+    struct http2_session *session = http2_session_new();
+    struct http2_stream *stream = http2_submit(session, "GET", "https", "example.com", "/", NULL, 0, NULL, 0, NULL);
+    unsigned char copy[4096];
+    struct frame frames[8];
+    take_output(session, frames, 8, copy);
+
+    // Response headers split over HEADERS and CONTINUATION, then padded DATA
+    struct hpack_table encoder;
+    hpack_table_init(&encoder, HPACK_DEFAULT_TABLE_SIZE);
+    struct hpack_buffer block = {0};
+    assert(hpack_encode(&encoder, &block, ":status", "200") == 0);
+    assert(hpack_encode(&encoder, &block, "content-type", "application/json") == 0);
+
+    unsigned char input[512];
+    size_t len = put_frame(input, 0x4, 0, 0, NULL, 0);
+    len += put_frame(input + len, 0x1, 0, 1, block.data, 2);
+    len += put_frame(input + len, 0x9, 0x4, 1, block.data + 2, block.len - 2);
+    unsigned char padded[] = {3, '{', '}', 0, 0, 0};
+    len += put_frame(input + len, 0x0, 0x8, 1, padded, sizeof(padded));
+    len += put_frame(input + len, 0x0, 0x1, 1, "\n", 1);
+    hpack_buffer_free(&block);
+    hpack_table_free(&encoder);
+
+    // Fed in two pieces, splitting a frame
+    assert(http2_feed(session, input, 20) == 0);
+    assert(!http2_take_done(session));
+    assert(http2_feed(session, input + 20, len - 20) == 0);
+
+    struct http2_stream *done = http2_take_done(session);
+    assert(done == stream);
+    assert(done->status == 200 && done->error == HTTP2_NO_ERROR);
+    assert(done->body_len == 3 && strcmp(done->body, "{}\n") == 0);
+    assert(done->bytes_received == len - 9); // Every frame but the SETTINGS
+    assert(strcmp(http2_stream_header(done, "content-type"), "application/json") == 0);
+    http2_stream_free(done);
+
+    // SETTINGS acknowledged
+    int count = take_output(session, frames, 8, copy);
+    assert(count == 1 && frames[0].type == 0x4 && frames[0].flags == 0x1);
+
+    http2_session_free(session);
+    printf("✓ Response with CONTINUATION and padded DATA assembled\n");
+}
+
+static void test_flow_control(void)
+{
+    struct http2_session *session = http2_session_new();
+    unsigned char copy[4096];
+    struct frame frames[16];
+    take_output(session, frames, 16, copy);
+
+    // A 100000-byte body only sends the default 65535-byte window
+    size_t body_len = 100000;
+    char *body = malloc(body_len);
+    memset(body, 'x', body_len);
+    struct http2_stream *stream =
+        http2_submit(session, "POST", "https", "example.com", "/upload", NULL, 0, body, body_len, NULL);
+    free(body);
+
+    const unsigned char *data;
+    size_t pending = http2_pending_output(session, &data);
+    unsigned char *output = malloc(pending);
+    memcpy(output, data, pending);
+    http2_output_sent(session, pending);
+    struct frame big[16];
+    int count = parse_frames(output, pending, big, 16);
+    size_t sent = 0;
+    for (int i = 0; i < count; i++) {
+        if (big[i].type == 0x0) {
+            sent += big[i].len;
+            assert(!(big[i].flags & 0x1));
+        }
+    }
+    assert(sent == 65535);
+    free(output);
+
+    // Window updates release the rest, which ends the stream
+    unsigned char input[64];
+    size_t len = put_u32_frame(input, 0x8, 0, 40000);
+    len += put_u32_frame(input + len, 0x8, 1, 40000);
+    assert(http2_feed(session, input, len) == 0);
+    pending = http2_pending_output(session, &data);
+    output = malloc(pending);
+    memcpy(output, data, pending);
+    http2_output_sent(session, pending);
+    count = parse_frames(output, pending, big, 16);
+    sent = 0;
+    for (int i = 0; i < count; i++) {
+        sent += big[i].len;
+    }
+    assert(sent == body_len - 65535);
+    assert(big[count - 1].type == 0x0 && (big[count - 1].flags & 0x1));
+    free(output);
+
+    assert(stream->pending == NULL);
+    http2_session_free(session);
+    printf("✓ Request body limited by flow-control windows\n");
+}
+
+static void test_consumed_window(void)
+{
+    struct http2_session *session = http2_session_new();
+    struct http2_stream *stream = http2_submit(session, "GET", "https", "example.com", "/", NULL, 0, NULL, 0, NULL);
+    stream->consume_body = true;
+    unsigned char copy[4096];
+    struct frame frames[16];
+    take_output(session, frames, 16, copy);
+
+    // 40 full DATA frames, more than half the stream window
+    struct hpack_table encoder;
+    hpack_table_init(&encoder, HPACK_DEFAULT_TABLE_SIZE);
+    struct hpack_buffer block = {0};
+    assert(hpack_encode(&encoder, &block, ":status", "200") == 0);
+    size_t frame_count = 40;
+    unsigned char *input = malloc(64 + frame_count * (9 + HTTP2_MAX_FRAME_SIZE));
+    unsigned char *payload = calloc(1, HTTP2_MAX_FRAME_SIZE);
+    size_t len = put_frame(input, 0x1, 0x4, 1, block.data, block.len);
+    for (size_t i = 0; i < frame_count; i++) {
+        len += put_frame(input + len, 0x0, 0, 1, payload, HTTP2_MAX_FRAME_SIZE);
+    }
+    hpack_buffer_free(&block);
+    hpack_table_free(&encoder);
+    assert(http2_feed(session, input, len) == 0);
+    free(input);
+    free(payload);
+
+    // Only the connection window reopens until the body is consumed
+    size_t received = frame_count * HTTP2_MAX_FRAME_SIZE;
+    int count = take_output(session, frames, 16, copy);
+    assert(count == 1 && frames[0].type == 0x8 && frames[0].id == 0);
+    assert(stream->body_len == received);
+
+    http2_consume(session, stream, received);
+    assert(stream->body_len == 0);
+    count = take_output(session, frames, 16, copy);
+    assert(count == 1 && frames[0].type == 0x8 && frames[0].id == 1);
+    const unsigned char *increment = frames[0].payload;
+    assert((((size_t) increment[1] << 16) | ((size_t) increment[2] << 8) | increment[3]) == received);
+
+    http2_session_free(session);
+    printf("✓ Streamed body reopens the stream window only when consumed\n");
+}
+
+static void test_goaway_and_errors(void)
+{
+    struct http2_session *session = http2_session_new();
+    struct http2_stream *first = http2_submit(session, "GET", "https", "example.com", "/1", NULL, 0, NULL, 0, NULL);
+    struct http2_stream *second = http2_submit(session, "GET", "https", "example.com", "/2", NULL, 0, NULL, 0, NULL);
+    struct http2_stream *third = http2_submit(session, "GET", "https", "example.com", "/3", NULL, 0, NULL, 0, NULL);
+    assert(first && second && third);
+
+    // Streams above the last processed one may be retried elsewhere
+    unsigned char input[64];
+    unsigned char goaway[8] = {0, 0, 0, 1, 0, 0, 0, 0};
+    size_t len = put_frame(input, 0x7, 0, 0, goaway, sizeof(goaway));
+    assert(http2_feed(session, input, len) == 0);
+    assert(!http2_can_submit(session) && !http2_is_usable(session));
+    assert(http2_active_streams(session) == 1);
+    struct http2_stream *done = http2_take_done(session);
+    assert(done == second && done->retryable && done->error == HTTP2_REFUSED_STREAM);
+    http2_stream_free(done);
+    done = http2_take_done(session);
+    assert(done == third && done->retryable);
+    http2_stream_free(done);
+
+    // Server push is refused: connection error, the open stream fails
+    unsigned char promise[4] = {0, 0, 0, 2};
+    len = put_frame(input, 0x5, 0x4, 1, promise, sizeof(promise));
+    assert(http2_feed(session, input, len) < 0);
+    done = http2_take_done(session);
+    assert(done == first && done->error == HTTP2_PROTOCOL_ERROR);
+    http2_stream_free(done);
+
+    unsigned char copy[4096];
+    struct frame frames[16];
+    int count = take_output(session, frames, 16, copy);
+    assert(frames[count - 1].type == 0x7); // GOAWAY with PROTOCOL_ERROR
+    assert(frames[count - 1].payload[7] == HTTP2_PROTOCOL_ERROR);
+
+    http2_session_free(session);
+    printf("✓ GOAWAY marks unprocessed streams retryable, protocol errors fail the connection\n");
+}
+
+// Loopback HTTP/2 stand-in server
+
+static int alpn_select(SSL *ssl,
+                       const unsigned char **out,
+                       unsigned char *out_len,
+                       const unsigned char *in,
+                       unsigned int in_len,
+                       void *arg)
+{
+    (void) ssl;
+    (void) arg;
+    int selected =
+        SSL_select_next_proto((unsigned char **) out, out_len, (const unsigned char *) "\x02h2", 3, in, in_len);
+    if (selected != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+
+// TLS context with a throwaway self-signed certificate, selecting h2
+static SSL_CTX *server_context(void)
+{
+    EVP_PKEY *key = EVP_EC_gen("P-256");
+    X509 *cert = X509_new();
+    assert(key && cert);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME *name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *) "localhost", -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    assert(X509_sign(cert, key, EVP_sha256()) > 0);
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    assert(ctx);
+    assert(SSL_CTX_use_certificate(ctx, cert) == 1);
+    assert(SSL_CTX_use_PrivateKey(ctx, key) == 1);
+    SSL_CTX_set_alpn_select_cb(ctx, alpn_select, NULL);
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return ctx;
+}
+
+static int read_exact(SSL *ssl, unsigned char *buffer, size_t len)
+{
+    size_t got = 0;
+    while (got < len) {
+        int received = SSL_read(ssl, buffer + got, (int) (len - got));
+        if (received <= 0) {
+            return -1;
+        }
+        got += (size_t) received;
+    }
+    return 0;
+}
+
+static void write_frame(SSL *ssl, int type, int flags, uint32_t id, const void *payload, size_t len)
+{
+    unsigned char frame[16384 + 9];
+    size_t frame_len = put_frame(frame, type, flags, id, payload, len);
+    assert(SSL_write(ssl, frame, (int) frame_len) == (int) frame_len);
+}
+
+// Answer every request on one connection with "METHOD PATH [BODY]". The first
+// request for /refuse is reset with REFUSED_STREAM.
+static void serve_connection(SSL *ssl)
+{
+    unsigned char preface[PREFACE_LEN];
+    if (read_exact(ssl, preface, sizeof(preface)) != 0 || memcmp(preface, "PRI * HTTP/2.0", 14) != 0) {
+        return;
+    }
+    unsigned char settings[6] = {0, 0x3, 0, 0, 0, 16}; // MAX_CONCURRENT_STREAMS
+    write_frame(ssl, 0x4, 0, 0, settings, sizeof(settings));
+
+    struct hpack_table decoder;
+    struct hpack_table encoder;
+    hpack_table_init(&decoder, HPACK_DEFAULT_TABLE_SIZE);
+    hpack_table_init(&encoder, HPACK_DEFAULT_TABLE_SIZE);
+    bool refused = false;
+    char request[1024] = "";
+    unsigned char header[9];
+    static unsigned char payload[16384];
+
+    while (read_exact(ssl, header, sizeof(header)) == 0) {
+        size_t len = ((size_t) header[0] << 16) | ((size_t) header[1] << 8) | header[2];
+        int type = header[3];
+        int flags = header[4];
+        uint32_t id = ((uint32_t) (header[5] & 0x7f) << 24) | ((uint32_t) header[6] << 16) |
+                      ((uint32_t) header[7] << 8) | header[8];
+        if (len > sizeof(payload) || read_exact(ssl, payload, len) != 0) {
+            break;
+        }
+
+        bool respond = false;
+        if (type == 0x4 && !(flags & 0x1)) {
+            write_frame(ssl, 0x4, 0x1, 0, NULL, 0);
+        } else if (type == 0x7) {
+            break;
+        } else if (type == 0x1) {
+            struct hpack_field fields[32];
+            int count = hpack_decode(&decoder, payload, len, fields, 32);
+            assert(count > 0);
+            const char *method = "";
+            const char *path = "";
+            for (int i = 0; i < count; i++) {
+                if (strcmp(fields[i].name, ":method") == 0) {
+                    method = fields[i].value;
+                } else if (strcmp(fields[i].name, ":path") == 0) {
+                    path = fields[i].value;
+                }
+            }
+            snprintf(request, sizeof(request), "%s %s", method, path);
+            hpack_fields_free(fields, count);
+            respond = (flags & 0x1) != 0;
+        } else if (type == 0x0) {
+            size_t used = strlen(request);
+            snprintf(request + used, sizeof(request) - used, " %.*s", (int) len, (const char *) payload);
+            respond = (flags & 0x1) != 0;
+        }
+        if (!respond) {
+            continue;
+        }
+
+        if (strcmp(request, "GET /refuse") == 0 && !refused) {
+            refused = true;
+            unsigned char code[4] = {0, 0, 0, HTTP2_REFUSED_STREAM};
+            write_frame(ssl, 0x3, 0, id, code, sizeof(code));
+            continue;
+        }
+        struct hpack_buffer block = {0};
+        assert(hpack_encode(&encoder, &block, ":status", "200") == 0);
+        assert(hpack_encode(&encoder, &block, "content-type", "text/plain") == 0);
+        write_frame(ssl, 0x1, 0x4, id, block.data, block.len);
+        write_frame(ssl, 0x0, 0x1, id, request, strlen(request));
+        hpack_buffer_free(&block);
+    }
+
+    hpack_table_free(&decoder);
+    hpack_table_free(&encoder);
+}
+
+// Fork a server accepting one connection, returns its pid
+static pid_t start_server(int *port)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    assert(bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(listen(listener, 4) == 0);
+    assert(getsockname(listener, (struct sockaddr *) &addr, &addr_len) == 0);
+    *port = ntohs(addr.sin_port);
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        alarm(10);
+        SSL_CTX *ctx = server_context();
+        int fd = accept(listener, NULL, NULL);
+        SSL *ssl = SSL_new(ctx);
+        SSL_set_fd(ssl, fd);
+        if (SSL_accept(ssl) == 1) {
+            serve_connection(ssl);
+        }
+        SSL_free(ssl);
+        close(fd);
+        SSL_CTX_free(ctx);
+        _exit(0);
+    }
+    close(listener);
+    return pid;
+}
+
+static void record_result(http_async_t *handle, int result, void *user_data)
+{
+    (void) handle;
+    *(int *) user_data = result;
+}
+
+static void test_loopback(void)
+{
+    int port;
+    pid_t server = start_server(&port);
+    alarm(10);
+    http_set_http2(true);
+
+    // Concurrent requests share the negotiated connection
+    http_loop_t *loop = http_loop_new();
+    struct http_response responses[5];
+    int results[5];
+    for (int i = 0; i < 5; i++) {
+        char url[128];
+        snprintf(url, sizeof(url), "https://127.0.0.1:%d/item/%d", port, i);
+        http_response_init(&responses[i]);
+        results[i] = -1;
+        assert(http_async_submit(loop, url, HTTP_GET, NULL, NULL, &responses[i], record_result, &results[i]));
+    }
+    assert(http_loop_run(loop, -1) == 0);
+    http_loop_free(loop);
+    for (int i = 0; i < 5; i++) {
+        char expected[64];
+        snprintf(expected, sizeof(expected), "GET /item/%d", i);
+        assert(results[i] == 0 && responses[i].status_code == 200);
+        assert(strcmp(responses[i].data, expected) == 0);
+        http_response_free(&responses[i]);
+    }
+
+    // The pooled connection carries a POST, and a refused stream is retried
+    char url[128];
+    struct http_response response;
+    http_response_init(&response);
+    snprintf(url, sizeof(url), "https://127.0.0.1:%d/records", port);
+    assert(http_request(url, HTTP_POST, "{\"content\":\"192.0.2.1\"}", NULL, &response) == 0);
+    assert(strcmp(response.data, "POST /records {\"content\":\"192.0.2.1\"}") == 0);
+    http_response_free(&response);
+    snprintf(url, sizeof(url), "https://127.0.0.1:%d/refuse", port);
+    assert(http_request(url, HTTP_GET, NULL, NULL, &response) == 0);
+    assert(strcmp(response.data, "GET /refuse") == 0);
+    http_response_free(&response);
+
+    struct http_stats stats;
+    http_get_stats(&stats);
+    assert(stats.connections_opened == 1);
+    assert(stats.http2_connections == 1);
+    assert(stats.http2_streams == 8);
+    assert(stats.stale_retries == 1);
+
+    // Closing the pool sends GOAWAY and the server exits
+    http_cleanup();
+    int status;
+    assert(waitpid(server, &status, 0) == server);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    alarm(0);
+    printf("✓ Loopback h2 server: %lu streams on %lu connection\n", stats.http2_streams, stats.http2_connections);
+}
+
+int main(void)
+{
+    printf("Testing HTTP/2\n");
+    printf("==============\n\n");
+
+    test_request_frames();
+    test_response();
+    test_flow_control();
+    test_consumed_window();
+    test_goaway_and_errors();
+    test_loopback();
+
+    printf("\nAll HTTP/2 tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include "../lib/http_encoding.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Compress with the given zlib window bits (31 gzip, 15 zlib, -15 raw deflate)
+static size_t compress_with(const char *data, size_t len, int window_bits, unsigned char *out, size_t out_cap)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    assert(deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+    zs.next_in = (Bytef *) data;
+    zs.avail_in = (uInt) len;
+    zs.next_out = out;
+    zs.avail_out = (uInt) out_cap;
+    assert(deflate(&zs, Z_FINISH) == Z_STREAM_END);
+    size_t written = zs.total_out;
+    deflateEnd(&zs);
+    return written;
+}
+
+// JSON much like a DNS record listing
+static char *sample_json(size_t *len)
+{
+    size_t cap = 200000;
+    char *json = malloc(cap);
+    size_t pos = (size_t) snprintf(json, cap, "{\"result\":[");
+    for (int i = 0; i < 1000; i++) {
+        pos += (size_t) snprintf(json + pos,
+                                 cap - pos,
+                                 "%s{\"id\":\"%08x\",\"type\":\"A\",\"name\":\"host%d.example.com\","
+                                 "\"content\":\"192.0.2.%d\"}",
+                                 i ? "," : "",
+                                 (unsigned int) i * 2654435761u,
+                                 i,
+                                 i % 256);
+    }
+    pos += (size_t) snprintf(json + pos, cap - pos, "]}");
+    *len = pos;
+    return json;
+}
+
+// Decode in pieces of at most step bytes and compare with the original
+static void expect_decoded(http_coding_t coding, const unsigned char *encoded, size_t len, size_t step,
+                           const char *expected, size_t expected_len)
+{
+    struct http_decoder decoder;
+    assert(http_decoder_init(&decoder, coding) == 0);
+    for (size_t pos = 0; pos < len; pos += step) {
+        size_t n = len - pos < step ? len - pos : step;
+        assert(http_decoder_feed(&decoder, (const char *) encoded + pos, n, NULL, NULL) == (ssize_t) n);
+    }
+    assert(http_decoder_finish(&decoder) == 0);
+    assert(decoder.encoded == len);
+
+    size_t size = 0;
+    char *data = http_decoder_take(&decoder, &size);
+    assert(size == expected_len && memcmp(data, expected, size) == 0 && data[size] == '\0');
+    free(data);
+    http_decoder_free(&decoder);
+}
+
+// Output callback that stops decoding after every piece
+struct collected {
+    char *data;
+    size_t len;
+    size_t largest;
+};
+
+static int collect_and_stop(const char *data, size_t len, void *user_data)
+{
+    struct collected *out = user_data;
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+    out->largest = len > out->largest ? len : out->largest;
+    return 1;
+}
+
+// Feed the whole body at once, feeding again whatever the callback left over
+static void expect_streamed(const unsigned char *encoded, size_t len, const char *expected, size_t expected_len)
+{
+    struct http_decoder decoder;
+    assert(http_decoder_init(&decoder, HTTP_CODING_GZIP) == 0);
+    struct collected out = {malloc(expected_len), 0, 0};
+    size_t pos = 0;
+    int calls = 0;
+    while (pos < len || decoder.full) {
+        ssize_t used = http_decoder_feed(&decoder, (const char *) encoded + pos, len - pos, collect_and_stop, &out);
+        assert(used >= 0);
+        pos += (size_t) used;
+        calls++;
+    }
+    assert(http_decoder_finish(&decoder) == 0);
+    assert(out.len == expected_len && memcmp(out.data, expected, expected_len) == 0);
+    assert(out.largest <= HTTP_DECODE_PIECE && calls > 1);
+    free(out.data);
+    http_decoder_free(&decoder);
+}
+
+static void test_codings(void)
+{
+    size_t json_len;
+    char *json = sample_json(&json_len);
+    size_t cap = json_len + 1024;
+    unsigned char *encoded = malloc(cap);
+
+    size_t gzip_len = compress_with(json, json_len, 31, encoded, cap);
+    expect_decoded(HTTP_CODING_GZIP, encoded, gzip_len, 1, json, json_len);
+    expect_decoded(HTTP_CODING_GZIP, encoded, gzip_len, 4096, json, json_len);
+    expect_streamed(encoded, gzip_len, json, json_len);
+
+    size_t zlib_len = compress_with(json, json_len, 15, encoded, cap);
+    expect_decoded(HTTP_CODING_DEFLATE, encoded, zlib_len, 7, json, json_len);
+
+    // "deflate" sent without the zlib header
+    size_t raw_len = compress_with(json, json_len, -15, encoded, cap);
+    expect_decoded(HTTP_CODING_DEFLATE, encoded, raw_len, raw_len, json, json_len);
+
+    free(encoded);
+    free(json);
+    printf("✓ gzip and deflate decoded incrementally (%zu bytes from %zu)\n", json_len, gzip_len);
+}
+
+static void test_truncated_and_corrupt(void)
+{
+    const char *text = "{\"success\":true,\"errors\":[],\"messages\":[]}";
+    unsigned char encoded[256];
+    size_t len = compress_with(text, strlen(text), 31, encoded, sizeof(encoded));
+    struct http_decoder decoder;
+
+    assert(http_decoder_init(&decoder, HTTP_CODING_GZIP) == 0);
+    assert(http_decoder_feed(&decoder, (const char *) encoded, len - 4, NULL, NULL) == (ssize_t) len - 4);
+    assert(http_decoder_finish(&decoder) != 0);
+    http_decoder_free(&decoder);
+
+    assert(http_decoder_init(&decoder, HTTP_CODING_GZIP) == 0);
+    assert(http_decoder_feed(&decoder, "not gzip at all", 15, NULL, NULL) < 0);
+    http_decoder_free(&decoder);
+
+    // A bodiless response may still name the coding
+    assert(http_decoder_init(&decoder, HTTP_CODING_GZIP) == 0);
+    assert(http_decoder_finish(&decoder) == 0);
+    http_decoder_free(&decoder);
+
+    printf("✓ Truncated and corrupt bodies rejected\n");
+}
+
+static void test_parse(void)
+{
+    http_coding_t coding;
+    assert(http_coding_parse(NULL, &coding) == 0 && coding == HTTP_CODING_IDENTITY);
+    assert(http_coding_parse(" GZIP ", &coding) == 0 && coding == HTTP_CODING_GZIP);
+    assert(http_coding_parse("x-gzip", &coding) == 0 && coding == HTTP_CODING_GZIP);
+    assert(http_coding_parse("deflate", &coding) == 0 && coding == HTTP_CODING_DEFLATE);
+    assert(http_coding_parse("identity", &coding) == 0 && coding == HTTP_CODING_IDENTITY);
+    assert(http_coding_parse("br", &coding) != 0);
+    assert(http_coding_parse("gzip, deflate", &coding) != 0);
+    printf("✓ Content-Encoding values parsed\n");
+}
+
+int main(void)
+{
+    printf("Testing Content Decoding\n");
+    printf("========================\n\n");
+
+    test_codings();
+    test_truncated_and_corrupt();
+    test_parse();
+
+    printf("\nAll content decoding tests passed!\n");
+    return 0;
+}
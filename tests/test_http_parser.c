@@ -0,0 +1,229 @@
+#include "../lib/http_parser.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Feed a response in pieces of at most step bytes, returns total bytes consumed
+static size_t feed_in_steps(struct http_parser *parser, const char *raw, size_t step)
+{
+    size_t len = strlen(raw);
+    size_t pos = 0;
+    while (pos < len && !http_parser_is_complete(parser)) {
+        size_t n = (len - pos) < step ? (len - pos) : step;
+        ssize_t consumed = http_parser_feed(parser, raw + pos, n);
+        assert(consumed >= 0);
+        pos += (size_t) consumed;
+        if ((size_t) consumed < n) {
+            break;
+        }
+    }
+    return pos;
+}
+
+// Read a response into the parser's own buffer in pieces of at most step
+// bytes, as from a socket. Returns the bytes consumed; *rest points at the
+// bytes left over after the last read.
+static size_t receive_in_steps(struct http_parser *parser, const char *raw, size_t len, size_t step, const char **rest)
+{
+    size_t pos = 0;
+    *rest = NULL;
+    while (pos < len && !http_parser_is_complete(parser)) {
+        size_t space = 0;
+        char *buffer = http_parser_recv_buffer(parser, &space);
+        assert(buffer && space > 0);
+        size_t n = (len - pos) < step ? (len - pos) : step;
+        n = n < space ? n : space;
+        memcpy(buffer, raw + pos, n);
+        ssize_t consumed = http_parser_received(parser, n, rest);
+        assert(consumed >= 0);
+        pos += (size_t) consumed;
+    }
+    return pos;
+}
+
+static void test_content_length(size_t step)
+{
+    const char *raw = "HTTP/1.1 200 OK\r\n"
+                      "Content-Type: application/json\r\n"
+                      "Content-Length: 13\r\n"
+                      "\r\n"
+                      "{\"ok\":true}\r\n";
+
+    struct http_parser parser;
+    http_parser_init(&parser);
+    size_t consumed = feed_in_steps(&parser, raw, step);
+
+    assert(http_parser_is_complete(&parser));
+    assert(consumed == strlen(raw));
+    assert(parser.status_code == 200);
+    assert(parser.keep_alive);
+    assert(strcmp(http_parser_get_header(&parser, "content-type"), "application/json") == 0);
+
+    size_t size = 0;
+    char *body = http_parser_take_body(&parser, &size);
+    assert(size == 13);
+    assert(strcmp(body, "{\"ok\":true}\r\n") == 0);
+    free(body);
+    http_parser_free(&parser);
+
+    printf("✓ Content-Length body (step %zu)\n", step);
+}
+
+static void test_chunked(size_t step)
+{
+    const char *raw = "HTTP/1.1 200 OK\r\n"
+                      "Transfer-Encoding: chunked\r\n"
+                      "\r\n"
+                      "5\r\nhello\r\n"
+                      "1;ext=1\r\n \r\n"
+                      "5\r\nworld\r\n"
+                      "0\r\n"
+                      "X-Trailer: yes\r\n"
+                      "\r\n"
+                      "HTTP/1.1 200 OK\r\n"; // Start of a following response
+
+    struct http_parser parser;
+    http_parser_init(&parser);
+    size_t consumed = feed_in_steps(&parser, raw, step);
+
+    assert(http_parser_is_complete(&parser));
+    assert(consumed == strlen(raw) - strlen("HTTP/1.1 200 OK\r\n"));
+    assert(parser.chunked);
+
+    size_t size = 0;
+    char *body = http_parser_take_body(&parser, &size);
+    assert(size == 11);
+    assert(strcmp(body, "hello world") == 0);
+    free(body);
+    http_parser_free(&parser);
+
+    printf("✓ Chunked body decoded incrementally (step %zu)\n", step);
+}
+
+static void test_close_delimited(void)
+{
+    const char *raw = "HTTP/1.0 200 OK\r\nServer: test\r\n\r\n203.0.113.7\n";
+
+    struct http_parser parser;
+    http_parser_init(&parser);
+    feed_in_steps(&parser, raw, 7);
+
+    assert(!http_parser_is_complete(&parser));
+    assert(http_parser_finish(&parser) == 0);
+    assert(http_parser_is_complete(&parser));
+    assert(!parser.keep_alive);
+
+    size_t size = 0;
+    char *body = http_parser_take_body(&parser, &size);
+    assert(strcmp(body, "203.0.113.7\n") == 0);
+    free(body);
+    http_parser_free(&parser);
+
+    printf("✓ Close-delimited body completes on EOF\n");
+}
+
+static void test_interim_and_empty(void)
+{
+    const char *raw = "HTTP/1.1 100 Continue\r\n\r\n"
+                      "HTTP/1.1 204 No Content\r\nConnection: close\r\n\r\n";
+
+    struct http_parser parser;
+    http_parser_init(&parser);
+    size_t consumed = feed_in_steps(&parser, raw, 4096);
+
+    assert(consumed == strlen(raw));
+    assert(http_parser_is_complete(&parser));
+    assert(parser.status_code == 204);
+    assert(!parser.keep_alive);
+
+    size_t size = 1;
+    char *body = http_parser_take_body(&parser, &size);
+    assert(size == 0);
+    assert(body && body[0] == '\0');
+    free(body);
+    http_parser_free(&parser);
+
+    printf("✓ 100 Continue skipped, 204 has no body\n");
+}
+
+static void test_in_place(size_t step)
+{
+    // Chunked binary body with NUL bytes, after an interim response, followed
+    // by the start of the next pipelined response
+    const char raw[] = "HTTP/1.1 103 Early Hints\r\nLink: </a>\r\n\r\n"
+                       "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                       "4\r\n\0ab\0\r\n"
+                       "3\r\nc\0d\r\n"
+                       "0\r\n\r\n"
+                       "HTTP/1.1 204 No Content\r\n\r\n";
+    size_t len = sizeof(raw) - 1;
+    size_t next_len = strlen("HTTP/1.1 204 No Content\r\n\r\n");
+
+    struct http_parser parser;
+    http_parser_init(&parser);
+    const char *rest = NULL;
+    size_t consumed = receive_in_steps(&parser, raw, len, step, &rest);
+
+    assert(http_parser_is_complete(&parser));
+    assert(parser.status_code == 200);
+    assert(consumed == len - next_len);
+
+    // The bytes of the next response are intact until the body is taken
+    struct http_parser next;
+    http_parser_init(&next);
+    if (step >= len) {
+        assert(http_parser_feed(&next, rest, next_len) == (ssize_t) next_len);
+        assert(http_parser_is_complete(&next) && next.status_code == 204);
+    }
+
+    size_t size = 0;
+    char *body = http_parser_take_body(&parser, &size);
+    assert(size == 7);
+    assert(memcmp(body, "\0ab\0c\0d", 8) == 0);
+    free(body);
+    http_parser_free(&parser);
+    http_parser_free(&next);
+
+    printf("✓ Binary chunked body decoded in place (step %zu)\n", step);
+}
+
+static void test_truncated_and_malformed(void)
+{
+    struct http_parser parser;
+
+    http_parser_init(&parser);
+    feed_in_steps(&parser, "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nabc", 4096);
+    assert(!http_parser_is_complete(&parser));
+    assert(http_parser_finish(&parser) != 0);
+    http_parser_free(&parser);
+
+    http_parser_init(&parser);
+    const char *bad = "SMTP ready\r\n\r\n";
+    assert(http_parser_feed(&parser, bad, strlen(bad)) < 0);
+    http_parser_free(&parser);
+
+    printf("✓ Truncated and malformed responses rejected\n");
+}
+
+int main(void)
+{
+    printf("Testing HTTP Response Parser\n");
+    printf("============================\n\n");
+
+    test_content_length(1);
+    test_content_length(4096);
+    test_chunked(1);
+    test_chunked(3);
+    test_chunked(4096);
+    test_close_delimited();
+    test_interim_and_empty();
+    test_in_place(1);
+    test_in_place(5);
+    test_in_place(4096);
+    test_truncated_and_malformed();
+
+    printf("\nAll HTTP parser tests passed!\n");
+    return 0;
+}
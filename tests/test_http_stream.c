@@ -0,0 +1,654 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../lib/socket_http.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define BODY_SIZE 1000000
+#define CHUNK_SIZE 4000
+
+// Byte at offset i of every response body
+static char body_byte(size_t i)
+{
+    return (char) ('a' + i % 23);
+}
+
+// Loopback HTTP/1.1 server
+
+static void write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written <= 0) {
+            return;
+        }
+        data += written;
+        len -= (size_t) written;
+    }
+}
+
+// Send data in chunks of CHUNK_SIZE after the given response head
+static void write_chunked(int fd, const char *start, const char *data, size_t len)
+{
+    char head[32];
+    write_all(fd, start, strlen(start));
+    for (size_t pos = 0; pos < len; pos += CHUNK_SIZE) {
+        size_t size = len - pos < CHUNK_SIZE ? len - pos : CHUNK_SIZE;
+        int head_len = snprintf(head, sizeof(head), "%zx\r\n", size);
+        write_all(fd, head, (size_t) head_len);
+        write_all(fd, data + pos, size);
+        write_all(fd, "\r\n", 2);
+    }
+    write_all(fd, "0\r\n\r\n", 5);
+}
+
+// Answer keep-alive requests: a request body is echoed, /chunked sends the
+// body in chunks, /gzip sends it gzip compressed and chunked when the client
+// accepts that, anything else with Content-Length. After /drop the next
+// request is not answered but the connection closed, as by a server timing
+// out an idle connection.
+static void serve_connection(int fd)
+{
+    static char body[BODY_SIZE];
+    for (size_t i = 0; i < BODY_SIZE; i++) {
+        body[i] = body_byte(i);
+    }
+    static unsigned char gzipped[BODY_SIZE / 10];
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    assert(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+    zs.next_in = (Bytef *) body;
+    zs.avail_in = BODY_SIZE;
+    zs.next_out = gzipped;
+    zs.avail_out = sizeof(gzipped);
+    assert(deflate(&zs, Z_FINISH) == Z_STREAM_END);
+    size_t gzipped_len = zs.total_out;
+    deflateEnd(&zs);
+
+    char request[4096];
+    size_t len = 0;
+    request[0] = '\0';
+    bool drop_next = false;
+    for (;;) {
+        // Pipelined requests may already be waiting in the buffer
+        char *end = strstr(request, "\r\n\r\n");
+        const char *length = end ? strstr(request, "Content-Length: ") : NULL;
+        size_t body_len = length && length < end ? (size_t) atol(length + 16) : 0;
+        if (!end || len < (size_t) (end + 4 - request) + body_len) {
+            ssize_t received = read(fd, request + len, sizeof(request) - 1 - len);
+            if (received <= 0) {
+                return;
+            }
+            len += (size_t) received;
+            request[len] = '\0';
+            continue;
+        }
+
+        if (drop_next) {
+            return;
+        }
+        drop_next = strncmp(request, "GET /drop ", 10) == 0;
+
+        // /flaky fails twice, with either form of Retry-After, then succeeds
+        static int flaky_count = 0;
+        const char *flaky[] = {
+            "HTTP/1.1 503 Service Unavailable\r\nRetry-After: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+            "Content-Length: 0\r\n\r\n",
+            "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 0\r\nContent-Length: 0\r\n\r\n"};
+        bool is_flaky = strstr(request, " /flaky ") && strstr(request, " /flaky ") < end;
+
+        // /busy turns every other request away for a second
+        static int busy_count = 0;
+        bool is_busy = strncmp(request, "PUT /busy ", 10) == 0 && busy_count++ % 2 == 0;
+
+        char head[128];
+        if (is_flaky && flaky_count % 3 < 2) {
+            write_all(fd, flaky[flaky_count % 3], strlen(flaky[flaky_count % 3]));
+            flaky_count++;
+        } else if (is_busy) {
+            const char *busy = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 0\r\n\r\n";
+            write_all(fd, busy, strlen(busy));
+        } else if (strncmp(request, "GET /limited ", 13) == 0) {
+            const char *limited = "HTTP/1.1 429 Too Many Requests\r\nRetry-After: 3600\r\nContent-Length: 0\r\n\r\n";
+            write_all(fd, limited, strlen(limited));
+        } else if (body_len > 0) {
+            int head_len = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", body_len);
+            write_all(fd, head, (size_t) head_len);
+            write_all(fd, end + 4, body_len);
+        } else if (strncmp(request, "GET /chunked ", 13) == 0) {
+            write_chunked(fd, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n", body, BODY_SIZE);
+        } else if (strncmp(request, "GET /gzip ", 10) == 0 && strstr(request, "Accept-Encoding: gzip")) {
+            write_chunked(fd,
+                          "HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n\r\n",
+                          (const char *) gzipped,
+                          gzipped_len);
+        } else {
+            flaky_count += is_flaky;
+            int head_len = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n", BODY_SIZE);
+            write_all(fd, head, (size_t) head_len);
+            write_all(fd, body, BODY_SIZE);
+        }
+
+        size_t used = (size_t) (end + 4 - request) + body_len;
+        memmove(request, request + used, len - used);
+        len -= used;
+        request[len] = '\0';
+    }
+}
+
+// Fork a server answering connections one after the other, returns its pid
+static pid_t start_server(int *port)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    assert(bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(listen(listener, 4) == 0);
+    assert(getsockname(listener, (struct sockaddr *) &addr, &addr_len) == 0);
+    *port = ntohs(addr.sin_port);
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        alarm(10);
+        signal(SIGPIPE, SIG_IGN);
+        for (;;) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd < 0) {
+                _exit(1);
+            }
+            serve_connection(fd);
+            close(fd);
+        }
+    }
+    close(listener);
+    return pid;
+}
+
+// Sink checking the body as it arrives
+struct sink_state {
+    size_t total;
+    size_t largest; // Largest piece delivered
+    int pieces;
+    int verdict; // Returned for every piece
+    int abort_after;
+    bool paused;
+};
+
+static int check_piece(const char *data, size_t len, const struct http_response *response, void *user_data)
+{
+    struct sink_state *state = user_data;
+    assert(!state->paused);
+    assert(response->status_code == 200 && response->success);
+    for (size_t i = 0; i < len; i++) {
+        assert(data[i] == body_byte(state->total + i));
+    }
+    state->total += len;
+    state->largest = len > state->largest ? len : state->largest;
+    state->pieces++;
+
+    if (state->abort_after > 0 && state->pieces == state->abort_after) {
+        return HTTP_SINK_ABORT;
+    }
+    state->paused = state->verdict == HTTP_SINK_PAUSE;
+    return state->verdict;
+}
+
+static void record_result(http_async_t *handle, int result, void *user_data)
+{
+    (void) handle;
+    *(int *) user_data = result;
+}
+
+static void test_blocking_stream(int port)
+{
+    char url[128];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/chunked", port);
+
+    // Pieces stay at the size of a read however large the body is
+    struct sink_state state = {0};
+    struct http_response response;
+    http_response_init(&response);
+    assert(http_request_stream(url, HTTP_GET, NULL, NULL, &response, check_piece, &state) == 0);
+    assert(state.total == BODY_SIZE && response.size == BODY_SIZE);
+    assert(response.data == NULL && response.status_code == 200);
+    assert(state.largest < 16384);
+    http_response_free(&response);
+
+    printf("✓ Chunked body streamed in %d pieces of at most %zu bytes\n", state.pieces, state.largest);
+}
+
+static void test_pause_resume(int port)
+{
+    char url[128];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/length", port);
+
+    // Every piece pauses the request; nothing is delivered until it is resumed
+    http_loop_t *loop = http_loop_new();
+    struct sink_state state = {.verdict = HTTP_SINK_PAUSE};
+    struct http_response response;
+    http_response_init(&response);
+    int result = 1;
+    http_async_t *handle = http_async_submit(loop, url, HTTP_GET, NULL, NULL, &response, record_result, &result);
+    assert(handle);
+    http_async_set_sink(handle, check_piece, &state);
+
+    int resumes = 0;
+    while (http_loop_run(loop, 5) > 0) {
+        assert(state.paused);
+        state.paused = false;
+        http_async_resume(handle);
+        resumes++;
+    }
+    http_loop_free(loop);
+
+    assert(result == 0);
+    assert(state.total == BODY_SIZE && response.size == BODY_SIZE);
+    assert(resumes > 1 && resumes >= state.pieces - 1);
+    http_response_free(&response);
+
+    printf("✓ Paused %d times, the body resumed intact\n", resumes);
+}
+
+static void test_abort(int port)
+{
+    char url[128];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/length", port);
+    struct http_stats before;
+    http_get_stats(&before);
+
+    struct sink_state state = {.abort_after = 2};
+    struct http_response response;
+    http_response_init(&response);
+    assert(http_request_stream(url, HTTP_GET, NULL, NULL, &response, check_piece, &state) == HTTP_SINK_ABORTED);
+    assert(state.pieces == 2 && state.total < BODY_SIZE);
+    http_response_free(&response);
+
+    // The aborted connection is closed, the next request opens another
+    assert(http_request(url, HTTP_GET, NULL, NULL, &response) == 0);
+    assert(response.size == BODY_SIZE);
+    for (size_t i = 0; i < BODY_SIZE; i += 997) {
+        assert(response.data[i] == body_byte(i));
+    }
+    http_response_free(&response);
+
+    struct http_stats after;
+    http_get_stats(&after);
+    assert(after.connections_opened == before.connections_opened + 1);
+
+    printf("✓ Aborted after %zu bytes, the connection was not reused\n", state.total);
+}
+
+static void test_compressed(int port)
+{
+    char url[128];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/gzip", port);
+    struct http_stats before;
+    http_get_stats(&before);
+    http_set_compression(true);
+
+    struct http_response response;
+    http_response_init(&response);
+    assert(http_request(url, HTTP_GET, NULL, NULL, &response) == 0);
+    assert(response.size == BODY_SIZE && response.encoded_size < BODY_SIZE / 10);
+    for (size_t i = 0; i < BODY_SIZE; i += 997) {
+        assert(response.data[i] == body_byte(i));
+    }
+    size_t encoded_size = response.encoded_size;
+    http_response_free(&response);
+
+    // Pausing stops the decoder too: pieces stay small and none arrives while paused
+    http_loop_t *loop = http_loop_new();
+    struct sink_state state = {.verdict = HTTP_SINK_PAUSE};
+    http_response_init(&response);
+    int result = 1;
+    http_async_t *handle = http_async_submit(loop, url, HTTP_GET, NULL, NULL, &response, record_result, &result);
+    assert(handle);
+    http_async_set_sink(handle, check_piece, &state);
+    while (http_loop_run(loop, 5) > 0) {
+        if (state.paused) {
+            state.paused = false;
+            http_async_resume(handle);
+        }
+    }
+    http_loop_free(loop);
+    assert(result == 0 && state.total == BODY_SIZE && state.largest <= 16384);
+    assert(response.encoded_size == encoded_size);
+    http_response_free(&response);
+
+    struct http_stats after;
+    http_get_stats(&after);
+    assert(after.bytes_compressed == before.bytes_compressed + 2 * encoded_size);
+    assert(after.bytes_decompressed == before.bytes_decompressed + 2 * BODY_SIZE);
+
+    // Without Accept-Encoding the server sends the body as it is
+    http_set_compression(false);
+    http_response_init(&response);
+    assert(http_request(url, HTTP_GET, NULL, NULL, &response) == 0);
+    assert(response.size == BODY_SIZE && response.encoded_size == BODY_SIZE);
+    http_response_free(&response);
+
+    printf("✓ gzip body of %zu bytes decoded to %d, streamed in %d pieces\n", encoded_size, BODY_SIZE, state.pieces);
+}
+
+static void test_template(int port)
+{
+    char url[128];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/records/1", port);
+    struct http_header *headers = http_header_add(NULL, "Content-Type", "application/json");
+    http_template_t *update = http_template_new(HTTP_PUT, url, headers);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/length", port);
+    http_template_t *query = http_template_new(HTTP_GET, url, headers);
+    http_headers_free(headers);
+    assert(update && query);
+
+    // Only the middle segment changes between requests
+    const char *ips[] = {"192.0.2.1", "198.51.100.23", "203.0.113.254"};
+    for (int i = 0; i < 3; i++) {
+        struct iovec body[3] = {{"{\"content\":\"", 12}, {(char *) ips[i], strlen(ips[i])}, {"\"}", 2}};
+        char expected[64];
+        snprintf(expected, sizeof(expected), "{\"content\":\"%s\"}", ips[i]);
+        struct http_response response;
+        http_response_init(&response);
+        assert(http_request_template(update, body, 3, &response) == 0);
+        assert(response.size == strlen(expected) && strcmp(response.data, expected) == 0);
+        http_response_free(&response);
+    }
+
+    // And submitted to a loop, the segments pointing into caller memory
+    http_loop_t *loop = http_loop_new();
+    assert(loop);
+    struct iovec body[3] = {{"{\"content\":\"", 12}, {(char *) ips[0], strlen(ips[0])}, {"\"}", 2}};
+    struct http_response response;
+    http_response_init(&response);
+    int result = 1;
+    assert(http_async_submit_template(loop, update, body, 3, &response, record_result, &result));
+    assert(http_loop_run(loop, 5000) == 0 && result == 0);
+    assert(response.data && strcmp(response.data, "{\"content\":\"192.0.2.1\"}") == 0);
+    http_response_free(&response);
+    http_loop_free(loop);
+
+    // Compiled entries are pipelined like URLs
+    struct http_batch_request batch[3] = {{.compiled = query}, {.compiled = query}, {.compiled = query}};
+    assert(http_request_batch(batch, 3, NULL, HTTP_PIPELINE_DEPTH) == 0);
+    for (int i = 0; i < 3; i++) {
+        assert(batch[i].response.size == BODY_SIZE);
+        http_response_free(&batch[i].response);
+    }
+
+    http_template_free(update);
+    http_template_free(query);
+    printf("✓ Compiled requests sent with their bodies in segments, blocking and asynchronous\n");
+}
+
+// Timings reported by the library for each request
+struct timing_log {
+    int reports;
+    char url[128];
+    long total_us;
+};
+
+static void record_timing(const char *method, const char *url, const struct http_response *response, void *user_data)
+{
+    struct timing_log *log = user_data;
+    assert(strcmp(method, "GET") == 0);
+    snprintf(log->url, sizeof(log->url), "%s", url);
+    log->total_us = response->timing.total_us;
+    log->reports++;
+}
+
+// Check that the phases of a plain HTTP exchange add up
+static void check_phases(const struct http_timing *timing, bool reused)
+{
+    const char *request = "GET /length HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    assert(timing->reused == reused && timing->tls_us == 0);
+    assert(!reused || (timing->resolve_us == 0 && timing->connect_us == 0));
+    assert(timing->bytes_sent == strlen(request) && timing->bytes_received > BODY_SIZE);
+    assert(timing->ttfb_us > 0 && timing->transfer_us > 0);
+    assert(timing->total_us >= timing->resolve_us + timing->connect_us + timing->ttfb_us + timing->transfer_us);
+}
+
+static void test_timing(int port)
+{
+    struct timing_log log = {0};
+    http_set_timing_callback(record_timing, &log);
+    http_cleanup(); // Start without a pooled connection
+
+    char url[128];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/length", port);
+    for (int i = 0; i < 2; i++) {
+        struct http_response response;
+        http_response_init(&response);
+        assert(http_request(url, HTTP_GET, NULL, NULL, &response) == 0);
+        check_phases(&response.timing, i > 0);
+        assert(log.reports == i + 1 && strcmp(log.url, url) == 0 && log.total_us == response.timing.total_us);
+        http_response_free(&response);
+    }
+
+    // Pipelined requests are timed from their own write
+    struct http_batch_request batch[3] = {{.url = url}, {.url = url}, {.url = url}};
+    assert(http_request_batch(batch, 3, NULL, HTTP_PIPELINE_DEPTH) == 0);
+    for (int i = 0; i < 3; i++) {
+        check_phases(&batch[i].response.timing, true);
+        http_response_free(&batch[i].response);
+    }
+    assert(log.reports == 5);
+
+    char line[256];
+    http_timing_format(&batch[0].response.timing, line, sizeof(line));
+    assert(strncmp(line, "resolve 0.0 ms, connect 0.0 ms, tls 0.0 ms, ttfb ", 49) == 0 && strstr(line, ", reused"));
+
+    http_set_timing_callback(NULL, NULL);
+    printf("✓ Request phases timed and reported (%d requests)\n", log.reports);
+}
+
+static void test_retry(int port)
+{
+    struct http_retry_policy policy = {3, 2000, 20, 100, 1000};
+    http_set_retry_policy(&policy);
+    struct http_stats before;
+    http_get_stats(&before);
+
+    char url[128];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/flaky", port);
+    struct http_response response;
+    http_response_init(&response);
+    assert(http_request(url, HTTP_GET, NULL, NULL, &response) == 0);
+    assert(response.attempts == 3 && response.status_code == 200 && response.size == BODY_SIZE);
+    http_response_free(&response);
+
+    // A POST may have been processed, so its 503 is final
+    http_response_init(&response);
+    assert(http_request(url, HTTP_POST, NULL, NULL, &response) == 0);
+    assert(response.attempts == 1 && response.status_code == 503 && response.retry_after == 0);
+    http_response_free(&response);
+
+    // Waiting longer than the policy allows ends the retries
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/limited", port);
+    http_response_init(&response);
+    assert(http_request(url, HTTP_GET, NULL, NULL, &response) == 0);
+    assert(response.attempts == 1 && response.status_code == 429 && response.retry_after == 3600);
+    http_response_free(&response);
+
+    // Connection refused on every attempt
+    http_response_init(&response);
+    assert(http_request("http://127.0.0.1:1/", HTTP_GET, NULL, NULL, &response) != 0 && response.attempts == 3);
+
+    // Nothing starts after the deadline
+    http_set_deadline(1);
+    struct timespec pause = {0, 5000000};
+    nanosleep(&pause, NULL);
+    http_response_init(&response);
+    assert(http_request(url, HTTP_GET, NULL, NULL, &response) != 0 && response.timing.bytes_sent == 0);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/length", port);
+    struct http_batch_request batch[3] = {{.url = url}, {.url = url}, {.url = url}};
+    assert(http_request_batch(batch, 3, NULL, HTTP_PIPELINE_DEPTH) != 0);
+    for (int i = 0; i < 3; i++) {
+        assert(batch[i].result != 0 && batch[i].response.timing.bytes_sent == 0);
+        http_response_free(&batch[i].response);
+    }
+    http_set_deadline(0);
+
+    struct http_stats after;
+    http_get_stats(&after);
+    assert(after.retries - before.retries == 4);
+    http_set_retry_policy(NULL);
+    printf("✓ Transient failures retried with backoff, Retry-After and POST rules honoured\n");
+}
+
+// An asynchronous PUT resubmitted by its caller under the retry policy, as
+// the record updates are: the 503 is repeated after its Retry-After, and the
+// second attempt succeeds
+static void test_async_retry(int port)
+{
+    struct http_retry_policy policy = {3, 2000, 20, 100, 2000};
+    http_set_retry_policy(&policy);
+    assert(http_retry_attempt_timeout() == 2000 && http_deadline_left() == -1);
+
+    char url[128];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/busy", port);
+    http_template_t *update = http_template_new(HTTP_PUT, url, NULL);
+    assert(update);
+    http_loop_t *loop = http_loop_new();
+    assert(loop);
+    struct iovec body[3] = {{"{\"content\":\"", 12}, {"192.0.2.1", 9}, {"\"}", 2}};
+    struct http_response response;
+    http_response_init(&response);
+
+    int result = 1;
+    assert(http_async_submit_template(loop, update, body, 3, &response, record_result, &result));
+    assert(http_loop_run(loop, 5000) == 0 && result == 0);
+    assert(response.status_code == 503 && response.retry_after == 1);
+    long delay = http_retry_delay(update, result, &response, 1);
+    assert(delay == 1000);
+    struct timespec pause = {delay / 1000, (delay % 1000) * 1000000};
+    nanosleep(&pause, NULL);
+
+    http_response_free(&response);
+    http_response_init(&response);
+    result = 1;
+    http_async_t *handle = http_async_submit_template(loop, update, body, 3, &response, record_result, &result);
+    assert(handle);
+    http_async_set_timeout(handle, http_retry_attempt_timeout());
+    assert(http_loop_run(loop, 5000) == 0 && result == 0);
+    assert(response.status_code == 200 && strcmp(response.data, "{\"content\":\"192.0.2.1\"}") == 0);
+    assert(http_retry_delay(update, result, &response, 2) == -1);
+    http_response_free(&response);
+
+    // Without a policy nothing is retried
+    http_set_retry_policy(NULL);
+    response.status_code = 503;
+    response.retry_after = 0;
+    assert(http_retry_delay(update, 0, &response, 1) == -1 && http_retry_attempt_timeout() == 0);
+
+    http_loop_free(loop);
+    http_template_free(update);
+    printf("✓ Asynchronous PUT retried after a 503 and its Retry-After\n");
+}
+
+static void test_stale_resend(int port)
+{
+    http_cleanup(); // Start without a pooled connection
+    char drop[128];
+    char url[128];
+    snprintf(drop, sizeof(drop), "http://127.0.0.1:%d/drop", port);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/length", port);
+    struct http_stats before;
+    struct http_stats after;
+    struct http_response response;
+
+    // A GET the pooled connection lost is sent again on a fresh one
+    http_response_init(&response);
+    assert(http_request(drop, HTTP_GET, NULL, NULL, &response) == 0);
+    http_response_free(&response);
+    http_get_stats(&before);
+    http_response_init(&response);
+    assert(http_request(url, HTTP_GET, NULL, NULL, &response) == 0 && response.status_code == 200);
+    assert(response.timing.reused && response.size == BODY_SIZE);
+    http_response_free(&response);
+    http_get_stats(&after);
+    assert(after.stale_retries == before.stale_retries + 1);
+
+    // The server may have acted on a POST it received, so that one fails
+    http_response_init(&response);
+    assert(http_request(drop, HTTP_GET, NULL, NULL, &response) == 0);
+    http_response_free(&response);
+    http_response_init(&response);
+    assert(http_request(url, HTTP_POST, "{}", NULL, &response) != 0);
+    assert(response.timing.bytes_sent > 0);
+    http_response_free(&response);
+    http_get_stats(&before);
+    assert(before.stale_retries == after.stale_retries);
+    printf("✓ Requests lost with a pooled connection resent unless they were POSTs\n");
+}
+
+static void test_fast_open(int port)
+{
+    // The test server does not enable Fast Open, so with a kernel cookie the
+    // data in the SYN is ignored and sent again, and without one the connect
+    // is an ordinary one; either way the request must go through
+    http_set_fast_open(true);
+    struct http_stats before;
+    http_get_stats(&before);
+
+    char url[128];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/length", port);
+    for (int i = 0; i < 2; i++) {
+        http_cleanup(); // A new connection each time
+        struct http_response response;
+        http_response_init(&response);
+        assert(http_request(url, HTTP_GET, NULL, NULL, &response) == 0);
+        assert(response.status_code == 200 && response.size == BODY_SIZE);
+        http_response_free(&response);
+    }
+
+    struct http_stats after;
+    http_get_stats(&after);
+    assert(after.connections_opened - before.connections_opened == 2);
+    assert(after.fast_open_fallbacks == before.fast_open_fallbacks);
+    http_set_fast_open(false);
+    printf("✓ Connections opened with TCP Fast Open enabled (%lu with data in the SYN)\n",
+           after.fast_open_connects - before.fast_open_connects);
+}
+
+int main(void)
+{
+    printf("Testing Streamed Response Bodies\n");
+    printf("================================\n\n");
+
+    int port;
+    pid_t server = start_server(&port);
+    alarm(10);
+
+    test_blocking_stream(port);
+    test_pause_resume(port);
+    test_abort(port);
+    test_compressed(port);
+    test_template(port);
+    test_timing(port);
+    test_retry(port);
+    test_async_retry(port);
+    test_stale_resend(port);
+    test_fast_open(port);
+
+    http_cleanup();
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+
+    printf("\nAll streaming tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,135 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../lib/ifwatch.h"
+#include "../lib/publicip.h"
+
+#include <assert.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static void test_is_public(void)
+{
+    const char *public[] = {"1.1.1.1", "8.8.8.8", "100.128.0.1", "172.32.0.1", "2606:4700:4700::1111"};
+    const char *private[] = {"10.0.0.1",
+                             "100.64.0.1",
+                             "100.127.255.254",
+                             "127.0.0.1",
+                             "169.254.1.1",
+                             "172.16.0.1",
+                             "192.168.1.1",
+                             "198.51.100.7",
+                             "224.0.0.1",
+                             "::1",
+                             "fe80::1",
+                             "fd00::1",
+                             "2001:db8::1",
+                             "not an address"};
+    for (size_t i = 0; i < sizeof(public) / sizeof(public[0]); i++) {
+        assert(ifwatch_is_public(public[i]));
+    }
+    for (size_t i = 0; i < sizeof(private) / sizeof(private[0]); i++) {
+        assert(!ifwatch_is_public(private[i]));
+    }
+    printf("✓ Private, carrier-grade NAT and special addresses are not public\n");
+}
+
+static void test_get_address(void)
+{
+    // The loopback interface has addresses, none of them public
+    char address[64];
+    assert(ifwatch_get_address("lo", AF_UNSPEC, address, sizeof(address)) == -1);
+    assert(ifwatch_get_address("no-such-if", AF_INET, address, sizeof(address)) == -1);
+    printf("✓ Interfaces without a public address send the lookup elsewhere\n");
+}
+
+// Append one address message for an interface index to a batch
+static size_t add_message(void *buf, size_t len, uint16_t type, unsigned int index)
+{
+    struct nlmsghdr *nh = (struct nlmsghdr *) ((char *) buf + len);
+    memset(nh, 0, NLMSG_SPACE(sizeof(struct ifaddrmsg)));
+    nh->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+    nh->nlmsg_type = type;
+    struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+    ifa->ifa_family = AF_INET;
+    ifa->ifa_index = index;
+    return len + NLMSG_SPACE(sizeof(struct ifaddrmsg));
+}
+
+static void test_parse(void)
+{
+    struct ifwatch watch;
+    memset(&watch, 0, sizeof(watch));
+    watch.fd = -1;
+    strcpy(watch.ifname, "lo");
+    unsigned int index = if_nametoindex("lo");
+    assert(index != 0);
+
+    uint32_t buf[256];
+    size_t len = add_message(buf, 0, RTM_NEWADDR, index + 1000);
+    len = add_message(buf, len, RTM_NEWROUTE, index);
+    assert(ifwatch_parse(&watch, buf, len) == 0);
+
+    assert(ifwatch_parse(&watch, buf, add_message(buf, len, RTM_DELADDR, index)) == 1);
+    assert(ifwatch_parse(&watch, buf, add_message(buf, 0, RTM_NEWADDR, index)) == 1);
+    assert(ifwatch_parse(&watch, buf, add_message(buf, 0, NLMSG_OVERRUN, 0)) == 1);
+
+    // A truncated message is ignored
+    assert(ifwatch_parse(&watch, buf, NLMSG_HDRLEN) == 0);
+    printf("✓ Address messages of the watched interface are changes, others not\n");
+}
+
+static void test_open(void)
+{
+    struct ifwatch watch;
+    assert(ifwatch_open(&watch, "an-interface-name-too-long") == -1);
+    if (ifwatch_open(&watch, "lo") != 0) {
+        printf("✓ rtnetlink not available, watch skipped\n");
+        return;
+    }
+    assert(watch.fd >= 0);
+    assert(ifwatch_wait(&watch, 0) == 0);
+    ifwatch_close(&watch);
+    assert(watch.fd == -1 && ifwatch_wait(&watch, 0) == -1);
+    printf("✓ Watch subscribes and times out without changes\n");
+}
+
+static void test_config(void)
+{
+    char path[] = "/tmp/test_ifwatch_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    const char *text = "WAN_INTERFACE=pppoe-wan\n";
+    assert(write(fd, text, strlen(text)) == (ssize_t) strlen(text));
+    close(fd);
+
+    struct publicip_config config;
+    assert(publicip_config_load(&config, path) == 0);
+    assert(strcmp(config.interface, "pppoe-wan") == 0);
+    publicip_config_free(&config);
+
+    assert(publicip_config_init(&config) == 0 && config.interface[0] == '\0');
+    publicip_config_free(&config);
+    unlink(path);
+    printf("✓ WAN_INTERFACE read from the configuration\n");
+}
+
+int main(void)
+{
+    printf("Testing Interface Address Watch\n");
+    printf("===============================\n\n");
+
+    test_is_public();
+    test_get_address();
+    test_parse();
+    test_open();
+    test_config();
+
+    printf("\nAll interface address watch tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,351 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../lib/provider_scores.h"
+#include "../lib/publicip.h"
+#include "../lib/socket_http.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Loopback stand-in for the public IP services
+
+static void write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written <= 0) {
+            return;
+        }
+        data += written;
+        len -= (size_t) written;
+    }
+}
+
+// Answer one request: /a and /a2 name one address, /b another, /v6 an IPv6
+// address spelled unusually, /slow answers after 3 seconds, /bad is not an
+// address and /error fails
+static void serve_connection(int fd)
+{
+    char request[2048];
+    size_t len = 0;
+    request[0] = '\0';
+    while (!strstr(request, "\r\n\r\n")) {
+        ssize_t received = read(fd, request + len, sizeof(request) - 1 - len);
+        if (received <= 0) {
+            return;
+        }
+        len += (size_t) received;
+        request[len] = '\0';
+    }
+
+    const char *body = "<html>not an address</html>";
+    int status = 200;
+    if (strncmp(request, "GET /a ", 7) == 0 || strncmp(request, "GET /a2 ", 8) == 0) {
+        body = "192.0.2.1\n";
+    } else if (strncmp(request, "GET /b ", 7) == 0) {
+        body = "192.0.2.2";
+    } else if (strncmp(request, "GET /v6 ", 8) == 0) {
+        body = " 2001:DB8:0:0::1\r\n";
+    } else if (strncmp(request, "GET /slow ", 10) == 0) {
+        sleep(3);
+        body = "192.0.2.2\n";
+    } else if (strncmp(request, "GET /error ", 11) == 0) {
+        status = 500;
+        body = "192.0.2.1\n";
+    }
+
+    char response[256];
+    int response_len = snprintf(response,
+                                sizeof(response),
+                                "HTTP/1.1 %d X\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n%s",
+                                status,
+                                strlen(body),
+                                body);
+    write_all(fd, response, (size_t) response_len);
+}
+
+// Fork a server answering every connection in a process of its own, so a
+// slow source does not hold up the others. Returns its process group.
+static pid_t start_server(int *port)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    assert(bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(listen(listener, 16) == 0);
+    assert(getsockname(listener, (struct sockaddr *) &addr, &addr_len) == 0);
+    *port = ntohs(addr.sin_port);
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        setpgid(0, 0);
+        alarm(20);
+        signal(SIGPIPE, SIG_IGN);
+        signal(SIGCHLD, SIG_IGN);
+        for (;;) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd < 0) {
+                _exit(1);
+            }
+            if (fork() == 0) {
+                serve_connection(fd);
+                _exit(0);
+            }
+            close(fd);
+        }
+    }
+    setpgid(pid, pid);
+    close(listener);
+    return pid;
+}
+
+static int server_port;
+
+// Configuration with the given paths of the stand-in server as sources,
+// started all at once
+static void make_config(struct publicip_config *config, int quorum, const char *paths[], int count)
+{
+    memset(config, 0, sizeof(*config));
+    config->quorum = quorum;
+    config->timeout_ms = 2000;
+    config->race = true;
+    for (int i = 0; i < count; i++) {
+        char url[128];
+        snprintf(url, sizeof(url), "http://127.0.0.1:%d%s", server_port, paths[i]);
+        config->sources[i] = strdup(url);
+    }
+    config->source_count = count;
+}
+
+static long long elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000LL + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+// Run a query and check its answer (NULL for none) and that it did not wait
+// for the slow source
+static void expect_answer(int quorum, const char *paths[], int count, const char *expected)
+{
+    struct publicip_config config;
+    make_config(&config, quorum, paths, count);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char *ip = publicip_query(&config);
+    assert(elapsed_ms(&start) < 1500);
+    assert(expected ? ip && strcmp(ip, expected) == 0 : ip == NULL);
+    free(ip);
+    publicip_config_free(&config);
+}
+
+static void test_first_answer(void)
+{
+    const char *paths[] = {"/slow", "/bad", "/error", "/a"};
+    expect_answer(1, paths, 4, "192.0.2.1");
+
+    const char *failing[] = {"/bad", "/error"};
+    expect_answer(1, failing, 2, NULL);
+
+    // An IPv6 answer cannot go into an A record, so it does not count
+    const char *single[] = {"/v6"};
+    expect_answer(1, single, 1, NULL);
+    const char *mixed[] = {"/v6", "/a"};
+    expect_answer(1, mixed, 2, "192.0.2.1");
+    printf("✓ First valid answer wins, slow, invalid and IPv6 sources are passed over\n");
+}
+
+static void test_quorum(void)
+{
+    const char *paths[] = {"/a", "/b", "/slow", "/a2"};
+    expect_answer(2, paths, 4, "192.0.2.1");
+
+    // Once the sources still running cannot make up the quorum it gives up
+    const char *split[] = {"/a", "/b", "/slow"};
+    expect_answer(3, split, 3, NULL);
+
+    const char *disagree[] = {"/a", "/b", "/bad"};
+    expect_answer(2, disagree, 3, NULL);
+    const char *v6[] = {"/v6", "/a", "/v6"};
+    expect_answer(2, v6, 3, NULL);
+    printf("✓ Agreement of k sources required in quorum mode\n");
+}
+
+static void test_scores(void)
+{
+    provider_scores_clear();
+    for (int i = 1; i <= 20; i++) {
+        provider_score_record("http://p/", PROVIDER_ANSWERED, i * 10);
+    }
+    const struct provider_score *score = provider_score_get("http://p/");
+    assert(score && score->requests == 20 && provider_score_p95(score) == 190);
+    assert(score->latency_ms > 100 && score->latency_ms < 200 && score->failure_rate == 0);
+
+    // Failures mark a provider unhealthy until the cooldown has passed
+    for (int i = 0; i < 4; i++) {
+        provider_score_record("http://p/", PROVIDER_FAILED, 0);
+    }
+    assert(score->failures == 4 && score->failure_rate > PROVIDER_SCORE_UNHEALTHY);
+    assert(!provider_score_healthy(score, time(NULL)));
+    assert(provider_score_healthy(score, time(NULL) + PROVIDER_SCORE_COOLDOWN));
+
+    // An overtaken request counts its time but not as a failure
+    double failure_rate = score->failure_rate;
+    provider_score_record("http://p/", PROVIDER_OVERTAKEN, 5000);
+    assert(score->failure_rate == failure_rate && score->requests == 25 && provider_score_p95(score) == 200);
+
+    char path[] = "/tmp/test_scores_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    assert(provider_scores_save(path) == 0);
+    struct provider_score saved = *score;
+    provider_scores_clear();
+    assert(provider_scores_load(path) == 1);
+    score = provider_score_get("http://p/");
+    assert(score && score->requests == saved.requests && score->failures == saved.failures);
+    assert(score->sample_count == PROVIDER_SCORE_SAMPLES && provider_score_p95(score) == 200);
+    assert(score->latency_ms - saved.latency_ms < 0.1 && saved.latency_ms - score->latency_ms < 0.1);
+    unlink(path);
+    provider_scores_clear();
+    printf("✓ Provider latency and failure averages, p95 and persistence\n");
+}
+
+static void test_adaptive(void)
+{
+    const char *paths[] = {"/a", "/slow"};
+    struct publicip_config config;
+    make_config(&config, 1, paths, 2);
+    config.race = false;
+
+    // /slow looks fastest, so it goes first and /a joins after its fallback delay
+    for (int i = 0; i < 5; i++) {
+        provider_score_record(config.sources[1], PROVIDER_ANSWERED, 40);
+        provider_score_record(config.sources[0], PROVIDER_ANSWERED, 80);
+    }
+    int order[PUBLICIP_MAX_SOURCES];
+    assert(publicip_rank(&config, order) == 2 && order[0] == 1 && order[1] == 0);
+    assert(publicip_fallback_delay(config.sources[1], config.timeout_ms) == PUBLICIP_FALLBACK_MIN_MS);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char *ip = publicip_query(&config);
+    long long elapsed = elapsed_ms(&start);
+    assert(ip && strcmp(ip, "192.0.2.1") == 0);
+    assert(elapsed >= PUBLICIP_FALLBACK_MIN_MS && elapsed < 1500);
+    free(ip);
+
+    // The stall cost /slow its place; the common path is now one request
+    assert(publicip_rank(&config, order) == 2 && order[0] == 0);
+    struct http_stats before;
+    http_get_stats(&before);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ip = publicip_query(&config);
+    assert(ip && strcmp(ip, "192.0.2.1") == 0 && elapsed_ms(&start) < PUBLICIP_FALLBACK_MIN_MS);
+    free(ip);
+    struct http_stats after;
+    http_get_stats(&after);
+    assert(after.requests - before.requests == 1);
+    publicip_config_free(&config);
+
+    // A failure moves on to the next source at once (neither has a score yet)
+    const char *failing[] = {"/error", "/a2"};
+    make_config(&config, 1, failing, 2);
+    config.race = false;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ip = publicip_query(&config);
+    assert(ip && strcmp(ip, "192.0.2.1") == 0 && elapsed_ms(&start) < PUBLICIP_FALLBACK_MIN_MS);
+    free(ip);
+    assert(provider_score_get(config.sources[0])->failures == 1);
+    publicip_config_free(&config);
+    provider_scores_clear();
+    printf("✓ Best scored source asked first, the next after its p95-based delay\n");
+}
+
+static void test_config(void)
+{
+    char path[] = "/tmp/test_publicip_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    char text[512];
+    int len = snprintf(text,
+                       sizeof(text),
+                       "ZONE_ID[0]=zone\n"
+                       "IP_SOURCE[2]=http://127.0.0.1:%d/a2\n"
+                       "# IP_SOURCE[1]=http://127.0.0.1:%d/bad\n"
+                       "IP_SOURCE[0] = http://127.0.0.1:%d/a\n"
+                       "IP_SOURCE[3]=dns://127.0.0.1/myip.opendns.com?type=AAAA\n"
+                       "IP_SOURCE_MODE=race\n"
+                       "IP_SOURCE_QUORUM=2\n"
+                       "IP_SOURCE_TIMEOUT_MS=3000\n",
+                       server_port,
+                       server_port,
+                       server_port);
+    write_all(fd, text, (size_t) len);
+    close(fd);
+
+    struct publicip_config config;
+    assert(publicip_config_load(&config, path) == 0);
+    assert(config.source_count == 2 && config.quorum == 2 && config.timeout_ms == 3000 && config.race);
+    assert(strstr(config.sources[0], "/a") && strstr(config.sources[1], "/a2"));
+    publicip_config_free(&config);
+
+    publicip_set_config_file(path);
+    char *ip = get_public_ip();
+    assert(ip && strcmp(ip, "192.0.2.1") == 0);
+    free(ip);
+    publicip_set_config_file(NULL);
+
+    // A quorum the sources cannot meet is refused
+    fd = open(path, O_WRONLY | O_TRUNC);
+    len = snprintf(text, sizeof(text), "IP_SOURCE[0]=http://127.0.0.1:%d/a\nIP_SOURCE_QUORUM=2\n", server_port);
+    write_all(fd, text, (size_t) len);
+    close(fd);
+    assert(publicip_config_load(&config, path) != 0);
+
+    // Without sources the default one is used
+    fd = open(path, O_WRONLY | O_TRUNC);
+    write_all(fd, "ZONE_ID[0]=zone\n", 16);
+    close(fd);
+    assert(publicip_config_load(&config, path) == 0);
+    assert(config.source_count == 1 && strcmp(config.sources[0], PUBLICIP_DEFAULT_SOURCE) == 0);
+    publicip_config_free(&config);
+
+    unlink(path);
+    printf("✓ Sources, quorum and timeout read from the configuration, malformed sources ignored\n");
+}
+
+int main(void)
+{
+    printf("Testing Public IP Sources\n");
+    printf("=========================\n\n");
+
+    pid_t server = start_server(&server_port);
+    alarm(20);
+
+    test_first_answer();
+    test_quorum();
+    test_scores();
+    test_adaptive();
+    test_config();
+
+    http_cleanup();
+    kill(-server, SIGTERM);
+    waitpid(server, NULL, 0);
+
+    printf("\nAll public IP tests passed!\n");
+    return 0;
+}
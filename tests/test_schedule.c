@@ -0,0 +1,156 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../lib/schedule.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// A policy without jitter, so delays are exact
+static void test_policy(struct schedule_policy *policy)
+{
+    schedule_policy_init(policy);
+    policy->interval_s = 100;
+    policy->min_interval_s = 10;
+    policy->max_interval_s = 500;
+    policy->backoff = 2.0;
+    policy->jitter_s = 0;
+    policy->settle_s = 60;
+}
+
+static void test_backoff(void)
+{
+    struct schedule_policy policy;
+    test_policy(&policy);
+    struct schedule schedule;
+    schedule_init(&schedule, &policy);
+    assert(schedule_next_ms(&schedule, 0) == 100000);
+
+    // Each check finding the published IP doubles the interval, up to the maximum
+    int expected[] = {200, 400, 500, 500};
+    for (int i = 0; i < 4; i++) {
+        assert(schedule_observe(&schedule, "1.2.3.4", "1.2.3.4", i) == SCHEDULE_KEEP);
+        assert(schedule.interval_s == expected[i]);
+    }
+
+    // A failed check polls fast
+    schedule_failed(&schedule);
+    assert(schedule_next_ms(&schedule, 10) == 10000);
+    printf("✓ Interval backs off while the IP is stable, failures poll fast\n");
+}
+
+static void test_jitter(void)
+{
+    struct schedule_policy policy;
+    test_policy(&policy);
+    policy.jitter_s = 5;
+    struct schedule schedule;
+    schedule_init(&schedule, &policy);
+    bool spread = false;
+    for (int i = 0; i < 50; i++) {
+        long long delay_ms = schedule_next_ms(&schedule, 0);
+        assert(delay_ms >= 100000 && delay_ms <= 105000);
+        spread = spread || delay_ms != 100000;
+    }
+    assert(spread);
+    printf("✓ Stable intervals get up to POLL_JITTER added\n");
+}
+
+static void test_settle(void)
+{
+    struct schedule_policy policy;
+    test_policy(&policy);
+    struct schedule schedule;
+    schedule_init(&schedule, &policy);
+    schedule_observe(&schedule, "1.1.1.1", "1.1.1.1", 0);
+
+    // A change polls fast and waits until it has held for the settle time
+    assert(schedule_observe(&schedule, "2.2.2.2", "1.1.1.1", 1000) == SCHEDULE_WAIT);
+    assert(schedule_next_ms(&schedule, 1000) == 10000);
+    assert(schedule_observe(&schedule, "2.2.2.2", "1.1.1.1", 1055) == SCHEDULE_WAIT);
+    assert(schedule_next_ms(&schedule, 1055) == 5000);
+
+    // Flipping to another address restarts the wait
+    assert(schedule_observe(&schedule, "3.3.3.3", "1.1.1.1", 1058) == SCHEDULE_WAIT);
+    assert(schedule_observe(&schedule, "3.3.3.3", "1.1.1.1", 1100) == SCHEDULE_WAIT);
+    assert(schedule_observe(&schedule, "3.3.3.3", "1.1.1.1", 1118) == SCHEDULE_WRITE);
+    assert(schedule_next_ms(&schedule, 1118) == 10000);
+
+    // Once written, polling stays fast at first, then backs off again
+    assert(schedule_observe(&schedule, "3.3.3.3", "3.3.3.3", 1128) == SCHEDULE_KEEP);
+    assert(schedule.interval_s == 10);
+    assert(schedule_observe(&schedule, "3.3.3.3", "3.3.3.3", 1138) == SCHEDULE_KEEP);
+    assert(schedule.interval_s == 20);
+    printf("✓ A burst of changes is written once, after the last one held\n");
+}
+
+static void test_flap_back(void)
+{
+    struct schedule_policy policy;
+    test_policy(&policy);
+    struct schedule schedule;
+    schedule_init(&schedule, &policy);
+
+    assert(schedule_observe(&schedule, "2.2.2.2", "1.1.1.1", 0) == SCHEDULE_WAIT);
+    assert(schedule_observe(&schedule, "1.1.1.1", "1.1.1.1", 10) == SCHEDULE_KEEP);
+    assert(schedule.candidate[0] == '\0');
+
+    // The wait starts over if the address changes again later
+    assert(schedule_observe(&schedule, "2.2.2.2", "1.1.1.1", 20) == SCHEDULE_WAIT);
+    assert(schedule_observe(&schedule, "2.2.2.2", "1.1.1.1", 79) == SCHEDULE_WAIT);
+    assert(schedule_observe(&schedule, "2.2.2.2", "1.1.1.1", 80) == SCHEDULE_WRITE);
+
+    // Nothing published yet, or no settle time: written at once
+    assert(schedule_observe(&schedule, "4.4.4.4", NULL, 81) == SCHEDULE_WRITE);
+    policy.settle_s = 0;
+    schedule_init(&schedule, &policy);
+    assert(schedule_observe(&schedule, "5.5.5.5", "1.1.1.1", 82) == SCHEDULE_WRITE);
+    printf("✓ An address flapping back to the published one is never written\n");
+}
+
+static void test_config(void)
+{
+    char path[] = "/tmp/test_schedule_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    const char *text = "# POLL_INTERVAL=1\n"
+                       "POLL_INTERVAL = 5000\n"
+                       "POLL_INTERVAL_MIN=20\n"
+                       "POLL_INTERVAL_MAX=1800\n"
+                       "POLL_BACKOFF=1.5\n"
+                       "POLL_JITTER=bad\n"
+                       "CHANGE_SETTLE=0\n";
+    assert(write(fd, text, strlen(text)) == (ssize_t) strlen(text));
+    close(fd);
+
+    struct schedule_policy policy;
+    assert(schedule_policy_load(&policy, path) == 0);
+    assert(policy.interval_s == 1800); // Held within the bounds
+    assert(policy.min_interval_s == 20);
+    assert(policy.max_interval_s == 1800);
+    assert(policy.backoff == 1.5);
+    assert(policy.jitter_s == SCHEDULE_JITTER_S);
+    assert(policy.settle_s == 0);
+    unlink(path);
+
+    assert(schedule_policy_load(&policy, path) == -1);
+    assert(policy.interval_s == SCHEDULE_INTERVAL_S && policy.settle_s == SCHEDULE_SETTLE_S);
+    printf("✓ Policy read from the configuration, bad values ignored\n");
+}
+
+int main(void)
+{
+    printf("Testing Renew Schedule\n");
+    printf("======================\n\n");
+
+    test_backoff();
+    test_jitter();
+    test_settle();
+    test_flap_back();
+    test_config();
+
+    printf("\nAll renew schedule tests passed!\n");
+    return 0;
+}
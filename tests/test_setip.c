@@ -0,0 +1,311 @@
+#define _DEFAULT_SOURCE
+#include "../lib/cloudflare_utils.h"
+#include "../lib/setip.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Loopback stand-in for the Cloudflare API. Records R0 to R3 are in zone Z0,
+// R4 and R5 in zone Z1.
+
+#define RECORD_COUNT 6
+#define UPDATE_MS 200
+
+static int record_zone(int record)
+{
+    return record < 4 ? 0 : 1;
+}
+
+// What the server saw, shared by the processes serving each connection: the
+// updates in flight and their peaks, and the order they started ('+') and
+// ended ('-') in
+struct server_log {
+    int in_flight;
+    int zone_in_flight[2];
+    int peak;
+    int zone_peak[2];
+    int event_count;
+    struct {
+        char kind;
+        int record;
+    } events[4 * RECORD_COUNT];
+};
+
+static struct server_log *server_log;
+
+static void write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written <= 0) {
+            return;
+        }
+        data += written;
+        len -= (size_t) written;
+    }
+}
+
+static void raise_peak(int *peak, int value)
+{
+    int seen = __atomic_load_n(peak, __ATOMIC_SEQ_CST);
+    while (value > seen &&
+           !__atomic_compare_exchange_n(peak, &seen, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+    }
+}
+
+static void log_event(char kind, int record)
+{
+    int slot = __atomic_fetch_add(&server_log->event_count, 1, __ATOMIC_SEQ_CST);
+    if (slot < (int) (sizeof(server_log->events) / sizeof(server_log->events[0]))) {
+        server_log->events[slot].record = record;
+        server_log->events[slot].kind = kind;
+    }
+}
+
+// Answer keep-alive PUTs of a record after UPDATE_MS with the record holding
+// the IP of the request body, counting the updates in flight meanwhile
+static void serve_connection(int fd)
+{
+    char request[4096];
+    size_t len = 0;
+    request[0] = '\0';
+    for (;;) {
+        char *end = strstr(request, "\r\n\r\n");
+        const char *length = end ? strstr(request, "Content-Length: ") : NULL;
+        size_t body_len = length && length < end ? (size_t) atol(length + 16) : 0;
+        if (!end || len < (size_t) (end + 4 - request) + body_len) {
+            ssize_t received = read(fd, request + len, sizeof(request) - 1 - len);
+            if (received <= 0) {
+                return;
+            }
+            len += (size_t) received;
+            request[len] = '\0';
+            continue;
+        }
+
+        int record = -1;
+        const char *path = strstr(request, "/dns_records/R");
+        if (strncmp(request, "PUT ", 4) == 0 && path && path < end) {
+            record = atoi(path + strlen("/dns_records/R"));
+        }
+        char ip[64] = "";
+        const char *content = strstr(end + 4, "\"content\":\"");
+        if (content) {
+            sscanf(content + strlen("\"content\":\""), "%63[^\"]", ip);
+        }
+
+        char response[512];
+        int response_len;
+        if (record >= 0 && record < RECORD_COUNT) {
+            int zone = record_zone(record);
+            log_event('+', record);
+            raise_peak(&server_log->peak, __atomic_add_fetch(&server_log->in_flight, 1, __ATOMIC_SEQ_CST));
+            raise_peak(&server_log->zone_peak[zone],
+                       __atomic_add_fetch(&server_log->zone_in_flight[zone], 1, __ATOMIC_SEQ_CST));
+            struct timespec ts = {0, UPDATE_MS * 1000000L};
+            nanosleep(&ts, NULL);
+            __atomic_sub_fetch(&server_log->zone_in_flight[zone], 1, __ATOMIC_SEQ_CST);
+            __atomic_sub_fetch(&server_log->in_flight, 1, __ATOMIC_SEQ_CST);
+            log_event('-', record);
+
+            char body[256];
+            int body_size = snprintf(body,
+                                     sizeof(body),
+                                     "{\"success\":true,\"result\":{\"id\":\"R%d\",\"content\":\"%s\"}}",
+                                     record,
+                                     ip);
+            response_len = snprintf(response,
+                                    sizeof(response),
+                                    "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n%s",
+                                    body_size,
+                                    body);
+        } else {
+            response_len = snprintf(response, sizeof(response), "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+        }
+        write_all(fd, response, (size_t) response_len);
+
+        size_t used = (size_t) (end + 4 - request) + body_len;
+        memmove(request, request + used, len - used);
+        len -= used;
+        request[len] = '\0';
+    }
+}
+
+// Fork a server answering every connection in a process of its own, so
+// updates run side by side. Returns its process group.
+static pid_t start_server(int *port)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    assert(bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(listen(listener, 16) == 0);
+    assert(getsockname(listener, (struct sockaddr *) &addr, &addr_len) == 0);
+    *port = ntohs(addr.sin_port);
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        setpgid(0, 0);
+        alarm(20);
+        signal(SIGPIPE, SIG_IGN);
+        signal(SIGCHLD, SIG_IGN);
+        for (;;) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd < 0) {
+                _exit(1);
+            }
+            if (fork() == 0) {
+                serve_connection(fd);
+                _exit(0);
+            }
+            close(fd);
+        }
+    }
+    setpgid(pid, pid);
+    close(listener);
+    return pid;
+}
+
+// Write the configuration of the six records with the given limit lines
+static void write_config(const char *path, const char *limits)
+{
+    FILE *file = fopen(path, "w");
+    assert(file);
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        fprintf(file, "ZONE_ID[%d]=Z%d\n", i, record_zone(i));
+        fprintf(file, "DNS_RECORD_ID[%d]=R%d\n", i, i);
+        fprintf(file, "DOMAIN_NAME[%d]=r%d.example.com\n", i, i);
+    }
+    fputs(limits, file);
+    fclose(file);
+}
+
+// Position in the log of an event, -1 if missing
+static int event_index(char kind, int record)
+{
+    for (int i = 0; i < server_log->event_count; i++) {
+        if (server_log->events[i].kind == kind && server_log->events[i].record == record) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Updates of the zone, or of any zone for -1, that ended before position
+static int ended_before(int zone, int position)
+{
+    int ended = 0;
+    for (int i = 0; i < position; i++) {
+        ended += server_log->events[i].kind == '-' && (zone < 0 || record_zone(server_log->events[i].record) == zone);
+    }
+    return ended;
+}
+
+static void test_limits(const char *config_file, const char *token_file)
+{
+    // Malformed or out of range limits keep the defaults
+    write_config(config_file, "UPDATE_CONCURRENCY=4abc\nUPDATE_ZONE_CONCURRENCY=1000\n");
+    cloudflare_config_t *config = load_cloudflare_config(config_file, token_file);
+    assert(config && config->entry_count == RECORD_COUNT);
+    assert(config->update_concurrency == CLOUDFLARE_UPDATE_CONCURRENCY);
+    assert(config->zone_concurrency == CLOUDFLARE_ZONE_CONCURRENCY);
+    free_cloudflare_config(config);
+
+    write_config(config_file, "UPDATE_CONCURRENCY=3\nUPDATE_ZONE_CONCURRENCY=2\n");
+    config = load_cloudflare_config(config_file, token_file);
+    assert(config && config->update_concurrency == 3 && config->zone_concurrency == 2);
+    free_cloudflare_config(config);
+    printf("✓ Concurrency limits parsed, malformed and out of range values ignored\n");
+}
+
+static void test_concurrency(const char *config_file, const char *token_file)
+{
+    char *domains[RECORD_COUNT];
+    char names[RECORD_COUNT][32];
+    int results[RECORD_COUNT];
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        snprintf(names[i], sizeof(names[i]), "r%d.example.com", i);
+        domains[i] = names[i];
+    }
+    write_config(config_file, "UPDATE_CONCURRENCY=3\nUPDATE_ZONE_CONCURRENCY=2\n");
+    assert(set_cloudflare_ips(config_file, token_file, "192.0.2.7", domains, RECORD_COUNT, results) == RECORD_COUNT);
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        assert(results[i] == 0);
+    }
+
+    // Never more than three updates at once, nor two in a zone, and both
+    // limits were reached
+    assert(server_log->event_count == 2 * RECORD_COUNT);
+    assert(server_log->in_flight == 0 && server_log->peak == 3);
+    assert(server_log->zone_peak[0] == 2 && server_log->zone_peak[1] <= 2);
+
+    // The first two updates of Z0 and the first of Z1 start at once, then
+    // nothing starts until one ends; the other updates of Z0 wait for slots
+    // of the zone, the last of Z1 for one overall
+    int first = 0;
+    for (int i = 0; i < 3; i++) {
+        assert(server_log->events[i].kind == '+');
+        first |= 1 << server_log->events[i].record;
+    }
+    assert(first == (1 << 0 | 1 << 1 | 1 << 4));
+    assert(server_log->events[3].kind == '-');
+    assert(ended_before(0, event_index('+', 2)) >= 1 && ended_before(0, event_index('+', 3)) >= 2);
+    assert(ended_before(-1, event_index('+', 5)) >= 1);
+    for (int record = 0; record < RECORD_COUNT; record++) {
+        assert(event_index('-', record) > event_index('+', record));
+    }
+    printf("✓ Updates held to the overall and per-zone limits, deferred ones start as slots free\n");
+}
+
+int main(void)
+{
+    printf("Running setip tests...\n\n");
+
+    server_log = mmap(NULL, sizeof(*server_log), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    assert(server_log != MAP_FAILED);
+    memset(server_log, 0, sizeof(*server_log));
+
+    int port;
+    pid_t server = start_server(&port);
+    char api_url[64];
+    snprintf(api_url, sizeof(api_url), "http://127.0.0.1:%d/client/v4", port);
+    cloudflare_set_api_url(api_url);
+
+    char config_file[] = "/tmp/test_setip_conf_XXXXXX";
+    char token_file[] = "/tmp/test_setip_token_XXXXXX";
+    int config_fd = mkstemp(config_file);
+    int token_fd = mkstemp(token_file);
+    assert(config_fd >= 0 && token_fd >= 0);
+    write_all(token_fd, "test-token\n", strlen("test-token\n"));
+    close(config_fd);
+    close(token_fd);
+
+    test_limits(config_file, token_file);
+    test_concurrency(config_file, token_file);
+
+    cloudflare_config_cleanup();
+    cloudflare_set_api_url(NULL);
+    unlink(config_file);
+    unlink(token_file);
+    kill(-server, SIGKILL);
+    waitpid(server, NULL, 0);
+    munmap(server_log, sizeof(*server_log));
+
+    printf("\nAll setip tests passed.\n");
+    return 0;
+}
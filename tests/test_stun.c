@@ -0,0 +1,266 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../lib/provider_scores.h"
+#include "../lib/publicip.h"
+#include "../lib/stun.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Sample responses of RFC 5769 section 2.2 and 2.3 (MESSAGE-INTEGRITY and
+// FINGERPRINT zeroed, they are not checked)
+static const unsigned char sample_txid[STUN_TXID_SIZE] = {
+    0xb7, 0xe7, 0xa7, 0x01, 0xbc, 0x34, 0xd6, 0x86, 0xfa, 0x87, 0xdf, 0xae};
+
+static const unsigned char sample_ipv4[] = {
+    0x01, 0x01, 0x00, 0x3c, 0x21, 0x12, 0xa4, 0x42, 0xb7, 0xe7, 0xa7, 0x01, 0xbc, 0x34, 0xd6, 0x86, 0xfa, 0x87,
+    0xdf, 0xae, 0x80, 0x22, 0x00, 0x0b, 0x74, 0x65, 0x73, 0x74, 0x20, 0x76, 0x65, 0x63, 0x74, 0x6f, 0x72, 0x20,
+    0x00, 0x20, 0x00, 0x08, 0x00, 0x01, 0xa1, 0x47, 0xe1, 0x12, 0xa6, 0x43, 0x00, 0x08, 0x00, 0x14, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x80, 0x28, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00};
+
+static const unsigned char sample_ipv6[] = {
+    0x01, 0x01, 0x00, 0x48, 0x21, 0x12, 0xa4, 0x42, 0xb7, 0xe7, 0xa7, 0x01, 0xbc, 0x34, 0xd6, 0x86, 0xfa,
+    0x87, 0xdf, 0xae, 0x80, 0x22, 0x00, 0x0b, 0x74, 0x65, 0x73, 0x74, 0x20, 0x76, 0x65, 0x63, 0x74, 0x6f,
+    0x72, 0x20, 0x00, 0x20, 0x00, 0x14, 0x00, 0x02, 0xa1, 0x47, 0x01, 0x13, 0xa9, 0xfa, 0xa5, 0xd3, 0xf1,
+    0x79, 0xbc, 0x25, 0xf4, 0xb5, 0xbe, 0xd2, 0xb9, 0xd9, 0x00, 0x08, 0x00, 0x14, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80,
+    0x28, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00};
+
+static void test_codec(void)
+{
+    unsigned char request[STUN_MAX_PACKET];
+    assert(stun_build_request(request, sizeof(request), sample_txid) == STUN_HEADER_SIZE);
+    assert(request[0] == 0x00 && request[1] == 0x01 && request[2] == 0 && request[3] == 0);
+    assert(request[4] == 0x21 && request[5] == 0x12 && request[6] == 0xa4 && request[7] == 0x42);
+    assert(memcmp(request + 8, sample_txid, STUN_TXID_SIZE) == 0);
+    assert(stun_build_request(request, 19, sample_txid) == -1);
+
+    struct stun_address mapped;
+    char text[INET6_ADDRSTRLEN];
+    assert(stun_parse_response(sample_ipv4, sizeof(sample_ipv4), sample_txid, &mapped) == 0);
+    assert(mapped.family == AF_INET && mapped.port == 32853);
+    assert(strcmp(inet_ntop(AF_INET, mapped.addr, text, sizeof(text)), "192.0.2.1") == 0);
+    assert(stun_parse_response(sample_ipv6, sizeof(sample_ipv6), sample_txid, &mapped) == 0);
+    assert(mapped.family == AF_INET6 && mapped.port == 32853);
+    assert(strcmp(inet_ntop(AF_INET6, mapped.addr, text, sizeof(text)), "2001:db8:1234:5678:11:2233:4455:6677") == 0);
+
+    // Another transaction, a truncated packet or an error response do not count
+    unsigned char other_txid[STUN_TXID_SIZE] = {0};
+    assert(stun_parse_response(sample_ipv4, sizeof(sample_ipv4), other_txid, &mapped) == -1);
+    assert(stun_parse_response(sample_ipv4, sizeof(sample_ipv4) - 8, sample_txid, &mapped) == -1);
+    unsigned char error[sizeof(sample_ipv4)];
+    memcpy(error, sample_ipv4, sizeof(error));
+    error[1] = 0x11;
+    assert(stun_parse_response(error, sizeof(error), sample_txid, &mapped) == -1);
+
+    // Older servers send a plain MAPPED-ADDRESS
+    unsigned char legacy[32];
+    memcpy(legacy, sample_ipv4, STUN_HEADER_SIZE);
+    legacy[3] = 12;
+    const unsigned char attribute[] = {0x00, 0x01, 0x00, 0x08, 0x00, 0x01, 0x0d, 0x96, 198, 51, 100, 7};
+    memcpy(legacy + STUN_HEADER_SIZE, attribute, sizeof(attribute));
+    assert(stun_parse_response(legacy, sizeof(legacy), sample_txid, &mapped) == 0);
+    assert(mapped.port == 3478 && strcmp(inet_ntop(AF_INET, mapped.addr, text, sizeof(text)), "198.51.100.7") == 0);
+    printf("✓ Binding requests and RFC 5769 sample responses\n");
+}
+
+static void test_uri(void)
+{
+    char host[64];
+    uint16_t port;
+    assert(stun_parse_uri("stun:stun.example.net", host, sizeof(host), &port) == 0);
+    assert(strcmp(host, "stun.example.net") == 0 && port == STUN_DEFAULT_PORT);
+    assert(stun_parse_uri("STUN:192.0.2.1:19302", host, sizeof(host), &port) == 0);
+    assert(strcmp(host, "192.0.2.1") == 0 && port == 19302);
+    assert(stun_parse_uri("stun:[2001:db8::1]:3479", host, sizeof(host), &port) == 0);
+    assert(strcmp(host, "2001:db8::1") == 0 && port == 3479);
+    assert(stun_parse_uri("stun:", host, sizeof(host), &port) == -1);
+    assert(stun_parse_uri("stun:host:0", host, sizeof(host), &port) == -1);
+    assert(stun_parse_uri("stun:host:99999", host, sizeof(host), &port) == -1);
+    assert(stun_parse_uri("stun:[2001:db8::1", host, sizeof(host), &port) == -1);
+    assert(stun_is_uri("stun:host") && !stun_is_uri("https://ipinfo.io/ip"));
+    printf("✓ stun: URIs\n");
+}
+
+// Loopback STUN responder: answers Binding requests with the sender's
+// address, except the very first one, which it drops
+static pid_t start_responder(int *port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    assert(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(getsockname(fd, (struct sockaddr *) &addr, &addr_len) == 0);
+    *port = ntohs(addr.sin_port);
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        alarm(20);
+        for (int received = 0;; received++) {
+            unsigned char packet[STUN_MAX_PACKET];
+            struct sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+            ssize_t len = recvfrom(fd, packet, sizeof(packet), 0, (struct sockaddr *) &from, &from_len);
+            if (len < STUN_HEADER_SIZE || received == 0) {
+                continue;
+            }
+
+            // XOR-MAPPED-ADDRESS, IPv4
+            packet[0] = 0x01;
+            packet[1] = 0x01;
+            packet[2] = 0;
+            packet[3] = 12;
+            unsigned char *attribute = packet + STUN_HEADER_SIZE;
+            uint16_t xport = (uint16_t) (ntohs(from.sin_port) ^ (STUN_MAGIC_COOKIE >> 16));
+            uint32_t xaddr = ntohl(from.sin_addr.s_addr) ^ STUN_MAGIC_COOKIE;
+            unsigned char value[12] = {0x00,
+                                       0x20,
+                                       0x00,
+                                       0x08,
+                                       0x00,
+                                       0x01,
+                                       (unsigned char) (xport >> 8),
+                                       (unsigned char) xport,
+                                       (unsigned char) (xaddr >> 24),
+                                       (unsigned char) (xaddr >> 16),
+                                       (unsigned char) (xaddr >> 8),
+                                       (unsigned char) xaddr};
+            memcpy(attribute, value, sizeof(value));
+            sendto(fd, packet, STUN_HEADER_SIZE + sizeof(value), 0, (struct sockaddr *) &from, from_len);
+        }
+    }
+    close(fd);
+    return pid;
+}
+
+// Bound UDP port nobody answers on
+static int silent_socket(int *port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    assert(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(getsockname(fd, (struct sockaddr *) &addr, &addr_len) == 0);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static long long elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000LL + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static int responder_port;
+static int silent_port;
+
+static void test_query(void)
+{
+    char silent[64];
+    char responder[64];
+    snprintf(silent, sizeof(silent), "stun:127.0.0.1:%d", silent_port);
+    snprintf(responder, sizeof(responder), "stun:127.0.0.1:%d", responder_port);
+    const char *uris[] = {silent, responder};
+
+    // The responder ignores the first request: the retransmission gets the answer
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct stun_query query;
+    assert(stun_query_start(&query, uris, 2, 1, 3000) == 0);
+    assert(stun_query_run(&query) == 1);
+    long long elapsed = elapsed_ms(&start);
+    assert(elapsed >= STUN_RTO_MS && elapsed < 2 * STUN_RTO_MS);
+    const struct stun_server *server = &query.servers[1];
+    assert(server->answered && server->requests == 2 && server->rtt_ms >= STUN_RTO_MS);
+    char text[INET6_ADDRSTRLEN];
+    assert(strcmp(inet_ntop(AF_INET, server->mapped.addr, text, sizeof(text)), "127.0.0.1") == 0);
+    assert(!query.servers[0].answered && !query.servers[0].done);
+    stun_query_cleanup(&query);
+
+    // Unanswered requests are resent after 500 ms, then 1000 ms, until the timeout
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert(stun_query_start(&query, uris, 1, 1, 1200) == 0);
+    assert(stun_query_run(&query) == 0);
+    elapsed = elapsed_ms(&start);
+    assert(elapsed >= 1200 && elapsed < 1500);
+    assert(query.servers[0].requests == 2 && !query.servers[0].answered);
+    stun_query_cleanup(&query);
+
+    // Unresolvable servers give up at once
+    const char *bad[] = {"stun:", "stun:127.0.0.1:0"};
+    assert(stun_query_start(&query, bad, 2, 1, 1000) == 1);
+    assert(query.answered == 0);
+    stun_query_cleanup(&query);
+    printf("✓ Binding requests retransmitted, first answer of several servers taken\n");
+}
+
+static void test_publicip(void)
+{
+    struct publicip_config config;
+    memset(&config, 0, sizeof(config));
+    config.quorum = 1;
+    config.timeout_ms = 2000;
+    char uri[64];
+    snprintf(uri, sizeof(uri), "stun:127.0.0.1:%d", silent_port);
+    config.sources[0] = strdup(uri);
+    snprintf(uri, sizeof(uri), "stun:127.0.0.1:%d", responder_port);
+    config.sources[1] = strdup(uri);
+    config.source_count = 2;
+
+    char *ip = publicip_query(&config);
+    assert(ip && strcmp(ip, "127.0.0.1") == 0);
+    free(ip);
+    assert(provider_score_get(config.sources[1])->sample_count == 1);
+    assert(provider_score_get(config.sources[0])->failures == 0);
+
+    // A lone STUN source skips the HTTP path
+    free(config.sources[0]);
+    config.sources[0] = config.sources[1];
+    config.sources[1] = NULL;
+    config.source_count = 1;
+    ip = publicip_query(&config);
+    assert(ip && strcmp(ip, "127.0.0.1") == 0);
+    free(ip);
+    publicip_config_free(&config);
+    provider_scores_clear();
+    printf("✓ STUN servers as public IP sources\n");
+}
+
+int main(void)
+{
+    printf("Testing STUN Client\n");
+    printf("===================\n\n");
+
+    pid_t responder = start_responder(&responder_port);
+    int silent = silent_socket(&silent_port);
+    alarm(20);
+
+    test_codec();
+    test_uri();
+    test_query();
+    test_publicip();
+
+    close(silent);
+    kill(responder, SIGTERM);
+    waitpid(responder, NULL, 0);
+
+    printf("\nAll STUN tests passed!\n");
+    return 0;
+}
@@ -1,20 +1,38 @@
 #include "../lib/getip.h"
+#include "../lib/socket_http.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 int main(int argc, char *argv[])
 {
+    const char *program = argv[0];
+    bool verbose = argc > 1 && (strcmp(argv[1], "-v") == 0 || strcmp(argv[1], "--verbose") == 0);
+    if (verbose) {
+        argc--;
+        argv++;
+    }
+
     if (argc < 3 || argc > 4) {
-        fprintf(stderr, "Usage: %s <config_file> <token_file> [domain_name]\n", argv[0]);
-        fprintf(stderr, "Example: %s cloudflare.conf cloudflare.token\n", argv[0]);
-        fprintf(stderr, "         %s cloudflare.conf cloudflare.token jmsmuy.com\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-v] <config_file> <token_file> [domain_name]\n", program);
+        fprintf(stderr, "Example: %s cloudflare.conf cloudflare.token\n", program);
+        fprintf(stderr, "         %s cloudflare.conf cloudflare.token jmsmuy.com\n", program);
         return 1;
     }
 
     const char *domain_name = (argc == 4) ? argv[3] : NULL;
+    http_set_session_cache_file(HTTP_SESSION_CACHE_FILE);
+    http_set_dns_cache_file(HTTP_DNS_CACHE_FILE);
+    http_set_fast_open(true);
+    http_set_early_data(true);
+    if (verbose) {
+        http_set_timing_callback(http_print_timing, NULL);
+    }
     char *ip_address = get_cloudflare_ip(argv[1], argv[2], domain_name);
+    http_cleanup();
 
     if (ip_address) {
         printf("%s\n", ip_address);
@@ -1,13 +1,103 @@
+#include "../lib/gateway.h"
+#include "../lib/provider_scores.h"
 #include "../lib/publicip.h"
+#include "../lib/socket_http.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 // Test comment to trigger CI workflow
 
-int main(void)
+// Print the sources in the order they would be asked, with their scores
+static int print_stats(const char *config_file)
 {
+    struct publicip_config config;
+    int loaded = config_file ? publicip_config_load(&config, config_file) : publicip_config_init(&config);
+    if (loaded != 0) {
+        return 1;
+    }
+
+    int order[PUBLICIP_MAX_SOURCES];
+    int count = publicip_rank(&config, order);
+    time_t now = time(NULL);
+    printf("%-4s %8s %8s %8s %8s %8s %8s %-9s %s\n",
+           "Rank",
+           "Requests",
+           "Failures",
+           "Avg ms",
+           "Fail %",
+           "p95 ms",
+           "Delay ms",
+           "Health",
+           "Source");
+    for (int i = 0; i < count; i++) {
+        const char *source = config.sources[order[i]];
+        const struct provider_score *score = provider_score_get(source);
+        char p95[16] = "-";
+        if (score && score->sample_count > 0) {
+            snprintf(p95, sizeof(p95), "%d", provider_score_p95(score));
+        }
+        if (!score) {
+            printf("%-4d %8s %8s %8s %8s %8s %8d %-9s %s\n",
+                   i + 1,
+                   "-",
+                   "-",
+                   "-",
+                   "-",
+                   "-",
+                   publicip_fallback_delay(source, config.timeout_ms),
+                   "new",
+                   source);
+            continue;
+        }
+        printf("%-4d %8lu %8lu %8.0f %8.1f %8s %8d %-9s %s\n",
+               i + 1,
+               score->requests,
+               score->failures,
+               score->latency_ms,
+               score->failure_rate * 100,
+               p95,
+               publicip_fallback_delay(source, config.timeout_ms),
+               provider_score_healthy(score, now) ? "healthy" : "unhealthy",
+               source);
+    }
+
+    publicip_config_free(&config);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    bool stats = argc > 1 && strcmp(argv[1], "--stats") == 0;
+    int config_arg = stats ? 2 : 1;
+    if (argc > config_arg + 1) {
+        fprintf(stderr, "Usage: %s [--stats] [config_file]\n", argv[0]);
+        fprintf(stderr, "Queries the IP_SOURCE entries of the config file, or ipinfo.io without one\n");
+        fprintf(stderr, "  --stats   Show the provider scores instead of querying\n");
+        return 1;
+    }
+    const char *config_file = argc > config_arg ? argv[config_arg] : NULL;
+    publicip_set_score_file(PUBLICIP_SCORE_FILE);
+
+    if (stats) {
+        int status = print_stats(config_file);
+        publicip_set_score_file(NULL);
+        return status;
+    }
+
+    publicip_set_config_file(config_file);
+    gateway_set_cache_file(GATEWAY_CACHE_FILE);
+    http_set_session_cache_file(HTTP_SESSION_CACHE_FILE);
+    http_set_dns_cache_file(HTTP_DNS_CACHE_FILE);
+    http_set_fast_open(true);
+    http_set_early_data(true);
     char *ip_address = get_public_ip();
+    http_cleanup();
+    publicip_set_config_file(NULL);
+    publicip_set_score_file(NULL);
+    gateway_set_cache_file(NULL);
     if (ip_address) {
         printf("%s\n", ip_address);
         free(ip_address);
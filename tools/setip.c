@@ -1,15 +1,25 @@
 #include "../lib/setip.h"
+#include "../lib/socket_http.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 int main(int argc, char *argv[])
 {
+    const char *program = argv[0];
+    bool verbose = argc > 1 && (strcmp(argv[1], "-v") == 0 || strcmp(argv[1], "--verbose") == 0);
+    if (verbose) {
+        argc--;
+        argv++;
+    }
+
     if (argc < 4 || argc > 5) {
-        fprintf(stderr, "Usage: %s <config_file> <token_file> <ip_address> [domain_name]\n", argv[0]);
-        fprintf(stderr, "Example: %s cloudflare.conf cloudflare.token 199.99.99.99\n", argv[0]);
-        fprintf(stderr, "         %s cloudflare.conf cloudflare.token 199.99.99.99 jmsmuy.com\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-v] <config_file> <token_file> <ip_address> [domain_name]\n", program);
+        fprintf(stderr, "Example: %s cloudflare.conf cloudflare.token 199.99.99.99\n", program);
+        fprintf(stderr, "         %s cloudflare.conf cloudflare.token 199.99.99.99 jmsmuy.com\n", program);
         return 1;
     }
 
@@ -18,7 +28,13 @@ int main(int argc, char *argv[])
     const char *ip_address = argv[3];
     const char *domain_name = (argc == 5) ? argv[4] : NULL;
 
+    http_set_session_cache_file(HTTP_SESSION_CACHE_FILE);
+    http_set_dns_cache_file(HTTP_DNS_CACHE_FILE);
+    if (verbose) {
+        http_set_timing_callback(http_print_timing, NULL);
+    }
     int result = set_cloudflare_ip(config_file, token_file, ip_address, domain_name);
+    http_cleanup();
 
     if (result == 0) {
         printf("✅ IP successfully updated to %s\n", ip_address);